@@ -1,6 +1,6 @@
 #!/bin/bash
 
-LIBS="-lm"
+LIBS="-lm -lpthread"
 INCS=""
 
 if [[ "$MSYSTEM" == "MINGW64" ]]
@@ -28,6 +28,25 @@ else
   DEFS="-D_GNU_SOURCE"
 fi
 
-gcc -Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers -O3 $DEFS $INCS -o decode6502 src/main.c src/memory.c src/em_6502.c src/em_65816.c src/em_6800.c src/profiler.c src/profiler_instr.c src/profiler_block.c src/profiler_call.c src/tube_decode.c src/musl_tsearch.c src/symbols.c $LIBS
+CFLAGS="-Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers -O3 $DEFS $INCS"
+
+# Everything other than the command line front end is built into a static
+# library, so the decoder can also be embedded (see src/decode6502.h)
+LIB_SRCS="src/libdecode6502.c src/context.c src/decoder.c src/disasm.c src/layout.c src/sink.c src/fold.c src/trigger.c src/history.c src/scan.c src/capture.c src/unpack.c src/ring.c src/pipeline.c src/output.c src/segment.c src/fanout.c src/trace.c src/cache.c src/index.c src/memmap.c src/memory.c src/em_6502.c src/em_65816.c src/em_6800.c src/profiler.c src/profiler_instr.c src/profiler_block.c src/profiler_call.c src/tube_decode.c src/musl_tsearch.c src/symbols.c"
+
+OBJDIR=`mktemp -d`
+trap "rm -rf $OBJDIR" EXIT
+
+for src in $LIB_SRCS
+do
+  gcc $CFLAGS -c -o $OBJDIR/`basename $src .c`.o $src || exit 1
+done
+
+rm -f libdecode6502.a
+ar rcs libdecode6502.a $OBJDIR/*.o
+
+gcc $CFLAGS -o decode6502 src/main.c libdecode6502.a $LIBS
+
+gcc $CFLAGS -o render6502 src/render6502.c libdecode6502.a $LIBS
 
 gcc -Wall -Wextra -Wno-unused-parameter -Wno-missing-field-initializers -O3 -o matcher src/matcher.c
@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC "D6502CYC"
+
+// Size of the read/write buffer
+#define CACHE_BUFFER 0x100000
+
+// Number of bus cycles in each block
+#define CACHE_BLOCK 4096
+
+// Number of distinct control words (the bus cycle without the data byte)
+#define CACHE_NUM_CONTROL 0x1000
+
+// Size of the length and hash that precede each encoded block
+#define CACHE_BLOCK_HEADER (2 * sizeof(uint32_t))
+
+// Longest encoded block (the header, the number of bus cycles, the control
+// words, the width, the data bytes, the indices, and the runs of counts,
+// with their number, each run being two five byte varints and a length)
+#define CACHE_MAX_BLOCK (CACHE_BLOCK_HEADER + 5 + 5 + 2 * CACHE_BLOCK + 1 + CACHE_BLOCK + 2 * CACHE_BLOCK + 5 + 13 * CACHE_BLOCK)
+
+// Number of bytes from the start of the capture that are hashed
+#define HASH_SIZE 0x10000
+
+typedef struct {
+   char        magic[8];
+   uint32_t    version;
+   uint32_t    reserved;
+   cache_key_t key;
+   uint64_t    num_cycles;
+} cache_header_t;
+
+struct cache {
+   FILE          *file;
+   char          *filename;
+   char          *tmpname;
+   int            reading;
+   int            failed;
+   cache_header_t header;
+   uint64_t       num_cycles;
+   // Previous bus cycle, that the counts are relative to
+   uint32_t       sample_count;
+   uint32_t       cycle_count;
+   // The block being written, or read but not yet passed on
+   int            block_num;
+   int            block_pos;
+   bus_cycle_t    block_bus[CACHE_BLOCK];
+   uint32_t       block_sample_count[CACHE_BLOCK];
+   uint32_t       block_cycle_count[CACHE_BLOCK];
+   // Index of each control word in the block being written (plus one)
+   uint16_t       lookup[CACHE_NUM_CONTROL];
+   // Buffered encoded blocks
+   uint8_t       *buffer;
+   uint8_t       *ptr;
+   uint8_t       *end;
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static uint64_t hash_capture(const char *filename) {
+   // FNV-1a
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   FILE *fp = fopen(filename, "rb");
+   if (fp) {
+      uint8_t *buf = (uint8_t *)malloc(HASH_SIZE);
+      size_t len = fread(buf, 1, HASH_SIZE, fp);
+      for (size_t i = 0; i < len; i++) {
+         hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+      }
+      free(buf);
+      fclose(fp);
+   }
+   return hash;
+}
+
+static uint32_t hash_block(const uint8_t *p, uint32_t len) {
+   // FNV-1a
+   uint32_t hash = 0x811c9dc5;
+   for (uint32_t i = 0; i < len; i++) {
+      hash = (hash ^ p[i]) * 0x01000193;
+   }
+   return hash;
+}
+
+static void flush_buffer(cache_t *cache) {
+   size_t len = cache->ptr - cache->buffer;
+   if (fwrite(cache->buffer, 1, len, cache->file) != len) {
+      cache->failed = 1;
+   }
+   cache->ptr = cache->buffer;
+}
+
+// Keep at least len bytes in the buffer, returns 0 if there aren't that many
+static int fill_buffer(cache_t *cache, size_t len) {
+   size_t have = cache->end - cache->ptr;
+   if (have < len) {
+      memmove(cache->buffer, cache->ptr, have);
+      have += fread(cache->buffer + have, 1, CACHE_BUFFER - have, cache->file);
+      cache->ptr = cache->buffer;
+      cache->end = cache->buffer + have;
+   }
+   return have >= len;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t value) {
+   while (value >= 0x80) {
+      *p++ = (value & 0x7f) | 0x80;
+      value >>= 7;
+   }
+   *p++ = value;
+   return p;
+}
+
+// Returns NULL if the varint runs past end, or is too long
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t *value) {
+   uint32_t v = 0;
+   int shift = 0;
+   do {
+      if (p == end || shift == 35) {
+         return NULL;
+      }
+      v |= (uint32_t) (*p & 0x7f) << shift;
+      shift += 7;
+   } while (*p++ & 0x80);
+   *value = v;
+   return p;
+}
+
+// The number of bits needed for each index into num control words
+static int index_width(int num) {
+   return num <= 1 ? 0 : num <= 2 ? 1 : num <= 4 ? 2 : num <= 16 ? 4 : num <= 256 ? 8 : 16;
+}
+
+// Encode the block being written into the buffer
+static void write_block(cache_t *cache) {
+   int num = cache->block_num;
+   if (num == 0) {
+      return;
+   }
+   uint8_t *start = cache->ptr;
+   uint8_t *p = start + CACHE_BLOCK_HEADER;
+   p = put_varint(p, num);
+
+   // The control words, in the order they first appear, and the index of
+   // each bus cycle's into them
+   uint16_t values[CACHE_BLOCK];
+   uint16_t index[CACHE_BLOCK];
+   int num_values = 0;
+   for (int i = 0; i < num; i++) {
+      int control = cache->block_bus[i] >> 8;
+      if (!cache->lookup[control]) {
+         values[num_values++] = control;
+         cache->lookup[control] = num_values;
+      }
+      index[i] = cache->lookup[control] - 1;
+   }
+   p = put_varint(p, num_values);
+   for (int i = 0; i < num_values; i++) {
+      cache->lookup[values[i]] = 0;
+      *p++ = values[i] & 0xff;
+      *p++ = values[i] >> 8;
+   }
+
+   for (int i = 0; i < num; i++) {
+      *p++ = bus_data(cache->block_bus[i]);
+   }
+
+   int width = index_width(num_values);
+   *p++ = width;
+   if (width == 16) {
+      for (int i = 0; i < num; i++) {
+         *p++ = index[i] & 0xff;
+         *p++ = index[i] >> 8;
+      }
+   } else if (width) {
+      size_t len = ((size_t) num * width + 7) / 8;
+      memset(p, 0, len);
+      for (int i = 0; i < num; i++) {
+         p[(i * width) >> 3] |= index[i] << ((i * width) & 7);
+      }
+      p += len;
+   }
+
+   // The runs of bus cycles whose counts have the same deltas
+   for (int i = 0; i < num; ) {
+      uint32_t sample_delta = cache->block_sample_count[i] - cache->sample_count;
+      uint32_t cycle_delta  = cache->block_cycle_count[i]  - cache->cycle_count;
+      int run = 1;
+      while (i + run < num &&
+             cache->block_sample_count[i + run] - cache->block_sample_count[i + run - 1] == sample_delta &&
+             cache->block_cycle_count[i + run]  - cache->block_cycle_count[i + run - 1]  == cycle_delta) {
+         run++;
+      }
+      p = put_varint(p, sample_delta);
+      p = put_varint(p, cycle_delta);
+      p = put_varint(p, run);
+      i += run;
+      cache->sample_count = cache->block_sample_count[i - 1];
+      cache->cycle_count  = cache->block_cycle_count[i - 1];
+   }
+
+   uint32_t len = p - start - CACHE_BLOCK_HEADER;
+   uint32_t hash = hash_block(start + CACHE_BLOCK_HEADER, len);
+   memcpy(start, &len, sizeof(uint32_t));
+   memcpy(start + sizeof(uint32_t), &hash, sizeof(uint32_t));
+   cache->ptr = p;
+   cache->num_cycles += num;
+   cache->block_num = 0;
+   if (p >= cache->end) {
+      flush_buffer(cache);
+   }
+}
+
+// Decode the encoded block from p to end, returns the number of bus
+// cycles, or 0 if it's damaged
+static uint32_t decode_block(cache_t *cache, const uint8_t *p, const uint8_t *end) {
+   uint32_t num;
+   uint32_t num_values;
+   if (!(p = get_varint(p, end, &num)) || num == 0 || num > CACHE_BLOCK ||
+       !(p = get_varint(p, end, &num_values)) || num_values == 0 || num_values > num) {
+      return 0;
+   }
+
+   if ((size_t) (end - p) < 2 * num_values) {
+      return 0;
+   }
+   bus_cycle_t values[CACHE_BLOCK];
+   for (uint32_t i = 0; i < num_values; i++) {
+      values[i] = (p[0] | p[1] << 8) << 8;
+      p += 2;
+   }
+
+   if ((size_t) (end - p) < num + 1) {
+      return 0;
+   }
+   const uint8_t *data = p;
+   p += num;
+
+   int width = *p++;
+   size_t index_len = ((size_t) num * width + 7) / 8;
+   if (width != index_width(num_values) || (size_t) (end - p) < index_len) {
+      return 0;
+   }
+   int mask = (1 << width) - 1;
+   for (uint32_t i = 0; i < num; i++) {
+      uint32_t index;
+      if (width == 16) {
+         index = p[2 * i] | p[2 * i + 1] << 8;
+      } else {
+         index = (p[(i * width) >> 3] >> ((i * width) & 7)) & mask;
+      }
+      if (index >= num_values) {
+         return 0;
+      }
+      cache->block_bus[i] = values[index] | data[i];
+   }
+   p += index_len;
+
+   // The runs must cover the bus cycles exactly, and fill the block
+   for (uint32_t i = 0; i < num; ) {
+      uint32_t sample_delta;
+      uint32_t cycle_delta;
+      uint32_t run;
+      if (!(p = get_varint(p, end, &sample_delta)) ||
+          !(p = get_varint(p, end, &cycle_delta)) ||
+          !(p = get_varint(p, end, &run)) || run == 0 || run > num - i) {
+         return 0;
+      }
+      for (uint32_t last = i + run; i < last; i++) {
+         cache->sample_count += sample_delta;
+         cache->cycle_count  += cycle_delta;
+         cache->block_sample_count[i] = cache->sample_count;
+         cache->block_cycle_count[i]  = cache->cycle_count;
+      }
+   }
+   return p == end ? num : 0;
+}
+
+// Decode the next block from the buffer, returns 0 at the end (or if the
+// cache is truncated or damaged, which sets failed)
+static int read_block(cache_t *cache) {
+   if (cache->num_cycles == cache->header.num_cycles) {
+      return 0;
+   }
+   uint32_t len;
+   uint32_t hash;
+   if (!fill_buffer(cache, CACHE_BLOCK_HEADER)) {
+      cache->failed = 1;
+      return 0;
+   }
+   memcpy(&len, cache->ptr, sizeof(uint32_t));
+   memcpy(&hash, cache->ptr + sizeof(uint32_t), sizeof(uint32_t));
+   if (len == 0 || len > CACHE_MAX_BLOCK - CACHE_BLOCK_HEADER || !fill_buffer(cache, CACHE_BLOCK_HEADER + len)) {
+      cache->failed = 1;
+      return 0;
+   }
+   const uint8_t *p = cache->ptr + CACHE_BLOCK_HEADER;
+   uint32_t num = 0;
+   if (hash_block(p, len) == hash) {
+      num = decode_block(cache, p, p + len);
+   }
+   if (num == 0 || num > cache->header.num_cycles - cache->num_cycles) {
+      cache->failed = 1;
+      return 0;
+   }
+   cache->ptr += CACHE_BLOCK_HEADER + len;
+   cache->num_cycles += num;
+   cache->block_num = num;
+   cache->block_pos = 0;
+   return 1;
+}
+
+static void reset_counts(cache_t *cache) {
+   cache->num_cycles   = 0;
+   cache->sample_count = 0;
+   cache->cycle_count  = 0;
+   cache->block_num    = 0;
+   cache->block_pos    = 0;
+}
+
+static cache_t *open_reader(cache_t *cache) {
+   FILE *fp = fopen(cache->filename, "rb");
+   if (!fp) {
+      return NULL;
+   }
+   cache_header_t header;
+   if (fread(&header, sizeof(header), 1, fp) != 1 ||
+       memcmp(header.magic, cache->header.magic, sizeof(header.magic)) ||
+       header.version != cache->header.version ||
+       memcmp(&header.key, &cache->header.key, sizeof(header.key))) {
+      fclose(fp);
+      return NULL;
+   }
+   cache->header = header;
+   cache->file = fp;
+   cache->reading = 1;
+   cache->ptr = cache->buffer;
+   cache->end = cache->buffer;
+   return cache;
+}
+
+static cache_t *open_writer(cache_t *cache) {
+   FILE *fp = fopen(cache->tmpname, "wb");
+   if (!fp) {
+      return NULL;
+   }
+   // The header is rewritten with the number of cycles when closed
+   if (fwrite(&cache->header, sizeof(cache->header), 1, fp) != 1) {
+      fclose(fp);
+      remove(cache->tmpname);
+      return NULL;
+   }
+   cache->file = fp;
+   cache->reading = 0;
+   cache->ptr = cache->buffer;
+   cache->end = cache->buffer + CACHE_BUFFER - CACHE_MAX_BLOCK;
+   return cache;
+}
+
+static void free_cache(cache_t *cache) {
+   free(cache->filename);
+   free(cache->tmpname);
+   free(cache->buffer);
+   free(cache);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int cache_fingerprint(const char *capture_filename, uint64_t capture_size, cache_key_t *key) {
+   struct stat st;
+   if (!capture_filename || !strcmp(capture_filename, "-") || stat(capture_filename, &st)) {
+      return 1;
+   }
+   key->capture_size  = capture_size;
+#if defined(__APPLE__)
+   key->capture_mtime = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+   key->capture_mtime = (int64_t) st.st_mtime * 1000000000;
+#else
+   key->capture_mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+   key->capture_hash  = hash_capture(capture_filename);
+   return 0;
+}
+
+cache_t *cache_open(const char *filename, const char *capture_filename, uint64_t capture_size, cache_key_t *key) {
+   if (cache_fingerprint(capture_filename, capture_size, key)) {
+      return NULL;
+   }
+
+   cache_t *cache = (cache_t *)calloc(1, sizeof(cache_t));
+   memcpy(cache->header.magic, CACHE_MAGIC, sizeof(cache->header.magic));
+   cache->header.version = CACHE_VERSION;
+   cache->header.key = *key;
+   cache->filename = strdup(filename);
+   cache->tmpname = (char *)malloc(strlen(filename) + 5);
+   sprintf(cache->tmpname, "%s.tmp", filename);
+   cache->buffer = (uint8_t *)malloc(CACHE_BUFFER);
+   reset_counts(cache);
+
+   if (open_reader(cache) || open_writer(cache)) {
+      return cache;
+   }
+   free_cache(cache);
+   return NULL;
+}
+
+int cache_hit(cache_t *cache) {
+   return cache->reading;
+}
+
+void cache_write(cache_t *cache, const bus_window_t *window, int num) {
+   for (int i = 0; i < num; ) {
+      int n = CACHE_BLOCK - cache->block_num;
+      if (n > num - i) {
+         n = num - i;
+      }
+      memcpy(cache->block_bus          + cache->block_num, window->bus          + i, n * sizeof(bus_cycle_t));
+      memcpy(cache->block_sample_count + cache->block_num, window->sample_count + i, n * sizeof(uint32_t));
+      memcpy(cache->block_cycle_count  + cache->block_num, window->cycle_count  + i, n * sizeof(uint32_t));
+      cache->block_num += n;
+      if (cache->block_num == CACHE_BLOCK) {
+         write_block(cache);
+      }
+      i += n;
+   }
+}
+
+int cache_read(cache_t *cache, const bus_window_t *window, int room) {
+   if (cache->block_pos == cache->block_num && !read_block(cache)) {
+      return 0;
+   }
+   int n = cache->block_num - cache->block_pos;
+   if (n > room) {
+      n = room;
+   }
+   memcpy(window->bus,          cache->block_bus          + cache->block_pos, n * sizeof(bus_cycle_t));
+   memcpy(window->sample_count, cache->block_sample_count + cache->block_pos, n * sizeof(uint32_t));
+   memcpy(window->cycle_count,  cache->block_cycle_count  + cache->block_pos, n * sizeof(uint32_t));
+   cache->block_pos += n;
+   return n;
+}
+
+int cache_close(cache_t *cache) {
+   int failed = cache->failed;
+   if (cache->reading) {
+      fclose(cache->file);
+      // A damaged cache is removed, so it's rebuilt by the next decode
+      if (failed) {
+         remove(cache->filename);
+      }
+   } else {
+      write_block(cache);
+      flush_buffer(cache);
+      cache->header.num_cycles = cache->num_cycles;
+      failed = cache->failed;
+      if (!failed) {
+         failed = fseek(cache->file, 0, SEEK_SET) != 0 ||
+            fwrite(&cache->header, sizeof(cache->header), 1, cache->file) != 1;
+      }
+      failed |= fclose(cache->file) != 0;
+      if (failed || rename(cache->tmpname, cache->filename)) {
+         remove(cache->tmpname);
+         failed = 1;
+      }
+   }
+   free_cache(cache);
+   return failed;
+}
+
+void cache_discard(cache_t *cache) {
+   fclose(cache->file);
+   if (!cache->reading) {
+      remove(cache->tmpname);
+   }
+   free_cache(cache);
+}
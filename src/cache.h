@@ -0,0 +1,76 @@
+#ifndef _INCLUDE_CACHE_H
+#define _INCLUDE_CACHE_H
+
+#include <inttypes.h>
+
+#include "defs.h"
+
+// Bus cycle cache: a sidecar file holding the bus cycles (bus_cycle_t)
+// extracted from a capture, so later decodes of the same capture with
+// the same extraction options can skip reading the capture entirely.
+//
+// The header fingerprints the capture (size, modification time and a
+// hash of its start) and the extraction options (pin mapping, skew,
+// skip, etc). If either differ, the cache is rebuilt.
+//
+// The bus cycles are stored in blocks of up to 4096, each being:
+//   - its length in bytes, a hash of the rest of the block (to detect
+//     damage), and the number of bus cycles (varint)
+//   - the number of control words (varint), and the control words (the
+//     bus cycle without the data byte, 16 bits each) in the order they
+//     first appear in the block, there being only a few
+//   - the data bytes
+//   - the width in bits of the indices, then the index of each bus
+//     cycle's control word, packed into as few bits as possible
+//   - the sample and cycle count deltas, as runs of bus cycles with the
+//     same deltas (three varints each)
+//
+// The cache is written to a temporary file, and only renamed into
+// place once the whole capture has been extracted.
+
+#define CACHE_VERSION 3
+
+#define CACHE_NUM_OPTIONS 40
+
+typedef struct {
+   uint64_t capture_size;
+   int64_t  capture_mtime;
+   uint64_t capture_hash;
+   int32_t  options[CACHE_NUM_OPTIONS]; // filled in by the caller, unused set to 0
+} cache_key_t;
+
+typedef struct cache cache_t;
+
+// Fill in the capture fields of a key (the fingerprint of the capture)
+//
+// Returns non-zero if there is no capture file to fingerprint.
+int cache_fingerprint(const char *capture_filename, uint64_t capture_size, cache_key_t *key);
+
+// Open the cache for a capture file
+//
+// If a cache with a matching key exists, it's opened for reading,
+// otherwise a new one is opened for writing. Returns NULL if there is
+// no capture file to fingerprint, or the cache can't be created.
+cache_t *cache_open(const char *filename, const char *capture_filename, uint64_t capture_size, cache_key_t *key);
+
+// Returns 1 if the cache is being read, 0 if it's being written
+int cache_hit(cache_t *cache);
+
+// Append the first num bus cycles of the window (when writing)
+void cache_write(cache_t *cache, const bus_window_t *window, int num);
+
+// Read up to room of the next bus cycles into the window (when reading),
+// returns the number read, or 0 at the end
+int cache_read(cache_t *cache, const bus_window_t *window, int room);
+
+// Close the cache, renaming it into place if it was written
+//
+// Returns non-zero if the cache could not be read or written (a cache
+// that could not be read, being truncated or damaged, is removed)
+int cache_close(cache_t *cache);
+
+// Close the cache without keeping it (when it's being written, but not all
+// of the capture has been extracted)
+void cache_discard(cache_t *cache);
+
+#endif
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "capture.h"
+
+// Upper limit on the number of files in a split capture
+#define MAX_SPLIT_FILES 1000
+
+// Amount copied to get back in place when the history isn't in the mapping
+#define CAPTURE_SEAM 4096
+
+typedef struct {
+   int      fd;
+   uint8_t *map;
+   uint64_t size;
+} capture_file_t;
+
+struct capture {
+   // Memory mapped mode: the list of files making up the stream
+   capture_file_t *files;
+   int             num_files;
+   int             cur;       // index of the current file
+   uint64_t        pos;       // offset of the cursor in the current file
+   uint64_t        advised;   // offset up to which the current file has been prefetched
+   int             held;      // set if the blocks are released by the caller
+   // Stream mode (stdin, pipes, or anything that can't be mapped)
+   FILE           *stream;
+   // Copy buffer (used in stream mode, and for samples straddling two files)
+   uint8_t        *buffer;
+   size_t          carry;     // bytes of a partial sample carried over in stream mode
+   // The last CAPTURE_HISTORY bytes handed out (zero at the start, or after a skip)
+   uint8_t         history[CAPTURE_HISTORY];
+   uint64_t        delivered; // bytes handed out since the start, or the last skip
+};
+
+// ====================================================================
+// Split file naming
+// ====================================================================
+
+// Generate the n'th successor of filename by incrementing the last run
+// of decimal digits in the basename, preserving its width.
+//
+// e.g. capture.000 -> capture.001, cap9.bin -> cap10.bin
+static char *next_split_name(const char *filename, int n) {
+   const char *base = strrchr(filename, '/');
+   base = base ? base + 1 : filename;
+   const char *end = NULL;
+   for (const char *p = base; *p; p++) {
+      if (*p >= '0' && *p <= '9') {
+         end = p + 1;
+      }
+   }
+   if (!end) {
+      return NULL;
+   }
+   const char *start = end;
+   while (start > base && start[-1] >= '0' && start[-1] <= '9') {
+      start--;
+   }
+   int width = end - start;
+   long value = strtol(start, NULL, 10) + n;
+   char *name = malloc(strlen(filename) + 32);
+   sprintf(name, "%.*s%0*ld%s", (int)(start - filename), filename, width, value, end);
+   return name;
+}
+
+// ====================================================================
+// Memory mapped mode
+// ====================================================================
+
+#ifndef _WIN32
+
+static int map_file(capture_file_t *file, const char *filename) {
+   struct stat st;
+   file->fd = open(filename, O_RDONLY);
+   if (file->fd < 0) {
+      return -1;
+   }
+   if (fstat(file->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+      close(file->fd);
+      return -1;
+   }
+   file->size = st.st_size;
+   file->map = NULL;
+   if (file->size > 0) {
+      void *map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+      if (map == MAP_FAILED) {
+         close(file->fd);
+         return -1;
+      }
+      file->map = (uint8_t *) map;
+      // The capture is walked from start to end exactly once
+      madvise(file->map, file->size, MADV_SEQUENTIAL);
+   }
+   return 0;
+}
+
+static void unmap_file(capture_file_t *file) {
+   if (file->map) {
+      munmap(file->map, file->size);
+   }
+   close(file->fd);
+}
+
+// Ask the kernel to start paging in the window after the cursor, and
+// drop the window that has just been consumed, so a multi-GB capture
+// doesn't build up a huge resident set.
+static void prefetch_ahead(capture_t *capture) {
+   capture_file_t *file = &capture->files[capture->cur];
+   long pagesize = sysconf(_SC_PAGESIZE);
+   uint64_t ahead = capture->pos + 2 * CAPTURE_WINDOW;
+   if (ahead > file->size) {
+      ahead = file->size;
+   }
+   if (capture->advised < ahead) {
+      uint64_t start = capture->advised & ~(uint64_t)(pagesize - 1);
+      madvise(file->map + start, ahead - start, MADV_WILLNEED);
+      capture->advised = ahead;
+   }
+   if (capture->pos >= 2 * CAPTURE_WINDOW && !capture->held) {
+      uint64_t done = (capture->pos - CAPTURE_WINDOW) & ~(uint64_t)(pagesize - 1);
+      uint64_t start = done >= CAPTURE_WINDOW ? done - CAPTURE_WINDOW : 0;
+      madvise(file->map + start, done - start, MADV_DONTNEED);
+   }
+}
+
+#endif
+
+// Move the cursor on to the next file with data remaining
+static void skip_empty_files(capture_t *capture) {
+   while (capture->cur < capture->num_files && capture->pos >= capture->files[capture->cur].size) {
+      capture->pos -= capture->files[capture->cur].size;
+      capture->cur++;
+      capture->advised = 0;
+   }
+}
+
+static uint64_t bytes_remaining(capture_t *capture) {
+   uint64_t total = 0;
+   for (int i = capture->cur; i < capture->num_files; i++) {
+      total += capture->files[i].size;
+   }
+   return total - capture->pos;
+}
+
+// Copy n bytes from the mapped files, crossing file boundaries as needed
+static void copy_mapped(capture_t *capture, uint8_t *dst, size_t n) {
+   while (n > 0) {
+      capture_file_t *file = &capture->files[capture->cur];
+      size_t chunk = file->size - capture->pos;
+      if (chunk > n) {
+         chunk = n;
+      }
+      memcpy(dst, file->map + capture->pos, chunk);
+      dst += chunk;
+      n -= chunk;
+      capture->pos += chunk;
+      skip_empty_files(capture);
+   }
+}
+
+// Hand out a block, remembering its tail as the history for the next block
+static size_t deliver(capture_t *capture, const uint8_t *ptr, size_t len, const uint8_t **block) {
+   if (len >= CAPTURE_HISTORY) {
+      memcpy(capture->history, ptr + len - CAPTURE_HISTORY, CAPTURE_HISTORY);
+   } else {
+      memmove(capture->history, capture->history + len, CAPTURE_HISTORY - len);
+      memcpy(capture->history + CAPTURE_HISTORY - len, ptr, len);
+   }
+   capture->delivered += len;
+   *block = ptr;
+   return len;
+}
+
+static size_t next_mapped(capture_t *capture, const uint8_t **block, size_t align) {
+   skip_empty_files(capture);
+   if (capture->cur >= capture->num_files) {
+      return 0;
+   }
+   capture_file_t *file = &capture->files[capture->cur];
+   uint8_t *ptr = file->map + capture->pos;
+   uint64_t remaining = file->size - capture->pos;
+   int aligned = ((uintptr_t) ptr) % align == 0;
+   if (remaining >= align && aligned && capture->pos >= CAPTURE_HISTORY && capture->delivered >= CAPTURE_HISTORY) {
+      // The normal case: hand out a window of the mapping in place
+      // (the preceeding bytes of the mapping are the history)
+      size_t len = remaining < CAPTURE_WINDOW ? remaining : CAPTURE_WINDOW;
+      len -= len % align;
+#ifndef _WIN32
+      prefetch_ahead(capture);
+#endif
+      capture->pos += len;
+      return deliver(capture, ptr, len, block);
+   } else {
+      // Fall back to copying, because either:
+      // - a sample straddles two files, or a file has left the cursor
+      //   misaligned, in which case this continues to the end of the file
+      // - the bytes before the cursor are not the history (start of a
+      //   file, or just after a skip), in which case copying a short
+      //   seam is enough to get back in place
+      uint64_t total = bytes_remaining(capture);
+      size_t max = aligned ? CAPTURE_SEAM : CAPTURE_WINDOW;
+      size_t len = total < max ? total : max;
+      len -= len % align;
+      if (len == 0) {
+         return 0;
+      }
+      uint8_t *data = capture->buffer + CAPTURE_HISTORY;
+      memcpy(capture->buffer, capture->history, CAPTURE_HISTORY);
+      copy_mapped(capture, data, len);
+      return deliver(capture, data, len, block);
+   }
+}
+
+// ====================================================================
+// Stream mode
+// ====================================================================
+
+static size_t next_stream(capture_t *capture, const uint8_t **block, size_t align) {
+   uint8_t *data = capture->buffer + CAPTURE_HISTORY;
+   memcpy(capture->buffer, capture->history, CAPTURE_HISTORY);
+   // Start with any partial sample held back from the last call
+   size_t len = capture->carry;
+   memmove(data, data + CAPTURE_WINDOW, len);
+   len += fread(data + len, 1, CAPTURE_WINDOW - len, capture->stream);
+   // Hold back any partial sample until the next call
+   capture->carry = len % align;
+   len -= capture->carry;
+   if (len == 0) {
+      return 0;
+   }
+   // Safe, as the buffer has space for one extra sample
+   memcpy(data + CAPTURE_WINDOW, data + len, capture->carry);
+   return deliver(capture, data, len, block);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+capture_t *capture_open(const char *filename, int split) {
+   capture_t *capture = (capture_t *)calloc(1, sizeof(capture_t));
+   capture->buffer = (uint8_t *)malloc(CAPTURE_HISTORY + CAPTURE_WINDOW + 16);
+   if (!filename || !strcmp(filename, "-")) {
+      capture->stream = stdin;
+      return capture;
+   }
+#ifndef _WIN32
+   capture->files = (capture_file_t *)calloc(MAX_SPLIT_FILES, sizeof(capture_file_t));
+   if (map_file(&capture->files[0], filename) == 0) {
+      capture->num_files = 1;
+      while (split && capture->num_files < MAX_SPLIT_FILES) {
+         char *name = next_split_name(filename, capture->num_files);
+         if (!name || access(name, R_OK) != 0 || map_file(&capture->files[capture->num_files], name) != 0) {
+            free(name);
+            break;
+         }
+         free(name);
+         capture->num_files++;
+      }
+      return capture;
+   }
+   free(capture->files);
+   capture->files = NULL;
+#endif
+   // Can't be mapped (e.g. a fifo), so read it as a stream
+   capture->stream = fopen(filename, "rb");
+   if (capture->stream == NULL) {
+      free(capture->buffer);
+      free(capture);
+      return NULL;
+   }
+   if (split) {
+      fprintf(stderr, "warning: --split ignored, as the capture file can't be mapped\n");
+   }
+   return capture;
+}
+
+void capture_skip(capture_t *capture, uint64_t nbytes) {
+   // Samples before the skip point read as zero
+   memset(capture->history, 0, CAPTURE_HISTORY);
+   capture->delivered = 0;
+   if (capture->stream) {
+      // fseek fails on pipes, in which case read and discard
+      if (fseek(capture->stream, nbytes, SEEK_CUR) != 0) {
+         while (nbytes > 0) {
+            size_t chunk = nbytes < CAPTURE_WINDOW ? nbytes : CAPTURE_WINDOW;
+            size_t num = fread(capture->buffer, 1, chunk, capture->stream);
+            if (num == 0) {
+               break;
+            }
+            nbytes -= num;
+         }
+      }
+   } else {
+      // Just move the cursor, no data need be touched
+      capture->pos += nbytes;
+      skip_empty_files(capture);
+   }
+}
+
+size_t capture_next(capture_t *capture, const uint8_t **block, size_t align) {
+   if (capture->stream) {
+      return next_stream(capture, block, align);
+   } else {
+      return next_mapped(capture, block, align);
+   }
+}
+
+int capture_is_mapped(capture_t *capture) {
+   return capture->stream == NULL;
+}
+
+void capture_hold(capture_t *capture) {
+   capture->held = 1;
+}
+
+int capture_in_place(capture_t *capture, const uint8_t *block) {
+   // The copies are always made to the same place
+   return !capture->stream && block != capture->buffer + CAPTURE_HISTORY;
+}
+
+void capture_release(capture_t *capture, const uint8_t *block, size_t len) {
+#ifndef _WIN32
+   // Just the whole pages, leaving the history of the next block in place
+   uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+   uintptr_t start = ((uintptr_t) block + pagesize - 1) & ~(pagesize - 1);
+   uintptr_t end = len > CAPTURE_HISTORY ? ((uintptr_t) block + len - CAPTURE_HISTORY) & ~(pagesize - 1) : 0;
+   if (end > start) {
+      madvise((void *) start, end - start, MADV_DONTNEED);
+   }
+#endif
+}
+
+uint64_t capture_size(capture_t *capture) {
+   uint64_t total = 0;
+   for (int i = 0; i < capture->num_files; i++) {
+      total += capture->files[i].size;
+   }
+   return total;
+}
+
+void capture_close(capture_t *capture) {
+   if (capture->stream) {
+      if (capture->stream != stdin) {
+         fclose(capture->stream);
+      }
+   }
+#ifndef _WIN32
+   for (int i = 0; i < capture->num_files; i++) {
+      unmap_file(&capture->files[i]);
+   }
+#endif
+   free(capture->files);
+   free(capture->buffer);
+   free(capture);
+}
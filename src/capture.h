@@ -0,0 +1,58 @@
+#ifndef _INCLUDE_CAPTURE_H
+#define _INCLUDE_CAPTURE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Size of the window handed out by capture_next() when the capture is
+// memory mapped, and of the copy buffer when it is not.
+#define CAPTURE_WINDOW (1 << 20)
+
+// Number of bytes before each block that are guaranteed to be readable,
+// and hold the preceeding bytes of the stream (or zero, if at the start
+// of the stream or just after a skip). This allows look-behind of up to
+// this distance without any buffering in the caller.
+#define CAPTURE_HISTORY 64
+
+typedef struct capture capture_t;
+
+// Open a capture file (or stdin if filename is NULL or "-")
+//
+// If split is set, the filename is treated as the first of a numbered
+// sequence of files (e.g. capture.000, capture.001, ...) that together
+// make up a single logical stream.
+capture_t *capture_open(const char *filename, int split);
+
+// Advance the read cursor by nbytes
+void capture_skip(capture_t *capture, uint64_t nbytes);
+
+// Return the next block of the stream in *block, and its length in bytes
+//
+// The length is always a multiple of align (i.e. the sample size), and
+// the block remains valid until the next call. Returns 0 at the end of
+// the stream.
+size_t capture_next(capture_t *capture, const uint8_t **block, size_t align);
+
+// Returns true if the capture is being walked in place (i.e. mmapped)
+int capture_is_mapped(capture_t *capture);
+
+// Keep the blocks handed out in place until they're released, rather than
+// dropping them from memory as the cursor moves on, so they can be passed
+// on to another thread without copying (see capture_in_place)
+void capture_hold(capture_t *capture);
+
+// Returns true if the block is part of the mapping (rather than a copy that
+// is only valid until the next call), in which case it remains valid until
+// the capture is closed
+int capture_in_place(capture_t *capture, const uint8_t *block);
+
+// Drop a block handed out in place from memory, once it's finished with
+// (only needed after capture_hold)
+void capture_release(capture_t *capture, const uint8_t *block, size_t len);
+
+// Returns the total size of the capture in bytes (0 if not mapped)
+uint64_t capture_size(capture_t *capture);
+
+void capture_close(capture_t *capture);
+
+#endif
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+
+#include "context.h"
+#include "decoder.h"
+#include "disasm.h"
+#include "memory.h"
+#include "output.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "tube_decode.h"
+
+__thread context_t *context = NULL;
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+context_t *context_create() {
+   context_t *saved = context;
+   context = (context_t *)calloc(1, sizeof(context_t));
+   decoder_create();
+   output_create();
+   tube_create();
+   context_t *c = context;
+   context = saved;
+   return c;
+}
+
+void context_destroy(context_t *c) {
+   context_t *saved = context;
+   context = c;
+   profiler_destroy();
+   disasm_destroy();
+   symbol_destroy();
+   memory_destroy();
+   tube_destroy();
+   output_destroy();
+   decoder_destroy();
+   free(c->em);
+   free(c);
+   context = saved == c ? NULL : saved;
+}
+
+void context_take_state(context_t *c) {
+   void *em = context->em;
+   context->em = c->em;
+   c->em = em;
+   struct memory_state *memory = context->memory;
+   context->memory = c->memory;
+   c->memory = memory;
+}
@@ -0,0 +1,57 @@
+#ifndef _INCLUDE_CONTEXT_H
+#define _INCLUDE_CONTEXT_H
+
+#include "defs.h"
+
+// Decoder context: all the state of one decode (the options, emulator
+// registers, memory model, output, etc), so that several independent
+// decodes can run in the same process.
+//
+// Each module keeps its state in a struct private to that module, which
+// hangs off the context, and is allocated by the module as it's
+// initialized (e.g. the memory model by memory_init).
+//
+// The context being worked on is per-thread: each thread that works on
+// a decode (including the pipeline stages it starts) first sets context
+// to it, and a context should only be worked on by one thread at a time
+// (other than the pipeline stages, which each use different modules).
+
+struct decoder_state;
+struct disasm_state;
+struct memory_state;
+struct output_state;
+struct pipeline_state;
+struct profiler_state;
+struct symbols_state;
+struct tube_state;
+
+typedef struct {
+   arguments_t            arguments;
+   int                    failflag;  // set when a prediction fails, cleared per instruction
+   struct decoder_state  *decoder;
+   void                  *em;        // the registers of the emulator (em_*.c)
+   struct disasm_state   *disasm;
+   struct memory_state   *memory;
+   struct output_state   *output;
+   struct pipeline_state *pipeline;
+   struct profiler_state *profiler;
+   struct symbols_state  *symbols;
+   struct tube_state     *tube;
+} context_t;
+
+extern __thread context_t *context;
+
+// Indicates state prediction failed (set by the emulators)
+#define failflag (context->failflag)
+
+// Create a context, with all the options at their defaults
+context_t *context_create();
+
+// Free a context, and everything it owns
+void context_destroy(context_t *c);
+
+// Swap the emulator registers and memory model of the current context
+// with those of c (e.g. to carry on from where c's decode ended)
+void context_take_state(context_t *c);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef _INCLUDE_DECODE6502_H
+#define _INCLUDE_DECODE6502_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// libdecode6502: the decoder as a library, for decoding samples from
+// within another program (e.g. directly from a logic analyzer), rather
+// than from a capture file.
+//
+//    decode6502_t *d = decode6502_create();
+//    char *argv[] = { "decode6502", "--cpu=65c02", "--machine=master", NULL };
+//    if (decode6502_configure(d, 3, argv)) ...
+//    while (...more samples...) {
+//       decode6502_feed(d, samples, len);
+//       while (decode6502_next(d, &record)) ...
+//    }
+//    decode6502_end(d);
+//    while (decode6502_next(d, &record)) ...
+//    decode6502_destroy(d);
+//
+// Each decoder is independent (with its own emulator and memory model),
+// so several can be used at once, from different threads if required
+// (but each decoder from only one thread at a time). A decoder does all
+// its work on the calling thread, so --threads is ignored.
+//
+// The options are the same as for the command line tool, other than
+// those that need a capture file (a capture FILENAME, --split, --cache,
+// --index, --segments and --segment_at), windows (--from_instr etc),
+// --fanout and --profile, which are rejected.
+
+typedef struct decode6502 decode6502_t;
+
+// The kinds of record
+#define DECODE6502_INSTRUCTION 0
+#define DECODE6502_INTERRUPT   1
+#define DECODE6502_RESET       2
+#define DECODE6502_TEXT        3  // just the output after the final instruction
+
+typedef struct {
+   int         kind;
+   uint32_t    sample_count;  // of the first bus cycle of the instruction
+   uint32_t    cycle_count;
+   int         num_cycles;    // bus cycles consumed
+   int         real_cycles;   // including any cycles where RDY was low
+   int         pc;            // -1 indicates unknown
+   int         pb;            // -1 indicates unknown (or not a 65C816)
+   int         opcode;
+   int         op1;
+   int         op2;
+   int         op3;
+   int         opcount;       // number of operand bytes
+   int         ea;            // -1 indicates none (or unknown)
+   int         fail;          // set if a prediction failed
+   const char *state;         // the registers and flags (as shown by --state)
+   const char *text;          // the output since the previous record (as written
+   size_t      text_len;      // by the command line tool, including the disassembly)
+} decode6502_record_t;
+
+// Create a decoder, returns NULL if out of memory
+decode6502_t *decode6502_create();
+
+// Set the options, from a command line (argv[0] is the program name used
+// in any error messages, which are written to stderr)
+//
+// Returns non-zero if the options are invalid, or not supported
+int decode6502_configure(decode6502_t *d, int argc, char *argv[]);
+
+// Decode the next len bytes of samples (in the same format as a capture
+// file, which needn't be split on a sample boundary)
+//
+// Returns non-zero if the decoder is not configured, or already ended
+int decode6502_feed(decode6502_t *d, const void *samples, size_t len);
+
+// Finish decoding, flushing any instructions still being decoded
+//
+// Returns non-zero if the decoder is not configured, or already ended
+int decode6502_end(decode6502_t *d);
+
+// Return the next record, in order, of those decoded so far
+//
+// Returns 0 if there are none, otherwise the strings in the record are
+// valid until the next call to any of these functions
+int decode6502_next(decode6502_t *d, decode6502_record_t *record);
+
+void decode6502_destroy(decode6502_t *d);
+
+#endif
@@ -0,0 +1,3185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <argp.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "defs.h"
+#include "em_6502.h"
+#include "em_65816.h"
+#include "em_6800.h"
+#include "memory.h"
+#include "memmap.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "capture.h"
+#include "unpack.h"
+#include "pipeline.h"
+#include "output.h"
+#include "segment.h"
+#include "cache.h"
+#include "index.h"
+#include "trace.h"
+#include "disasm.h"
+#include "layout.h"
+#include "fold.h"
+#include "trigger.h"
+#include "history.h"
+#include "scan.h"
+#include "context.h"
+#include "decoder.h"
+
+// Allow the data bus samples to be taken early or late, by looking back
+// into the capture history (which must cover 2 * MAX_SKEW_VALUE samples)
+
+#define SKEW_BUFFER_SIZE  ((int) (CAPTURE_HISTORY / sizeof(uint16_t)))
+
+#define MAX_SKEW_VALUE ((SKEW_BUFFER_SIZE / 2) - 1)
+
+// Value use to indicate a pin (or register) has not been assigned by
+// the user, so should take the default value.
+#define UNSPECIFIED -2
+
+// Value used to indicate a pin (or register) is undefined. For a pin,
+// this means unconnected. For a register this means it will default
+// to a value of undefined (?).
+#define UNDEFINED -1
+
+#define DOCSIZE 10000
+
+char machines_doc[DOCSIZE];
+
+char cpus_doc[DOCSIZE];
+
+const char *machine_names[] = {
+   "default",
+   "beeb",
+   "master",
+   "elk",
+   "atom",
+   "mek6800d2",
+   "blitter",
+   0
+};
+
+// ====================================================================
+// Decoder state
+// ====================================================================
+
+// The state of the extraction of bus cycles, carried over from one
+// block of the capture to the next
+typedef struct {
+   int              cached;    // the bus cycles are being read from the cache
+   int              ended;     // the LAST bus cycle has been read from the cache
+   unpack_pins_t    pins;      // pin mappings into the 16 bit words
+   int              idx_phi;   // phi1 or phi2, whichever is connected (or -1)
+   int              clk_pol;   // set if phi1 is used rather than phi2
+   int              last_phi2; // the previous value of phi, to detect the edges
+   int              delay;     // how far the data bus can be sampled late
+   unpack_planes_t *planes;
+   uint16_t        *edges;
+   sample_t         s;         // the bus cycle being built
+} extract_t;
+
+// The decoder state is per context (see context.h)
+struct decoder_state {
+   char disbuf[256];
+
+   cpu_emulator_t *em;
+
+   int c816;
+
+   // The layouts of the instruction lines (see layout.h)
+   layout_t *layout;
+   layout_t *fail_layout;
+
+   // Set if the lines show the registers (so they are recorded for every instruction)
+   int need_state;
+
+   // Set if the lines read the memory model (so can only be formatted in order)
+   int lines_need_memory;
+
+   // Loop folding of the instruction lines (otherwise NULL)
+   fold_t *fold;
+
+   int triggered;
+
+   // The compiled --on rules and --filter (otherwise NULL)
+   trigger_t *trigger;
+
+   // Cleared until a profile trigger is hit
+   int profiling;
+
+   // The instructions leading up to a trigger (otherwise NULL)
+   history_t *history;
+
+   // Instructions still to be shown after a trigger, if limited
+   int post_left;
+
+   // The segment being decoded, in a segmented decode (otherwise NULL)
+   segment_t *segment;
+
+   // The chunk being scanned, in a structural scan (otherwise NULL)
+   scan_t *scan;
+
+   // Sample number of the boundary at the end of the segment or window (0 until seen)
+   uint32_t decode_stop;
+
+   // Set once the segment or window has seen enough bus cycles
+   atomic_int decode_done;
+
+   // The index of checkpoints, being either created or used (otherwise NULL)
+   index_t *checkpoints;
+
+   // The checkpoint the decode was started from (otherwise NULL)
+   const index_checkpoint_t *restored;
+
+   // Set once the start of the window has been reached
+   int window_started;
+
+   // Number of instructions decoded (including resets and interrupts)
+   uint64_t num_instructions;
+
+   // The bus cycle cache, being either read or written (otherwise NULL)
+   cache_t *cache;
+
+   // The state carried over between instructions (saved in checkpoints)
+   int total_cycles;
+   int interrupt_depth;
+   int skipping_interrupted;
+
+   // Not every field is filled in by every instruction (e.g. reset leaves
+   // the opcode, which is still profiled), and these need to consistently
+   // carry over from the previous instruction
+   instruction_t instruction;
+
+   // Instruction number of the next checkpoint to add to the index
+   uint64_t next_checkpoint;
+
+   // The emulator does everything up to producing the output in one step
+   step_t step;
+
+   // Set while coming out of reset (see decode_instruction)
+   int rst_seen;
+
+   // The bus cycles the decoders are still looking ahead over at the end
+   // of the last batch, preceded by the BEHIND before them
+   bus_cycle_t carry_bus[BEHIND + DEPTH];
+   uint32_t carry_sample_count[BEHIND + DEPTH];
+   uint32_t carry_cycle_count[BEHIND + DEPTH];
+   int num_carried;
+
+   // The instruction being analyzed (for dump_samples)
+   const bus_window_t *window;
+
+   // Progress through the start (and end) of a segment or window
+   int segment_started;
+   int segment_lookahead;
+   int window_restored;
+   uint32_t window_cycle_offset;
+
+   extract_t extract;
+
+   // Called after each instruction (see decoder_set_hook)
+   decoder_hook_t hook;
+   void *hook_data;
+
+   // Set if any option could not be parsed
+   int parse_failed;
+
+   // The command line, as recorded in a trace
+   int argc;
+   char **argv;
+
+   // The binary trace being written (otherwise NULL), and the output
+   // other than the instruction lines (which all goes in the trace)
+   trace_t *trace;
+   output_chunk_t *trace_chunk;
+
+   // Set if the instruction lines are written to the trace as records
+   int trace_lines;
+};
+
+// ====================================================================
+// Argp processing
+// ====================================================================
+
+const char *argp_program_version = "decode6502 0.1";
+
+const char *argp_program_bug_address = "<dave@hoglet.com>";
+
+static char doc[] = "\n\
+Decoder for 6502/65C02/65C816 logic analyzer capture files.\n\
+\n\
+FILENAME must be a binary capture file containing:\n\
+- 16 bit samples (of the data bus and control signals), or\n\
+-  8-bit samples (of the data bus), if the --byte option is present.\n\
+\n\
+If FILENAME is omitted, stdin is read instead.\n\
+\n\
+If --split is specified, FILENAME is the first of a numbered sequence of\n\
+capture files (e.g. capture.000, capture.001, ...) that are decoded as a\n\
+single continuous capture.\n\
+\n\
+If --segments or --segment_at is specified, the capture is split into segments\n\
+which are decoded in parallel, each starting from an unknown state. Segments\n\
+are split at the first opcode fetch (or RST) after each sample number, either\n\
+evenly spaced or as given. This needs sync (or vpa/vda), and a capture file\n\
+that can be mapped. The point at which the state of each segment is fully\n\
+known is reported to stderr.\n\
+\n\
+If --scan is specified, the capture is only scanned for a summary (counts of\n\
+instructions, cycles per instruction, resets and interrupts, opcodes, and the\n\
+code executed by page), worked out from the bus cycles without emulation.\n\
+This needs sync (or vpa/vda). With --threads=N, a capture file that can be\n\
+mapped is scanned as N chunks in parallel. As there are no registers, the\n\
+interrupts and the program counter are approximate, and reported as such.\n\
+\n\
+The default sample bit assignments for the 6502/65C02 signals are:\n\
+ - data: bit  0 (assumes 8 consecutive bits)\n\
+ -  rnw: bit  8\n\
+ - sync: bit  9\n\
+ -  rdy: bit 10\n\
+ -  rst: bit 14\n\
+ - phi2: bit 15\n\
+\n\
+The default sample bit assignments for the 65C816 signals are:\n\
+ - data: bit  0 (assumes 8 consecutive bits)\n\
+ -  rnw: bit  8\n\
+ -  vpa: bit  9\n\
+ -  rdy: bit 10\n\
+ -  vda: bit 11\n\
+ -    e: bit 12\n\
+ -  rst: bit 14\n\
+ - phi2: bit 15\n\
+\n\
+To specify that an input is unconnected, include the option with an empty\n\
+BITNUM. e.g. --sync=\n\
+\n\
+If phi2 is not connected the capture file should contain one sample per\n\
+falling edge of phi2.\n\
+\n\
+If rdy is not connected a value of '1' is assumed.\n\
+\n\
+If sync (or vda/vpa) is not connected a heuristic based decoder is used.\n\
+This works well, but can take several instructions to lock onto the\n\
+instruction stream. Use of sync (or vda/vpa) is recommended.\n\
+\n\
+If RST is not connected, an alternative is to specify the reset vector:\n\
+ - D9CD (D9 is the high byte, CD is the low byte)\n\
+ - A9D9CD (optionally, also specify the first opcode, LDA # in this case)\n\
+\n\
+If --debug=1 is specified, each instruction is preceeded by it\'s sample values.\n\
+If --debug=2 is specified, pipeline queue, disassembly cache and output\n\
+statistics are written to stderr.\n\
+\n\
+If --threads is specified, the decoder is run as a pipeline, with the capture\n\
+reader, bus cycle extraction, emulation and output stages on separate threads.\n\
+The instruction lines are then formatted by the output stage, or with more\n\
+than 4 threads, by the rest in parallel (other than with --showromno or\n\
+--bbcfwa).\n\
+The text output is also written by a thread of its own, from one buffer while\n\
+the next is filled.\n\
+\n\
+If --fold is specified, loops of up to N instructions (e.g. polling a status\n\
+register, or a delay loop) are shown as one iteration, followed by a summary\n\
+of the iterations folded, their cycles, and the registers on leaving the loop.\n\
+Loops are found by address and opcode, so can change registers (e.g.\n\
+counters). Any other output (e.g. memory logging) during a loop ends it.\n\
+\n\
+If --on is specified (any number of times), ACTION is taken after each\n\
+instruction matching CONDITION. ACTION is one of: start (the output, which is\n\
+then off until started), stop (the output), profile (start profiling, which is\n\
+then off until started), snapshot (write the registers) or end (the decode).\n\
+Once stopped, if nothing can start the output again (and there's no profiling\n\
+or --trace_out), the rest of the capture isn't read. If --filter is specified,\n\
+only the instructions matching CONDITION are shown. A CONDITION is made of:\n\
+ - pc, pb, opcode and user, of the instruction\n\
+ - cycle and instr, the bus cycles and instructions decoded before it\n\
+ - registers and flags afterwards, named as in the state, e.g. A, SP, C\n\
+ - symbol names (see --labels), for their address\n\
+ - read(ADDR) or read(LO..HI), set if the instruction read memory there, and\n\
+   read(ADDR, DATA) if it read DATA; write(...) likewise for writes\n\
+ - nth(N, CONDITION), set the Nth time CONDITION is\n\
+compared with == != < <= > >= (== and != can also take a range LO..HI), and\n\
+combined with ! && || and brackets. Numbers are decimal, or hex after $, & or\n\
+0x. e.g. --on='start:pc==OSWRCH && A==13' --on='end:nth(3, write($FE40))'\n\
+\n\
+If --pre_trigger is specified, the last N instructions before the output is\n\
+started by a trigger (--trigger or --on) are shown first, like the pre-trigger\n\
+of a logic analyzer. Until then, they're only kept as compact records, and are\n\
+not formatted. If --post_trigger is specified, the output is stopped again N\n\
+instructions after it's started by a trigger.\n\
+\n\
+If --output is specified, the text output is written directly to FILE, rather\n\
+than through stdio to stdout.\n\
+\n\
+If --cache is specified, the bus cycles extracted from the capture are saved\n\
+to FILE (by default FILENAME.cycles), and later decodes with the same capture\n\
+and the same pin, skew and skip options read the bus cycles from there\n\
+instead. A cache found to be damaged is removed, and the decode fails.\n\
+\n\
+If --index is specified, a checkpoint of the complete decoder state\n\
+(registers, flags and memory model) is saved to FILE (by default\n\
+FILENAME.index) every --index_interval instructions. This index is then used\n\
+to decode a window of the capture (--from_instr/--to_instr, or\n\
+--from_cycle/--to_cycle), by restoring the nearest checkpoint, rather than\n\
+decoding from the start. Instructions are numbered from 0, and bus cycles from\n\
+1, at the start of the capture (after --skip).\n\
+\n\
+If --trace_out is specified, a compact binary record of each instruction is\n\
+written to FILE instead of the text output, which render6502 turns back into\n\
+the same text (and can also run the profilers on).\n\
+\n\
+If --fanout is specified, the capture is read once, and decoded by several\n\
+independently configured decoders at once, each on its own thread. Each line\n\
+of FILE is the name of an output file followed by options for one decoder,\n\
+which are added to those on the command line. The decoders must all use the\n\
+same --byte and --skip options. Once done, the output (after the first reset,\n\
+if any) of each is compared with that of the first, and where they diverge is\n\
+reported.\n\
+\n\
+If --format is specified, each instruction is shown as FORMAT, in place of the\n\
+other output options (other than the signal options). FORMAT is text with\n\
+these fields:\n\
+ - %Y bus cycle number    - %a address             - %r BBC rom number\n\
+ - %h hex bytes           - %i disassembly         - %y number of bus cycles\n\
+ - %s register state      - %f BBC FWA and FWB     - %u user signal\n\
+ - %R one register or flag, named as in the state, e.g. %A %X %SP %N\n\
+   (or %{R}, e.g. %{Y}, as %Y is the bus cycle number)\n\
+ - %P all the flags       - %% a %\n\
+Each field can have a minimum width, e.g. %14i pads the disassembly to 14\n\
+characters.\n\
+\n\
+The --mem= option controls the memory access logging and modelling. The value\n\
+is three hex nibbles: WRM, where W controls write logging, R controls read\n\
+logging, and M controls modelling.\n\
+Each of the three nibbles has the same semantics:\n\
+ - bit 3 applies to stack accesses\n\
+ - bit 2 applies to data accesses\n\
+ - bit 1 applies to pointer accesses\n\
+ - bit 0 applies to instruction accesses\n\
+Examples:\n\
+ --mem=00F models (and verifies) all accesses, but with minimal extra logging\n\
+ --mem=F0F would additional log all writes\n\
+\n\
+If --machine_file is specified, the memory model is built from the\n\
+description of the machine in FILE, in place of that of --machine. Each line\n\
+is one of:\n\
+  ram NAME SIZE                       a block of memory (main is predefined)\n\
+  latch NAME ADDR MASK [INIT]         a write to ADDR sets NAME to data&MASK\n\
+  map LO-HI RAM[VAR&MASK] ACCESS [when COND...]\n\
+  remap LO-HI TO [when COND...]\n\
+  tube LO-HI\n\
+where ACCESS is any of c(heck), r(ead) and w(rite), or -, and COND is\n\
+VAR&MASK, VAR&MASK=VALUE or VAR=VALUE. Each 256 byte page is mapped by the\n\
+first map line covering it whose conditions hold. Numbers are hex, and #\n\
+starts a comment.\n\
+\n";
+
+static char args_doc[] = "[FILENAME]";
+
+enum {
+   GROUP_GENERAL = 1,
+   GROUP_OUTPUT  = 2,
+   GROUP_SIGDEFS = 3,
+   GROUP_6502    = 4,
+   GROUP_65816   = 5
+};
+
+
+enum {
+   KEY_ADDR = 'a',
+   KEY_BYTE = 'b',
+   KEY_CPU = 'c',
+   KEY_DEBUG = 'd',
+   KEY_BBCFWA = 'f',
+   KEY_HEX = 'h',
+   KEY_INSTR = 'i',
+   KEY_MACHINE = 'm',
+   KEY_PROFILE = 'p',
+   KEY_QUIET = 'q',
+   KEY_STATE = 's',
+   KEY_TRIGGER = 't',
+   KEY_UNDOC = 'u',
+   KEY_CYCLES = 'y',
+   KEY_SAMPLES = 'Y',
+   KEY_VECRST = 1,
+   KEY_BBCTUBE,
+   KEY_MACHINE_FILE,
+   KEY_MEM,
+   KEY_SP,
+   KEY_SKIP,
+   KEY_SPLIT,
+   KEY_THREADS,
+   KEY_SEGMENTS,
+   KEY_SEGMENT_AT,
+   KEY_SCAN,
+   KEY_CACHE,
+   KEY_INDEX,
+   KEY_INDEX_INTERVAL,
+   KEY_FROM_INSTR,
+   KEY_TO_INSTR,
+   KEY_FROM_CYCLE,
+   KEY_TO_CYCLE,
+   KEY_FANOUT,
+   KEY_TRACE_OUT,
+   KEY_OUTPUT,
+   KEY_FORMAT,
+   KEY_FOLD,
+   KEY_ON,
+   KEY_FILTER,
+   KEY_PRE_TRIGGER,
+   KEY_POST_TRIGGER,
+   KEY_SKEW,
+   KEY_SKEW_RD,
+   KEY_SKEW_WR,
+   KEY_LABELS,
+   KEY_DATA,
+   KEY_RNW,
+   KEY_RDY,
+   KEY_PHI1,
+   KEY_PHI2,
+   KEY_USER,
+   KEY_RST,
+   KEY_SYNC,
+   KEY_VDA,
+   KEY_VPA,
+   KEY_E,
+   KEY_PB,
+   KEY_DB,
+   KEY_DP,
+   KEY_EMUL,
+   KEY_MS,
+   KEY_XS,
+   KEY_SHOWROM = 'r'
+};
+
+
+typedef struct {
+   char *cpu_name;
+   cpu_t cpu_type;
+} cpu_name_t;
+
+static cpu_name_t cpu_names[] = {
+   // 6502
+   {"6502",       CPU_6502},
+   {"R6502",      CPU_6502},
+   {"SY6502",     CPU_6502},
+   {"NMOS",       CPU_6502},
+   {"02",         CPU_6502},
+   // 65C02
+   {"65C02",      CPU_65C02},
+   {"CMOS",       CPU_65C02},
+   {"C02",        CPU_65C02},
+   // 65C02_ROCKWELL
+   {"R65C02",     CPU_65C02_ROCKWELL},
+   {"ROCKWELL",   CPU_65C02_ROCKWELL},
+   // 65C02_WDC
+   {"WD65C02",    CPU_65C02_WDC},
+   {"W65C02",     CPU_65C02_WDC},
+   {"WDC",        CPU_65C02_WDC},
+   // 6502_ARLET
+   {"ARLET",      CPU_6502_ARLET},
+   // 65C02_ARLET
+   {"ARLETC02",   CPU_65C02_ARLET},
+   // 65C02_ALAND
+   {"ALANDC02",   CPU_65C02_ALAND},
+   // 65C816
+   {"65816",      CPU_65C816},
+   {"65C816",     CPU_65C816},
+   {"W65816",     CPU_65C816},
+   {"W65C816",    CPU_65C816},
+   {"816",        CPU_65C816},
+   {"C816",       CPU_65C816},
+   // 6800
+   {"6800",       CPU_6800},
+   {"M6800",      CPU_6800},
+   {"MC6800",     CPU_6800},
+   {"6802",       CPU_6800},
+   {"M6802",      CPU_6800},
+   {"MC6802",     CPU_6800},
+
+   // Terminator
+   {NULL, 0}
+};
+
+static int cpu_rst_delay[] = {
+   9, // CPU_UNKNOWN
+   9, // CPU_6502
+   9, // CPU_6502_ARLET
+   8, // CPU_65C02
+   8, // CPU_65C02_ROCKWELL
+   8, // CPU_65C02_WDC
+   9, // CPU_65C02_ARLET
+   9, // CPU_65C02_ALAND
+   9, // CPU_65C816
+   3, // CPU_6800
+};
+
+static struct argp_option options[] = {
+   { 0, 0, 0, 0, "General options:", GROUP_GENERAL},
+
+   { "vecrst",      KEY_VECRST,    "HEX",  OPTION_ARG_OPTIONAL, "Reset vector, optionally preceeded by the first opcode (e.g. A9D9CD)",
+                                                                                                                     GROUP_GENERAL},
+   { "cpu",            KEY_CPU,     "CPU",                   0, "Sets CPU type (see above)",                         GROUP_GENERAL},
+   { "machine",    KEY_MACHINE, "MACHINE",                   0, "Sets machine specific defaults and memory model (see above)", GROUP_GENERAL},
+   { "machine_file", KEY_MACHINE_FILE, "FILE",               0, "Reads the memory model from FILE (see above)",      GROUP_GENERAL},
+   { "byte",          KEY_BYTE,         0,                   0, "Enable byte-wide sample mode",                      GROUP_GENERAL},
+   { "debug",        KEY_DEBUG,   "LEVEL",                   0, "Sets the debug level (bitmask, see above)",          GROUP_GENERAL},
+   { "profile",    KEY_PROFILE,  "PARAMS", OPTION_ARG_OPTIONAL, "Profile code execution",                            GROUP_GENERAL},
+   { "trigger",    KEY_TRIGGER, "ADDRESS",                   0, "Trigger on address",                                GROUP_GENERAL},
+   { "on",              KEY_ON, "ACTION:CONDITION",          0, "Take ACTION on each CONDITION (see above)",         GROUP_GENERAL},
+   { "filter",      KEY_FILTER, "CONDITION",                 0, "Only show the instructions matching CONDITION",     GROUP_GENERAL},
+   { "pre_trigger", KEY_PRE_TRIGGER, "N",                    0, "Show N instructions before a start trigger",        GROUP_GENERAL},
+   { "post_trigger", KEY_POST_TRIGGER, "N",                  0, "Stop the output N instructions after a trigger",    GROUP_GENERAL},
+   { "bbctube",    KEY_BBCTUBE,         0,                   0, "BBC tube protocol decoding",                        GROUP_GENERAL},
+   { "mem",            KEY_MEM,     "HEX", OPTION_ARG_OPTIONAL, "Memory modelling (see above)",                      GROUP_GENERAL},
+   { "skip",          KEY_SKIP,     "HEX", OPTION_ARG_OPTIONAL, "Skip the first n samples",                          GROUP_GENERAL},
+   { "split",        KEY_SPLIT,         0,                   0, "Capture is split over numbered files (see above)",  GROUP_GENERAL},
+   { "threads",    KEY_THREADS,       "N",                   0, "Run the decoder as a pipeline of N threads (1-16)",  GROUP_GENERAL},
+   { "segments",  KEY_SEGMENTS,       "N",                   0, "Decode as N segments in parallel (see above)",      GROUP_GENERAL},
+   { "segment_at", KEY_SEGMENT_AT, "HEX,...",                0, "Decode as segments split at these sample numbers",  GROUP_GENERAL},
+   { "scan",          KEY_SCAN,         0,                   0, "Only scan the capture for a summary (see above)",   GROUP_GENERAL},
+   { "cache",        KEY_CACHE,    "FILE", OPTION_ARG_OPTIONAL, "Cache the extracted bus cycles (see above)",        GROUP_GENERAL},
+   { "index",        KEY_INDEX,    "FILE", OPTION_ARG_OPTIONAL, "Index the capture with checkpoints (see above)",    GROUP_GENERAL},
+   { "index_interval", KEY_INDEX_INTERVAL, "N",              0, "Instructions between checkpoints (default 10000)",  GROUP_GENERAL},
+   { "from_instr", KEY_FROM_INSTR,    "N",                   0, "Decode from instruction N",                         GROUP_GENERAL},
+   { "to_instr",     KEY_TO_INSTR,    "N",                   0, "Decode up to (but not including) instruction N",    GROUP_GENERAL},
+   { "from_cycle", KEY_FROM_CYCLE,    "N",                   0, "Decode from the instruction at bus cycle N",        GROUP_GENERAL},
+   { "to_cycle",     KEY_TO_CYCLE,    "N",                   0, "Decode up to (but not including) bus cycle N",      GROUP_GENERAL},
+   { "fanout",      KEY_FANOUT,    "FILE",                   0, "Decode with each configuration in FILE (see above)", GROUP_GENERAL},
+   { "trace_out", KEY_TRACE_OUT,   "FILE",                   0, "Write a binary instruction trace (see above)",      GROUP_GENERAL},
+   { "output",       KEY_OUTPUT,   "FILE",                   0, "Write the output to FILE, rather than stdout",      GROUP_GENERAL},
+   { "skew",          KEY_SKEW,    "SKEW", OPTION_ARG_OPTIONAL, "Skew the data bus by +/- n samples",                GROUP_GENERAL},
+   { "skew_rd",    KEY_SKEW_RD,    "SKEW", OPTION_ARG_OPTIONAL, "Skew the data bus by +/- n samples for read data",  GROUP_GENERAL},
+   { "skew_wr",    KEY_SKEW_WR,    "SKEW", OPTION_ARG_OPTIONAL, "Skew the data bus by +/- n samples for write data", GROUP_GENERAL},
+   { "labels",      KEY_LABELS,   "FILE",                    0, "Swift format label/symbols file e.g. from beebasm", GROUP_GENERAL},
+
+   { 0, 0, 0, 0, "Output options:", GROUP_OUTPUT},
+
+   { "quiet",        KEY_QUIET,         0,                   0, "Set all the output options to off",                 GROUP_OUTPUT},
+   { "address",       KEY_ADDR,         0,                   0, "Show address of instruction",                       GROUP_OUTPUT},
+   { "hex",            KEY_HEX,         0,                   0, "Show hex bytes of instruction",                     GROUP_OUTPUT},
+   { "instruction",  KEY_INSTR,         0,                   0, "Show instruction disassembly",                      GROUP_OUTPUT},
+   { "state",        KEY_STATE,         0,                   0, "Show register/flag state",                          GROUP_OUTPUT},
+   { "cycles",      KEY_CYCLES,         0,                   0, "Show number of bus cycles",                         GROUP_OUTPUT},
+   { "samplenum",  KEY_SAMPLES,         0,                   0, "Show bus cycle numbers",                            GROUP_OUTPUT},
+   { "bbcfwa",      KEY_BBCFWA,         0,                   0, "Show BBC floating-point work areas",                GROUP_OUTPUT},
+   { "showromno",   KEY_SHOWROM,        0,                   0, "Show BBC rom no for address 8000..BFFF",            GROUP_OUTPUT},
+   { "format",       KEY_FORMAT,  "FORMAT",                   0, "Show each instruction as FORMAT (see above)",       GROUP_OUTPUT},
+   { "fold",           KEY_FOLD,       "N", OPTION_ARG_OPTIONAL, "Fold loops of up to N instructions (default 16)",    GROUP_OUTPUT},
+
+   { 0, 0, 0, 0, "Signal defintion options:", GROUP_SIGDEFS},
+
+   { "data",          KEY_DATA, "BITNUM",                   0, "Bit number for data (default  0)",                   GROUP_SIGDEFS},
+   { "rnw",            KEY_RNW, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for rnw  (default  8)",                   GROUP_SIGDEFS},
+   { "rdy",            KEY_RDY, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for rdy  (default 10)",                   GROUP_SIGDEFS},
+   { "phi1",          KEY_PHI1, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for phi1 (default -1)",                   GROUP_SIGDEFS},
+   { "phi2",          KEY_PHI2, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for phi2 (default 15)",                   GROUP_SIGDEFS},
+   { "user",          KEY_USER, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for user (default -1)",                   GROUP_SIGDEFS},
+   { "rst",            KEY_RST, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for rst  (default 14)",                   GROUP_SIGDEFS},
+   { "sync",          KEY_SYNC, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for sync (default  9) (6502/65C02)",      GROUP_SIGDEFS},
+   { "vpa",            KEY_VPA, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for vpa  (default  9) (65C816)",          GROUP_SIGDEFS},
+   { "vda",            KEY_VDA, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for vda  (default 11) (65C816)",          GROUP_SIGDEFS},
+   { "e",                KEY_E, "BITNUM", OPTION_ARG_OPTIONAL, "Bit number for e    (default 12) (65C816)",          GROUP_SIGDEFS},
+   { 0, 0, 0, 0, "Additional 6502/65C02 options:", GROUP_6502},
+
+   { "undocumented", KEY_UNDOC,        0,                   0, "Enable undocumented opcodes",                        GROUP_6502},
+   { "sp",              KEY_SP,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the Stack Pointer register",       GROUP_6502},
+
+   { 0, 0, 0, 0, "Additional 65C816 options:", GROUP_65816},
+
+   { "pb",              KEY_PB,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the Program Bank register",         GROUP_65816},
+   { "db",              KEY_DB,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the Data Bank register",            GROUP_65816},
+   { "dp",              KEY_DP,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the Direct Page register",          GROUP_65816},
+   { "emul",          KEY_EMUL,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the E flag",                        GROUP_65816},
+   { "ms",              KEY_MS,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the M flag",                        GROUP_65816},
+   { "xs",              KEY_XS,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the X flag",                        GROUP_65816},
+   { "sp",              KEY_SP,    "HEX", OPTION_ARG_OPTIONAL, "Initial value of the Stack Pointer register",       GROUP_65816},
+   { 0 }
+};
+
+// Report an error in the arguments, recording it so the parse fails
+// (rather than exits) with ARGP_NO_EXIT
+static void parse_error(struct argp_state *state, const char *fmt, ...) {
+   context->decoder->parse_failed = 1;
+   char *message;
+   va_list ap;
+   va_start(ap, fmt);
+   if (vasprintf(&message, fmt, ap) < 0) {
+      message = NULL;
+   }
+   va_end(ap);
+   argp_error(state, "%s", message ? message : fmt);
+   free(message);
+}
+
+static int parse_skew(char *arg, struct argp_state *state) {
+   int skew = 0;
+   if (arg && strlen(arg) > 0) {
+      skew = strtol(arg, (char **)NULL, 10);
+      if (skew < -MAX_SKEW_VALUE || skew > MAX_SKEW_VALUE) {
+         parse_error(state, "specified skew exceeds skew buffer size");
+      }
+   }
+   return skew;
+}
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+   int i;
+   arguments_t *arguments = state->input;
+
+   // First, pass argument to the profiler moduler
+   profiler_parse_opt(key, arg, state);
+
+   switch (key) {
+   case KEY_DATA:
+      arguments->idx_data = atoi(arg);
+      break;
+   case KEY_RNW:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_rnw = atoi(arg);
+      } else {
+         arguments->idx_rnw = UNDEFINED;
+      }
+      break;
+   case KEY_SYNC:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_sync = atoi(arg);
+      } else {
+         arguments->idx_sync = UNDEFINED;
+      }
+      break;
+   case KEY_RDY:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_rdy = atoi(arg);
+      } else {
+         arguments->idx_rdy = UNDEFINED;
+      }
+      break;
+   case KEY_PHI1:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_phi1 = atoi(arg);
+      } else {
+         arguments->idx_phi1 = UNDEFINED;
+      }
+      break;
+   case KEY_PHI2:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_phi2 = atoi(arg);
+      } else {
+         arguments->idx_phi2 = UNDEFINED;
+      }
+      break;
+   case KEY_USER:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_user = atoi(arg);
+      } else {
+         arguments->idx_user = UNDEFINED;
+      }
+      break;
+   case KEY_RST:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_rst = atoi(arg);
+      } else {
+         arguments->idx_rst = UNDEFINED;
+      }
+      break;
+   case KEY_VECRST:
+      if (arg && strlen(arg) > 0) {
+         arguments->vec_rst = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->vec_rst = UNDEFINED;
+      }
+      break;
+   case KEY_BBCTUBE:
+      arguments->bbctube = 1;
+      break;
+   case KEY_VDA:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_vda = atoi(arg);
+      } else {
+         arguments->idx_vda = UNDEFINED;
+      }
+      break;
+   case KEY_VPA:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_vpa = atoi(arg);
+      } else {
+         arguments->idx_vpa = UNDEFINED;
+      }
+      break;
+   case KEY_E:
+      if (arg && strlen(arg) > 0) {
+         arguments->idx_e = atoi(arg);
+      } else {
+         arguments->idx_e = UNDEFINED;
+      }
+      break;
+   case KEY_EMUL:
+      if (arg && strlen(arg) > 0) {
+         arguments->e_flag = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->e_flag = UNDEFINED;
+      }
+      break;
+   case KEY_SP:
+      if (arg && strlen(arg) > 0) {
+         arguments->sp_reg = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->sp_reg = UNDEFINED;
+      }
+      break;
+   case KEY_PB:
+      if (arg && strlen(arg) > 0) {
+         arguments->pb_reg = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->pb_reg = UNDEFINED;
+      }
+      break;
+   case KEY_DB:
+      if (arg && strlen(arg) > 0) {
+         arguments->db_reg = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->db_reg = UNDEFINED;
+      }
+      break;
+   case KEY_DP:
+      if (arg && strlen(arg) > 0) {
+         arguments->dp_reg = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->dp_reg = UNDEFINED;
+      }
+      break;
+   case KEY_MS:
+      if (arg && strlen(arg) > 0) {
+         arguments->ms_flag = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->ms_flag = UNDEFINED;
+      }
+      break;
+   case KEY_XS:
+      if (arg && strlen(arg) > 0) {
+         arguments->xs_flag = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->xs_flag = UNDEFINED;
+      }
+      break;
+   case KEY_SKIP:
+      if (arg && strlen(arg) > 0) {
+         arguments->skip = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->skip = 0;
+      }
+      break;
+   case KEY_SPLIT:
+      arguments->split = 1;
+      break;
+   case KEY_SEGMENTS:
+      arguments->segments = atoi(arg);
+      if (arguments->segments < 1 || arguments->segments > MAX_SEGMENTS) {
+         parse_error(state, "number of segments must be between 1 and %d", MAX_SEGMENTS);
+      }
+      break;
+   case KEY_SEGMENT_AT:
+      arguments->segment_at = arg;
+      break;
+   case KEY_SCAN:
+      arguments->scan = 1;
+      break;
+   case KEY_CACHE:
+      arguments->cache = 1;
+      arguments->cache_file = arg;
+      break;
+   case KEY_INDEX:
+      arguments->index = 1;
+      arguments->index_file = arg;
+      break;
+   case KEY_INDEX_INTERVAL:
+      arguments->index_interval = atoi(arg);
+      if (arguments->index_interval < 1) {
+         parse_error(state, "index interval must be at least 1");
+      }
+      break;
+   case KEY_FANOUT:
+      arguments->fanout_file = arg;
+      break;
+   case KEY_TRACE_OUT:
+      arguments->trace_file = arg;
+      break;
+   case KEY_OUTPUT:
+      arguments->output_file = *arg ? arg : NULL;
+      break;
+   case KEY_FROM_INSTR:
+      arguments->from_instr = strtoull(arg, (char **)NULL, 10);
+      break;
+   case KEY_TO_INSTR:
+      arguments->to_instr = strtoull(arg, (char **)NULL, 10);
+      break;
+   case KEY_FROM_CYCLE:
+      arguments->from_cycle = strtoul(arg, (char **)NULL, 10);
+      break;
+   case KEY_TO_CYCLE:
+      arguments->to_cycle = strtoul(arg, (char **)NULL, 10);
+      break;
+   case KEY_THREADS:
+      arguments->threads = atoi(arg);
+      if (arguments->threads < 1 || arguments->threads > PIPELINE_MAX_THREADS) {
+         parse_error(state, "number of threads must be between 1 and %d", PIPELINE_MAX_THREADS);
+      }
+      break;
+   case KEY_SKEW:
+      arguments->skew_rd = parse_skew(arg, state);
+      arguments->skew_wr = arguments->skew_rd;
+      break;
+   case KEY_SKEW_RD:
+      arguments->skew_rd = parse_skew(arg, state);
+      break;
+   case KEY_SKEW_WR:
+      arguments->skew_wr = parse_skew(arg, state);
+      break;
+   case KEY_LABELS:
+      arguments->labels_file = arg;
+      break;
+   case KEY_MEM:
+      if (arg && strlen(arg) > 0) {
+         arguments->mem_model = strtol(arg, (char **)NULL, 16);
+      } else {
+         arguments->mem_model = 0;
+      }
+      break;
+   case KEY_CPU:
+      if (arg && strlen(arg) > 0) {
+         i = 0;
+         while (cpu_names[i].cpu_name) {
+            if (strcasecmp(arg, cpu_names[i].cpu_name) == 0) {
+               arguments->cpu_type = cpu_names[i].cpu_type;
+               return 0;
+            }
+            i++;
+         }
+      }
+      parse_error(state, "unsupported cpu type: %s\n\n%s", arg, cpus_doc);
+      break;
+   case KEY_MACHINE:
+      i = 0;
+      while (machine_names[i]) {
+         if (strcasecmp(arg, machine_names[i]) == 0) {
+            arguments->machine = i;
+            return 0;
+         }
+         i++;
+      }
+      parse_error(state, "unsupported machine type: %s\n\n%s", arg, machines_doc);
+      break;
+   case KEY_MACHINE_FILE:
+      arguments->machine_file = arg;
+      break;
+   case KEY_DEBUG:
+      arguments->debug = atoi(arg);
+      break;
+   case KEY_BYTE:
+      arguments->byte = 1;
+      break;
+   case KEY_QUIET:
+      arguments->format = NULL;
+      arguments->show_address = 0;
+      arguments->show_hex = 0;
+      arguments->show_instruction = 0;
+      arguments->show_state = 0;
+      arguments->show_bbcfwa = 0;
+      arguments->show_cycles = 0;
+      arguments->show_samplenums = 0;
+      break;
+   case KEY_ADDR:
+      arguments->show_address = 1;
+      break;
+   case KEY_SHOWROM:
+      arguments->show_romno = 1;
+      break;
+   case KEY_HEX:
+      arguments->show_hex = 1;
+      break;
+   case KEY_INSTR:
+      arguments->show_instruction = 1;
+      break;
+   case KEY_STATE:
+      arguments->show_state = 1;
+      break;
+   case KEY_BBCFWA:
+      arguments->show_bbcfwa = 1;
+      break;
+   case KEY_CYCLES:
+      arguments->show_cycles = 1;
+      break;
+   case KEY_SAMPLES:
+      arguments->show_samplenums = 1;
+      break;
+   case KEY_FORMAT:
+      arguments->format = arg;
+      break;
+   case KEY_FOLD:
+      arguments->fold = arg ? atoi(arg) : 16;
+      if (arguments->fold < 0 || arguments->fold > FOLD_MAX) {
+         parse_error(state, "loops to fold must be up to %d instructions", FOLD_MAX);
+      }
+      break;
+   case KEY_PROFILE:
+      arguments->profile = 1;
+      break;
+   case KEY_TRIGGER:
+      if (arg && strlen(arg) > 0) {
+         char *start   = strtok(arg, ",");
+         char *stop    = strtok(NULL, ",");
+         char *skipint = strtok(NULL, ",");
+         if (start && strlen(start) > 0) {
+            arguments->trigger_start = strtol(start, (char **)NULL, 16);
+         }
+         if (stop && strlen(stop) > 0) {
+            arguments->trigger_stop = strtol(stop, (char **)NULL, 16);
+         }
+         if (skipint && strlen(skipint) > 0) {
+            arguments->trigger_skipint = atoi(skipint);
+         }
+      }
+      break;
+   case KEY_ON:
+      if (arguments->num_on == MAX_TRIGGER_RULES) {
+         parse_error(state, "at most %d --on options can be given", MAX_TRIGGER_RULES);
+      } else {
+         arguments->on[arguments->num_on++] = arg;
+      }
+      break;
+   case KEY_FILTER:
+      arguments->filter = arg;
+      break;
+   case KEY_PRE_TRIGGER:
+      arguments->pre_trigger = atoi(arg);
+      if (arguments->pre_trigger < 0 || arguments->pre_trigger > HISTORY_MAX) {
+         parse_error(state, "pre-trigger instructions must be up to %d", HISTORY_MAX);
+      }
+      break;
+   case KEY_POST_TRIGGER:
+      arguments->post_trigger = atoi(arg);
+      if (arguments->post_trigger < 0) {
+         parse_error(state, "post-trigger instructions must not be negative");
+      }
+      break;
+   case KEY_UNDOC:
+      arguments->undocumented = 1;
+      break;
+   case ARGP_KEY_ARG:
+      arguments->filename = arg;
+      break;
+   case ARGP_KEY_END:
+      if (state->arg_num > 1) {
+         parse_error(state, "multiple capture file arguments");
+      }
+      break;
+   default:
+      return ARGP_ERR_UNKNOWN;
+   }
+   return 0;
+}
+
+// ====================================================================
+// Analyze a complete instruction
+// ====================================================================
+
+
+static void dump_samples(int n) {
+   struct decoder_state *decoder = context->decoder;
+   const bus_window_t *window = decoder->window;
+   for (int i = 0; i < n; i++) {
+      bus_cycle_t bus = window->bus[i];
+      output_printf("%08x %2d %02x ", window->sample_count[i], i, bus_data(bus));
+      switch(bus_type(bus)) {
+      case INTERNAL:
+         output_putchar('I');
+         break;
+      case PROGRAM:
+         output_putchar('P');
+         break;
+      case DATA:
+         output_putchar('D');
+         break;
+      case OPCODE:
+         output_putchar('O');
+         break;
+      case LAST:
+         output_putchar('L');
+         break;
+      default:
+         output_putchar('?');
+         break;
+      }
+      output_putchar(' ');
+      output_putchar(bus_rnw(bus) >= 0 ? '0' + bus_rnw(bus) : '?');
+      output_putchar(' ');
+      output_putchar(bus_rst(bus) >= 0 ? '0' + bus_rst(bus) : '?');
+      if (bus_user(bus) >= 0) {
+         output_putchar(' ');
+         output_putchar('0' + bus_user(bus));
+      }
+      output_putchar('\n');
+   }
+}
+
+void write_hex1(char *buffer, int value) {
+   *buffer = value + (value < 10 ? '0' : 'A' - 10);
+}
+
+void write_hex2(char *buffer, int value) {
+   write_hex1(buffer++, (value >> 4) & 15);
+   write_hex1(buffer++, (value >> 0) & 15);
+}
+
+void write_hex4(char *buffer, int value) {
+   write_hex1(buffer++, (value >> 12) & 15);
+   write_hex1(buffer++, (value >> 8) & 15);
+   write_hex1(buffer++, (value >> 4) & 15);
+   write_hex1(buffer++, (value >> 0) & 15);
+}
+
+void write_hex6(char *buffer, int value) {
+   write_hex1(buffer++, (value >> 20) & 15);
+   write_hex1(buffer++, (value >> 16) & 15);
+   write_hex1(buffer++, (value >> 12) & 15);
+   write_hex1(buffer++, (value >> 8) & 15);
+   write_hex1(buffer++, (value >> 4) & 15);
+   write_hex1(buffer++, (value >> 0) & 15);
+}
+
+void write_hex8(char *buffer, int value) {
+   write_hex1(buffer++, (value >> 28) & 15);
+   write_hex1(buffer++, (value >> 24) & 15);
+   write_hex1(buffer++, (value >> 20) & 15);
+   write_hex1(buffer++, (value >> 16) & 15);
+   write_hex1(buffer++, (value >> 12) & 15);
+   write_hex1(buffer++, (value >> 8) & 15);
+   write_hex1(buffer++, (value >> 4) & 15);
+   write_hex1(buffer++, (value >> 0) & 15);
+}
+
+int write_s(char *buffer, const char *s) {
+   int i = 0;
+   while (*s) {
+      *buffer++ = *s++;
+      i++;
+   }
+   return i;
+}
+
+// Number of ints of state saved by the decoder itself (before the emulator's)
+#define DECODER_STATE 11
+
+static int save_decoder_state(int *state) {
+   struct decoder_state *decoder = context->decoder;
+   state[0]  = decoder->total_cycles;
+   state[1]  = decoder->interrupt_depth;
+   state[2]  = decoder->skipping_interrupted;
+   state[3]  = decoder->triggered;
+   state[4]  = decoder->instruction.pc;
+   state[5]  = decoder->instruction.pb;
+   state[6]  = decoder->instruction.opcode;
+   state[7]  = decoder->instruction.op1;
+   state[8]  = decoder->instruction.op2;
+   state[9]  = decoder->instruction.op3;
+   state[10] = decoder->instruction.opcount;
+   return DECODER_STATE + decoder->em->save_state(state + DECODER_STATE);
+}
+
+static void restore_decoder_state(const int *state) {
+   struct decoder_state *decoder = context->decoder;
+   decoder->total_cycles         = state[0];
+   decoder->interrupt_depth      = state[1];
+   decoder->skipping_interrupted = state[2];
+   decoder->triggered            = state[3];
+   decoder->instruction.pc       = state[4];
+   decoder->instruction.pb       = state[5];
+   decoder->instruction.opcode   = state[6];
+   decoder->instruction.op1      = state[7];
+   decoder->instruction.op2      = state[8];
+   decoder->instruction.op3      = state[9];
+   decoder->instruction.opcount  = state[10];
+   decoder->em->restore_state(state + DECODER_STATE);
+}
+
+// Called at the start of each instruction, which is where checkpoints
+// are added (other than for a reset, as the decoder is then part way
+// through), and where the window starts and ends. Returns 1 if the
+// instruction is beyond the end of the window.
+static int instruction_boundary(const bus_window_t *window, int rst_seen) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   if (!rst_seen && decoder->num_instructions >= decoder->next_checkpoint) {
+      index_checkpoint_t checkpoint = {
+         .instruction  = decoder->num_instructions,
+         .sample_count = window->sample_count[0],
+         .cycle_count  = window->cycle_count[0]
+      };
+      int state[INDEX_MAX_STATE];
+      index_add(decoder->checkpoints, &checkpoint, state, save_decoder_state(state));
+      decoder->next_checkpoint = decoder->num_instructions + arguments->index_interval;
+   }
+   if (!decoder->window_started && decoder->num_instructions >= arguments->from_instr && window->cycle_count[0] >= arguments->from_cycle) {
+      decoder->window_started = 1;
+      // Nothing held back from before the window is shown
+      if (decoder->fold) {
+         fold_flush(decoder->fold);
+      }
+      output_suppress(0);
+   }
+   if (decoder->num_instructions >= arguments->to_instr || window->cycle_count[0] >= arguments->to_cycle) {
+      decoder->decode_stop = window->sample_count[0];
+      atomic_store(&decoder->decode_done, 1);
+      return 1;
+   }
+   return 0;
+}
+
+// Format the line of output for an instruction, from its record and the
+// registers afterwards (as save_state), returning the end of the line
+//
+// Other than with layouts that read the memory model (--showromno,
+// --bbcfwa, or their --format fields), this depends only on its
+// arguments, so the lines can be formatted on other threads (see
+// output_line), or from a trace.
+static char *format_instruction(char *bp, const trace_instr_t *rec, const int *state, int formatter) {
+   struct decoder_state *decoder = context->decoder;
+   const layout_t *layout = (rec->flags & TRACE_FAIL) ? decoder->fail_layout : decoder->layout;
+   return layout_write(layout, bp, rec, state, formatter);
+}
+
+static char *format_line(char *bp, const output_line_t *line, int formatter) {
+   return format_instruction(bp, &line->instr, line->state, formatter);
+}
+
+static void write_instruction(const trace_instr_t *rec, const int *state) {
+   struct decoder_state *decoder = context->decoder;
+   char *bp = format_instruction(decoder->disbuf, rec, state, 0);
+   // End the line
+   *bp++ = 0;
+   output_puts(decoder->disbuf);
+}
+
+// Write (or defer) the line for an instruction
+static void show_instruction(const trace_instr_t *rec, const int *state) {
+   struct decoder_state *decoder = context->decoder;
+   // When the output is written on another thread, so is the line
+   if (output_lines_deferred()) {
+      output_line(rec, state, decoder->step.num_state);
+   } else {
+      write_instruction(rec, state);
+   }
+}
+
+// Fill in the record of an instruction (which is also that of a trace)
+static void record_instruction(trace_instr_t *rec, const bus_window_t *window, int num_cycles, int rst_seen, int intr_seen, int fail, int real_cycles) {
+   struct decoder_state *decoder = context->decoder;
+   instruction_t *instr = &decoder->instruction;
+   *rec = (trace_instr_t) {
+      .type         = TRACE_INSTRUCTION,
+      .flags        = (fail ? TRACE_FAIL : 0) | (decoder->triggered ? TRACE_TRIGGERED : 0) | (decoder->skipping_interrupted ? TRACE_SKIPPING : 0),
+      .kind         = (rst_seen ? STEP_RESET : 0) | (intr_seen ? STEP_INTERRUPT : 0),
+      .opcode       = instr->opcode,
+      .op1          = instr->op1,
+      .op2          = instr->op2,
+      .op3          = instr->op3,
+      .opcount      = instr->opcount,
+      .num_cycles   = num_cycles,
+      .user         = bus_user(window->bus[num_cycles - 1]),
+      .pb           = instr->pb,
+      .pc           = instr->pc,
+      .ea           = instr->ea,
+      .sample_count = window->sample_count[0],
+      .cycle_count  = window->cycle_count[0],
+      .real_cycles  = real_cycles
+   };
+   // The registers are only needed when they are shown
+   if (fail || decoder->need_state) {
+      rec->flags |= TRACE_STATE;
+   }
+}
+
+// ====================================================================
+// Binary instruction trace
+// ====================================================================
+
+// Write the output since the last instruction as a text record (this is
+// everything other than the instruction lines)
+static void trace_flush(output_chunk_t *chunk) {
+   struct decoder_state *decoder = context->decoder;
+   if (chunk->len) {
+      trace_write_text(decoder->trace, chunk->text, chunk->len);
+   }
+   for (int i = 0; i < chunk->num_profile; i++) {
+      output_profile_t *p = chunk->profile + i;
+      profiler_profile_instruction(p->pc, p->opcode, p->op1, p->op2, p->num_cycles);
+   }
+   chunk->len = 0;
+   chunk->num_profile = 0;
+}
+
+static output_chunk_t *trace_handoff(output_chunk_t *chunk) {
+   trace_flush(chunk);
+   return chunk;
+}
+
+static void trace_instruction(const trace_instr_t *rec, const int *state) {
+   struct decoder_state *decoder = context->decoder;
+   trace_flush(decoder->trace_chunk);
+   trace_write_instr(decoder->trace, rec, state);
+}
+
+static int open_trace() {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   int state[MAX_EM_STATE];
+   int flags = decoder->need_state ? TRACE_ALL_STATE : 0;
+   // These need the memory model, so the lines are written as text
+   if (decoder->lines_need_memory) {
+      flags |= TRACE_TEXT_LINES;
+   }
+   decoder->trace = trace_create(arguments->trace_file, decoder->argc, decoder->argv, decoder->em->save_state(state), flags);
+   if (!decoder->trace) {
+      return 1;
+   }
+   decoder->trace_lines = !(flags & TRACE_TEXT_LINES);
+   decoder->trace_chunk = (output_chunk_t *)malloc(sizeof(output_chunk_t));
+   output_divert(trace_handoff, decoder->trace_chunk);
+   return 0;
+}
+
+static int close_trace() {
+   struct decoder_state *decoder = context->decoder;
+   trace_flush(output_restore());
+   trace_write_memory(decoder->trace);
+   free(decoder->trace_chunk);
+   decoder->trace_chunk = NULL;
+   int failed = trace_close(decoder->trace);
+   decoder->trace = NULL;
+   decoder->trace_lines = 0;
+   return failed;
+}
+
+// Show the line of an instruction (through the loop folding, if any)
+static void show_line(const trace_instr_t *rec, const int *state) {
+   struct decoder_state *decoder = context->decoder;
+   if (decoder->fold) {
+      fold_instruction(decoder->fold, rec, state);
+   } else {
+      show_instruction(rec, state);
+   }
+}
+
+// Start the output on a trigger, first showing the instructions leading up to it
+static void start_output() {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   if (decoder->history) {
+      history_replay(decoder->history, show_line);
+   }
+   decoder->triggered = 1;
+   decoder->post_left = arguments->post_trigger;
+}
+
+// Run the --on rules and --filter on an instruction, taking the actions
+// hit, and returning 1 if it passes the filter
+static int run_triggers(const bus_window_t *window, int num_cycles, const step_t *step) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   trigger_instr_t instr = {
+      .pc     = decoder->instruction.pc,
+      .pb     = decoder->instruction.pb,
+      .opcode = decoder->instruction.opcode,
+      .user   = bus_user(window->bus[num_cycles - 1]),
+      .cycle  = decoder->total_cycles,
+      .instr  = decoder->num_instructions - 1,
+      .state  = step->state
+   };
+   unsigned hit = trigger_evaluate(decoder->trigger, &instr);
+   int end = 0;
+   if ((hit & (1 << TRIGGER_START)) && !decoder->triggered) {
+      start_output();
+      output_printf("start trigger hit at cycle %d\n", decoder->total_cycles);
+   }
+   if ((hit & (1 << TRIGGER_STOP)) && decoder->triggered) {
+      decoder->triggered = 0;
+      output_printf("stop trigger hit at cycle %d\n", decoder->total_cycles);
+      // Nothing more will be shown, so unless something else needs the
+      // rest of the capture, there's no need to decode it
+      end = !trigger_has(decoder->trigger, TRIGGER_START) && arguments->trigger_start < 0 &&
+         !arguments->profile && !decoder->trace && !decoder->hook;
+   }
+   if ((hit & (1 << TRIGGER_PROFILE)) && !decoder->profiling) {
+      decoder->profiling = 1;
+      output_printf("profile trigger hit at cycle %d\n", decoder->total_cycles);
+   }
+   if (hit & (1 << TRIGGER_SNAPSHOT)) {
+      char buffer[256];
+      decoder->em->write_state(buffer, step->state);
+      output_printf("snapshot at cycle %d : %s\n", decoder->total_cycles, buffer);
+   }
+   if (hit & (1 << TRIGGER_END)) {
+      output_printf("end trigger hit at cycle %d\n", decoder->total_cycles);
+      end = 1;
+   }
+   if (end) {
+      // As the end of a window
+      decoder->decode_stop = window->sample_count[num_cycles];
+      atomic_store(&decoder->decode_done, 1);
+   }
+   return (hit & (1 << TRIGGER_FILTER)) != 0;
+}
+
+// The number of bus cycles to the next opcode fetch, found from the
+// boundary map rather than by looking at the type of each. Returns 0 if the
+// LAST marker comes first, or -1 if neither is within DEPTH bus cycles.
+static int next_opcode(const bus_window_t *window) {
+   int i = 0;
+   while ((i = bus_window_find(window, i + 1, DEPTH)) < DEPTH) {
+      sample_type_t type = bus_type(window->bus[i]);
+      if (type == OPCODE) {
+         return i;
+      }
+      if (type == LAST) {
+         return 0;
+      }
+      // Otherwise a reset cycle, which the instruction runs on over
+   }
+   return -1;
+}
+
+static int analyze_instruction(const bus_window_t *window, int num_samples, int rst_seen) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+
+   // This is before anything (e.g. count_cycles) updates the emulator state
+   if (instruction_boundary(window, rst_seen)) {
+      return num_samples;
+   }
+   decoder->num_instructions++;
+
+   // The emulator does everything up to producing the output in one call
+   step_t *step = &decoder->step;
+   step->before = (decoder->triggered && arguments->debug & 1) ? dump_samples : NULL;
+   step->next_opcode = next_opcode(window);
+   decoder->window = window;
+
+   // The triggers only see the memory accesses of this instruction
+   if (decoder->trigger) {
+      memory_clear_records();
+   }
+
+   int num_cycles = decoder->em->step(window->bus, num_samples, rst_seen, step);
+
+   // Deal with partial final instruction
+   if (num_cycles == 0) {
+      return num_samples;
+   }
+
+   int intr_seen = step->kind & STEP_INTERRUPT;
+   int oldpc = step->oldpc;
+   int oldpb = step->oldpb;
+
+   int real_cycles = window->cycle_count[num_cycles] - window->cycle_count[0];
+
+   // Sanity check the pc prediction has not gone awry
+   // (e.g. in JSR the emulation can use the stacked PC)
+
+   int opcode = decoder->instruction.opcode;
+   int pb = decoder->instruction.pb;
+   int pc = decoder->instruction.pc;
+
+   if (decoder->c816) {
+      if (pb >= 0) {
+         if (oldpb >= 0 && oldpb != pb) {
+            output_printf("pb: prediction failed at %02X old pb was %02X\n", pb, oldpb);
+         }
+      }
+   }
+
+   if (pc >= 0) {
+      if (oldpc >= 0 && oldpc != pc) {
+         output_printf("pc: prediction failed at %04X old pc was %04X\n", pc, oldpc);
+      }
+   }
+
+   if (pc >= 0 && pc == arguments->trigger_start) {
+      start_output();
+      output_printf("start trigger hit at cycle %d\n", decoder->total_cycles);
+   } else if (pc >= 0 && pc == arguments->trigger_stop) {
+      decoder->triggered = 0;
+      output_printf("stop trigger hit at cycle %d\n", decoder->total_cycles);
+   }
+
+   int filtered = decoder->trigger && !run_triggers(window, num_cycles, step);
+
+   // Exclude interrupts from profiling
+   if (arguments->trigger_skipint && pc >= 0) {
+      if (decoder->interrupt_depth == 0) {
+         decoder->skipping_interrupted = 0;
+      }
+      if (intr_seen) {
+         decoder->interrupt_depth++;
+         decoder->skipping_interrupted = 1;
+      } else if (decoder->interrupt_depth > 0 && opcode == 0x40) {
+         decoder->interrupt_depth--;
+      }
+   }
+
+   if (arguments->profile && decoder->triggered && decoder->profiling && !decoder->skipping_interrupted && !intr_seen) {
+      // TODO: refactor profiler to take instruction_t *
+      output_profile_instruction(decoder->instruction.pc, decoder->instruction.opcode, decoder->instruction.op1, decoder->instruction.op2, real_cycles);
+   }
+
+   int fail = step->fail;
+
+   if (decoder->segment) {
+      // Track how long the segment takes to reach full state lock
+      if (decoder->segment->instructions == 0) {
+         decoder->segment->first = window->sample_count[0];
+      }
+      decoder->segment->instructions++;
+      decoder->segment->fails += fail != 0;
+      if (!decoder->segment->lock) {
+         char state[256];
+         char *end = decoder->em->get_state(state);
+         if (!memchr(state, '?', end - state)) {
+            decoder->segment->lock = window->sample_count[0];
+            decoder->segment->lock_instructions = decoder->segment->instructions - 1;
+         }
+      }
+   }
+
+   int showable = (fail | arguments->show_something) && !filtered && !decoder->skipping_interrupted && !decoder->trace_lines;
+   int shown = showable && decoder->triggered;
+   // Before a trigger, the instruction is kept in case it's hit soon
+   int kept = showable && !decoder->triggered && decoder->history && decoder->window_started;
+   int traced = decoder->trace && decoder->window_started;
+
+   if (shown || kept || traced) {
+      trace_instr_t rec;
+      record_instruction(&rec, window, num_cycles, rst_seen, intr_seen, fail, real_cycles);
+      if (shown) {
+         show_line(&rec, step->state);
+         if (decoder->post_left && --decoder->post_left == 0) {
+            decoder->triggered = 0;
+         }
+      } else if (kept) {
+         history_add(decoder->history, &rec, step->state, step->num_state);
+      }
+      if (traced) {
+         trace_instruction(&rec, step->state);
+      }
+   }
+
+   if (decoder->hook) {
+      decoder->hook(decoder->hook_data, window, step, real_cycles);
+   }
+
+   decoder->total_cycles += real_cycles;
+   return num_cycles;
+}
+
+// ====================================================================
+// Generic instruction decoder
+// ====================================================================
+
+// This stage is mostly about cleaning coming out of reset in all cases
+//
+//        Rst Sync
+//
+// Case 1:  ?   ?  : search for heuristic at n, n+1, n+2 - consume n+2 cycles
+// Case 2:  ?  01  : search for heuristic at 5, 6, 7 - consume 7 ctcles
+// Case 3: 01   ?  : dead reconning; 8 or 9 depending on the cpu type
+// Case 4: 01  01  : mark first instruction after rst stable
+//
+
+static int decode_instruction(const bus_window_t *window, int num_samples) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   const bus_cycle_t *sample_q = window->bus;
+
+   // Anything from the boundary at the end of the segment onwards belongs
+   // to the next segment (the cycles are only queued as lookahead)
+   if (decoder->decode_stop && window->sample_count[0] >= decoder->decode_stop) {
+      return num_samples;
+   }
+
+   // Skip any samples where RST is asserted (active low)
+   if (bus_rst(sample_q[0]) == 0) {
+      decoder->rst_seen = 1;
+      return 1;
+   }
+
+   // If the first sample is not an SYNC, then drop the sample
+   if (bus_type(sample_q[0]) != OPCODE && bus_type(sample_q[0]) != UNKNOWN) {
+      return 1;
+   }
+
+   // Flag to indicate the sample type is missing (sync/vda/vpa unconnected)
+   int notype = bus_type(sample_q[0]) == UNKNOWN;
+
+   if (bus_rst(sample_q[0]) < 0) {
+      // We use a heuristic, based on what we expect to see on the data
+      // bus in cycles 5, 6 and 7, i.e. RSTVECL, RSTVECH, RSTOPCODE
+      int veclo  = (arguments->vec_rst      ) & 0xff;
+      int vechi  = (arguments->vec_rst >>  8) & 0xff;
+      int opcode = (arguments->vec_rst >> 16) & 0xff;
+      if (notype) {
+         // No Sync, so search for heurisic anywhere in the sample queue
+         for (int i = 0; i <= num_samples - 3; i++) {
+            if (bus_data(sample_q[i]) == veclo && bus_data(sample_q[i + 1]) == vechi && (!opcode || bus_data(sample_q[i + 2]) == opcode)) {
+               decoder->rst_seen = i + 2;
+               break;
+            }
+         }
+      } else {
+         // Sync, so check heurisic at a specific offset in the sample queue
+         if (bus_data(sample_q[5]) == veclo && bus_data(sample_q[6]) == vechi && (!opcode || bus_data(sample_q[7]) == opcode) && bus_type(sample_q[7]) == OPCODE) {
+            decoder->rst_seen = 7;
+         }
+      }
+   } else if (decoder->rst_seen) {
+      // First, make sure rst is stable
+      for (int i = 1; i < num_samples; i++) {
+         if (bus_rst(sample_q[i]) == 0) {
+            return i + 1;
+         }
+      }
+      if (notype) {
+         // Do this by dead reconning
+         decoder->rst_seen = cpu_rst_delay[arguments->cpu_type];
+         // We could also check the vector
+      } else {
+         if (bus_type(sample_q[7]) == OPCODE) {
+            decoder->rst_seen = 7;
+         } else {
+            output_printf("Instruction after rst /= 7 cycles\n");
+            decoder->rst_seen = 0;
+         }
+      }
+   }
+
+   // Decode the instruction
+   int num_cycles = analyze_instruction(window, num_samples, decoder->rst_seen);
+
+   // And reset rst_seen for the next reset
+   if (decoder->rst_seen) {
+      decoder->rst_seen = 0;
+   }
+
+   return num_cycles;
+}
+
+// ====================================================================
+// Decode batches of bus cycles through a window, so the decoders can lookahead
+// ====================================================================
+
+// Decode a batch of bus cycles (the last ending with the LAST marker)
+// through a window of DEPTH bus cycles that slides along it. The bus cycles
+// left in the window at the end are carried over to just in front of the
+// next batch (in its headroom), so the decoders always see them in place.
+//
+// So do the BEHIND bus cycles before them, as an emulator can look back at
+// those when an instruction is cut short (e.g. the operand of a
+// read-modify-write with too few cycles), which then doesn't depend on
+// where a batch ends.
+static void queue_samples(const bus_window_t *batch, int num) {
+   struct decoder_state *decoder = context->decoder;
+   int carried = decoder->num_carried;
+   bus_window_t window = bus_window_at(batch, -carried);
+   bus_window_t behind = bus_window_at(batch, -carried - BEHIND);
+   memcpy(behind.bus, decoder->carry_bus, (BEHIND + carried) * sizeof(bus_cycle_t));
+   memcpy(behind.sample_count, decoder->carry_sample_count, (BEHIND + carried) * sizeof(uint32_t));
+   memcpy(behind.cycle_count, decoder->carry_cycle_count, (BEHIND + carried) * sizeof(uint32_t));
+   for (int i = 0; i < carried; i++) {
+      bus_window_mark(&window, i);
+   }
+   int end = carried + num;
+   int last = num > 0 && bus_type(batch->bus[num - 1]) == LAST;
+   if (last) {
+      // To prevent edge condition, don't advertise the LAST marker
+      end--;
+   }
+
+   // This helped when clock noise affected Arlet's core
+   // (a better fix was to add 100pF cap to the clock)
+   //
+   // if (index > 0 && sample_q[index - 1].type == OPCODE && sample->type == OPCODE) {
+   //    printf("Skipping duplicate SYNC\n");
+   //    return;
+   // }
+
+   // Pass the window on to the decoder whenever it's full
+   int index = 0;
+   while (end - index >= DEPTH) {
+      bus_window_t at = bus_window_at(&window, index);
+      index += decode_instruction(&at, DEPTH);
+   }
+   if (last) {
+      // Drain the window when the LAST marker is seen
+      while (end - index > 1) {
+         bus_window_t at = bus_window_at(&window, index);
+         index += decode_instruction(&at, end - index);
+      }
+      if (decoder->fold) {
+         fold_flush(decoder->fold);
+      }
+   }
+   decoder->num_carried = end - index;
+   memcpy(decoder->carry_bus, window.bus + index - BEHIND, (BEHIND + decoder->num_carried) * sizeof(bus_cycle_t));
+   memcpy(decoder->carry_sample_count, window.sample_count + index - BEHIND, (BEHIND + decoder->num_carried) * sizeof(uint32_t));
+   memcpy(decoder->carry_cycle_count, window.cycle_count + index - BEHIND, (BEHIND + decoder->num_carried) * sizeof(uint32_t));
+}
+
+// ====================================================================
+// Segmented decode
+// ====================================================================
+
+// Number of samples to start extracting bus cycles from ahead of the
+// nominal start of a segment or window, so the extraction has settled by then
+#define EXTRACT_PREROLL 4096
+
+// Pass on the bus cycles of the segment, from its start boundary up to
+// its end boundary, plus enough lookahead to decode the final instruction.
+// The segment is split at a clean point (an opcode fetch or a reset cycle),
+// so only the boundaries need to be looked at, which are found from the
+// boundary map.
+static void segment_samples(const bus_window_t *batch, int num) {
+   struct decoder_state *decoder = context->decoder;
+   int last = num > 0 && bus_type(batch->bus[num - 1]) == LAST;
+   int n = num - last;
+   int first = 0;
+   int end = num;
+   int i = 0;
+   if (!decoder->segment_started) {
+      if (decoder->segment->start) {
+         i = bus_window_find(batch, 0, n);
+         while (i < n && batch->sample_count[i] <= decoder->segment->start) {
+            i = bus_window_find(batch, i + 1, n);
+         }
+         first = i;
+      }
+      decoder->segment_started = i < n;
+   }
+   while (decoder->segment_started && i < n) {
+      if (decoder->decode_stop) {
+         // The lookahead counts the bus cycles from the end boundary on
+         int stop = i + DEPTH - decoder->segment_lookahead;
+         if (stop < n) {
+            atomic_store(&decoder->decode_done, 1);
+            decoder->segment_lookahead = DEPTH + 1;
+            end = stop < i ? i : stop;
+         } else {
+            decoder->segment_lookahead += n - i;
+         }
+         break;
+      }
+      if (!decoder->segment->end) {
+         break;
+      }
+      i = bus_window_find(batch, i, n);
+      if (i < n && batch->sample_count[i] > decoder->segment->end) {
+         decoder->decode_stop = batch->sample_count[i];
+         decoder->segment_lookahead = 1;
+      }
+      i++;
+   }
+   if (end < num && last) {
+      // The LAST marker is always passed on
+      batch->bus[end] = batch->bus[num - 1];
+      batch->sample_count[end] = batch->sample_count[num - 1];
+      batch->cycle_count[end] = batch->cycle_count[num - 1];
+      bus_window_mark(batch, end);
+      end++;
+   }
+   bus_window_t from = bus_window_at(batch, first);
+   queue_samples(&from, end - first);
+}
+
+// ====================================================================
+// Windowed decode
+// ====================================================================
+
+// Pass on the bus cycles from the restored checkpoint onwards, with the
+// cycle count matching a decode from the start of the capture
+static void window_samples(const bus_window_t *batch, int num) {
+   struct decoder_state *decoder = context->decoder;
+   int first = 0;
+   if (!decoder->window_restored) {
+      while (first < num && bus_type(batch->bus[first]) != LAST && batch->sample_count[first] < decoder->restored->sample_count) {
+         first++;
+      }
+      if (first == num) {
+         return;
+      }
+      decoder->window_restored = 1;
+      decoder->window_cycle_offset = decoder->restored->cycle_count - batch->cycle_count[first];
+   }
+   for (int i = first; i < num; i++) {
+      batch->cycle_count[i] += decoder->window_cycle_offset;
+   }
+   bus_window_t from = bus_window_at(batch, first);
+   queue_samples(&from, num - first);
+}
+
+// ====================================================================
+// Structural scan
+// ====================================================================
+
+// Pass the bus cycles on to the scan, until the chunk is complete
+static void scan_consume(const bus_window_t *batch, int num) {
+   struct decoder_state *decoder = context->decoder;
+   if (scan_samples(decoder->scan, batch, num)) {
+      atomic_store(&decoder->decode_done, 1);
+   }
+}
+
+// Returns 1 if just a window of the capture is to be decoded
+static int is_window() {
+   arguments_t *arguments = &context->arguments;
+   return arguments->from_instr || arguments->to_instr != UINT64_MAX || arguments->from_cycle || arguments->to_cycle != UINT32_MAX;
+}
+
+// ====================================================================
+// Input file processing and bus cycle extraction
+// ====================================================================
+
+static int max(int a, int b) {
+   return (a > b) ? a : b;
+}
+
+static inline sample_type_t build_sample_type(uint16_t sample, int idx_vpa, int idx_vda, int idx_sync) {
+   struct decoder_state *decoder = context->decoder;
+   if (decoder->c816) {
+      if (idx_vpa < 0 || idx_vda < 0) {
+         return UNKNOWN;
+      } else if ((sample >> idx_vpa) & 1) {
+         if ((sample >> idx_vda) & 1) {
+            return OPCODE;
+         } else {
+            return PROGRAM;
+         }
+      } else {
+         if ((sample >> idx_vda) & 1) {
+            return DATA;
+         } else {
+            return INTERNAL;
+         }
+      }
+   } else {
+      if (idx_sync < 0) {
+         return UNKNOWN;
+      } else if ((sample >> idx_sync) & 1) {
+         return OPCODE;
+      } else {
+         return DATA;
+      }
+   }
+}
+
+// Pass on the first num bus cycles extracted to the window from
+// pipeline_room, saving them to the cache if required
+static void extract_commit(const bus_window_t *window, int num) {
+   struct decoder_state *decoder = context->decoder;
+   if (decoder->cache) {
+      cache_write(decoder->cache, window, num);
+   }
+   pipeline_commit(num);
+}
+
+// Pass an extracted bus cycle on, saving it to the cache if required
+static inline void extract_sample(sample_t *s) {
+   bus_window_t out;
+   pipeline_room(&out);
+   out.bus[0]          = bus_pack(s);
+   out.sample_count[0] = s->sample_count;
+   out.cycle_count[0]  = s->cycle_count;
+   extract_commit(&out, 1);
+}
+
+// The i'th sample of a block of unpacked samples, as a packed bus cycle
+static inline bus_cycle_t plane_cycle(const unpack_planes_t *planes, int i) {
+   return planes->data[i] | planes->type[i] << 8 | (planes->rnw[i] + 1) << 12 | (planes->rst[i] + 1) << 14 | (planes->e[i] + 1) << 16 | (planes->user[i] + 1) << 18;
+}
+
+// Start extracting bus cycles, from the given sample number
+//
+// capture may be NULL, in which case the blocks of samples are passed to
+// extract_block by the caller, rather than read from the pipeline
+static void extract_begin(capture_t *capture, uint32_t start) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   extract_t *x = &decoder->extract;
+
+   // Pin mappings into the 16 bit words
+   x->pins = (unpack_pins_t) {
+      .idx_data = arguments->idx_data,
+      .idx_rnw  = arguments->idx_rnw,
+      .idx_rst  = arguments->idx_rst,
+      .idx_e    = arguments->idx_e,
+      .idx_user = arguments->idx_user,
+      .idx_rdy  = arguments->idx_rdy,
+      .idx_sync = arguments->idx_sync,
+      .idx_vpa  = arguments->idx_vpa,
+      .idx_vda  = arguments->idx_vda,
+      // Invert RDY polarity on the 6800 to allow it to be driven from BA
+      .rdy_pol  = (arguments->cpu_type == CPU_6800) ? 0 : 1,
+      .c816     = decoder->c816
+   };
+
+   // Handle clock inversion of phi1 used rather than phi2
+   x->idx_phi = -1;
+   x->clk_pol = 0;
+   if (arguments->idx_phi1 >= 0) {
+      x->idx_phi = arguments->idx_phi1;
+      x->clk_pol = 1;
+   } else if (arguments->idx_phi2 >= 0) {
+      x->idx_phi = arguments->idx_phi2;
+   }
+
+   // Bus cycles previously extracted from the capture are read back from the cache
+   x->cached = decoder->cache && cache_hit(decoder->cache);
+   x->ended = 0;
+   if (x->cached) {
+      capture = NULL;
+   }
+
+   // Skip the start of the file, if required
+   if (capture && (arguments->skip || start)) {
+      capture_skip(capture, ((uint64_t) arguments->skip + start) * (arguments->byte ? 1 : 2));
+   }
+
+   // This thread is the extract stage; the others are started as requested
+   // (there's no reader stage when the bus cycles come from the cache)
+   // The instruction lines can be formatted on other threads, unless they
+   // read the memory model
+   output_format_t format = decoder->lines_need_memory ? NULL : format_line;
+   pipeline_start(capture, arguments->byte ? sizeof(uint8_t) : sizeof(uint16_t), arguments->threads, arguments->debug & 2, decoder->scan ? scan_consume : decoder->segment ? segment_samples : decoder->restored ? window_samples : queue_samples, format);
+
+   // Common to all sampling modes
+   sample_t *s = &x->s;
+   s->type = UNKNOWN;
+   s->sample_count = start + 1;
+   s->cycle_count = start + 1;
+   s->rnw  = -1;
+   s->rst  = -1;
+   s->e    = -1;
+   s->user = -1;
+
+   x->planes = NULL;
+   x->edges = NULL;
+   if (!arguments->byte) {
+      if (x->idx_phi < 0) {
+         x->planes = (unpack_planes_t *)malloc(sizeof(unpack_planes_t));
+      } else {
+         // The previous value of clke, to detect the rising/falling edge
+         x->last_phi2 = -1;
+         // The control signals are sampled at a fixed delay, so the data
+         // bus can be sampled early or late (--skew=) relative to them.
+         // This look-behind is satisfied by the capture history, which
+         // is zero at the start so the first few samples are ignored.
+         x->delay = max(0, max(arguments->skew_rd, arguments->skew_wr));
+         // Only the edges of phi need visiting, and they are found a block
+         // at a time using SIMD where available.
+         x->edges = (uint16_t *)malloc(UNPACK_BLOCK * sizeof(uint16_t));
+      }
+   }
+}
+
+// Extract the bus cycles from a block of len bytes of samples, which is
+// preceeded by at least CAPTURE_HISTORY bytes of the previous samples
+static void extract_block(const uint8_t *block, size_t len) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   extract_t *x = &decoder->extract;
+
+   // The structured bus sample we will pass on to the next level of processing
+   sample_t s = x->s;
+
+   if (arguments->byte) {
+
+      // ------------------------------------------------------------
+      // Synchronous byte sampling mode
+      // ------------------------------------------------------------
+
+      // In byte mode we have only data bus samples, nothing else so we must
+      // use the sync-less decoder. All the control signals should be marked
+      // as disconnected, by being set to -1.
+
+      // Queue structured sampled for the decoder
+      size_t num = len;
+      const uint8_t *sampleptr = block;
+      while (num-- > 0) {
+         s.data = *sampleptr++;
+         extract_sample(&s);
+         s.sample_count++;
+         s.cycle_count++;
+      }
+
+   } else if (x->idx_phi < 0) {
+
+      // ------------------------------------------------------------
+      // Synchronous word sampling mode
+      // ------------------------------------------------------------
+
+      // In word sampling mode we have data bus samples, plus
+      // optionally rnw, sync, rdy, phy2 and rst.
+
+      // In synchronous word sampling mode clke is not connected, and
+      // it's assumed that each sample represents a seperate bus
+      // cycle.
+
+      // Samples are unpacked a block at a time into separate planes
+      // (data, rnw, type, etc) using SIMD where available, and the
+      // cycles where RDY=0 (or BA=1 for 6800) are compacted out. The
+      // bus cycles are then packed from the planes straight into the
+      // batch for the decoder.
+      unpack_planes_t *planes = x->planes;
+      bus_window_t out;
+      int room = pipeline_room(&out);
+      int k = 0;
+
+      size_t num = len / sizeof(uint16_t);
+      const uint16_t *sampleptr = (const uint16_t *) block;
+      while (num > 0) {
+         int n = num < UNPACK_BLOCK ? num : UNPACK_BLOCK;
+         unpack_words(&x->pins, sampleptr, n, planes);
+         uint32_t base = s.sample_count;
+         for (int j = 0; j < planes->num; j++) {
+            if (k == room) {
+               extract_commit(&out, k);
+               room = pipeline_room(&out);
+               k = 0;
+            }
+            int i = planes->index[j];
+            out.bus[k]          = plane_cycle(planes, i);
+            out.sample_count[k] = base + i;
+            out.cycle_count[k]  = base + i;
+            k++;
+         }
+         s.sample_count = base + n;
+         s.cycle_count  = base + n;
+         sampleptr += n;
+         num -= n;
+      }
+      extract_commit(&out, k);
+
+   } else {
+
+      // ------------------------------------------------------------
+      // Asynchronous word sampling mode
+      // ------------------------------------------------------------
+
+      // In word sampling mode we have data bus samples, plus
+      // optionally rnw, sync, rdy, phy2 and rst.
+
+      // In asynchronous word sampling mode clke is connected, and
+      // the capture file contans multple samples per bus cycle.
+
+      int idx_data  = x->pins.idx_data;
+      int idx_rnw   = x->pins.idx_rnw;
+      int idx_sync  = x->pins.idx_sync;
+      int idx_rdy   = x->pins.idx_rdy;
+      int idx_user  = x->pins.idx_user;
+      int idx_rst   = x->pins.idx_rst;
+      int idx_vda   = x->pins.idx_vda;
+      int idx_vpa   = x->pins.idx_vpa;
+      int idx_e     = x->pins.idx_e;
+      int idx_phi   = x->idx_phi;
+      int clk_pol   = x->clk_pol;
+      int skew_rd   = arguments->skew_rd;
+      int skew_wr   = arguments->skew_wr;
+      int last_phi2 = x->last_phi2;
+      uint16_t *edges = x->edges;
+
+      // Queue structured sampled for the decoder
+      size_t num = len / sizeof(uint16_t);
+      const uint16_t *sampleptr = (const uint16_t *) block - x->delay;
+      while (num > 0) {
+         int n = num < UNPACK_BLOCK ? num : UNPACK_BLOCK;
+         int num_edges = unpack_edges(sampleptr, n, idx_phi, edges);
+         int j = 0;
+         if (last_phi2 < 0 && (num_edges == 0 || edges[0] != 0)) {
+            // The very first sample always counts as an edge
+            j = -1;
+         }
+         uint32_t base = s.sample_count;
+         for (; j < num_edges; j++) {
+            int i = j < 0 ? 0 : edges[j];
+            uint16_t sample = sampleptr[i];
+            int pin_phi2 = clk_pol ^ ((sample >> idx_phi) & 1);
+            last_phi2 = pin_phi2;
+            if (pin_phi2) {
+               // Sample control signals after rising edge of PHI2
+               // Note: this is a change for the 65816, but should be fine timing wise
+               s.type = build_sample_type(sample, idx_vpa, idx_vda, idx_sync);
+               if (idx_rnw >= 0) {
+                  s.rnw = (sample >> idx_rnw ) & 1;
+               }
+               if (idx_rst >= 0) {
+                  s.rst = (sample >> idx_rst) & 1;
+                  }
+               if (idx_e >= 0) {
+                  s.e = (sample >> idx_e) & 1;
+               }
+               if (idx_user >= 0) {
+                  s.user = (sample >> idx_user) & 1;
+               }
+            } else {
+               if (idx_rdy < 0 || ((sample >> idx_rdy) & 1)) {
+                  // Sample the data skewed (--skew=) relative to the falling edge of PHI2
+                  s.data = (sampleptr[i + (s.rnw == 0 ? skew_wr : skew_rd)] >> idx_data) & 255;
+                  s.sample_count = base + i;
+                  extract_sample(&s);
+               }
+               s.cycle_count++;
+            }
+         }
+         s.sample_count = base + n;
+         sampleptr += n;
+         num -= n;
+      }
+      x->last_phi2 = last_phi2;
+   }
+
+   x->s = s;
+}
+
+// Finish extracting bus cycles, waiting for the decode to complete
+static void extract_end() {
+   struct decoder_state *decoder = context->decoder;
+   extract_t *x = &decoder->extract;
+
+   // Flush the sample queue (unless the LAST bus cycle came from the cache)
+   x->s.type = LAST;
+   if (x->cached) {
+      if (!x->ended) {
+         pipeline_cycle(bus_pack(&x->s), x->s.sample_count, x->s.cycle_count);
+      }
+   } else {
+      extract_sample(&x->s);
+   }
+
+   pipeline_finish();
+
+   free(x->planes);
+   free(x->edges);
+   x->planes = NULL;
+   x->edges = NULL;
+}
+
+// Decode the capture, starting from the given sample number
+static void decode(capture_t *capture, uint32_t start) {
+   struct decoder_state *decoder = context->decoder;
+   extract_t *x = &decoder->extract;
+
+   extract_begin(capture, start);
+
+   if (x->cached) {
+
+      // ------------------------------------------------------------
+      // Cached bus cycles
+      // ------------------------------------------------------------
+
+      // The cache is read a block at a time straight into the batches, and
+      // ends with the LAST bus cycle (which is otherwise passed on below)
+      bus_window_t out;
+      int num;
+      while (!x->ended && !atomic_load(&decoder->decode_done) && (num = cache_read(decoder->cache, &out, pipeline_room(&out))) > 0) {
+         x->ended = bus_type(out.bus[num - 1]) == LAST;
+         x->s.sample_count = out.sample_count[num - 1];
+         x->s.cycle_count  = out.cycle_count[num - 1];
+         pipeline_commit(num);
+      }
+
+   } else {
+
+      // The current block of the capture file, walked in place where possible
+      const uint8_t *block;
+
+      // Read the capture file, and extract the bus cycles a block at a time
+      size_t num;
+      while (!atomic_load(&decoder->decode_done) && (num = pipeline_next_block(&block)) > 0) {
+         extract_block(block, num);
+      }
+
+   }
+
+   extract_end();
+}
+
+// Set up the decoder (the emulator, memory model, layouts, etc) from the
+// arguments, once they're complete; warn is cleared if the same arguments
+// have already been through here (for another context)
+static int setup_decoder(int warn) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   if (arguments->trigger_start < 0) {
+      decoder->triggered = 1;
+   }
+
+   decoder->c816 = 0;
+   if (arguments->cpu_type == CPU_65C816) {
+      decoder->c816 = 1;
+      decoder->em = &em_65816;
+   } else if (arguments->cpu_type == CPU_6800) {
+      decoder->em = &em_6800;
+   } else {
+      decoder->em = em_6502_variant(arguments->cpu_type);
+      if (!decoder->em) {
+         fprintf(stderr, "unsupported cpu type (%d)\n", arguments->cpu_type);
+         return 1;
+      }
+   }
+
+   // Compile the layouts of the instruction lines
+   if (decoder->layout) {
+      layout_destroy(decoder->layout);
+      layout_destroy(decoder->fail_layout);
+      decoder->layout = NULL;
+   }
+   if (arguments->format) {
+      decoder->layout = layout_create(decoder->em, arguments->format, decoder->c816, 0);
+      if (!decoder->layout) {
+         return 1;
+      }
+      decoder->fail_layout = layout_create(decoder->em, arguments->format, decoder->c816, 1);
+      if (!decoder->fail_layout) {
+         layout_destroy(decoder->layout);
+         decoder->layout = NULL;
+         return 1;
+      }
+   } else {
+      decoder->layout      = layout_create_default(decoder->em, arguments, decoder->c816, 0);
+      decoder->fail_layout = layout_create_default(decoder->em, arguments, decoder->c816, 1);
+   }
+   int uses = layout_uses(decoder->layout);
+   decoder->need_state = (uses & LAYOUT_STATE) != 0;
+   decoder->lines_need_memory = (uses & (LAYOUT_ROMNO | LAYOUT_FWA)) != 0;
+
+   if (decoder->fold) {
+      fold_destroy(decoder->fold);
+      decoder->fold = NULL;
+   }
+   if (arguments->fold) {
+      // The lines held back would show the memory model as it is later on
+      if (decoder->lines_need_memory) {
+         if (warn) {
+            fprintf(stderr, "--fold is ignored with --showromno or --bbcfwa\n");
+         }
+      } else {
+         decoder->fold = fold_create(decoder->em, arguments->fold, show_instruction);
+         // The summary shows the registers on leaving the loop
+         decoder->need_state = 1;
+      }
+   }
+
+   int memory_size;
+   // Initialize memory modelling
+   // (em->init actually mallocs the memory)
+   if (arguments->cpu_type == CPU_65C816) {
+      // 16MB
+      memory_size = 0x1000000;
+   } else {
+      // 64KB
+      memory_size = 0x10000;
+   }
+
+   memory_init(memory_size, arguments->machine, arguments->machine_file, arguments->bbctube);
+
+   // Turn on memory write logging if show rom bank option (-r) is selected
+   if (uses & LAYOUT_ROMNO) {
+      arguments->mem_model |= (1 << MEM_DATA) | (1 << MEM_STACK);
+   }
+
+   memory_set_modelling(  arguments->mem_model       & 0x0f);
+   memory_set_rd_logging((arguments->mem_model >> 4) & 0x0f);
+   memory_set_wr_logging((arguments->mem_model >> 8) & 0x0f);
+
+   // Load the swift format symbol file
+   if (arguments->labels_file) {
+      symbol_init(memory_size);
+      symbol_import_swift(arguments->labels_file);
+   }
+
+   // Compile the triggers (after the labels, which they can name)
+   if (decoder->trigger) {
+      trigger_destroy(decoder->trigger);
+      decoder->trigger = NULL;
+   }
+   decoder->profiling = 1;
+   if (arguments->num_on || arguments->filter) {
+      decoder->trigger = trigger_create(decoder->em);
+      for (int i = 0; i < arguments->num_on; i++) {
+         if (trigger_add(decoder->trigger, arguments->on[i])) {
+            return 1;
+         }
+      }
+      if (arguments->filter && trigger_set_filter(decoder->trigger, arguments->filter)) {
+         return 1;
+      }
+      // Nothing is output (or profiled) until started by a trigger
+      if (trigger_has(decoder->trigger, TRIGGER_START)) {
+         decoder->triggered = 0;
+      }
+      if (trigger_has(decoder->trigger, TRIGGER_PROFILE)) {
+         decoder->profiling = 0;
+      }
+      memory_set_recording(trigger_uses_memory(decoder->trigger));
+   }
+
+   if (decoder->history) {
+      history_destroy(decoder->history);
+      decoder->history = NULL;
+   }
+   if (arguments->pre_trigger) {
+      if (arguments->trigger_start < 0 && !(decoder->trigger && trigger_has(decoder->trigger, TRIGGER_START))) {
+         if (warn) {
+            fprintf(stderr, "--pre_trigger is ignored without a start trigger\n");
+         }
+      } else if (decoder->lines_need_memory) {
+         // The lines would show the memory model as it is later on
+         if (warn) {
+            fprintf(stderr, "--pre_trigger is ignored with --showromno or --bbcfwa\n");
+         }
+      } else {
+         decoder->history = history_create(arguments->pre_trigger);
+      }
+   }
+
+   decoder->em->init(arguments);
+   disasm_init(decoder->em);
+
+   if (arguments->profile) {
+      profiler_init(decoder->em);
+   }
+   return 0;
+}
+
+// Create the context for a segment decoded on a thread of its own,
+// configured as the caller's
+static context_t *segment_context(const arguments_t *args) {
+   context = context_create();
+   context->arguments = *args;
+   if (setup_decoder(0)) {
+      context_destroy(context);
+      return NULL;
+   }
+   return context;
+}
+
+static void decode_segment(segment_t *this) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   decoder->segment = this;
+   // Each segment has its own view of the capture
+   capture_t *capture = capture_open(arguments->filename, arguments->split);
+   if (!capture) {
+      this->status = 1;
+      return;
+   }
+   decode(capture, this->start > EXTRACT_PREROLL ? this->start - EXTRACT_PREROLL : 0);
+   capture_close(capture);
+}
+
+// Returns the number of segments that failed (or -1 if not possible)
+static int decode_segmented(capture_t *capture) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   uint32_t bounds[MAX_SEGMENTS] = { 0 };
+   int num = 1;
+   if (arguments->byte || (decoder->c816 ? (arguments->idx_vpa < 0 || arguments->idx_vda < 0) : arguments->idx_sync < 0)) {
+      fprintf(stderr, "segmented decode needs sync (or vpa/vda) to be connected\n");
+      return -1;
+   }
+   if (arguments->trigger_start != UNSPECIFIED || arguments->trigger_stop != UNSPECIFIED) {
+      fprintf(stderr, "segmented decode is incompatible with --trigger\n");
+      return -1;
+   }
+   if (decoder->trigger) {
+      fprintf(stderr, "segmented decode is incompatible with --on and --filter\n");
+      return -1;
+   }
+   if (is_window()) {
+      fprintf(stderr, "segmented decode is incompatible with decoding a window\n");
+      return -1;
+   }
+   if (!capture_is_mapped(capture)) {
+      fprintf(stderr, "segmented decode needs a capture file that can be mapped\n");
+      return -1;
+   }
+   if (arguments->segment_at) {
+      // Explicit split points, which must be non-zero and ascending
+      char *p = arguments->segment_at;
+      while (*p && num < MAX_SEGMENTS) {
+         bounds[num] = strtoul(p, &p, 16);
+         if (bounds[num] <= bounds[num - 1]) {
+            fprintf(stderr, "--segment_at sample numbers must be ascending\n");
+            return -1;
+         }
+         num++;
+         if (*p == ',') {
+            p++;
+         }
+      }
+   } else {
+      // Evenly spaced split points
+      uint64_t total = capture_size(capture) / (arguments->byte ? 1 : 2);
+      total = total > (uint64_t) arguments->skip ? total - arguments->skip : 0;
+      for (num = 1; num < arguments->segments; num++) {
+         bounds[num] = (total * num) / arguments->segments;
+      }
+   }
+   segment_t *segments = segment_create(num);
+   for (int i = 0; i < num; i++) {
+      segments[i].start = i > 0 ? bounds[i] : 0;
+      segments[i].end   = i < num - 1 ? bounds[i + 1] : 0;
+   }
+   // Each segment is decoded sequentially (on its own thread)
+   arguments->threads = 1;
+   int failed = segment_run(segments, num, segment_context, decode_segment);
+   segment_report(segments, num);
+   segment_destroy(segments);
+   return failed;
+}
+
+// Build the key for the cache or index, from everything that affects the
+// bus cycles extracted, plus optionally everything that affects emulation
+static void build_key(cache_key_t *key, int emulation) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   memset(key, 0, sizeof(*key));
+   int32_t *opt = key->options;
+   *opt++ = arguments->byte;
+   *opt++ = arguments->skip;
+   *opt++ = arguments->split;
+   *opt++ = arguments->idx_data;
+   *opt++ = arguments->idx_rnw;
+   *opt++ = arguments->idx_sync;
+   *opt++ = arguments->idx_rdy;
+   *opt++ = arguments->idx_phi1;
+   *opt++ = arguments->idx_phi2;
+   *opt++ = arguments->idx_user;
+   *opt++ = arguments->idx_rst;
+   *opt++ = arguments->idx_vda;
+   *opt++ = arguments->idx_vpa;
+   *opt++ = arguments->idx_e;
+   *opt++ = arguments->skew_rd;
+   *opt++ = arguments->skew_wr;
+   *opt++ = decoder->c816;
+   *opt++ = arguments->cpu_type == CPU_6800; // RDY polarity
+   if (emulation) {
+      *opt++ = arguments->cpu_type;
+      *opt++ = arguments->machine;
+      *opt++ = arguments->machine_file ? memmap_file_hash(arguments->machine_file) : 0;
+      *opt++ = arguments->vec_rst;
+      *opt++ = arguments->mem_model;
+      *opt++ = arguments->undocumented;
+      *opt++ = arguments->e_flag;
+      *opt++ = arguments->ms_flag;
+      *opt++ = arguments->xs_flag;
+      *opt++ = arguments->sp_reg;
+      *opt++ = arguments->pb_reg;
+      *opt++ = arguments->db_reg;
+      *opt++ = arguments->dp_reg;
+      *opt++ = arguments->trigger_start;
+      *opt++ = arguments->trigger_stop;
+      *opt++ = arguments->trigger_skipint;
+      *opt++ = arguments->bbctube;
+   }
+}
+
+// Returns the file to use for the cache or index (to be freed), or NULL
+static char *sidecar_filename(char *filename, const char *suffix) {
+   arguments_t *arguments = &context->arguments;
+   if (filename && *filename) {
+      return strdup(filename);
+   }
+   if (!arguments->filename) {
+      return NULL;
+   }
+   char *name = (char *)malloc(strlen(arguments->filename) + strlen(suffix) + 1);
+   sprintf(name, "%s%s", arguments->filename, suffix);
+   return name;
+}
+
+// Open the bus cycle cache
+static cache_t *open_cache(capture_t *capture) {
+   arguments_t *arguments = &context->arguments;
+   char *filename = sidecar_filename(arguments->cache_file, ".cycles");
+   if (!filename) {
+      return NULL;
+   }
+   cache_key_t key;
+   build_key(&key, 0);
+   cache_t *c = cache_open(filename, arguments->filename, capture_size(capture), &key);
+   free(filename);
+   return c;
+}
+
+// Open the index of checkpoints, creating it if required (and possible)
+static index_t *open_index(capture_t *capture, int create) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   char *filename = sidecar_filename(arguments->index_file, ".index");
+   cache_key_t key;
+   build_key(&key, 1);
+   if (!filename || cache_fingerprint(arguments->filename, capture_size(capture), &key)) {
+      free(filename);
+      return NULL;
+   }
+   index_t *index = index_open(filename, &key);
+   if (!index && create) {
+      index = index_create(filename, &key, arguments->index_interval);
+      if (index) {
+         decoder->next_checkpoint = 0;
+      }
+   }
+   free(filename);
+   return index;
+}
+
+// Decode a window of the capture, from the nearest checkpoint if indexed
+static void decode_window(capture_t *capture) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   uint32_t start = 0;
+   if (decoder->checkpoints) {
+      int state[INDEX_MAX_STATE];
+      int num_state;
+      decoder->restored = index_restore(decoder->checkpoints, arguments->from_instr, arguments->from_cycle, state, &num_state);
+      if (decoder->restored) {
+         restore_decoder_state(state);
+         decoder->num_instructions = decoder->restored->instruction;
+         // Sample numbers count from one
+         start = decoder->restored->sample_count - 1;
+         start = start > EXTRACT_PREROLL ? start - EXTRACT_PREROLL : 0;
+      }
+   }
+   // Nothing is output until the start of the window is reached
+   decoder->window_started = 0;
+   output_suppress(1);
+   decode(capture, start);
+   output_suppress(0);
+}
+
+// Each chunk of a scan is extracted by its own thread, in its own context
+typedef struct {
+   const arguments_t *args;
+   int                c816;
+   scan_t            *scan;
+   uint32_t           start;
+   int                failed;
+} scan_chunk_t;
+
+static void *scan_chunk(void *arg) {
+   scan_chunk_t *chunk = (scan_chunk_t *)arg;
+   context = context_create();
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   *arguments = *chunk->args;
+   arguments->threads = 1;
+   decoder->c816 = chunk->c816;
+   decoder->scan = chunk->scan;
+   capture_t *capture = capture_open(arguments->filename, arguments->split);
+   if (capture) {
+      decode(capture, chunk->start > EXTRACT_PREROLL ? chunk->start - EXTRACT_PREROLL : 0);
+      capture_close(capture);
+   } else {
+      chunk->failed = 1;
+   }
+   context_destroy(context);
+   return NULL;
+}
+
+// Returns -1 if the scan isn't possible
+static int decode_scan(capture_t *capture) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   if (arguments->byte || (decoder->c816 ? (arguments->idx_vpa < 0 || arguments->idx_vda < 0) : arguments->idx_sync < 0)) {
+      fprintf(stderr, "--scan needs sync (or vpa/vda) to be connected\n");
+      return -1;
+   }
+   if (arguments->cpu_type == CPU_6800) {
+      fprintf(stderr, "--scan is not supported on the 6800\n");
+      return -1;
+   }
+   int lengths[256];
+   for (int i = 0; i < 256; i++) {
+      lengths[i] = decoder->em->get_length(i);
+   }
+   int num = capture_is_mapped(capture) ? arguments->threads : 1;
+   scan_chunk_t chunks[PIPELINE_MAX_THREADS];
+   scan_t *scans[PIPELINE_MAX_THREADS] = { NULL };
+   if (num == 1) {
+      // Scanned by this thread (through the pipeline, if requested)
+      scans[0] = scan_create(arguments->cpu_type, lengths, 0, 0);
+      decoder->scan = scans[0];
+      decode(capture, 0);
+      decoder->scan = NULL;
+   } else {
+      // Evenly spaced chunks, each extracted sequentially
+      uint64_t total = capture_size(capture) / 2;
+      total = total > (uint64_t) arguments->skip ? total - arguments->skip : 0;
+      pthread_t threads[PIPELINE_MAX_THREADS];
+      for (int i = 0; i < num; i++) {
+         uint32_t start = (total * i) / num;
+         uint32_t end = i < num - 1 ? (total * (i + 1)) / num : 0;
+         scans[i] = scan_create(arguments->cpu_type, lengths, start, end);
+         chunks[i].args = arguments;
+         chunks[i].c816 = decoder->c816;
+         chunks[i].scan = scans[i];
+         chunks[i].start = start;
+         chunks[i].failed = 0;
+         pthread_create(&threads[i], NULL, scan_chunk, &chunks[i]);
+      }
+      int failed = 0;
+      for (int i = 0; i < num; i++) {
+         pthread_join(threads[i], NULL);
+         failed |= chunks[i].failed;
+      }
+      for (int i = 1; i < num; i++) {
+         scan_merge(scans[0], scans[i]);
+         scan_destroy(scans[i]);
+      }
+      if (failed) {
+         perror("failed to open capture file");
+         scan_destroy(scans[0]);
+         return -1;
+      }
+   }
+   scan_report(scans[0]);
+   scan_destroy(scans[0]);
+   return 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+// The documentation is built once, as it's shared by all contexts
+static pthread_once_t doc_once = PTHREAD_ONCE_INIT;
+
+static struct argp argp;
+
+static void build_doc() {
+   int i;
+   char name[100];
+   int type;
+   char *extended_doc;
+
+   // Build documentation for supported machine types
+   strcat(machines_doc, "Supported machine types:\n");
+   i = 0;
+   while (machine_names[i]) {
+      strcat(machines_doc,  "    ");
+      strcat(machines_doc,  machine_names[i]);
+      strcat(machines_doc,  "\n");
+      i++;
+   }
+
+   // Build documentation for supported CPU types
+   strcat(cpus_doc, "Supported CPU types:");
+   i = 0;
+   type = -1;
+   while (cpu_names[i].cpu_name) {
+      sprintf(name, "%-10s", cpu_names[i].cpu_name);
+      if (((int)cpu_names[i].cpu_type) != type) {
+         // Start a new type line
+         type = cpu_names[i].cpu_type;
+         strcat(cpus_doc,  "\n    ");
+         strcat(cpus_doc,  name);
+         strcat(cpus_doc,  "aliases:");
+      } else {
+         strcat(cpus_doc,  " ");
+         strcat(cpus_doc,  cpu_names[i].cpu_name);
+      }
+      i++;
+   }
+   strcat(cpus_doc,  "\n");
+
+   // Merge all documentation into a single string
+   extended_doc = (char *)malloc(strlen(doc) + strlen(cpus_doc) + strlen(cpus_doc) + 100);
+   strcpy(extended_doc, doc);
+   strcat(extended_doc, machines_doc);
+   strcat(extended_doc,  "\n");
+   strcat(extended_doc, cpus_doc);
+
+   argp.options = options;
+   argp.parser = parse_opt;
+   argp.args_doc = args_doc;
+   argp.doc = extended_doc;
+}
+
+void decoder_create() {
+   struct decoder_state *decoder = (struct decoder_state *)calloc(1, sizeof(struct decoder_state));
+   arguments_t *arguments = &context->arguments;
+   context->decoder = decoder;
+   decoder->step.instruction = &decoder->instruction;
+   decoder->window_started = 1;
+   decoder->next_checkpoint = UINT64_MAX;
+   atomic_init(&decoder->decode_done, 0);
+
+   // General options
+   arguments->cpu_type         = CPU_UNKNOWN;
+   arguments->machine          = MACHINE_DEFAULT;
+   arguments->machine_file     = NULL;
+   arguments->vec_rst          = UNSPECIFIED;
+   arguments->sp_reg           = UNSPECIFIED;
+   arguments->bbctube          = 0;
+   arguments->byte             = 0;
+   arguments->debug            = 0;
+   arguments->mem_model        = 0;
+   arguments->skip             = 0;
+   arguments->split            = 0;
+   arguments->threads          = 1;
+   arguments->segments         = 1;
+   arguments->segment_at       = NULL;
+   arguments->scan             = 0;
+   arguments->cache            = 0;
+   arguments->cache_file       = NULL;
+   arguments->index            = 0;
+   arguments->index_file       = NULL;
+   arguments->index_interval   = 10000;
+   arguments->from_instr       = 0;
+   arguments->to_instr         = UINT64_MAX;
+   arguments->fanout_file      = NULL;
+   arguments->trace_file       = NULL;
+   arguments->output_file      = NULL;
+   arguments->from_cycle       = 0;
+   arguments->to_cycle         = UINT32_MAX;
+   arguments->skew_rd          = UNSPECIFIED;
+   arguments->skew_wr          = UNSPECIFIED;
+   arguments->profile          = 0;
+   arguments->trigger_start    = UNSPECIFIED;
+   arguments->trigger_stop     = UNSPECIFIED;
+   arguments->trigger_skipint  = 0;
+   arguments->num_on           = 0;
+   arguments->filter           = NULL;
+   arguments->pre_trigger      = 0;
+   arguments->post_trigger     = 0;
+   arguments->filename         = NULL;
+
+   // Output options
+   arguments->show_address     = 1;
+   arguments->show_hex         = 0;
+   arguments->show_instruction = 1;
+   arguments->show_state       = 0;
+   arguments->show_bbcfwa      = 0;
+   arguments->show_cycles      = 0;
+   arguments->show_samplenums  = 0;
+   arguments->format           = NULL;
+   arguments->fold             = 0;
+
+   // Signal definition options
+   arguments->idx_data         = UNSPECIFIED;
+   arguments->idx_rnw          = UNSPECIFIED;
+   arguments->idx_sync         = UNSPECIFIED;
+   arguments->idx_vpa          = UNSPECIFIED;
+   arguments->idx_rdy          = UNSPECIFIED;
+   arguments->idx_vda          = UNSPECIFIED;
+   arguments->idx_e            = UNSPECIFIED;
+   arguments->idx_rst          = UNSPECIFIED;
+   arguments->idx_phi1         = UNSPECIFIED;
+   arguments->idx_phi2         = UNSPECIFIED;
+   arguments->idx_user         = UNSPECIFIED;
+
+   // Additional 6502 options
+   arguments->undocumented     = 0;
+
+   // Additional 65816 options
+   arguments->pb_reg           = UNSPECIFIED;
+   arguments->db_reg           = UNSPECIFIED;
+   arguments->dp_reg           = UNSPECIFIED;
+   arguments->e_flag           = UNSPECIFIED;
+   arguments->ms_flag          = UNSPECIFIED;
+   arguments->xs_flag          = UNSPECIFIED;
+}
+
+void decoder_destroy() {
+   struct decoder_state *decoder = context->decoder;
+   if (decoder->layout) {
+      layout_destroy(decoder->layout);
+      layout_destroy(decoder->fail_layout);
+   }
+   if (decoder->fold) {
+      fold_destroy(decoder->fold);
+   }
+   if (decoder->trigger) {
+      trigger_destroy(decoder->trigger);
+   }
+   if (decoder->history) {
+      history_destroy(decoder->history);
+   }
+   free(decoder);
+   context->decoder = NULL;
+}
+
+void decoder_set_hook(decoder_hook_t hook, void *data) {
+   struct decoder_state *decoder = context->decoder;
+   decoder->hook = hook;
+   decoder->hook_data = data;
+}
+
+int decoder_check_fed() {
+   arguments_t *arguments = &context->arguments;
+   if (arguments->split) {
+      fprintf(stderr, "--split can only be used when decoding a capture file\n");
+      return 1;
+   }
+   if (arguments->segments > 1 || arguments->segment_at) {
+      fprintf(stderr, "--segments and --segment_at can only be used when decoding a capture file\n");
+      return 1;
+   }
+   if (arguments->cache || arguments->index) {
+      fprintf(stderr, "--cache and --index can only be used when decoding a capture file\n");
+      return 1;
+   }
+   if (arguments->scan) {
+      fprintf(stderr, "--scan can only be used when decoding a capture file\n");
+      return 1;
+   }
+   if (is_window()) {
+      fprintf(stderr, "windows can only be used when decoding a capture file\n");
+      return 1;
+   }
+   if (arguments->trace_file) {
+      fprintf(stderr, "--trace_out can only be used when decoding a capture file\n");
+      return 1;
+   }
+   // Everything is done on the calling thread
+   arguments->threads = 1;
+   return 0;
+}
+
+cpu_emulator_t *decoder_emulator() {
+   struct decoder_state *decoder = context->decoder;
+   return decoder->em;
+}
+
+int decoder_configure(int argc, char *argv[], unsigned flags) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+
+   pthread_once(&doc_once, build_doc);
+
+   if (argp_parse(&argp, argc, argv, flags, 0, arguments) || decoder->parse_failed) {
+      return 1;
+   }
+   decoder->argc = argc;
+   decoder->argv = argv;
+
+   if (arguments->trace_file) {
+      if (arguments->segments > 1 || arguments->segment_at) {
+         fprintf(stderr, "--trace_out can't be used with a segmented decode\n");
+         return 1;
+      }
+      // The output stage would take the output away from the trace
+      if (arguments->threads > 3) {
+         arguments->threads = 3;
+      }
+   }
+
+   arguments->show_something = arguments->show_samplenums | arguments->show_address | arguments->show_hex | arguments->show_instruction | arguments->show_state | arguments->show_bbcfwa | arguments->show_cycles | (arguments->format != NULL);
+
+   // Normally the data file should be 16 bit samples. In byte mode
+   // the data file is 8 bit samples, and all the control signals are
+   // assumed to be don't care.
+   if (arguments->byte) {
+      if (arguments->idx_rnw != UNSPECIFIED) {
+         fprintf(stderr, "--rnw is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_sync != UNSPECIFIED) {
+         fprintf(stderr, "--sync is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_phi1 != UNSPECIFIED) {
+         fprintf(stderr, "--phi1 is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_phi2 != UNSPECIFIED) {
+         fprintf(stderr, "--phi2 is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_rst != UNSPECIFIED) {
+         fprintf(stderr, "--rst is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_rdy != UNSPECIFIED) {
+         fprintf(stderr, "--rdy is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_vpa != UNSPECIFIED) {
+         fprintf(stderr, "--vpa is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_vda != UNSPECIFIED) {
+         fprintf(stderr, "--vda is incompatible with byte mode\n");
+         return 1;
+      }
+      if (arguments->idx_e != UNSPECIFIED) {
+         fprintf(stderr, "--e is incompatible with byte mode\n");
+         return 1;
+      }
+   }
+
+   // Apply Machine specific defaults
+   if (arguments->vec_rst == UNSPECIFIED) {
+      switch (arguments->machine) {
+      case MACHINE_BEEB:
+         arguments->vec_rst = 0xA9D9CD;
+         break;
+      case MACHINE_MASTER:
+         arguments->vec_rst = 0xA9E364;
+         break;
+      case MACHINE_ELK:
+         arguments->vec_rst = 0xA9D8D2;
+         break;
+      case MACHINE_ATOM:
+         arguments->vec_rst = 0xA2FF3F;
+         break;
+      case MACHINE_MEK6800D2:
+         arguments->vec_rst = 0x8E8DE0;
+         break;
+      default:
+         arguments->vec_rst = 0xFFFFFF;
+      }
+   }
+   if (arguments->cpu_type == CPU_UNKNOWN) {
+      switch (arguments->machine) {
+      case MACHINE_MASTER:
+         arguments->cpu_type = CPU_65C02;
+         break;
+      case MACHINE_MEK6800D2:
+         arguments->cpu_type = CPU_6800;
+         break;
+      default:
+         arguments->cpu_type = CPU_6502;
+         break;
+      }
+   }
+
+   // Validate options compatibility with CPU
+   if (arguments->cpu_type != CPU_6502 && arguments->cpu_type != CPU_6800 && arguments->undocumented) {
+      fprintf(stderr, "--undocumented is only applicable to the 6502/6800\n");
+      return 1;
+   }
+   if (arguments->cpu_type == CPU_65C816) {
+      if (arguments->idx_sync != UNSPECIFIED) {
+         fprintf(stderr, "--sync is not applicable to the 65C816\n");
+         return 1;
+      }
+   } else {
+      if (arguments->idx_vda != UNSPECIFIED) {
+         fprintf(stderr, "--vda is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->idx_vpa != UNSPECIFIED) {
+         fprintf(stderr, "--vpa is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->idx_e != UNSPECIFIED) {
+         fprintf(stderr, "--e is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->pb_reg != UNSPECIFIED) {
+         fprintf(stderr, "--pb is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->db_reg != UNSPECIFIED) {
+         fprintf(stderr, "--db is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->dp_reg != UNSPECIFIED) {
+         fprintf(stderr, "--dp is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->e_flag != UNSPECIFIED) {
+         fprintf(stderr, "--emul is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->ms_flag != UNSPECIFIED) {
+         fprintf(stderr, "--ms is only applicable to the 65C816\n");
+         return 1;
+      }
+      if (arguments->xs_flag != UNSPECIFIED) {
+         fprintf(stderr, "--xs is only applicable to the 65C816\n");
+         return 1;
+      }
+   }
+
+   // Implement default pins mapping for unspecified pins
+   if (arguments->idx_data == UNSPECIFIED) {
+      arguments->idx_data = 0;
+   }
+   if (arguments->idx_rnw == UNSPECIFIED) {
+      arguments->idx_rnw = 8;
+   }
+   if (arguments->idx_sync == UNSPECIFIED) {
+      arguments->idx_sync = 9;
+   }
+   if (arguments->idx_vpa == UNSPECIFIED) {
+      arguments->idx_vpa = 9;
+   }
+   if (arguments->idx_rdy == UNSPECIFIED) {
+      arguments->idx_rdy = 10;
+   }
+   if (arguments->idx_vda == UNSPECIFIED) {
+      arguments->idx_vda = 11;
+   }
+   if (arguments->idx_e == UNSPECIFIED) {
+      arguments->idx_e = 12;
+   }
+   if (arguments->idx_rst == UNSPECIFIED) {
+      arguments->idx_rst = 14;
+   }
+   // Flag conflicting use of --phi1 and --phi2
+   if (arguments->idx_phi1 >= 0 && arguments->idx_phi2 >= 0) {
+      fprintf(stderr, "--phi1 and --phi2 cannot both be assigned to pins\n");
+      return 1;
+   }
+   // Only default phi2 if phi1 is not assigned to a pin
+   if (arguments->idx_phi2 == UNSPECIFIED && arguments->idx_phi1 < 0) {
+      arguments->idx_phi2 = 15;
+   }
+
+   if (arguments->skew_rd == UNSPECIFIED) {
+      switch (arguments->machine) {
+      case MACHINE_BEEB:
+         arguments->skew_rd =  0; // sample after Phi2 falls
+         break;
+      case MACHINE_MASTER:
+         arguments->skew_rd = -1; // sample before PHI2 fails
+         break;
+      default:
+         arguments->skew_rd = -1; // sample before PHI2 fails
+         break;
+      }
+   }
+   if (arguments->skew_wr == UNSPECIFIED) {
+      switch (arguments->machine) {
+      case MACHINE_BEEB:
+         arguments->skew_wr = -1; // sample before PHI2 fails
+         break;
+      case MACHINE_MASTER:
+         arguments->skew_wr = -2; // sample well before PHI2 fails
+         break;
+      default:
+         arguments->skew_wr = -1; // sample before PHI2 fails
+         break;
+      }
+   }
+
+   return setup_decoder(1);
+}
+
+int decoder_run() {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+
+   capture_t *capture = capture_open(arguments->filename, arguments->split);
+   if (capture == NULL) {
+      perror("failed to open capture file");
+      return 2;
+   }
+   if (output_open(arguments->output_file, arguments->threads > 1)) {
+      perror("failed to create output file");
+      capture_close(capture);
+      return 2;
+   }
+
+   int failed = 0;
+   int window = is_window();
+   if (arguments->scan) {
+      if (arguments->segments > 1 || arguments->segment_at || arguments->cache || arguments->index || window || arguments->trace_file || decoder->trigger || arguments->profile) {
+         fprintf(stderr, "--scan ignores segments, windows, --cache, --index, --trace_out, --on, --filter and --profile\n");
+         arguments->profile = 0;
+      }
+      failed = decode_scan(capture);
+   } else if (arguments->segments > 1 || arguments->segment_at) {
+      if (arguments->cache) {
+         fprintf(stderr, "--cache is ignored in a segmented decode\n");
+      }
+      if (arguments->index) {
+         fprintf(stderr, "--index is ignored in a segmented decode\n");
+      }
+      failed = decode_segmented(capture);
+   } else {
+      if (arguments->cache) {
+         if (window) {
+            fprintf(stderr, "--cache is ignored when decoding a window\n");
+         } else {
+            decoder->cache = open_cache(capture);
+            if (!decoder->cache) {
+               fprintf(stderr, "failed to open bus cycle cache, decoding without it\n");
+            }
+         }
+      }
+      if (arguments->index && decoder->trigger) {
+         // The state of the triggers isn't saved in the checkpoints
+         fprintf(stderr, "--index is ignored with --on or --filter\n");
+      } else if (arguments->index) {
+         // The index is only created by a decode of the whole capture
+         decoder->checkpoints = open_index(capture, !window);
+         if (!decoder->checkpoints) {
+            fprintf(stderr, window ? "no index for this capture, decoding from the start\n" : "failed to create index\n");
+         }
+      }
+      if (arguments->trace_file && open_trace()) {
+         perror("failed to create trace file");
+         capture_close(capture);
+         return 1;
+      }
+      if (window) {
+         decode_window(capture);
+      } else {
+         decode(capture, 0);
+      }
+      if (decoder->trace && close_trace()) {
+         fprintf(stderr, "failed to write trace file\n");
+         failed = -1;
+      }
+      if (decoder->cache) {
+         int hit = cache_hit(decoder->cache);
+         if (!hit && atomic_load(&decoder->decode_done)) {
+            // Ended by a trigger, so not all the bus cycles were extracted
+            cache_discard(decoder->cache);
+         } else if (cache_close(decoder->cache)) {
+            if (hit) {
+               // Not all the bus cycles were decoded, so the decode fails
+               // (and the next decode rebuilds the cache)
+               fprintf(stderr, "failed to read bus cycle cache, which has been removed\n");
+               failed = -1;
+            } else {
+               fprintf(stderr, "failed to write bus cycle cache\n");
+            }
+         }
+         decoder->cache = NULL;
+      }
+      if (decoder->checkpoints) {
+         if (index_close(decoder->checkpoints)) {
+            fprintf(stderr, "failed to read or write index\n");
+         }
+         decoder->checkpoints = NULL;
+      }
+   }
+   capture_close(capture);
+   if (failed < 0) {
+      return 1;
+   }
+
+   if (arguments->profile) {
+      profiler_done();
+   }
+
+   if (output_flush()) {
+      fprintf(stderr, "failed to write output\n");
+      return 1;
+   }
+
+   if (arguments->debug & 2) {
+      disasm_print_stats();
+      sink_print_stats(output_sink());
+   }
+
+   return failed ? 3 : 0;
+}
+
+int decoder_render(trace_t *trace) {
+   struct decoder_state *decoder = context->decoder;
+   arguments_t *arguments = &context->arguments;
+   if (arguments->scan) {
+      fprintf(stderr, "--scan can only be used when decoding a capture file\n");
+      trace_close(trace);
+      return 1;
+   }
+   if (decoder->trigger) {
+      fprintf(stderr, "--on and --filter can only be used when decoding a capture file\n");
+      trace_close(trace);
+      return 1;
+   }
+   if (output_open(arguments->output_file, arguments->threads > 1)) {
+      perror("failed to create output file");
+      trace_close(trace);
+      return 2;
+   }
+   int text_lines = trace_get_flags(trace) & TRACE_TEXT_LINES;
+   if (decoder->need_state && !(trace_get_flags(trace) & TRACE_ALL_STATE)) {
+      fprintf(stderr, "the registers were not recorded in the trace (without --state), so are shown as unknown\n");
+   }
+   int num_state = trace_get_num_state(trace);
+   int unknown[MAX_EM_STATE];
+   for (int i = 0; i < num_state; i++) {
+      unknown[i] = -1;
+   }
+   trace_instr_t rec;
+   int state[MAX_EM_STATE];
+   const char *text;
+   size_t len;
+   int type;
+   while ((type = trace_read(trace, &rec, state, &text, &len)) != 0) {
+      if (type == TRACE_TEXT) {
+         output_write(text, len);
+         continue;
+      } else if (type == TRACE_MEMORY) {
+         continue;
+      }
+      int intr_seen = rec.kind & STEP_INTERRUPT;
+      int fail      = rec.flags & TRACE_FAIL;
+      int shown     = (rec.flags & TRACE_TRIGGERED) && !(rec.flags & TRACE_SKIPPING);
+      // As analyze_instruction
+      if (arguments->profile && shown && !intr_seen) {
+         output_profile_instruction(rec.pc, rec.opcode, rec.op1, rec.op2, rec.real_cycles);
+      }
+      if ((fail | arguments->show_something) && shown && !text_lines) {
+         if (decoder->fold) {
+            fold_instruction(decoder->fold, &rec, (rec.flags & TRACE_STATE) ? state : unknown);
+         } else {
+            write_instruction(&rec, (rec.flags & TRACE_STATE) ? state : unknown);
+         }
+      }
+   }
+   if (decoder->fold) {
+      fold_flush(decoder->fold);
+   }
+   if (arguments->profile) {
+      profiler_done();
+   }
+   if (output_flush()) {
+      fprintf(stderr, "failed to write output\n");
+      trace_close(trace);
+      return 1;
+   }
+   if (arguments->debug & 2) {
+      disasm_print_stats();
+      sink_print_stats(output_sink());
+   }
+   if (trace_close(trace)) {
+      fprintf(stderr, "failed to read trace file\n");
+      return 1;
+   }
+   return 0;
+}
+
+void decoder_begin() {
+   extract_begin(NULL, 0);
+}
+
+void decoder_feed(const uint8_t *block, size_t len) {
+   extract_block(block, len);
+   pipeline_flush();
+}
+
+void decoder_end() {
+   extract_end();
+}
@@ -0,0 +1,62 @@
+#ifndef _INCLUDE_DECODER_H
+#define _INCLUDE_DECODER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "trace.h"
+
+// The decoder itself: option parsing, bus cycle extraction, and the
+// analysis of each instruction. All of these work on the current context
+// (see context.h).
+
+// Called after each instruction is decoded (and its output written),
+// with the bus cycles of the instruction
+typedef void (*decoder_hook_t)(void *data, const bus_window_t *window, step_t *step, int real_cycles);
+
+// Allocate (and free) the decoder state, with the options at their defaults
+void decoder_create();
+
+void decoder_destroy();
+
+// Parse the command line options (flags are passed on to argp_parse),
+// and initialize the emulator, memory model, etc to match
+//
+// Returns non-zero if the options are invalid, or the decoder can't be set
+// up for them (the error is written to stderr)
+int decoder_configure(int argc, char *argv[], unsigned flags);
+
+// Decode the capture file named in the options
+//
+// Returns the exit status of the command line tool
+int decoder_run();
+
+// Write out the text (and run the profilers) from a binary trace, as the
+// decode that wrote it would have, then close it
+//
+// Returns non-zero if the trace could not be read
+int decoder_render(trace_t *trace);
+
+void decoder_set_hook(decoder_hook_t hook, void *data);
+
+// The emulator selected by the options (valid once configured)
+cpu_emulator_t *decoder_emulator();
+
+// Check the options can be used when the samples are passed in by the
+// caller (see below), rather than read from the capture file
+//
+// Returns non-zero (with a message to stderr) if not
+int decoder_check_fed();
+
+// Decode samples that are passed in by the caller, rather than read from
+// a capture file, a block at a time. Each block must be a whole number
+// of samples, and preceeded by at least CAPTURE_HISTORY bytes of the
+// previous samples (zeros at the start).
+void decoder_begin();
+
+void decoder_feed(const uint8_t *block, size_t len);
+
+void decoder_end();
+
+#endif
@@ -29,6 +29,10 @@ typedef enum {
 // Sample Queue Depth - needs to fit the longest instruction
 #define DEPTH 13
 
+// How far back before the sample queue the emulators can look (when an
+// instruction has fewer cycles than expected)
+#define BEHIND 4
+
 // Sample_type_t is an abstraction of both the 6502 SYNC and the 65816 VDA/VPA
 
 typedef enum {     // 6502 Sync    65815 VDA/VPA
@@ -51,6 +55,95 @@ typedef struct {
    int8_t        user; // -1 indicates unknown (user defined signal)
 } sample_t;
 
+// A bus cycle as the decoder works on it, packed into 32 bits: the data
+// byte, the sample type, and the control signals, each of which is stored
+// plus one (so 0 indicates unknown). The counts are kept alongside in a
+// bus_window_t, as the emulators don't need them.
+typedef uint32_t bus_cycle_t;
+
+static inline bus_cycle_t bus_pack(const sample_t *sample) {
+   return sample->data | sample->type << 8 | (sample->rnw + 1) << 12 | (sample->rst + 1) << 14 | (sample->e + 1) << 16 | (sample->user + 1) << 18;
+}
+
+static inline int bus_data(bus_cycle_t bus) {
+   return bus & 0xff;
+}
+
+static inline sample_type_t bus_type(bus_cycle_t bus) {
+   return (sample_type_t) ((bus >> 8) & 7);
+}
+
+static inline int bus_rnw(bus_cycle_t bus) {
+   return (int) ((bus >> 12) & 3) - 1;
+}
+
+static inline int bus_rst(bus_cycle_t bus) {
+   return (int) ((bus >> 14) & 3) - 1;
+}
+
+static inline int bus_e(bus_cycle_t bus) {
+   return (int) ((bus >> 16) & 3) - 1;
+}
+
+static inline int bus_user(bus_cycle_t bus) {
+   return (int) ((bus >> 18) & 3) - 1;
+}
+
+// Replace the data byte and rnw (to reorder the bus cycles of a core)
+static inline bus_cycle_t bus_set_data_rnw(bus_cycle_t bus, bus_cycle_t from) {
+   return (bus & ~0x30ffu) | (from & 0x30ffu);
+}
+
+static inline bus_cycle_t bus_set_data(bus_cycle_t bus, bus_cycle_t from) {
+   return (bus & ~0xffu) | (from & 0xffu);
+}
+
+// The bus cycles the decoder has to stop at: the opcode fetches (when sync
+// or vpa/vda is connected), the reset cycles, and the LAST marker
+static inline int bus_is_boundary(bus_cycle_t bus) {
+   sample_type_t type = bus_type(bus);
+   return type == OPCODE || type == LAST || bus_rst(bus) == 0;
+}
+
+// A run of bus cycles, with the sample and cycle count of each alongside,
+// and a bitmap of which are boundaries (bus[0] is bit 'bit' of boundary[0])
+typedef struct {
+   bus_cycle_t *bus;
+   uint32_t    *sample_count;
+   uint32_t    *cycle_count;
+   uint64_t    *boundary;
+   int          bit;
+} bus_window_t;
+
+// The same run of bus cycles, from the i'th on
+static inline bus_window_t bus_window_at(const bus_window_t *window, int i) {
+   int pos = window->bit + i;
+   return (bus_window_t) { window->bus + i, window->sample_count + i, window->cycle_count + i, window->boundary + (pos >> 6), pos & 63 };
+}
+
+// Update the boundary bit of the i'th bus cycle, after it's been written
+static inline void bus_window_mark(const bus_window_t *window, int i) {
+   int pos = window->bit + i;
+   uint64_t mask = 1ull << (pos & 63);
+   uint64_t *word = window->boundary + (pos >> 6);
+   *word = (*word & ~mask) | (bus_is_boundary(window->bus[i]) ? mask : 0);
+}
+
+// The first boundary from the i'th bus cycle up to (but not including) the
+// end'th, or end if there isn't one
+static inline int bus_window_find(const bus_window_t *window, int i, int end) {
+   while (i < end) {
+      int pos = window->bit + i;
+      uint64_t word = window->boundary[pos >> 6] >> (pos & 63);
+      if (word) {
+         i += __builtin_ctzll(word);
+         return i < end ? i : end;
+      }
+      i += 64 - (pos & 63);
+   }
+   return end;
+}
+
 
 typedef struct {
    int           pc;
@@ -60,17 +153,23 @@ typedef struct {
    uint8_t       op2;
    uint8_t       op3;
    uint8_t       opcount;
+   int           ea;      // -1 indicates none (or unknown)
 } instruction_t;
 
 void write_hex1(char *buffer, int value);
 void write_hex2(char *buffer, int value);
 void write_hex4(char *buffer, int value);
 void write_hex6(char *buffer, int value);
+void write_hex8(char *buffer, int value);
 int  write_s   (char *buffer, const char *s);
 
+// The most --on options
+#define MAX_TRIGGER_RULES 16
+
 typedef struct {
    cpu_t cpu_type;
    machine_t machine;
+   char *machine_file;
    int idx_data;
    int idx_rnw;
    int idx_sync;
@@ -103,6 +202,25 @@ typedef struct {
    int byte;
    int debug;
    int skip;
+   int split;
+   int threads;
+   int segments;
+   char *segment_at;
+   int scan;
+   int cache;
+   char *cache_file;
+   int index;
+   char *index_file;
+   int index_interval;
+   char *fanout_file;
+   char *trace_file;
+   char *output_file;
+   char *format;
+   int fold;
+   uint64_t from_instr;
+   uint64_t to_instr;
+   uint32_t from_cycle;
+   uint32_t to_cycle;
    int skew_rd;
    int skew_wr;
    char *labels_file;
@@ -111,25 +229,60 @@ typedef struct {
    int trigger_start;
    int trigger_stop;
    int trigger_skipint;
+   char *on[MAX_TRIGGER_RULES];
+   int num_on;
+   char *filter;
+   int pre_trigger;
+   int post_trigger;
    char *filename;
    int show_romno;
 } arguments_t;
 
+// The most ints that save_state can write
+#define MAX_EM_STATE 32
+
+// Flags for the kind of instruction stepped
+#define STEP_INTERRUPT 1
+#define STEP_RESET     2
+
+// The complete record of one instruction, filled in by a single call to
+// the emulator's step function
+typedef struct {
+   instruction_t *instruction;         // updated in place (fields carry over)
+   void         (*before)(int num_cycles); // optional, called before emulating
+   int            next_opcode;         // set by the caller: cycles to the next opcode fetch (0 if
+                                       // LAST is first, -1 if neither is within DEPTH)
+   int            kind;                // STEP_INTERRUPT and/or STEP_RESET
+   int            num_cycles;          // 0 indicates a partial instruction
+   int            oldpc;               // the predicted pc and pb
+   int            oldpb;
+   int            fail;
+   int            num_state;
+   int            state[MAX_EM_STATE]; // registers afterwards (as save_state)
+} step_t;
+
 typedef struct {
    void (*init)(arguments_t *args);
-   int (*match_interrupt)(sample_t *sample_q, int num_samples);
-   int (*count_cycles)(sample_t *sample_q, int intr_seen);
-   void (*reset)(sample_t *sample_q, int num_cycles, instruction_t *instruction);
-   void (*interrupt)(sample_t *sample_q, int num_cycles, instruction_t *instruction);
-   void (*emulate)(sample_t *sample_q, int num_cycles, instruction_t *instruction);
+   int (*match_interrupt)(bus_cycle_t *sample_q, int num_samples);
+   int (*count_cycles)(bus_cycle_t *sample_q, int intr_seen, int next_opcode);
+   void (*reset)(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction);
+   void (*interrupt)(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction);
+   void (*emulate)(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction);
    int (*disassemble)(char *bp, instruction_t *instruction);
    int (*get_PC)();
    int (*get_PB)();
+   // Length in bytes of the instruction with the opcode (with 8-bit operands
+   // on the 65C816)
+   int (*get_length)(int opcode);
    int (*read_memory)(int address);
    char *(*get_state)(char*);
+   // As get_state, but of the registers in state (as save_state), so it
+   // can be called from another thread while emulating
+   char *(*write_state)(char *buffer, const int *state);
    int (*get_and_clear_fail)();
+   int (*save_state)(int *buffer);
+   void (*restore_state)(const int *buffer);
+   int (*step)(bus_cycle_t *sample_q, int num_samples, int rst_seen, step_t *step);
 } cpu_emulator_t;
 
-extern int failflag;
-
 #endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "disasm.h"
+#include "pipeline.h"
+#include "context.h"
+
+// One slot for the decoder, and one for each formatter
+#define DISASM_SLOTS   (PIPELINE_MAX_THREADS - 3)
+
+#define DISASM_BITS    12
+#define DISASM_ENTRIES (1 << DISASM_BITS)
+
+// Longest text cached (including the terminator); anything longer is
+// just formatted each time
+#define DISASM_TEXT    23
+
+// Flags in the key
+#define KEY_VALID      (1ULL << 63)
+#define KEY_NO_PC      (1ULL << 62)
+#define KEY_NO_PB      (1ULL << 61)
+
+typedef struct {
+   uint64_t key;
+   uint8_t  len;
+   char     text[DISASM_TEXT];
+} entry_t;
+
+typedef struct {
+   uint64_t hits;
+   uint64_t misses;
+   entry_t  entries[DISASM_ENTRIES];
+} slot_t;
+
+struct disasm_state {
+   cpu_emulator_t *em;
+   // Allocated on first use, by the thread using the slot
+   slot_t         *slots[DISASM_SLOTS];
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+// Returns 0 if the instruction can't be cached
+static inline uint64_t make_key(const instruction_t *instr) {
+   if (instr->pc > 0xffff || instr->pb > 0xff) {
+      return 0;
+   }
+   uint64_t key = KEY_VALID;
+   key |= instr->pc < 0 ? KEY_NO_PC : (uint64_t) instr->pc;
+   key |= instr->pb < 0 ? KEY_NO_PB : (uint64_t) instr->pb << 16;
+   key |= (uint64_t) instr->opcode << 24;
+   key |= (uint64_t) instr->op1 << 32;
+   key |= (uint64_t) instr->op2 << 40;
+   key |= (uint64_t) instr->op3 << 48;
+   key |= (uint64_t) (instr->opcount & 3) << 56;
+   return key;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+void disasm_init(cpu_emulator_t *em) {
+   disasm_destroy();
+   struct disasm_state *disasm = (struct disasm_state *)calloc(1, sizeof(struct disasm_state));
+   context->disasm = disasm;
+   disasm->em = em;
+}
+
+int disasm_instruction(int slot, char *buffer, instruction_t *instr) {
+   struct disasm_state *disasm = context->disasm;
+   uint64_t key = make_key(instr);
+   if (!key) {
+      return disasm->em->disassemble(buffer, instr);
+   }
+   slot_t *s = disasm->slots[slot];
+   if (!s) {
+      s = disasm->slots[slot] = (slot_t *)calloc(1, sizeof(slot_t));
+   }
+   entry_t *entry = s->entries + ((key * 0x9E3779B97F4A7C15ULL) >> (64 - DISASM_BITS));
+   if (entry->key == key) {
+      s->hits++;
+      memcpy(buffer, entry->text, entry->len + 1);
+      return entry->len;
+   }
+   s->misses++;
+   int n = disasm->em->disassemble(buffer, instr);
+   if (n < DISASM_TEXT) {
+      entry->key = key;
+      entry->len = n;
+      memcpy(entry->text, buffer, n + 1);
+   }
+   return n;
+}
+
+void disasm_print_stats() {
+   struct disasm_state *disasm = context->disasm;
+   uint64_t hits = 0;
+   uint64_t misses = 0;
+   for (int i = 0; i < DISASM_SLOTS; i++) {
+      if (disasm->slots[i]) {
+         hits   += disasm->slots[i]->hits;
+         misses += disasm->slots[i]->misses;
+      }
+   }
+   double rate = hits + misses ? 100.0 * (double) hits / (double) (hits + misses) : 0.0;
+   fprintf(stderr, "disassembly     : %10" PRIu64 " hits; %10" PRIu64 " misses; hit rate %5.1f%%\n", hits, misses, rate);
+}
+
+void disasm_destroy() {
+   struct disasm_state *disasm = context->disasm;
+   if (disasm) {
+      for (int i = 0; i < DISASM_SLOTS; i++) {
+         free(disasm->slots[i]);
+      }
+      free(disasm);
+      context->disasm = NULL;
+   }
+}
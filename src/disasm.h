@@ -0,0 +1,28 @@
+#ifndef _INCLUDE_DISASM_H
+#define _INCLUDE_DISASM_H
+
+#include "defs.h"
+
+// Memoized disassembly: the same few thousand instructions are typically
+// executed millions of times, so the text of each is kept in a direct
+// mapped cache, rather than formatting it again with sprintf. The key is
+// everything the emulator's disassemble depends on: the bank and pc, the
+// opcode and operand bytes, and the operand count (which gives the width
+// of a 65816 immediate operand, from the M/X flags).
+//
+// The cache is per context, with a slot for each thread that formats the
+// output (see output_format_t), so no locking is needed: slot 0 is for
+// the decoder's own threads (one at a time), and 1 on for the formatters.
+
+// Set the emulator whose disassembly is cached (emptying the cache)
+void disasm_init(cpu_emulator_t *em);
+
+// As em->disassemble, returning the number of characters written
+int disasm_instruction(int slot, char *buffer, instruction_t *instr);
+
+// Write the hit and miss counts to stderr (with the pipeline statistics)
+void disasm_print_stats();
+
+void disasm_destroy();
+
+#endif
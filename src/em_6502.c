@@ -5,6 +5,8 @@
 #include "memory.h"
 #include "tube_decode.h"
 #include "em_6502.h"
+#include "output.h"
+#include "context.h"
 
 // ====================================================================
 // Type Defs
@@ -77,14 +79,15 @@ typedef struct {
 
 static const char default_state[] = "A=?? X=?? Y=?? SP=?? N=? V=? D=? I=? Z=? C=?";
 
-static int rockwell     = 0;
-static int arlet        = 0;
-static int aland        = 0;
-static int c02          = 0;
-static int bbctube      = 0;
-static int master_nordy = 0;
+// Each variant of the core has its own instruction table, and its own
+// copy of the functions on the hot path, specialized at compile time by
+// passing the cpu type as a constant (so the tests of these fold away)
+#define IS_C02(cpu)      ((cpu) != CPU_6502 && (cpu) != CPU_6502_ARLET)
+#define IS_ROCKWELL(cpu) ((cpu) == CPU_65C02_ROCKWELL || (cpu) == CPU_65C02_WDC)
+#define IS_ARLET(cpu)    ((cpu) == CPU_6502_ARLET || (cpu) == CPU_65C02_ARLET)
+#define IS_ALAND(cpu)    ((cpu) == CPU_65C02_ALAND)
 
-static InstrType *instr_table;
+#define SPECIALIZED static inline __attribute__((always_inline))
 
 static AddrModeType addr_mode_table[] = {
    {1,    "%1$s"},                  // IMP
@@ -105,20 +108,40 @@ static AddrModeType addr_mode_table[] = {
    {3,    "%1$s %2$02X,%3$s"}       // ZPR
 };
 
-// 6502 registers: -1 means unknown
-static int A = -1;
-static int X = -1;
-static int Y = -1;
-static int S = -1;
-static int PC = -1;
-
-// 6502 flags: -1 means unknown
-static int N = -1;
-static int V = -1;
-static int D = -1;
-static int I = -1;
-static int Z = -1;
-static int C = -1;
+// The registers and flags saved in a checkpoint, in order
+enum {
+   // 6502 registers: -1 means unknown
+   REG_A, REG_X, REG_Y, REG_S, REG_PC,
+   // 6502 flags: -1 means unknown
+   REG_N, REG_V, REG_D, REG_I, REG_Z, REG_C,
+   // Phase of the 1MHz bus (used on the Master when RDY is not connected)
+   REG_MHZ1_PHASE,
+   NUM_REGS
+};
+
+// The emulator state is per context (see context.h), allocated by init
+typedef struct {
+   int reg[NUM_REGS];
+   int bbctube;
+   int master_nordy;
+   // A copy of the base table, patched for the variant and options
+   InstrType instr_table[256];
+} em_6502_state_t;
+
+#define STATE ((em_6502_state_t *) context->em)
+
+#define A            (STATE->reg[REG_A])
+#define X            (STATE->reg[REG_X])
+#define Y            (STATE->reg[REG_Y])
+#define S            (STATE->reg[REG_S])
+#define PC           (STATE->reg[REG_PC])
+#define N            (STATE->reg[REG_N])
+#define V            (STATE->reg[REG_V])
+#define D            (STATE->reg[REG_D])
+#define I            (STATE->reg[REG_I])
+#define Z            (STATE->reg[REG_Z])
+#define C            (STATE->reg[REG_C])
+#define mhz1_phase   (STATE->reg[REG_MHZ1_PHASE])
 
 static char ILLEGAL[] = "???";
 static char STP[]     = "STP";
@@ -126,17 +149,20 @@ static char WAI[]     = "WAI";
 
 // JSR cycle positions
 // <opcode> <op1> <read dummy> <write pch> <write pcl> <op2>
+// (Arlet's core writes pch/pcl one cycle earlier)
 
-static int jsr_pch = 3;
-static int jsr_pcl = 4;
+#define JSR_PCH(cpu) (IS_ARLET(cpu) ? 2 : 3)
+#define JSR_PCL(cpu) (IS_ARLET(cpu) ? 3 : 4)
 
 // ====================================================================
 // Forward declarations
 // ====================================================================
 
-static InstrType instr_table_6502[];
-static InstrType instr_table_65c02[];
+static const InstrType instr_table_6502[];
+static const InstrType instr_table_65c02[];
 
+static int op_ADC(operand_t operand, ea_t ea);
+static int op_SBC(operand_t operand, ea_t ea);
 static int op_STA(operand_t operand, ea_t ea);
 static int op_STX(operand_t operand, ea_t ea);
 static int op_STY(operand_t operand, ea_t ea);
@@ -235,12 +261,12 @@ static void push16(int value) {
    push8(value);
 }
 
-static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction, int pc_offset) {
+SPECIALIZED void interrupt(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction, int pc_offset, const int cpu) {
    // Parse the bus cycles
    // <opcode> <op1> <write pch> <write pcl> <write p> <read rst> <read rsth>
-   int pc     = (sample_q[2].data << 8) + sample_q[3].data;
-   int flags  = sample_q[4].data;
-   int vector = (sample_q[6].data << 8) + sample_q[5].data;
+   int pc     = (bus_data(sample_q[2]) << 8) + bus_data(sample_q[3]);
+   int flags  = bus_data(sample_q[4]);
+   int vector = (bus_data(sample_q[6]) << 8) + bus_data(sample_q[5]);
    // Update the address of the interruted instruction
    instruction->pc = (pc - pc_offset) & 0xffff;
    // Stack the PB/PC/FLags (for memory modelling)
@@ -252,48 +278,46 @@ static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruc
    set_FLAGS(flags);
    // Setup expected state for the ISR
    I = 1;
-   if (c02) {
+   if (IS_C02(cpu)) {
       D = 0;
    }
    PC = vector;
 }
 
-static int get_num_cycles(sample_t *sample_q, int intr_seen) {
-
-   static int mhz1_phase = 1;
+SPECIALIZED int get_num_cycles(bus_cycle_t *sample_q, int intr_seen, const int cpu) {
 
    if (intr_seen) {
       mhz1_phase ^= 1;
       return 7;
    }
 
-   int opcode = sample_q[0].data;
-   int op1    = sample_q[1].data;
-   int op2    = sample_q[opcode == 0x20 ? 5 : ((opcode & 0x0f) == 0x0f) ? 4 : 2].data;
+   int opcode = bus_data(sample_q[0]);
+   int op1    = bus_data(sample_q[1]);
+   int op2    = bus_data(sample_q[opcode == 0x20 ? 5 : ((opcode & 0x0f) == 0x0f) ? 4 : 2]);
 
-   InstrType *instr = &instr_table[opcode];
+   const InstrType *instr = &STATE->instr_table[opcode];
 
    int cycle_count = instr->cycles;
 
    // Account for extra cycle in ADC/SBC in decimal mode in C02
-   if (c02 && instr->decimalcorrect && D == 1) {
+   if (IS_C02(cpu) && instr->decimalcorrect && D == 1) {
       cycle_count++;
    }
 
    // Account for extra cycle in a page crossing in (indirect), Y (not stores)
    // <opcpde> <op1> <addrlo> <addrhi> [ <page crossing>] <<operand> [ <extra cycle in dec mode> ]
    if ((instr->mode == INDY) && (instr->optype != WRITEOP) && Y >= 0) {
-      int base = (sample_q[3].data << 8) + sample_q[2].data;
+      int base = (bus_data(sample_q[3]) << 8) + bus_data(sample_q[2]);
       if ((base & 0xff00) != ((base + Y) & 0xff00)) {
          cycle_count++;
       }
    }
 
    // Account for extra cycle in a page crossing in absolute indexed (not stores)
-   if ((((instr->mode == ABSX) || (instr->mode == ABSY)) && (instr->optype != WRITEOP)) || (arlet && instr->mode == IND1X)) {
+   if ((((instr->mode == ABSX) || (instr->mode == ABSY)) && (instr->optype != WRITEOP)) || (IS_ARLET(cpu) && instr->mode == IND1X)) {
       // 6502:  Need to exclude ASL/ROL/LSR/ROR/DEC/INC, which are 7 cycles regardless
       // 65C02: Need to exclude DEC/INC, which are 7 cycles regardless
-      if ((opcode != 0xDE) && (opcode != 0xFE) && ((c02 && !arlet && !aland) || ((opcode != 0x1E) && (opcode != 0x3E) && (opcode != 0x5E) && (opcode != 0x7E)))) {
+      if ((opcode != 0xDE) && (opcode != 0xFE) && ((IS_C02(cpu) && !IS_ARLET(cpu) && !IS_ALAND(cpu)) || ((opcode != 0x1E) && (opcode != 0x3E) && (opcode != 0x5E) && (opcode != 0x7E)))) {
          int index = (instr->mode == ABSY) ? Y : X;
          if (index >= 0) {
             int base = op1 + (op2 << 8);
@@ -316,8 +340,8 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
    // 6          (<page crossed penalty>)
    //
 
-   if (rockwell && (opcode & 0x0f) == 0x0f) {
-      int operand = sample_q[2].data;
+   if (IS_ROCKWELL(cpu) && (opcode & 0x0f) == 0x0f) {
+      int operand = bus_data(sample_q[2]);
       // invert operand for BBR
       if (opcode <= 0x80) {
          operand ^= 0xff;
@@ -338,7 +362,7 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
    }
 
    // Account for extra cycles in a branch
-   if (((opcode & 0x1f) == 0x10) || (c02 && opcode == 0x80)) {
+   if (((opcode & 0x1f) == 0x10) || (IS_C02(cpu) && opcode == 0x80)) {
       // Default to backards branches taken, forward not taken
       int taken = ((int8_t)op1) < 0;
       switch (opcode) {
@@ -400,7 +424,7 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
    }
 
    // Master specific behaviour to remain in sync if rdy is not available
-   if (master_nordy) {
+   if (STATE->master_nordy) {
       if (instr->len == 3) {
          if ((op2 == 0xfc) ||              // &FC00-&FCFF
              (op2 == 0xfd) ||              // &FD00-&FDFF
@@ -412,9 +436,9 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
             ))) {
             // Use STA/STX/STA to determine 1MHz clock phase
             if (opcode == 0x8C || opcode == 0x8D || opcode == 0x8E) {
-               if (sample_q[3].data == sample_q[4].data) {
+               if (bus_data(sample_q[3]) == bus_data(sample_q[4])) {
                   int new_phase;
-                  if (sample_q[3].data == sample_q[5].data) {
+                  if (bus_data(sample_q[3]) == bus_data(sample_q[5])) {
                      new_phase = 1;
                   } else {
                      new_phase = 0;
@@ -424,7 +448,7 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
                      mhz1_phase = new_phase;
                   }
                } else {
-                  printf("fail: 1MHz access not extended as expected\n");
+                  output_printf("fail: 1MHz access not extended as expected\n");
                }
             }
             // Correct cycle count based on expected cycle stretching behaviour
@@ -443,31 +467,29 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
    return cycle_count;
 }
 
-static int count_cycles_without_sync(sample_t *sample_q, int intr_seen) {
-   int num_cycles = get_num_cycles(sample_q, intr_seen);
+SPECIALIZED int count_cycles_without_sync(bus_cycle_t *sample_q, int intr_seen, const int cpu) {
+   int num_cycles = get_num_cycles(sample_q, intr_seen, cpu);
    if (num_cycles >= 0) {
       return num_cycles;
    }
-   printf ("cycle prediction unknown\n");
+   output_printf("cycle prediction unknown\n");
    return 1;
 }
 
-static int count_cycles_with_sync(sample_t *sample_q, int intr_seen) {
-   if (sample_q[0].type == OPCODE) {
-      for (int i = 1; i < DEPTH; i++) {
-         if (sample_q[i].type == LAST) {
-            return 0;
-         }
-         if (sample_q[i].type == OPCODE) {
-            // Validate the num_cycles passed in
-            int expected = get_num_cycles(sample_q, intr_seen);
-            if (expected >= 0) {
-               if (i != expected) {
-                  printf ("opcode %02x: cycle prediction fail: expected %d actual %d\n", sample_q[0].data, expected, i);
-               }
+SPECIALIZED int count_cycles_with_sync(bus_cycle_t *sample_q, int intr_seen, int next_opcode, const int cpu) {
+   if (bus_type(sample_q[0]) == OPCODE) {
+      if (next_opcode > 0) {
+         // Validate the num_cycles passed in
+         int expected = get_num_cycles(sample_q, intr_seen, cpu);
+         if (expected >= 0) {
+            if (next_opcode != expected) {
+               output_printf("opcode %02x: cycle prediction fail: expected %d actual %d\n", bus_data(sample_q[0]), expected, next_opcode);
             }
-            return i;
          }
+         return next_opcode;
+      }
+      if (next_opcode == 0) {
+         return 0;
       }
    }
    return 1;
@@ -477,45 +499,20 @@ static int count_cycles_with_sync(sample_t *sample_q, int intr_seen) {
 // Public Methods
 // ====================================================================
 
-static void em_6502_init(arguments_t *args) {
+static void init(arguments_t *args, const int cpu, int (*op_adc)(operand_t, ea_t), int (*op_sbc)(operand_t, ea_t)) {
 
-   switch (args->cpu_type) {
-   case CPU_6502:
-      instr_table = instr_table_6502;
-      break;
-   case CPU_6502_ARLET:
-      arlet = 1;
-      jsr_pch = 2;
-      jsr_pcl = 3;
-      instr_table = instr_table_6502;
-      break;
-   case CPU_65C02_WDC:
-   case CPU_65C02_ROCKWELL:
-      rockwell = 1;
-      c02 = 1;
-      instr_table = instr_table_65c02;
-      break;
-   case CPU_65C02_ARLET:
-      arlet = 1;
-      c02 = 1;
-      jsr_pch = 2;
-      jsr_pcl = 3;
-      instr_table = instr_table_65c02;
-      break;
-   case CPU_65C02_ALAND:
-      aland = 1;
-      c02 = 1;
-      instr_table = instr_table_65c02;
-      break;
-   case CPU_65C02:
-      c02 = 1;
-      instr_table = instr_table_65c02;
-      break;
-   default:
-      printf("em_6502_init called with unsupported cpu_type (%d)\n", args->cpu_type);
-      exit(1);
+   free(context->em);
+   context->em = malloc(sizeof(em_6502_state_t));
+   for (int i = 0; i < NUM_REGS; i++) {
+      STATE->reg[i] = -1;
    }
-   bbctube = args->bbctube;
+   mhz1_phase = 1;
+
+   // Start from a copy of the base table, so the variants are independent
+   InstrType *instr_table = STATE->instr_table;
+   memcpy(instr_table, IS_C02(cpu) ? instr_table_65c02 : instr_table_6502, sizeof(STATE->instr_table));
+
+   STATE->bbctube = args->bbctube;
    // Initialize the SP
    if (args->sp_reg >= 0) {
       S = args->sp_reg & 0xff;
@@ -523,9 +520,9 @@ static void em_6502_init(arguments_t *args) {
 
    // This flag tells the sync-less cycle count estimation to infer additional cycles on the master
    // It's needed when rdy is not being explicitely sampled
-   master_nordy = (args->machine == MACHINE_MASTER) && (args->idx_rdy < 0);
+   STATE->master_nordy = (args->machine == MACHINE_MASTER) && (args->idx_rdy < 0);
 
-   if (args->cpu_type == CPU_65C02_ARLET) {
+   if (cpu == CPU_65C02_ARLET) {
       // Arlet's 65C02 is really an NMOS 6502 with extra instructions
       // The NMOS instructions have NMOS cycle counts
       instr_table[0x6c].cycles = 5; // JMP (ind)
@@ -548,7 +545,7 @@ static void em_6502_init(arguments_t *args) {
       }
    }
 
-   if (args->cpu_type == CPU_65C02_ALAND) {
+   if (cpu == CPU_65C02_ALAND) {
       // Alan D's 65C02 is mostly cycle accurate, with a few exceptions
       instr_table[0x40].cycles = 7; // RTI
       instr_table[0x1e].cycles = 7; // ASL absx
@@ -565,11 +562,20 @@ static void em_6502_init(arguments_t *args) {
       }
    }
 
+   // Use the variant's own decimal mode ADC and SBC
+   for (int i = 0x00; i <= 0xff; i++) {
+      if (instr_table[i].emulate == op_ADC) {
+         instr_table[i].emulate = op_adc;
+      } else if (instr_table[i].emulate == op_SBC) {
+         instr_table[i].emulate = op_sbc;
+      }
+   }
+
    // If not supporting the Rockwell C02 extensions, tweak the cycle countes
-   if (args->cpu_type == CPU_65C02 || args->cpu_type == CPU_65C02_ARLET || args->cpu_type == CPU_65C02_ALAND) {
+   if (cpu == CPU_65C02 || cpu == CPU_65C02_ARLET || cpu == CPU_65C02_ALAND) {
       // x7 (RMB/SMB): 5 cycles -> 1 cycles (2 on Arlet's core)
       // xF (BBR/BBS): 5 cycles -> 1 cycles (2 on Arlet's core)
-      int cycles = args->cpu_type == CPU_65C02_ARLET ? 2 : 1;
+      int cycles = cpu == CPU_65C02_ARLET ? 2 : 1;
       for (int i = 0x07; i <= 0xff; i+= 0x08) {
          instr_table[i].mnemonic = ILLEGAL;
          instr_table[i].mode     = IMP;
@@ -582,7 +588,7 @@ static void em_6502_init(arguments_t *args) {
    // Support the WDC C02 extensions
    // TODO: more work is needed to properly support WAI and STP
    // See https://github.com/hoglet67/6502Decoder/issues/10
-   if (args->cpu_type == CPU_65C02_WDC) {
+   if (cpu == CPU_65C02_WDC) {
       instr_table[0xcb].mnemonic = WAI;
       instr_table[0xcb].cycles   = 3;
       instr_table[0xdb].mnemonic = STP;
@@ -605,29 +611,32 @@ static void em_6502_init(arguments_t *args) {
 }
 
 
-static int em_6502_match_interrupt(sample_t *sample_q, int num_samples) {
+
+
+
+static int em_6502_match_interrupt(bus_cycle_t *sample_q, int num_samples) {
    // Check we have enough valid samples
    if (num_samples < 7) {
       return 0;
    }
    // An interupt will write PCH, PCL, PSW in bus cycles 2,3,4
-   if (sample_q[0].rnw >= 0) {
+   if (bus_rnw(sample_q[0]) >= 0) {
       // If we have the RNW pin connected, then just look for these three writes in succession
       // Currently can't detect a BRK being interrupted
-      if (sample_q[0].data == 0x00) {
+      if (bus_data(sample_q[0]) == 0x00) {
          return 0;
       }
-      if (sample_q[2].rnw == 0 && sample_q[3].rnw == 0 && sample_q[4].rnw == 0) {
+      if (bus_rnw(sample_q[2]) == 0 && bus_rnw(sample_q[3]) == 0 && bus_rnw(sample_q[4]) == 0) {
          return 1;
       }
    } else {
       // If not, then we use a heuristic, based on what we expect to see on the data
       // bus in cycles 2, 3 and 4, i.e. PCH, PCL, PSW
-      if (sample_q[2].data == ((PC >> 8) & 0xff) && sample_q[3].data == (PC & 0xff)) {
+      if (bus_data(sample_q[2]) == ((PC >> 8) & 0xff) && bus_data(sample_q[3]) == (PC & 0xff)) {
          // Now test unused flag is 1, B is 0
-         if ((sample_q[4].data & 0x30) == 0x20) {
+         if ((bus_data(sample_q[4]) & 0x30) == 0x20) {
             // Finally test all other known flags match
-            if (!compare_FLAGS(sample_q[4].data)) {
+            if (!compare_FLAGS(bus_data(sample_q[4]))) {
                // Matched PSW = NV-BDIZC
                return 1;
             }
@@ -637,15 +646,15 @@ static int em_6502_match_interrupt(sample_t *sample_q, int num_samples) {
    return 0;
 }
 
-static int em_6502_count_cycles(sample_t *sample_q, int intr_seen) {
-   if (sample_q[0].type == UNKNOWN) {
-      return count_cycles_without_sync(sample_q, intr_seen);
+SPECIALIZED int count_cycles(bus_cycle_t *sample_q, int intr_seen, int next_opcode, const int cpu) {
+   if (bus_type(sample_q[0]) == UNKNOWN) {
+      return count_cycles_without_sync(sample_q, intr_seen, cpu);
    } else {
-      return count_cycles_with_sync(sample_q, intr_seen);
+      return count_cycles_with_sync(sample_q, intr_seen, next_opcode, cpu);
    }
 }
 
-static void em_6502_reset(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+SPECIALIZED void reset(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction, const int cpu) {
    instruction->pc = -1;
    A = -1;
    X = -1;
@@ -657,32 +666,28 @@ static void em_6502_reset(sample_t *sample_q, int num_cycles, instruction_t *ins
    Z = -1;
    C = -1;
    I = 1;
-   if (c02) {
+   if (IS_C02(cpu)) {
       D = 0;
    }
-   PC = (sample_q[num_cycles - 1].data << 8) + sample_q[num_cycles - 2].data;
+   PC = (bus_data(sample_q[num_cycles - 1]) << 8) + bus_data(sample_q[num_cycles - 2]);
 }
 
-static void em_6502_interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
-   interrupt(sample_q, num_cycles, instruction, 0);
-}
-
-static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+SPECIALIZED void emulate(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction, const int cpu) {
 
    // Unpack the instruction bytes
-   int opcode = sample_q[0].data;
+   int opcode = bus_data(sample_q[0]);
 
    // lookup the entry for the instruction
-   InstrType *instr = &instr_table[opcode];
+   const InstrType *instr = &STATE->instr_table[opcode];
 
    int opcount = instr->len - 1;
 
-   int op1 = (opcount < 1) ? 0 : sample_q[1].data;
+   int op1 = (opcount < 1) ? 0 : bus_data(sample_q[1]);
 
    int op2 =
       (opcount < 2)             ? 0 :
-      (opcode == 0x20)          ? sample_q[5].data :
-      ((opcode & 0x0f) == 0x0f) ? sample_q[4].data : sample_q[2].data;
+      (opcode == 0x20)          ? bus_data(sample_q[5]) :
+      ((opcode & 0x0f) == 0x0f) ? bus_data(sample_q[4]) : bus_data(sample_q[2]);
 
    // Memory Modelling: Instruction fetches
    if (PC >= 0) {
@@ -705,11 +710,11 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
    // Determine the current PC value
    if (opcode == 0x00) {
       // Now just pass BRK onto the interrupt handler
-      interrupt(sample_q, num_cycles, instruction, 2);
+      interrupt(sample_q, num_cycles, instruction, 2, cpu);
       // And we are done
       return;
    } else if (opcode == 0x20) {
-      instruction->pc = (((sample_q[jsr_pch].data << 8) + sample_q[jsr_pcl].data) - 2) & 0xffff;
+      instruction->pc = (((bus_data(sample_q[JSR_PCH(cpu)]) << 8) + bus_data(sample_q[JSR_PCL(cpu)])) - 2) & 0xffff;
    } else {
       instruction->pc = PC;
    }
@@ -719,37 +724,37 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
    case IND:
       //        C02: <opcode> <op1> <addrlo> <addrhi> <operand>
       // Arlet  C02: <opcode> <op1> <addrlo> <addrlo> <addrhi> <operand>
-      memory_read(sample_q[arlet ? 3 : 2].data,   op1             , MEM_POINTER);
-      memory_read(sample_q[arlet ? 4 : 3].data, ((op1 + 1) & 0xff), MEM_POINTER);
+      memory_read(bus_data(sample_q[IS_ARLET(cpu) ? 3 : 2]),   op1             , MEM_POINTER);
+      memory_read(bus_data(sample_q[IS_ARLET(cpu) ? 4 : 3]), ((op1 + 1) & 0xff), MEM_POINTER);
       break;
    case INDY:
       // <opcode> <op1> <addrlo> <addrhi> [ <page crossing>] <operand>
-      memory_read(sample_q[2].data,   op1             , MEM_POINTER);
-      memory_read(sample_q[3].data, ((op1 + 1) & 0xff), MEM_POINTER);
+      memory_read(bus_data(sample_q[2]),   op1             , MEM_POINTER);
+      memory_read(bus_data(sample_q[3]), ((op1 + 1) & 0xff), MEM_POINTER);
       break;
    case INDX:
       // <opcode> <op1> <dummy> <addrlo> <addrhi> <operand>
       if (X >= 0) {
-         memory_read(sample_q[3].data, ((op1 + X    ) & 0xff), MEM_POINTER);
-         memory_read(sample_q[4].data, ((op1 + X + 1) & 0xff), MEM_POINTER);
+         memory_read(bus_data(sample_q[3]), ((op1 + X    ) & 0xff), MEM_POINTER);
+         memory_read(bus_data(sample_q[4]), ((op1 + X + 1) & 0xff), MEM_POINTER);
       }
       break;
    case IND16:
       // e.g. JMP (1234)
       // <opcode=6C> <op1> <op2> <read new pcl> <read new pch>
-      if (c02) {
-         memory_read(sample_q[num_cycles - 2].data,  (op2 << 8) + op1              , MEM_POINTER);
-         memory_read(sample_q[num_cycles - 1].data, ((op2 << 8) + op1 + 1) & 0xffff, MEM_POINTER);
+      if (IS_C02(cpu)) {
+         memory_read(bus_data(sample_q[num_cycles - 2]),  (op2 << 8) + op1              , MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 1]), ((op2 << 8) + op1 + 1) & 0xffff, MEM_POINTER);
       } else {
-         memory_read(sample_q[num_cycles - 2].data, (op2 << 8) +   op1             , MEM_POINTER);
-         memory_read(sample_q[num_cycles - 1].data, (op2 << 8) + ((op1 + 1) & 0xff), MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 2]), (op2 << 8) +   op1             , MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 1]), (op2 << 8) + ((op1 + 1) & 0xff), MEM_POINTER);
       }
       break;
    case IND1X:
       // JMP: <opcode=7C> <op1> <op2> <dummy> <read new pcl> <read new pch>
       if (X >= 0) {
-         memory_read(sample_q[num_cycles - 2].data, ((op2 << 8) + op1 + X    ) & 0xffff, MEM_POINTER);
-         memory_read(sample_q[num_cycles - 1].data, ((op2 << 8) + op1 + X + 1) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 2]), ((op2 << 8) + op1 + X    ) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 1]), ((op2 << 8) + op1 + X + 1) & 0xffff, MEM_POINTER);
       }
       break;
    default:
@@ -763,43 +768,43 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
          // e.g. <opcode> <op1> <op2> <read old> <write old> <write new>
          //      <opcode> <op1>       <read old> <write old> <write new>
          // Want to pick off the read
-         operand = sample_q[num_cycles - 3].data;
+         operand = bus_data(sample_q[num_cycles - 3]);
       } else if (instr->optype == BRANCHOP) {
          // the operand is true if branch taken
          operand = (num_cycles != 2);
       } else if (opcode == 0x00) {
          // BRK: the operand is the data pushed to the stack (PCH, PCL, P)
          // <opcode> <op1> <write pch> <write pcl> <write p> <read rst> <read rsth>
-         operand = (sample_q[2].data << 16) +  (sample_q[3].data << 8) + sample_q[4].data;
+         operand = (bus_data(sample_q[2]) << 16) +  (bus_data(sample_q[3]) << 8) + bus_data(sample_q[4]);
       } else if (opcode == 0x20) {
          // JSR: the operand is the data pushed to the stack (PCH, PCL)
          // <opcode> <op1> <read dummy> <write pch> <write pcl> <op2>
-         operand = (sample_q[jsr_pch].data << 8) + sample_q[jsr_pcl].data;
+         operand = (bus_data(sample_q[JSR_PCH(cpu)]) << 8) + bus_data(sample_q[JSR_PCL(cpu)]);
       } else if (opcode == 0x40) {
          // RTI: the operand is the data pulled from the stack (P, PCL, PCH)
          // C02:      <opcode> <op1> <read dummy> <read p>            <read pcl> <read pch>
          // AlanDC02: <opcode> <op1> <read dummy> <read p> <read pcl> <read pcl> <read pch>
-         operand = (sample_q[num_cycles - 1].data << 16) +  (sample_q[num_cycles - 2].data << 8) + sample_q[3].data;
+         operand = (bus_data(sample_q[num_cycles - 1]) << 16) +  (bus_data(sample_q[num_cycles - 2]) << 8) + bus_data(sample_q[3]);
       } else if (opcode == 0x60) {
          // RTS: the operand is the data pulled from the stack (PCL, PCH)
          // <opcode> <op1> <read dummy> <read pcl> <read pch>
-         operand = (sample_q[4].data << 8) + sample_q[3].data;
+         operand = (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
       } else if (instr->mode == IMM) {
          // Immediate addressing mode: the operand is the 2nd byte of the instruction
          operand = op1;
       } else if (instr->decimalcorrect && (D == 1)) {
          // read operations on the C02 that have an extra cycle added
-         operand = sample_q[num_cycles - 2].data;
+         operand = bus_data(sample_q[num_cycles - 2]);
       } else {
          // default to using the last bus cycle as the operand
-         operand = sample_q[num_cycles - 1].data;
+         operand = bus_data(sample_q[num_cycles - 1]);
       }
 
       // Operand 2 is the value written back in a store or read-modify-write
       // See RMW comment above for bus cycles
       operand_t operand2 = operand;
       if (instr->optype == RMWOP || instr->optype == WRITEOP) {
-         operand2 = sample_q[num_cycles - 1].data;
+         operand2 = bus_data(sample_q[num_cycles - 1]);
       }
 
       // For instructions that read or write memory, we need to work out the effective address
@@ -822,17 +827,17 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
          // <opcpde> <op1> <addrlo> <addrhi> [ <page crossing>] <<operand> [ <extra cycle in dec mode> ]
          index = Y;
          if (index >= 0) {
-            ea = (sample_q[3].data << 8) + sample_q[2].data;
+            ea = (bus_data(sample_q[3]) << 8) + bus_data(sample_q[2]);
             ea = (ea + index) & 0xffff;
          }
          break;
       case INDX:
          // <opcpde> <op1> <dummy> <addrlo> <addrhi> <operand> [ <extra cycle in dec mode> ]
-         ea = (sample_q[4].data << 8) + sample_q[3].data;
+         ea = (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
          break;
       case IND:
          // <opcpde> <op1> <addrlo> <addrhi> <operand> [ <extra cycle in dec mode> ]
-         ea = (sample_q[arlet ? 4 : 3].data << 8) + sample_q[arlet ? 3 : 2].data;
+         ea = (bus_data(sample_q[IS_ARLET(cpu) ? 4 : 3]) << 8) + bus_data(sample_q[IS_ARLET(cpu) ? 3 : 2]);
          break;
       case ABS:
          ea = op2 << 8 | op1;
@@ -857,6 +862,7 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
       // Execute the instruction specific function
       // (This returns -1 if the result is unknown or invalid)
       int result = instr->emulate(operand, ea);
+      instruction->ea = ea;
 
       if (instr->optype == WRITEOP || instr->optype == RMWOP) {
 
@@ -877,19 +883,19 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
    }
 
    // Look for control flow changes and update the PC
-   if (opcode == 0x40 || opcode == 0x6c || (c02 && opcode == 0x7c)) {
+   if (opcode == 0x40 || opcode == 0x6c || (IS_C02(cpu) && opcode == 0x7c)) {
       // RTI, JMP (ind), JMP (ind, X)
-      PC = (sample_q[num_cycles - 1].data << 8) | sample_q[num_cycles - 2].data;
+      PC = (bus_data(sample_q[num_cycles - 1]) << 8) | bus_data(sample_q[num_cycles - 2]);
    } else if (opcode == 0x20 || opcode == 0x4c) {
       // JSR abs, JMP abs
       PC = op2 << 8 | op1;
    } else if (PC < 0) {
       // PC value is not known yet, everything below this point is relative
       PC = -1;
-   } else if (c02 && opcode == 0x80) {
+   } else if (IS_C02(cpu) && opcode == 0x80) {
       // BRA
       PC = (PC + ((int8_t)(op1)) + 2) & 0xffff;
-   } else if (rockwell && ((opcode & 0x0f) == 0x0f) && (num_cycles != 5)) {
+   } else if (IS_ROCKWELL(cpu) && ((opcode & 0x0f) == 0x0f) && (num_cycles != 5)) {
       // BBR/BBS: op2 if taken
       PC = (PC + ((int8_t)(op2)) + 3) & 0xffff;
    } else if ((opcode & 0x1f) == 0x10 && num_cycles != 2) {
@@ -901,7 +907,7 @@ static void em_6502_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
    }
 }
 
-static int em_6502_disassemble(char *buffer, instruction_t *instruction) {
+static int disassemble(char *buffer, instruction_t *instruction, const int cpu) {
 
    int numchars;
    int offset;
@@ -914,7 +920,7 @@ static int em_6502_disassemble(char *buffer, instruction_t *instruction) {
    int pc     = instruction->pc;
 
    // lookup the entry for the instruction
-   InstrType *instr = &instr_table[opcode];
+   const InstrType *instr = &STATE->instr_table[opcode];
 
    const char *mnemonic = instr->mnemonic;
    const char *fmt = instr->fmt;
@@ -982,71 +988,153 @@ static int em_6502_get_PB() {
    return 0;
 }
 
+static int em_6502_get_length(int opcode) {
+   return STATE->instr_table[opcode].len;
+}
+
 static int em_6502_read_memory(int address) {
    return memory_read_raw(address);
 }
 
-static char *em_6502_get_state(char *buffer) {
+static char *em_6502_write_state(char *buffer, const int *reg) {
    strcpy(buffer, default_state);
-   if (A >= 0) {
-      write_hex2(buffer + OFFSET_A, A);
+   if (reg[REG_A] >= 0) {
+      write_hex2(buffer + OFFSET_A, reg[REG_A]);
    }
-   if (X >= 0) {
-      write_hex2(buffer + OFFSET_X, X);
+   if (reg[REG_X] >= 0) {
+      write_hex2(buffer + OFFSET_X, reg[REG_X]);
    }
-   if (Y >= 0) {
-      write_hex2(buffer + OFFSET_Y, Y);
+   if (reg[REG_Y] >= 0) {
+      write_hex2(buffer + OFFSET_Y, reg[REG_Y]);
    }
-   if (S >= 0) {
-      write_hex2(buffer + OFFSET_S, S);
+   if (reg[REG_S] >= 0) {
+      write_hex2(buffer + OFFSET_S, reg[REG_S]);
    }
-   if (N >= 0) {
-      buffer[OFFSET_N] = '0' + N;
+   if (reg[REG_N] >= 0) {
+      buffer[OFFSET_N] = '0' + reg[REG_N];
    }
-   if (V >= 0) {
-      buffer[OFFSET_V] = '0' + V;
+   if (reg[REG_V] >= 0) {
+      buffer[OFFSET_V] = '0' + reg[REG_V];
    }
-   if (D >= 0) {
-      buffer[OFFSET_D] = '0' + D;
+   if (reg[REG_D] >= 0) {
+      buffer[OFFSET_D] = '0' + reg[REG_D];
    }
-   if (I >= 0) {
-      buffer[OFFSET_I] = '0' + I;
+   if (reg[REG_I] >= 0) {
+      buffer[OFFSET_I] = '0' + reg[REG_I];
    }
-   if (Z >= 0) {
-      buffer[OFFSET_Z] = '0' + Z;
+   if (reg[REG_Z] >= 0) {
+      buffer[OFFSET_Z] = '0' + reg[REG_Z];
    }
-   if (C >= 0) {
-      buffer[OFFSET_C] = '0' + C;
+   if (reg[REG_C] >= 0) {
+      buffer[OFFSET_C] = '0' + reg[REG_C];
    }
    return buffer + OFFSET_END;
 }
 
+static char *em_6502_get_state(char *buffer) {
+   return em_6502_write_state(buffer, STATE->reg);
+}
+
 static int em_6502_get_and_clear_fail() {
    int ret = failflag;
    failflag = 0;
    return ret;
 }
 
-cpu_emulator_t em_6502 = {
-   .init = em_6502_init,
-   .match_interrupt = em_6502_match_interrupt,
-   .count_cycles = em_6502_count_cycles,
-   .reset = em_6502_reset,
-   .interrupt = em_6502_interrupt,
-   .emulate = em_6502_emulate,
-   .disassemble = em_6502_disassemble,
-   .get_PC = em_6502_get_PC,
-   .get_PB = em_6502_get_PB,
-   .read_memory = em_6502_read_memory,
-   .get_state = em_6502_get_state,
-   .get_and_clear_fail = em_6502_get_and_clear_fail
-};
+static int em_6502_save_state(int *buffer) {
+   memcpy(buffer, STATE->reg, sizeof(STATE->reg));
+   return NUM_REGS;
+}
+
+static void em_6502_restore_state(const int *buffer) {
+   memcpy(STATE->reg, buffer, sizeof(STATE->reg));
+}
+
+// This is a rather ugly hack to cope with a decode failure on Arlet's core.
+SPECIALIZED void arlet_reorder(bus_cycle_t *sample_q, const int cpu) {
+   int op = bus_data(sample_q[0]);
+   if (op == 0x08 || op == 0x48 || ((op == 0x5A || op == 0xDA) && IS_C02(cpu))) {
+      // PHP, PHA, PHX, PHY
+      //
+      //    Normal 6502   Arlet
+      // 0: 48 R SYNC     48 R SYNC <<<<< Push instruction
+      // 1: XX R          XX R
+      // 2: AA W          YY R
+      // 3: XX R SYNC     AA W SYNC <<<<< Next instruction
+      // 4: YY R          YY R
+      //
+      // Reorder the samples to make it look conventional:
+      //   3->2
+      //   1->3
+      // But preserve the original type (sync) value, as this is correct
+      sample_q[2] = bus_set_data_rnw(sample_q[2], sample_q[3]);
+      sample_q[3] = bus_set_data_rnw(sample_q[3], sample_q[1]);
+   }
+   if (op == 0x28 || op == 0x68 || ((op == 0x7A || op == 0xFA) && IS_C02(cpu))) {
+      // PLP, PLA, PLX, PLY
+      //
+      //    Normal 6502   Arlet
+      // 0: 68 R SYNC     68 R SYNC <<<<< Pull instruction
+      // 1: XX R          XX R
+      // 2: ?? R          YY R
+      // 3: AA R          AA R
+      // 4: XX R SYNC     YY R SYNC <<<<< Next instruction
+      // 5: YY R          YY R
+      //
+      // Reorder the samples to make it look conventional
+      //    1->4
+      // But preserve the original type (sync) value, as this is correct
+      sample_q[4] = bus_set_data(sample_q[4], sample_q[1]);
+   }
+}
+
+SPECIALIZED int step(bus_cycle_t *sample_q, int num_samples, int rst_seen, step_t *step, const int cpu) {
+   instruction_t *instruction = step->instruction;
+
+   int intr_seen = em_6502_match_interrupt(sample_q, num_samples);
+
+   if (IS_ARLET(cpu)) {
+      arlet_reorder(sample_q, cpu);
+   }
+
+   int num_cycles = (rst_seen > 0) ? rst_seen : count_cycles(sample_q, intr_seen, step->next_opcode, cpu);
+
+   // Deal with partial final instruction
+   if (num_samples <= num_cycles || num_cycles == 0) {
+      step->num_cycles = 0;
+      return 0;
+   }
+
+   if (step->before) {
+      step->before(num_cycles);
+   }
+
+   step->kind  = (intr_seen ? STEP_INTERRUPT : 0) | (rst_seen ? STEP_RESET : 0);
+   step->oldpc = PC;
+   step->oldpb = 0;
+   instruction->ea = -1;
+
+   if (rst_seen) {
+      reset(sample_q, num_cycles, instruction, cpu);
+   } else if (intr_seen) {
+      interrupt(sample_q, num_cycles, instruction, 0, cpu);
+   } else {
+      emulate(sample_q, num_cycles, instruction, cpu);
+   }
+
+   step->num_cycles = num_cycles;
+   step->fail = failflag;
+   failflag = 0;
+   step->num_state = em_6502_save_state(step->state);
+   return num_cycles;
+}
+
 
 // ====================================================================
 // Individual Instructions
 // ====================================================================
 
-static int op_ADC(operand_t operand, ea_t ea) {
+SPECIALIZED int adc(operand_t operand, const int cpu) {
    if (A >= 0 && C >= 0) {
       if (D == 1) {
          // Decimal mode ADC
@@ -1078,11 +1166,11 @@ static int op_ADC(operand_t operand, ea_t ea) {
          }
          A = (al & 0xF) | (ah << 4);
          // On 65C02 ADC, only the NZ flags are different to the 6502
-         if (c02) {
+         if (IS_C02(cpu)) {
             set_NZ(A);
          }
          // Arlet's core doesn't define the behaviour of the overflow flag in decimal mode
-         if (arlet) {
+         if (IS_ARLET(cpu)) {
             V = -1;
          }
       } else {
@@ -1100,6 +1188,11 @@ static int op_ADC(operand_t operand, ea_t ea) {
    return -1;
 }
 
+// The base tables use the NMOS ADC/SBC, which each variant replaces with its own
+static int op_ADC(operand_t operand, ea_t ea) {
+   return adc(operand, CPU_6502);
+}
+
 static int op_AND(operand_t operand, ea_t ea) {
    if (A >= 0) {
       A = A & operand;
@@ -1544,11 +1637,11 @@ static int op_RTI(operand_t operand, ea_t ea) {
    return -1;
 }
 
-static int op_SBC(operand_t operand, ea_t ea) {
+SPECIALIZED int sbc(operand_t operand, const int cpu) {
    if (A >= 0 && C >= 0) {
       if (D == 1) {
          // Decimal mode SBC
-         if (c02) {
+         if (IS_C02(cpu)) {
             int al;
             int tmp;
             // On 65C02 SBC, both flags and A can be different to the 6502
@@ -1596,7 +1689,7 @@ static int op_SBC(operand_t operand, ea_t ea) {
             A = (al & 0xF) | ((ah & 0xF) << 4);
          }
          // Arlet's core doesn't define the behaviour of the overflow flag in decimal mode
-         if (arlet) {
+         if (IS_ARLET(cpu)) {
             V = -1;
          }
       } else {
@@ -1614,6 +1707,10 @@ static int op_SBC(operand_t operand, ea_t ea) {
    return -1;
 }
 
+static int op_SBC(operand_t operand, ea_t ea) {
+   return sbc(operand, CPU_6502);
+}
+
 static int op_SEC(operand_t operand, ea_t ea) {
    C = 1;
    return -1;
@@ -1817,7 +1914,7 @@ static int op_SMB7(operand_t operand, ea_t ea) {
 // Opcode Tables
 // ====================================================================
 
-static InstrType instr_table_65c02[] = {
+static const InstrType instr_table_65c02[] = {
    /* 00 */   { "BRK",  0, IMM   , 7, 0, OTHER,    0},
    /* 01 */   { "ORA",  0, INDX  , 6, 0, READOP,   op_ORA},
    /* 02 */   { "NOP",  0, IMM   , 2, 0, OTHER,    0},
@@ -2076,7 +2173,7 @@ static InstrType instr_table_65c02[] = {
    /* FF */   { "BBS7", 0, ZPR   , 5, 0, READOP,   0}
 };
 
-static InstrType instr_table_6502[] = {
+static const InstrType instr_table_6502[] = {
    /* 00 */   { "BRK",  0, IMM   , 7, 0, OTHER,    0},
    /* 01 */   { "ORA",  0, INDX  , 6, 0, READOP,   op_ORA},
    /* 02 */   { "KIL",  1, IMP   , 0, 0, OTHER,    0},
@@ -2334,3 +2431,94 @@ static InstrType instr_table_6502[] = {
    /* FE */   { "INC",  0, ABSX  , 7, 0, RMWOP,    op_INC},
    /* FF */   { "ISC",  1, ABSX  , 7, 0, READOP,   0}
 };
+
+// ====================================================================
+// Variants
+// ====================================================================
+
+#define VARIANT(name, cpu)                                                                           \
+                                                                                                     \
+   static int name##_ADC(operand_t operand, ea_t ea) {                                               \
+      return adc(operand, cpu);                                                                      \
+   }                                                                                                 \
+                                                                                                     \
+   static int name##_SBC(operand_t operand, ea_t ea) {                                               \
+      return sbc(operand, cpu);                                                                      \
+   }                                                                                                 \
+                                                                                                     \
+   static void name##_init(arguments_t *args) {                                                      \
+      init(args, cpu, name##_ADC, name##_SBC);                                                       \
+   }                                                                                                 \
+                                                                                                     \
+   static int name##_count_cycles(bus_cycle_t *sample_q, int intr_seen, int next_opcode) {           \
+      return count_cycles(sample_q, intr_seen, next_opcode, cpu);                                    \
+   }                                                                                                 \
+                                                                                                     \
+   static void name##_reset(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {     \
+      reset(sample_q, num_cycles, instruction, cpu);                                                 \
+   }                                                                                                 \
+                                                                                                     \
+   static void name##_interrupt(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) { \
+      interrupt(sample_q, num_cycles, instruction, 0, cpu);                                          \
+   }                                                                                                 \
+                                                                                                     \
+   static void name##_emulate(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {   \
+      emulate(sample_q, num_cycles, instruction, cpu);                                               \
+   }                                                                                                 \
+                                                                                                     \
+   static int name##_disassemble(char *buffer, instruction_t *instruction) {                         \
+      return disassemble(buffer, instruction, cpu);                                                  \
+   }                                                                                                 \
+                                                                                                     \
+   static int name##_step(bus_cycle_t *sample_q, int num_samples, int rst_seen, step_t *step_rec) {  \
+      return step(sample_q, num_samples, rst_seen, step_rec, cpu);                                   \
+   }                                                                                                 \
+                                                                                                     \
+   static cpu_emulator_t name = {                                                                    \
+      .init = name##_init,                                                                           \
+      .match_interrupt = em_6502_match_interrupt,                                                    \
+      .count_cycles = name##_count_cycles,                                                           \
+      .reset = name##_reset,                                                                         \
+      .interrupt = name##_interrupt,                                                                 \
+      .emulate = name##_emulate,                                                                     \
+      .disassemble = name##_disassemble,                                                             \
+      .get_PC = em_6502_get_PC,                                                                      \
+      .get_PB = em_6502_get_PB,                                                                      \
+      .get_length = em_6502_get_length,                                                              \
+      .read_memory = em_6502_read_memory,                                                            \
+      .get_state = em_6502_get_state,                                                                \
+      .write_state = em_6502_write_state,                                                            \
+      .get_and_clear_fail = em_6502_get_and_clear_fail,                                              \
+      .save_state = em_6502_save_state,                                                              \
+      .restore_state = em_6502_restore_state,                                                        \
+      .step = name##_step                                                                            \
+   };
+
+VARIANT(em_6502_nmos,      CPU_6502)
+VARIANT(em_6502_arlet,     CPU_6502_ARLET)
+VARIANT(em_65c02,          CPU_65C02)
+VARIANT(em_65c02_rockwell, CPU_65C02_ROCKWELL)
+VARIANT(em_65c02_wdc,      CPU_65C02_WDC)
+VARIANT(em_65c02_arlet,    CPU_65C02_ARLET)
+VARIANT(em_65c02_aland,    CPU_65C02_ALAND)
+
+cpu_emulator_t *em_6502_variant(cpu_t cpu_type) {
+   switch (cpu_type) {
+   case CPU_6502:
+      return &em_6502_nmos;
+   case CPU_6502_ARLET:
+      return &em_6502_arlet;
+   case CPU_65C02:
+      return &em_65c02;
+   case CPU_65C02_ROCKWELL:
+      return &em_65c02_rockwell;
+   case CPU_65C02_WDC:
+      return &em_65c02_wdc;
+   case CPU_65C02_ARLET:
+      return &em_65c02_arlet;
+   case CPU_65C02_ALAND:
+      return &em_65c02_aland;
+   default:
+      return NULL;
+   }
+}
@@ -3,6 +3,8 @@
 
 #include "defs.h"
 
-extern cpu_emulator_t em_6502;
+// Each variant of the 6502 core is a separate emulator (with its own
+// instruction table), returns NULL if cpu_type isn't a 6502 variant
+cpu_emulator_t *em_6502_variant(cpu_t cpu_type);
 
 #endif
@@ -5,6 +5,8 @@
 #include "em_65816.h"
 #include "defs.h"
 #include "memory.h"
+#include "output.h"
+#include "context.h"
 
 // ====================================================================
 // Type Defs
@@ -96,8 +98,6 @@ typedef struct {
 
 static const char default_state[] = "A=???? X=???? Y=???? SP=???? N=? V=? M=? X=? D=? I=? Z=? C=? E=? PB=?? DB=?? DP=????";
 
-static InstrType *instr_table;
-
 AddrModeType addr_mode_table[] = {
    {2,    "%1$s (%2$02X,X)"},          // INDX
    {2,    "%1$s (%2$02X),Y"},          // INDY
@@ -127,34 +127,53 @@ AddrModeType addr_mode_table[] = {
 
 static const char *fmt_imm16 = "%1$s #%3$02X%2$02X";
 
-// 6502 registers: -1 means unknown
-static int A = -1;
-static int X = -1;
-static int Y = -1;
-
-static int SH = -1;
-static int SL = -1;
-
-static int PC = -1;
-
-// 65C816 additional registers: -1 means unknown
-static int B  = -1; // Accumulator bits 15..8
-static int DP = -1; // 16-bit Direct Page Register (default to zero, otherwise ZP addressing is broken)
-static int DB = -1; // 8-bit Data Bank Register
-static int PB = -1; // 8-bit Program Bank Register
-
-// 6502 flags: -1 means unknown
-static int N = -1;
-static int V = -1;
-static int D = -1;
-static int I = -1;
-static int Z = -1;
-static int C = -1;
+// The registers and flags saved in a checkpoint, in order
+enum {
+   // 6502 registers: -1 means unknown
+   REG_A, REG_X, REG_Y, REG_SH, REG_SL, REG_PC,
+   // 65C816 additional registers: -1 means unknown
+   REG_B,   // Accumulator bits 15..8
+   REG_DP,  // 16-bit Direct Page Register (default to zero, otherwise ZP addressing is broken)
+   REG_DB,  // 8-bit Data Bank Register
+   REG_PB,  // 8-bit Program Bank Register
+   // 6502 flags: -1 means unknown
+   REG_N, REG_V, REG_D, REG_I, REG_Z, REG_C,
+   // 65C816 additional flags: -1 means unknown
+   REG_MS,  // Accumulator and Memeory Size Flag
+   REG_XS,  // Index Register Size Flag
+   REG_E,   // Emulation Mode Flag, updated by XCE
+   NUM_REGS
+};
 
-// 65C816 additional flags: -1 means unknown
-static int MS = -1; // Accumulator and Memeory Size Flag
-static int XS = -1; // Index Register Size Flag
-static int E =  -1; // Emulation Mode Flag, updated by XCE
+// The emulator state is per context (see context.h), allocated by init
+typedef struct {
+   int reg[NUM_REGS];
+   // A copy of the base table, with the extra cycles filled in
+   InstrType instr_table[256];
+} em_65816_state_t;
+
+#define STATE ((em_65816_state_t *) context->em)
+
+#define A           (STATE->reg[REG_A])
+#define X           (STATE->reg[REG_X])
+#define Y           (STATE->reg[REG_Y])
+#define SH          (STATE->reg[REG_SH])
+#define SL          (STATE->reg[REG_SL])
+#define PC          (STATE->reg[REG_PC])
+#define B           (STATE->reg[REG_B])
+#define DP          (STATE->reg[REG_DP])
+#define DB          (STATE->reg[REG_DB])
+#define PB          (STATE->reg[REG_PB])
+#define N           (STATE->reg[REG_N])
+#define V           (STATE->reg[REG_V])
+#define D           (STATE->reg[REG_D])
+#define I           (STATE->reg[REG_I])
+#define Z           (STATE->reg[REG_Z])
+#define C           (STATE->reg[REG_C])
+#define MS          (STATE->reg[REG_MS])
+#define XS          (STATE->reg[REG_XS])
+#define E           (STATE->reg[REG_E])
+#define instr_table (STATE->instr_table)
 
 static char *x1_ops[] = {
    "CPX",
@@ -202,7 +221,7 @@ static char *m2_ops[] = {
 // Forward declarations
 // ====================================================================
 
-static InstrType instr_table_65c816[];
+static const InstrType instr_table_65c816[];
 
 static void emulation_mode_on();
 static void emulation_mode_off();
@@ -359,26 +378,26 @@ static void set_NZ_MS(int value) {
    }
 }
 
-static void set_NZ_AB(int A, int B) {
+static void set_NZ_AB(int a, int b) {
    if (MS > 0) {
       // 8-bit
-      if (A >= 0) {
-         set_NZ8(A);
+      if (a >= 0) {
+         set_NZ8(a);
       } else {
          set_NZ_unknown();
       }
    } else if (MS == 0) {
       // 16-bit
-      if (A >= 0 && B >= 0) {
-         set_NZ16((B << 8) + A);
+      if (a >= 0 && b >= 0) {
+         set_NZ16((b << 8) + a);
       } else {
          // TODO: the behaviour when A is known and B is unknown could be improved
          set_NZ_unknown();
       }
    } else {
       // width unknown
-      if (A >= 0 && B >= 0) {
-         set_NZ_unknown_width((B << 8) + A);
+      if (a >= 0 && b >= 0) {
+         set_NZ_unknown_width((b << 8) + a);
       } else {
          set_NZ_unknown();
       }
@@ -558,7 +577,7 @@ static void pushMS(int value) {
    }
 }
 
-static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction, int pc_offset) {
+static void interrupt(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction, int pc_offset) {
    int i;
    int pb;
    if (num_cycles == 7) {
@@ -570,14 +589,14 @@ static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruc
       // We must be in native mode
       emulation_mode_off();
       i = 3;
-      pb = sample_q[2].data;
+      pb = bus_data(sample_q[2]);
    }
    // Parse the bus cycles
    // E=0 <opcode> <op1> <write pbr> <write pch> <write pcl> <write p> <read rst> <read rsth>
    // E=1 <opcode> <op1>             <write pch> <write pcl> <write p> <read rst> <read rsth>
-   int pc     = (sample_q[i].data << 8) + sample_q[i + 1].data;
-   int flags  = sample_q[i + 2].data;
-   int vector = (sample_q[i + 4].data << 8) + sample_q[i + 3].data;
+   int pc     = (bus_data(sample_q[i]) << 8) + bus_data(sample_q[i + 1]);
+   int flags  = bus_data(sample_q[i + 2]);
+   int vector = (bus_data(sample_q[i + 4]) << 8) + bus_data(sample_q[i + 3]);
    // Update the address of the interruted instruction
    if (pb >= 0) {
       instruction->pb = pb;
@@ -600,10 +619,10 @@ static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruc
    PC = vector;
 }
 
-static int get_8bit_cycles(sample_t *sample_q) {
-   int opcode = sample_q[0].data;
-   int op1    = sample_q[1].data;
-   int op2    = sample_q[2].data;
+static int get_8bit_cycles(bus_cycle_t *sample_q) {
+   int opcode = bus_data(sample_q[0]);
+   int op1    = bus_data(sample_q[1]);
+   int op2    = bus_data(sample_q[2]);
    InstrType *instr = &instr_table[opcode];
    int cycle_count = instr->cycles;
 
@@ -613,7 +632,7 @@ static int get_8bit_cycles(sample_t *sample_q) {
    // Account for extra cycle in a page crossing in (indirect), Y (not stores)
    // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> [ <page crossing>] <operand> [ <extra cycle in dec mode> ]
    if ((instr->mode == INDY) && (instr->optype != WRITEOP) && Y >= 0) {
-      int base = (sample_q[3 + dpextra].data << 8) + sample_q[2 + dpextra].data;
+      int base = (bus_data(sample_q[3 + dpextra]) << 8) + bus_data(sample_q[2 + dpextra]);
       if ((base & 0x1ff00) != ((base + Y) & 0x1ff00)) {
          cycle_count++;
       }
@@ -633,10 +652,10 @@ static int get_8bit_cycles(sample_t *sample_q) {
    return cycle_count + dpextra;
 }
 
-static int get_num_cycles(sample_t *sample_q, int intr_seen) {
-   int opcode = sample_q[0].data;
-   int op1    = sample_q[1].data;
-   int op2    = sample_q[2].data;
+static int get_num_cycles(bus_cycle_t *sample_q, int intr_seen) {
+   int opcode = bus_data(sample_q[0]);
+   int op1    = bus_data(sample_q[1]);
+   int op2    = bus_data(sample_q[2]);
    InstrType *instr = &instr_table[opcode];
    int cycle_count = instr->cycles;
 
@@ -688,7 +707,7 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
    // Account for extra cycle in a page crossing in (indirect), Y (not stores)
    // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> [ <page crossing>] <operand> [ <extra cycle in dec mode> ]
    if ((instr->mode == INDY) && (instr->optype != WRITEOP) && Y >= 0) {
-      int base = (sample_q[3 + dpextra].data << 8) + sample_q[2 + dpextra].data;
+      int base = (bus_data(sample_q[3 + dpextra]) << 8) + bus_data(sample_q[2 + dpextra]);
       // TODO: take account of page crossing with 16-bit Y
       if ((base & 0x1ff00) != ((base + Y) & 0x1ff00)) {
          cycle_count++;
@@ -804,33 +823,31 @@ static int get_num_cycles(sample_t *sample_q, int intr_seen) {
 }
 
 
-static int count_cycles_without_sync(sample_t *sample_q, int intr_seen) {
+static int count_cycles_without_sync(bus_cycle_t *sample_q, int intr_seen) {
    //printf("VPA/VDA must be connected in 65816 mode\n");
    //exit(1);
    int num_cycles = get_num_cycles(sample_q, intr_seen);
    if (num_cycles >= 0) {
       return num_cycles;
    }
-   printf ("cycle prediction unknown\n");
+   output_printf("cycle prediction unknown\n");
    return 1;
 }
 
-static int count_cycles_with_sync(sample_t *sample_q, int intr_seen) {
-   if (sample_q[0].type == OPCODE) {
-      for (int i = 1; i < DEPTH; i++) {
-         if (sample_q[i].type == LAST) {
-            return 0;
-         }
-         if (sample_q[i].type == OPCODE) {
-            // Validate the num_cycles passed in
-            int expected = get_num_cycles(sample_q, intr_seen);
-            if (expected >= 0) {
-               if (i != expected) {
-                  printf ("opcode %02x: cycle prediction fail: expected %d actual %d\n", sample_q[0].data, expected, i);
-               }
+static int count_cycles_with_sync(bus_cycle_t *sample_q, int intr_seen, int next_opcode) {
+   if (bus_type(sample_q[0]) == OPCODE) {
+      if (next_opcode > 0) {
+         // Validate the num_cycles passed in
+         int expected = get_num_cycles(sample_q, intr_seen);
+         if (expected >= 0) {
+            if (next_opcode != expected) {
+               output_printf("opcode %02x: cycle prediction fail: expected %d actual %d\n", bus_data(sample_q[0]), expected, next_opcode);
             }
-            return i;
          }
+         return next_opcode;
+      }
+      if (next_opcode == 0) {
+         return 0;
       }
    }
    return 1;
@@ -898,12 +915,17 @@ static int get_accumulator() {
 // ====================================================================
 
 static void em_65816_init(arguments_t *args) {
+   free(context->em);
+   context->em = malloc(sizeof(em_65816_state_t));
+   for (int i = 0; i < NUM_REGS; i++) {
+      STATE->reg[i] = -1;
+   }
    switch (args->cpu_type) {
    case CPU_65C816:
-      instr_table = instr_table_65c816;
+      memcpy(instr_table, instr_table_65c816, sizeof(instr_table));
       break;
    default:
-      printf("em_65816_init called with unsupported cpu_type (%d)\n", args->cpu_type);
+      output_printf("em_65816_init called with unsupported cpu_type (%d)\n", args->cpu_type);
       exit(1);
    }
    if (args->e_flag >= 0) {
@@ -969,14 +991,14 @@ static void em_65816_init(arguments_t *args) {
    }
 }
 
-static int em_65816_match_interrupt(sample_t *sample_q, int num_samples) {
+static int em_65816_match_interrupt(bus_cycle_t *sample_q, int num_samples) {
    // Check we have enough valid samples
    if (num_samples < 7) {
       return 0;
    }
    // Check the cycle has the right structure
    for (int i = 1; i < 7; i++) {
-      if (sample_q[i].type == OPCODE) {
+      if (bus_type(sample_q[i]) == OPCODE) {
          return 0;
       }
    }
@@ -984,23 +1006,23 @@ static int em_65816_match_interrupt(sample_t *sample_q, int num_samples) {
    // In native mode an interupt will write PBR, PCH, PCL, PSW in bus cycles 2,3,4,5
    //
    // TODO: the heuristic only works in emulation mode
-   if (sample_q[0].rnw >= 0) {
+   if (bus_rnw(sample_q[0]) >= 0) {
       // If we have the RNW pin connected, then just look for these three writes in succession
       // Currently can't detect a BRK or COP being interrupted
-      if (sample_q[0].data == 0x00 || sample_q[0].data == 0x02) {
+      if (bus_data(sample_q[0]) == 0x00 || bus_data(sample_q[0]) == 0x02) {
          return 0;
       }
-      if (sample_q[2].rnw == 0 && sample_q[3].rnw == 0 && sample_q[4].rnw == 0) {
+      if (bus_rnw(sample_q[2]) == 0 && bus_rnw(sample_q[3]) == 0 && bus_rnw(sample_q[4]) == 0) {
          return 1;
       }
    } else {
       // If not, then we use a heuristic, based on what we expect to see on the data
       // bus in cycles 2, 3 and 4, i.e. PCH, PCL, PSW
-      if (sample_q[2].data == ((PC >> 8) & 0xff) && sample_q[3].data == (PC & 0xff)) {
+      if (bus_data(sample_q[2]) == ((PC >> 8) & 0xff) && bus_data(sample_q[3]) == (PC & 0xff)) {
          // Now test unused flag is 1, B is 0
-         if ((sample_q[4].data & 0x30) == 0x20) {
+         if ((bus_data(sample_q[4]) & 0x30) == 0x20) {
             // Finally test all other known flags match
-            if (!compare_FLAGS(sample_q[4].data)) {
+            if (!compare_FLAGS(bus_data(sample_q[4]))) {
                // Matched PSW = NV-BDIZC
                return 1;
             }
@@ -1010,15 +1032,15 @@ static int em_65816_match_interrupt(sample_t *sample_q, int num_samples) {
    return 0;
 }
 
-static int em_65816_count_cycles(sample_t *sample_q, int intr_seen) {
-   if (sample_q[0].type == UNKNOWN) {
+static int em_65816_count_cycles(bus_cycle_t *sample_q, int intr_seen, int next_opcode) {
+   if (bus_type(sample_q[0]) == UNKNOWN) {
       return count_cycles_without_sync(sample_q, intr_seen);
    } else {
-      return count_cycles_with_sync(sample_q, intr_seen);
+      return count_cycles_with_sync(sample_q, intr_seen, next_opcode);
    }
 }
 
-static void em_65816_reset(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_65816_reset(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {
    instruction->pc = -1;
    A = -1;
    X = -1;
@@ -1040,23 +1062,23 @@ static void em_65816_reset(sample_t *sample_q, int num_cycles, instruction_t *in
    E = 1;
    emulation_mode_on();
    // Program Counter
-   PC = (sample_q[num_cycles - 1].data << 8) + sample_q[num_cycles - 2].data;
+   PC = (bus_data(sample_q[num_cycles - 1]) << 8) + bus_data(sample_q[num_cycles - 2]);
 }
 
-static void em_65816_interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_65816_interrupt(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {
    interrupt(sample_q, num_cycles, instruction, 0);
 }
 
-static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_65816_emulate(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {
 
    // Unpack the instruction bytes
-   int opcode = sample_q[0].data;
+   int opcode = bus_data(sample_q[0]);
 
    // Update the E flag if this e pin is being sampled
-   int new_E = sample_q[0].e;
+   int new_E = bus_e(sample_q[0]);
    if (new_E >= 0 && E != new_E) {
       if (E >= 0) {
-         printf("correcting e flag\n");
+         output_printf("correcting e flag\n");
          failflag |= 1;
       }
       E = new_E;
@@ -1091,12 +1113,12 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
    }
    opcount += instr->len - 1;
 
-   int op1 = (opcount < 1) ? 0 : sample_q[1].data;
+   int op1 = (opcount < 1) ? 0 : bus_data(sample_q[1]);
 
    // Special case JSR (IND16, X)
-   int op2 = (opcount < 2) ? 0 : (opcode == 0xFC) ? sample_q[4].data : sample_q[2].data;
+   int op2 = (opcount < 2) ? 0 : (opcode == 0xFC) ? bus_data(sample_q[4]) : bus_data(sample_q[2]);
 
-   int op3 = (opcount < 3) ? 0 : sample_q[(opcode == 0x22) ? 5 : 3].data;
+   int op3 = (opcount < 3) ? 0 : bus_data(sample_q[(opcode == 0x22) ? 5 : 3]);
 
    // Memory Modelling: Instruction fetches
    if (PB >= 0 && PC >= 0) {
@@ -1130,12 +1152,12 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       return;
    } else if (opcode == 0x20) {
       // JSR: <opcode> <op1> <op2> <read dummy> <write pch> <write pcl>
-      instruction->pc = (((sample_q[4].data << 8) + sample_q[5].data) - 2) & 0xffff;
+      instruction->pc = (((bus_data(sample_q[4]) << 8) + bus_data(sample_q[5])) - 2) & 0xffff;
       instruction->pb = PB;
    } else if (opcode == 0x22) {
       // JSL: <opcode> <op1> <op2> <write pbr> <read dummy> <op3> <write pch> <write pcl>
-      instruction->pc = (((sample_q[6].data << 8) + sample_q[7].data) - 3) & 0xffff;
-      instruction->pb = sample_q[3].data;
+      instruction->pc = (((bus_data(sample_q[6]) << 8) + bus_data(sample_q[7])) - 3) & 0xffff;
+      instruction->pb = bus_data(sample_q[3]);
    } else {
       instruction->pc = PC;
       instruction->pb = PB;
@@ -1156,11 +1178,11 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> [ <page crossing>] <operand>
       if (DP >= 0) {
          if (wrap) {
-            memory_read(sample_q[2 + dpextra].data, (DP & 0xFF00) +                op1, MEM_POINTER);
-            memory_read(sample_q[3 + dpextra].data, (DP & 0xFF00) + ((op1 + 1) & 0xff), MEM_POINTER);
+            memory_read(bus_data(sample_q[2 + dpextra]), (DP & 0xFF00) +                op1, MEM_POINTER);
+            memory_read(bus_data(sample_q[3 + dpextra]), (DP & 0xFF00) + ((op1 + 1) & 0xff), MEM_POINTER);
          } else {
-            memory_read(sample_q[2 + dpextra].data, (DP + op1    ) & 0xffff, MEM_POINTER);
-            memory_read(sample_q[3 + dpextra].data, (DP + op1 + 1) & 0xffff, MEM_POINTER);
+            memory_read(bus_data(sample_q[2 + dpextra]), (DP + op1    ) & 0xffff, MEM_POINTER);
+            memory_read(bus_data(sample_q[3 + dpextra]), (DP + op1 + 1) & 0xffff, MEM_POINTER);
          }
       }
       break;
@@ -1184,15 +1206,15 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // <opcode> <op1> [ <dpextra> ] <dummy> <addrlo> <addrhi> <operand>
       if (DP >= 0 && X >= 0) {
          if (wrap) {
-            memory_read(sample_q[3 + dpextra].data, (DP & 0xFF00) + ((op1 + X    ) & 0xff), MEM_POINTER);
-            memory_read(sample_q[4 + dpextra].data, (DP & 0xFF00) + ((op1 + X + 1) & 0xff), MEM_POINTER);
+            memory_read(bus_data(sample_q[3 + dpextra]), (DP & 0xFF00) + ((op1 + X    ) & 0xff), MEM_POINTER);
+            memory_read(bus_data(sample_q[4 + dpextra]), (DP & 0xFF00) + ((op1 + X + 1) & 0xff), MEM_POINTER);
          } else {
-            memory_read(sample_q[3 + dpextra].data, (DP + op1 + X) & 0xffff, MEM_POINTER);
+            memory_read(bus_data(sample_q[3 + dpextra]), (DP + op1 + X) & 0xffff, MEM_POINTER);
             if (E) {
                // This one is very strange, see above cooment
-               memory_read(sample_q[4 + dpextra].data, ((DP + op1 + X) & 0xff00) + ((DP + op1 + X + 1) & 0xff), MEM_POINTER);
+               memory_read(bus_data(sample_q[4 + dpextra]), ((DP + op1 + X) & 0xff00) + ((DP + op1 + X + 1) & 0xff), MEM_POINTER);
             } else {
-               memory_read(sample_q[4 + dpextra].data, (DP + op1 + X + 1) & 0xffff, MEM_POINTER);
+               memory_read(bus_data(sample_q[4 + dpextra]), (DP + op1 + X + 1) & 0xffff, MEM_POINTER);
             }
          }
       }
@@ -1201,11 +1223,11 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // <opcode> <op1>  [ <dpextra> ] <addrlo> <addrhi> <operand>
       if (DP >= 0) {
          if (wrap) {
-            memory_read(sample_q[2 + dpextra].data, (DP & 0xFF00) + op1               , MEM_POINTER);
-            memory_read(sample_q[3 + dpextra].data, (DP & 0xFF00) + ((op1 + 1) & 0xff), MEM_POINTER);
+            memory_read(bus_data(sample_q[2 + dpextra]), (DP & 0xFF00) + op1               , MEM_POINTER);
+            memory_read(bus_data(sample_q[3 + dpextra]), (DP & 0xFF00) + ((op1 + 1) & 0xff), MEM_POINTER);
          } else {
-            memory_read(sample_q[2 + dpextra].data, (DP + op1    ) & 0xffff, MEM_POINTER);
-            memory_read(sample_q[3 + dpextra].data, (DP + op1 + 1) & 0xffff, MEM_POINTER);
+            memory_read(bus_data(sample_q[2 + dpextra]), (DP + op1    ) & 0xffff, MEM_POINTER);
+            memory_read(bus_data(sample_q[3 + dpextra]), (DP + op1 + 1) & 0xffff, MEM_POINTER);
          }
       }
       break;
@@ -1213,47 +1235,47 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // e.g. LDA (08, S),Y
       // <opcode> <op1> <internal> <addrlo> <addrhi> <internal> <operand>
       if (SL >= 0 && SH >= 0) {
-         memory_read(sample_q[3].data, ((SH << 8) + SL + op1    ) & 0xffff, MEM_POINTER);
-         memory_read(sample_q[4].data, ((SH << 8) + SL + op1 + 1) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[3]), ((SH << 8) + SL + op1    ) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[4]), ((SH << 8) + SL + op1 + 1) & 0xffff, MEM_POINTER);
       }
       break;
    case IDL:
       // e.g. LDA [80]
       // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> <bank> <operand>
       if (DP >= 0) {
-         memory_read(sample_q[2 + dpextra].data, (DP + op1    ) & 0xffff, MEM_POINTER);
-         memory_read(sample_q[3 + dpextra].data, (DP + op1 + 1) & 0xffff, MEM_POINTER);
-         memory_read(sample_q[4 + dpextra].data, (DP + op1 + 2) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[2 + dpextra]), (DP + op1    ) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[3 + dpextra]), (DP + op1 + 1) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[4 + dpextra]), (DP + op1 + 2) & 0xffff, MEM_POINTER);
       }
       break;
    case IDLY:
       // e.g. LDA [80],Y
       // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> <bank> <operand>
       if (DP >= 0) {
-         memory_read(sample_q[2 + dpextra].data, (DP + op1    ) & 0xffff, MEM_POINTER);
-         memory_read(sample_q[3 + dpextra].data, (DP + op1 + 1) & 0xffff, MEM_POINTER);
-         memory_read(sample_q[4 + dpextra].data, (DP + op1 + 2) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[2 + dpextra]), (DP + op1    ) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[3 + dpextra]), (DP + op1 + 1) & 0xffff, MEM_POINTER);
+         memory_read(bus_data(sample_q[4 + dpextra]), (DP + op1 + 2) & 0xffff, MEM_POINTER);
       }
       break;
    case IAL:
       // e.g. JMP [$1234] (this is the only one)
       // <opcode> <op1> <op2> <addrlo> <addrhi> <bank>
-      memory_read(sample_q[3].data,  (op2 << 8) + op1              , MEM_POINTER);
-      memory_read(sample_q[4].data, ((op2 << 8) + op1 + 1) & 0xffff, MEM_POINTER);
-      memory_read(sample_q[5].data, ((op2 << 8) + op1 + 2) & 0xffff, MEM_POINTER);
+      memory_read(bus_data(sample_q[3]),  (op2 << 8) + op1              , MEM_POINTER);
+      memory_read(bus_data(sample_q[4]), ((op2 << 8) + op1 + 1) & 0xffff, MEM_POINTER);
+      memory_read(bus_data(sample_q[5]), ((op2 << 8) + op1 + 2) & 0xffff, MEM_POINTER);
       break;
    case IND16:
       // e.g. JMP (1234)
       // <opcode> <op1> <op2> <addrlo> <addrhi>
-      memory_read(sample_q[3].data,  (op2 << 8) + op1              , MEM_POINTER);
-      memory_read(sample_q[4].data, ((op2 << 8) + op1 + 1) & 0xffff, MEM_POINTER);
+      memory_read(bus_data(sample_q[3]),  (op2 << 8) + op1              , MEM_POINTER);
+      memory_read(bus_data(sample_q[4]), ((op2 << 8) + op1 + 1) & 0xffff, MEM_POINTER);
       break;
    case IND1X:
       // JMP: <opcode=6C> <op1> <op2> <read new pcl> <read new pch>
       // JSR: <opcode=FC> <op1> <write pch> <write pcl> <op2> <internal> <read new pcl> <read new pch>
       if (PB >= 0 && X >= 0) {
-         memory_read(sample_q[num_cycles - 2].data, (PB << 16) + (((op2 << 8) + op1 + X    ) & 0xffff), MEM_POINTER);
-         memory_read(sample_q[num_cycles - 1].data, (PB << 16) + (((op2 << 8) + op1 + X + 1) & 0xffff), MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 2]), (PB << 16) + (((op2 << 8) + op1 + X    ) & 0xffff), MEM_POINTER);
+         memory_read(bus_data(sample_q[num_cycles - 1]), (PB << 16) + (((op2 << 8) + op1 + X + 1) & 0xffff), MEM_POINTER);
       }
       break;
    default:
@@ -1270,13 +1292,13 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // MS == 1:       <opcode> <op1> <op2> <read lo> <read hi> <dummy> <write hi> <write lo>
       // MS == 0:       <opcode> <op1> <op2> <read> <dummy> <write>
       if (E == 1) {
-         operand = sample_q[num_cycles - 2].data;
+         operand = bus_data(sample_q[num_cycles - 2]);
       } else if (MS == 0) {
          // 16-bit mode
-         operand = (sample_q[num_cycles - 4].data << 8) + sample_q[num_cycles - 5].data;
+         operand = (bus_data(sample_q[num_cycles - 4]) << 8) + bus_data(sample_q[num_cycles - 5]);
       } else {
          // 8-bit mode
-         operand = sample_q[num_cycles - 3].data;
+         operand = bus_data(sample_q[num_cycles - 3]);
       }
    } else if (instr->optype == BRANCHOP) {
       // the operand is true if branch taken
@@ -1284,37 +1306,37 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
    } else if (opcode == 0x20) {
       // JSR abs: the operand is the data pushed to the stack (PCH, PCL)
       // <opcode> <op1> <op2> <read dummy> <write pch> <write pcl>
-      operand = (sample_q[4].data << 8) + sample_q[5].data;
+      operand = (bus_data(sample_q[4]) << 8) + bus_data(sample_q[5]);
    } else if (opcode == 0xfc) {
       // JSR (IND, X): the operand is the data pushed to the stack (PCH, PCL)
       // <opcode> <op1> <write pch> <write pcl> <op2> <internal> <read new pcl> <read new pch>
-      operand = (sample_q[2].data << 8) + sample_q[3].data;
+      operand = (bus_data(sample_q[2]) << 8) + bus_data(sample_q[3]);
    } else if (opcode == 0x22) {
       // JSL: the operand is the data pushed to the stack (PCB, PCH, PCL)
       // <opcode> <op1> <op2> <write pbr> <read dummy> <op3> <write pch> <write pcl>
-      operand = (sample_q[3].data << 16) + (sample_q[6].data << 8) + sample_q[7].data;
+      operand = (bus_data(sample_q[3]) << 16) + (bus_data(sample_q[6]) << 8) + bus_data(sample_q[7]);
    } else if (opcode == 0x40) {
       // RTI: the operand is the data pulled from the stack (P, PCL, PCH)
       // E=0: <opcode> <op1> <read dummy> <read p> <read pcl> <read pch> <read pbr>
       // E=1: <opcode> <op1> <read dummy> <read p> <read pcl> <read pch>
-      operand = (sample_q[5].data << 16) +  (sample_q[4].data << 8) + sample_q[3].data;
+      operand = (bus_data(sample_q[5]) << 16) +  (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
       if (num_cycles == 6) {
          emulation_mode_on();
       } else {
          emulation_mode_off();
-         operand |= (sample_q[6].data << 24);
+         operand |= (bus_data(sample_q[6]) << 24);
       }
    } else if (opcode == 0x60) {
       // RTS: the operand is the data pulled from the stack (PCL, PCH)
       // <opcode> <op1> <read dummy> <read pcl> <read pch> <read dummy>
-      operand = (sample_q[4].data << 8) + sample_q[3].data;
+      operand = (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
    } else if (opcode == 0x6B) {
       // RTL: the operand is the data pulled from the stack (PCL, PCH, PBR)
       // <opcode> <op1> <read dummy> <read pcl> <read pch> <read pbr>
-      operand = (sample_q[5].data << 16) + (sample_q[4].data << 8) + sample_q[3].data;
+      operand = (bus_data(sample_q[5]) << 16) + (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
    } else if (instr->mode == BM) {
       // Block Move
-      operand = sample_q[3].data;
+      operand = bus_data(sample_q[3]);
    } else if (instr->mode == IMM) {
       // Immediate addressing mode: the operand is the 2nd byte of the instruction
       operand = (op2 << 8) + op1;
@@ -1325,14 +1347,14 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
          // 16-bit operation
          if (opcode == 0x48 || opcode == 0x5A || opcode == 0xDA || opcode == 0x0B || opcode == 0xD4) {
             // PHA/PHX/PHY/PHD push high byte followed by low byte
-            operand = sample_q[num_cycles - 1].data + (sample_q[num_cycles - 2].data << 8);
+            operand = bus_data(sample_q[num_cycles - 1]) + (bus_data(sample_q[num_cycles - 2]) << 8);
          } else {
             // all other 16-bit ops are low byte then high byer
-            operand = sample_q[num_cycles - 2].data + (sample_q[num_cycles - 1].data << 8);
+            operand = bus_data(sample_q[num_cycles - 2]) + (bus_data(sample_q[num_cycles - 1]) << 8);
          }
       } else {
          // 8-bit operation
-         operand = sample_q[num_cycles - 1].data;
+         operand = bus_data(sample_q[num_cycles - 1]);
       }
    }
 
@@ -1342,17 +1364,17 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
    if (instr->optype == RMWOP) {
       if (E == 0 && ((instr->m_extra && (MS == 0)) || (instr->x_extra && (XS == 0)))) {
          // 16-bit - byte ordering is high then low
-         operand2 = (sample_q[num_cycles - 2].data << 8) + sample_q[num_cycles - 1].data;
+         operand2 = (bus_data(sample_q[num_cycles - 2]) << 8) + bus_data(sample_q[num_cycles - 1]);
       } else {
          // 8-bit
-         operand2 = sample_q[num_cycles - 1].data;
+         operand2 = bus_data(sample_q[num_cycles - 1]);
       }
    } else if (instr->optype == WRITEOP) {
       if (E == 0 && ((instr->m_extra && (MS == 0)) || (instr->x_extra && (XS == 0)))) {
          // 16-bit - byte ordering is low then high
-         operand2 = (sample_q[num_cycles - 1].data << 8) + sample_q[num_cycles - 2].data;
+         operand2 = (bus_data(sample_q[num_cycles - 1]) << 8) + bus_data(sample_q[num_cycles - 2]);
       } else {
-         operand2 = sample_q[num_cycles - 1].data;
+         operand2 = bus_data(sample_q[num_cycles - 1]);
       }
    }
 
@@ -1381,20 +1403,20 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> [ <page crossing>] <operand>
       index = Y;
       if (index >= 0 && DB >= 0) {
-         ea = (sample_q[3 + dpextra].data << 8) + sample_q[2 + dpextra].data;
+         ea = (bus_data(sample_q[3 + dpextra]) << 8) + bus_data(sample_q[2 + dpextra]);
          ea = ((DB << 16) + ea + index) & 0xffffff;
       }
       break;
    case INDX:
       // <opcode> <op1> [ <dpextra> ] <dummy> <addrlo> <addrhi> <operand>
       if (DB >= 0) {
-         ea = (DB << 16) + (sample_q[4 + dpextra].data << 8) + sample_q[3 + dpextra].data;
+         ea = (DB << 16) + (bus_data(sample_q[4 + dpextra]) << 8) + bus_data(sample_q[3 + dpextra]);
       }
       break;
    case IND:
       // <opcode> <op1>  [ <dpextra> ] <addrlo> <addrhi> <operand>
       if (DB >= 0) {
-         ea = (DB << 16) + (sample_q[3 + dpextra].data << 8) + sample_q[2 + dpextra].data;
+         ea = (DB << 16) + (bus_data(sample_q[3 + dpextra]) << 8) + bus_data(sample_q[2 + dpextra]);
       }
       break;
    case ABS:
@@ -1425,21 +1447,21 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // <opcode> <op1> <internal> <addrlo> <addrhi> <internal> <operand>
       index = Y;
       if (index >= 0 && DB >= 0) {
-         ea = (DB << 16) + (sample_q[4].data << 8) + sample_q[3].data;
+         ea = (DB << 16) + (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
          ea = (ea + index) & 0xffffff;
       }
       break;
    case IDL:
       // e.g. LDA [80]
       // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> <bank> <operand>
-      ea = (sample_q[4 + dpextra].data << 16) + (sample_q[3 + dpextra].data << 8) + sample_q[2 + dpextra].data;
+      ea = (bus_data(sample_q[4 + dpextra]) << 16) + (bus_data(sample_q[3 + dpextra]) << 8) + bus_data(sample_q[2 + dpextra]);
       break;
    case IDLY:
       // e.g. LDA [80],Y
       // <opcode> <op1> [ <dpextra> ] <addrlo> <addrhi> <bank> <operand>
       index = Y;
       if (index >= 0) {
-         ea = (sample_q[4 + dpextra].data << 16) + (sample_q[3 + dpextra].data << 8) + sample_q[2 + dpextra].data;
+         ea = (bus_data(sample_q[4 + dpextra]) << 16) + (bus_data(sample_q[3 + dpextra]) << 8) + bus_data(sample_q[2 + dpextra]);
          ea = (ea + index) & 0xffffff;
       }
       break;
@@ -1456,7 +1478,7 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
    case IAL:
       // e.g. JMP [$1234] (this is the only one)
       // <opcode> <op1> <op2> <addrlo> <addrhi> <bank>
-      ea = (sample_q[5].data << 16) + (sample_q[4].data << 8) + sample_q[3].data;
+      ea = (bus_data(sample_q[5]) << 16) + (bus_data(sample_q[4]) << 8) + bus_data(sample_q[3]);
       break;
    case BRL:
       // e.g. PER 1234 or BRL 1234
@@ -1500,6 +1522,7 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
       // Execute the instruction specific function
       // (This returns -1 if the result is unknown or invalid)
       int result = instr->emulate(operand, ea);
+      instruction->ea = ea;
 
       if (instr->optype == WRITEOP || instr->optype == RMWOP) {
 
@@ -1530,13 +1553,13 @@ static void em_65816_emulate(sample_t *sample_q, int num_cycles, instruction_t *
    if (opcode == 0x40) {
       // E=0: <opcode> <op1> <read dummy> <read p> <read pcl> <read pch> <read pbr>
       // E=1: <opcode> <op1> <read dummy> <read p> <read pcl> <read pch>
-      PC = sample_q[4].data | (sample_q[5].data << 8);
+      PC = bus_data(sample_q[4]) | (bus_data(sample_q[5]) << 8);
       if (E == 0) {
-         PB = sample_q[6].data;
+         PB = bus_data(sample_q[6]);
       }
    } else if (opcode == 0x6c || opcode == 0x7c || opcode == 0xfc ) {
       // JMP (ind), JMP (ind, X), JSR (ind, X)
-      PC = (sample_q[num_cycles - 1].data << 8) | sample_q[num_cycles - 2].data;
+      PC = (bus_data(sample_q[num_cycles - 1]) << 8) | bus_data(sample_q[num_cycles - 2]);
    } else if (opcode == 0x20 || opcode == 0x4c) {
       // JSR abs, JMP abs
       // Don't use ea here as it includes PB which may be unknown
@@ -1658,75 +1681,129 @@ static int em_65816_get_PB() {
    return PB;
 }
 
+static int em_65816_get_length(int opcode) {
+   return instr_table[opcode].len;
+}
+
 static int em_65816_read_memory(int address) {
    return memory_read_raw(address);
 }
 
-static char *em_65816_get_state(char *buffer) {
+static char *em_65816_write_state(char *buffer, const int *reg) {
    strcpy(buffer, default_state);
-   if (B >= 0) {
-      write_hex2(buffer + OFFSET_B, B);
+   if (reg[REG_B] >= 0) {
+      write_hex2(buffer + OFFSET_B, reg[REG_B]);
    }
-   if (A >= 0) {
-      write_hex2(buffer + OFFSET_A, A);
+   if (reg[REG_A] >= 0) {
+      write_hex2(buffer + OFFSET_A, reg[REG_A]);
    }
-   if (X >= 0) {
-      write_hex4(buffer + OFFSET_X, X);
+   if (reg[REG_X] >= 0) {
+      write_hex4(buffer + OFFSET_X, reg[REG_X]);
    }
-   if (Y >= 0) {
-      write_hex4(buffer + OFFSET_Y, Y);
+   if (reg[REG_Y] >= 0) {
+      write_hex4(buffer + OFFSET_Y, reg[REG_Y]);
    }
-   if (SH >= 0) {
-      write_hex2(buffer + OFFSET_SH, SH);
+   if (reg[REG_SH] >= 0) {
+      write_hex2(buffer + OFFSET_SH, reg[REG_SH]);
    }
-   if (SL >= 0) {
-      write_hex2(buffer + OFFSET_SL, SL);
+   if (reg[REG_SL] >= 0) {
+      write_hex2(buffer + OFFSET_SL, reg[REG_SL]);
    }
-   if (N >= 0) {
-      buffer[OFFSET_N] = '0' + N;
+   if (reg[REG_N] >= 0) {
+      buffer[OFFSET_N] = '0' + reg[REG_N];
    }
-   if (V >= 0) {
-      buffer[OFFSET_V] = '0' + V;
+   if (reg[REG_V] >= 0) {
+      buffer[OFFSET_V] = '0' + reg[REG_V];
    }
-   if (MS >= 0) {
-      buffer[OFFSET_MS] = '0' + MS;
+   if (reg[REG_MS] >= 0) {
+      buffer[OFFSET_MS] = '0' + reg[REG_MS];
    }
-   if (XS >= 0) {
-      buffer[OFFSET_XS] = '0' + XS;
+   if (reg[REG_XS] >= 0) {
+      buffer[OFFSET_XS] = '0' + reg[REG_XS];
    }
-   if (D >= 0) {
-      buffer[OFFSET_D] = '0' + D;
+   if (reg[REG_D] >= 0) {
+      buffer[OFFSET_D] = '0' + reg[REG_D];
    }
-   if (I >= 0) {
-      buffer[OFFSET_I] = '0' + I;
+   if (reg[REG_I] >= 0) {
+      buffer[OFFSET_I] = '0' + reg[REG_I];
    }
-   if (Z >= 0) {
-      buffer[OFFSET_Z] = '0' + Z;
+   if (reg[REG_Z] >= 0) {
+      buffer[OFFSET_Z] = '0' + reg[REG_Z];
    }
-   if (C >= 0) {
-      buffer[OFFSET_C] = '0' + C;
+   if (reg[REG_C] >= 0) {
+      buffer[OFFSET_C] = '0' + reg[REG_C];
    }
-   if (E >= 0) {
-      buffer[OFFSET_E] = '0' + E;
+   if (reg[REG_E] >= 0) {
+      buffer[OFFSET_E] = '0' + reg[REG_E];
    }
-   if (PB >= 0) {
-      write_hex2(buffer + OFFSET_PB, PB);
+   if (reg[REG_PB] >= 0) {
+      write_hex2(buffer + OFFSET_PB, reg[REG_PB]);
    }
-   if (DB >= 0) {
-      write_hex2(buffer + OFFSET_DB, DB);
+   if (reg[REG_DB] >= 0) {
+      write_hex2(buffer + OFFSET_DB, reg[REG_DB]);
    }
-   if (DP >= 0) {
-      write_hex4(buffer + OFFSET_DP, DP);
+   if (reg[REG_DP] >= 0) {
+      write_hex4(buffer + OFFSET_DP, reg[REG_DP]);
    }
    return buffer + OFFSET_END;
 }
 
+static char *em_65816_get_state(char *buffer) {
+   return em_65816_write_state(buffer, STATE->reg);
+}
+
 static int em_65816_get_and_clear_fail() {
    int ret = failflag;
    failflag = 0;
    return ret;
 }
 
+static int em_65816_save_state(int *buffer) {
+   memcpy(buffer, STATE->reg, sizeof(STATE->reg));
+   return NUM_REGS;
+}
+
+static void em_65816_restore_state(const int *buffer) {
+   memcpy(STATE->reg, buffer, sizeof(STATE->reg));
+}
+
+static int em_65816_step(bus_cycle_t *sample_q, int num_samples, int rst_seen, step_t *step) {
+   instruction_t *instruction = step->instruction;
+
+   int intr_seen = em_65816_match_interrupt(sample_q, num_samples);
+
+   int num_cycles = (rst_seen > 0) ? rst_seen : em_65816_count_cycles(sample_q, intr_seen, step->next_opcode);
+
+   // Deal with partial final instruction
+   if (num_samples <= num_cycles || num_cycles == 0) {
+      step->num_cycles = 0;
+      return 0;
+   }
+
+   if (step->before) {
+      step->before(num_cycles);
+   }
+
+   step->kind  = (intr_seen ? STEP_INTERRUPT : 0) | (rst_seen ? STEP_RESET : 0);
+   step->oldpc = PC;
+   step->oldpb = PB;
+   instruction->ea = -1;
+
+   if (rst_seen) {
+      em_65816_reset(sample_q, num_cycles, instruction);
+   } else if (intr_seen) {
+      em_65816_interrupt(sample_q, num_cycles, instruction);
+   } else {
+      em_65816_emulate(sample_q, num_cycles, instruction);
+   }
+
+   step->num_cycles = num_cycles;
+   step->fail = failflag;
+   failflag = 0;
+   step->num_state = em_65816_save_state(step->state);
+   return num_cycles;
+}
+
 cpu_emulator_t em_65816 = {
    .init = em_65816_init,
    .match_interrupt = em_65816_match_interrupt,
@@ -1737,9 +1814,14 @@ cpu_emulator_t em_65816 = {
    .disassemble = em_65816_disassemble,
    .get_PC = em_65816_get_PC,
    .get_PB = em_65816_get_PB,
+   .get_length = em_65816_get_length,
    .read_memory = em_65816_read_memory,
    .get_state = em_65816_get_state,
+   .write_state = em_65816_write_state,
    .get_and_clear_fail = em_65816_get_and_clear_fail,
+   .save_state = em_65816_save_state,
+   .restore_state = em_65816_restore_state,
+   .step = em_65816_step
 };
 
 // ====================================================================
@@ -1829,9 +1911,9 @@ static int op_MV(int data, int sba, int dba, int dir) {
       memory_write(data, (dba << 16) + Y, MEM_DATA);
    }
    if (A >= 0 && B >= 0) {
-      int C = (((B << 8) | A) - 1) & 0xffff;
-      A = C & 0xff;
-      B = (C >> 8) & 0xff;
+      int count = (((B << 8) | A) - 1) & 0xffff;
+      A = count & 0xff;
+      B = (count >> 8) & 0xff;
       if (XS > 0) {
          // 8-bit mode
          if (X >= 0) {
@@ -1855,7 +1937,7 @@ static int op_MV(int data, int sba, int dba, int dir) {
          X = -1;
          Y = -1;
       }
-      if (PC >= 0 && C != 0xffff) {
+      if (PC >= 0 && count != 0xffff) {
          PC -= 3;
       }
    } else {
@@ -3033,7 +3115,7 @@ static int op_TYA(operand_t operand, ea_t ea) {
 // ====================================================================
 
 
-static InstrType instr_table_65c816[] = {
+static const InstrType instr_table_65c816[] = {
    /* 00 */   { "BRK",  0, IMM   , 7, 0, OTHER,    0},
    /* 01 */   { "ORA",  0, INDX  , 6, 0, READOP,   op_ORA},
    /* 02 */   { "COP",  0, IMM   , 7, 1, OTHER,    0},
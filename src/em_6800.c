@@ -4,6 +4,8 @@
 #include <inttypes.h>
 #include "memory.h"
 #include "em_6800.h"
+#include "output.h"
+#include "context.h"
 
 // ====================================================================
 // TODO:
@@ -56,7 +58,7 @@ typedef struct {
    AddrMode mode;
    int cycles;
    OpType optype;
-   int (*emulate)(operand_t, ea_t, sample_t *);
+   int (*emulate)(operand_t, ea_t, bus_cycle_t *);
    int len;
    const char *fmt;
 } InstrType;
@@ -80,8 +82,6 @@ typedef struct {
 
 static const char default_state[] = "A=?? B=?? X=???? SP=???? H=? I=? N=? Z=? V=? C=?";
 
-static InstrType *instr_table;
-
 static AddrModeType addr_mode_table[] = {
    {1,    "%1$s"},                  // IMP
    {1,    "%1$s"},                  // ACC
@@ -96,20 +96,36 @@ static AddrModeType addr_mode_table[] = {
    {2,    "%1$s %2$s"}              // REL
 };
 
-// 6800 registers: -1 means unknown
-static int A = -1;
-static int B = -1;
-static int X = -1;
-static int S = -1;
-static int PC = -1;
-
-// 6800 flags: -1 means unknown
-static int H = -1;
-static int I = -1;
-static int N = -1;
-static int Z = -1;
-static int V = -1;
-static int C = -1;
+// The registers and flags saved in a checkpoint, in order
+enum {
+   // 6800 registers: -1 means unknown
+   REG_A, REG_B, REG_X, REG_S, REG_PC,
+   // 6800 flags: -1 means unknown
+   REG_H, REG_I, REG_N, REG_Z, REG_V, REG_C,
+   NUM_REGS
+};
+
+// The emulator state is per context (see context.h), allocated by init
+typedef struct {
+   int reg[NUM_REGS];
+   // A copy of the base table, patched for the options
+   InstrType instr_table[256];
+} em_6800_state_t;
+
+#define STATE ((em_6800_state_t *) context->em)
+
+#define A           (STATE->reg[REG_A])
+#define B           (STATE->reg[REG_B])
+#define X           (STATE->reg[REG_X])
+#define S           (STATE->reg[REG_S])
+#define PC          (STATE->reg[REG_PC])
+#define H           (STATE->reg[REG_H])
+#define I           (STATE->reg[REG_I])
+#define N           (STATE->reg[REG_N])
+#define Z           (STATE->reg[REG_Z])
+#define V           (STATE->reg[REG_V])
+#define C           (STATE->reg[REG_C])
+#define instr_table (STATE->instr_table)
 
 static char ILLEGAL[] = "???  ";
 
@@ -125,7 +141,7 @@ static int jsr_idx_pch = 4;
 // Forward declarations
 // ====================================================================
 
-static InstrType instr_table_6800[];
+static const InstrType instr_table_6800[];
 
 // ====================================================================
 // Helper Methods
@@ -248,15 +264,15 @@ static void push16(int value) {
    push8(value >> 8);
 }
 
-static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction, int pc_offset) {
+static void interrupt(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction, int pc_offset) {
    // Parse the bus cycles
    // <opcode> <op1> <write pch> <write pcl> <write p> <read rst> <read rsth>
-   int pc     = sample_q[2].data + (sample_q[3].data << 8);
-   int x      = sample_q[4].data + (sample_q[5].data << 8);
-   int a      = sample_q[6].data;
-   int b      = sample_q[7].data;
-   int flags  = sample_q[8].data;
-   int vector = (sample_q[10].data << 8) + sample_q[11].data;
+   int pc     = bus_data(sample_q[2]) + (bus_data(sample_q[3]) << 8);
+   int x      = bus_data(sample_q[4]) + (bus_data(sample_q[5]) << 8);
+   int a      = bus_data(sample_q[6]);
+   int b      = bus_data(sample_q[7]);
+   int flags  = bus_data(sample_q[8]);
+   int vector = (bus_data(sample_q[10]) << 8) + bus_data(sample_q[11]);
    // Update the address of the interruted instruction
    instruction->pc = (pc - pc_offset) & 0xffff;
    // Stack the PB/PC/FLags (for memory modelling)
@@ -289,7 +305,12 @@ static void interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruc
 
 static void em_6800_init(arguments_t *args) {
 
-   instr_table = instr_table_6800;
+   free(context->em);
+   context->em = malloc(sizeof(em_6800_state_t));
+   for (int i = 0; i < NUM_REGS; i++) {
+      STATE->reg[i] = -1;
+   }
+   memcpy(instr_table, instr_table_6800, sizeof(instr_table));
 
    // Initialize the SP
    if (args->sp_reg >= 0) {
@@ -313,33 +334,33 @@ static void em_6800_init(arguments_t *args) {
 }
 
 
-static int em_6800_match_interrupt(sample_t *sample_q, int num_samples) {
+static int em_6800_match_interrupt(bus_cycle_t *sample_q, int num_samples) {
    // Check we have enough valid samples
    if (num_samples < 12) {
       return 0;
    }
    // An interupt will write PCH, PCL, PSW in bus cycles 2,3,4
-   if (sample_q[0].rnw >= 0) {
+   if (bus_rnw(sample_q[0]) >= 0) {
       // If we have the RNW pin connected, then just look for these three writes in succession
       // Currently can't detect a WAI or SWI being interrupted
-      if (sample_q[0].data == 0x3E || sample_q[0].data == 0x3F) {
+      if (bus_data(sample_q[0]) == 0x3E || bus_data(sample_q[0]) == 0x3F) {
          return 0;
       }
-      if (sample_q[2].rnw == 0 && sample_q[3].rnw == 0 &&
-          sample_q[4].rnw == 0 && sample_q[5].rnw == 0 &&
-          sample_q[6].rnw == 0 && sample_q[7].rnw == 0 &&
-          sample_q[8].rnw == 0) {
+      if (bus_rnw(sample_q[2]) == 0 && bus_rnw(sample_q[3]) == 0 &&
+          bus_rnw(sample_q[4]) == 0 && bus_rnw(sample_q[5]) == 0 &&
+          bus_rnw(sample_q[6]) == 0 && bus_rnw(sample_q[7]) == 0 &&
+          bus_rnw(sample_q[8]) == 0) {
          return 1;
       }
    } else {
       // If not, then we use a heuristic, based on what we expect to see on the data
       // bus in cycles 2, 3 and 8, i.e. PCL, PCH, PSW
       // (we could include X,A,B checks as well).
-      if (sample_q[2].data == (PC & 0xff) && sample_q[3].data == ((PC >> 8) & 0xff) ) {
+      if (bus_data(sample_q[2]) == (PC & 0xff) && bus_data(sample_q[3]) == ((PC >> 8) & 0xff) ) {
          // Now test unused flag is 1, B is 0
-         if ((sample_q[8].data & 0xC0) == 0xC0) {
+         if ((bus_data(sample_q[8]) & 0xC0) == 0xC0) {
             // Finally test all other known flags match
-            if (!compare_FLAGS(sample_q[8].data & 0x3F)) {
+            if (!compare_FLAGS(bus_data(sample_q[8]) & 0x3F)) {
                // Matched PSW = --HIVZVC
                return 1;
             }
@@ -349,15 +370,15 @@ static int em_6800_match_interrupt(sample_t *sample_q, int num_samples) {
    return 0;
 }
 
-static int em_6800_count_cycles(sample_t *sample_q, int intr_seen) {
+static int em_6800_count_cycles(bus_cycle_t *sample_q, int intr_seen, int next_opcode) {
    if (intr_seen) {
       return 12;
    }
-   int opcode = sample_q[0].data;
+   int opcode = bus_data(sample_q[0]);
    return instr_table[opcode].cycles;
 }
 
-static void em_6800_reset(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_6800_reset(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {
    instruction->pc = -1;
    A = -1;
    B = -1;
@@ -369,23 +390,23 @@ static void em_6800_reset(sample_t *sample_q, int num_cycles, instruction_t *ins
    Z = -1;
    V = -1;
    C = -1;
-   PC = (sample_q[num_cycles - 2].data << 8) + sample_q[num_cycles - 1].data;
+   PC = (bus_data(sample_q[num_cycles - 2]) << 8) + bus_data(sample_q[num_cycles - 1]);
 }
 
-static void em_6800_interrupt(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_6800_interrupt(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {
    interrupt(sample_q, num_cycles, instruction, 0);
 }
 
-static void em_6800_emulate(sample_t *sample_q, int num_cycles, instruction_t *instruction) {
+static void em_6800_emulate(bus_cycle_t *sample_q, int num_cycles, instruction_t *instruction) {
 
    // Unpack the instruction bytes
-   int opcode = sample_q[0].data;
+   int opcode = bus_data(sample_q[0]);
 
    // lookup the entry for the instruction
    InstrType *instr = &instr_table[opcode];
    int opcount = instr->len - 1;
-   int op1 = (opcount < 1) ? 0 : sample_q[1].data;
-   int op2 = (opcount < 2) ? 0 : sample_q[2].data;
+   int op1 = (opcount < 1) ? 0 : bus_data(sample_q[1]);
+   int op2 = (opcount < 2) ? 0 : bus_data(sample_q[2]);
 
    // Memory Modelling: Instruction fetches
    if (PC >= 0) {
@@ -412,13 +433,13 @@ static void em_6800_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
       return;
    } else if (opcode == 0x8D) {
       // BSR REL
-      instruction->pc = (((sample_q[bsr_rel_pch].data << 8) + sample_q[bsr_rel_pcl].data) - 2) & 0xffff;
+      instruction->pc = (((bus_data(sample_q[bsr_rel_pch]) << 8) + bus_data(sample_q[bsr_rel_pcl])) - 2) & 0xffff;
    } else if (opcode == 0xAD) {
       // JSR IDX
-      instruction->pc = (((sample_q[jsr_idx_pch].data << 8) + sample_q[jsr_idx_pcl].data) - 2) & 0xffff;
+      instruction->pc = (((bus_data(sample_q[jsr_idx_pch]) << 8) + bus_data(sample_q[jsr_idx_pcl])) - 2) & 0xffff;
       // JSR EXT
    } else if (opcode == 0xBD) {
-      instruction->pc = (((sample_q[jsr_ext_pch].data << 8) + sample_q[jsr_ext_pcl].data) - 3) & 0xffff;
+      instruction->pc = (((bus_data(sample_q[jsr_ext_pch]) << 8) + bus_data(sample_q[jsr_ext_pcl])) - 3) & 0xffff;
    } else {
       // current PC value
       instruction->pc = PC;
@@ -465,7 +486,7 @@ static void em_6800_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
          // e.g. <opcode> <op1> <op2> <read old> <write old> <write new>
          //      <opcode> <op1>       <read old> <write old> <write new>
          // Want to pick off the read
-         operand = sample_q[num_cycles - 3].data;
+         operand = bus_data(sample_q[num_cycles - 3]);
       } else if (instr->mode == IMM8) {
          // Immediate addressing mode: the operand is the 2nd byte of the instruction
          operand = op1;
@@ -477,11 +498,11 @@ static void em_6800_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
          operand = op1;
       } else if (word) {
          // 16 bit data (LDS/LDX/STS/STX/CPX), default top last two bus cycles as operand
-         operand = (sample_q[num_cycles - 2].data << 8) + sample_q[num_cycles - 1].data;
+         operand = (bus_data(sample_q[num_cycles - 2]) << 8) + bus_data(sample_q[num_cycles - 1]);
          word = 1;
       } else {
          // 8 bit data, default to using the last bus cycle as the operand
-         operand = sample_q[num_cycles - 1].data;
+         operand = bus_data(sample_q[num_cycles - 1]);
       }
 
       // Operand 2 is the value written back in a store or read-modify-write
@@ -489,9 +510,9 @@ static void em_6800_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
       operand_t operand2 = operand;
       if (instr->optype == RMWOP || instr->optype == WRITEOP) {
          if (word) {
-            operand2 = (sample_q[num_cycles - 2].data << 8) + sample_q[num_cycles - 1].data;
+            operand2 = (bus_data(sample_q[num_cycles - 2]) << 8) + bus_data(sample_q[num_cycles - 1]);
          } else {
-            operand2 = sample_q[num_cycles - 1].data;
+            operand2 = bus_data(sample_q[num_cycles - 1]);
          }
       }
 
@@ -508,6 +529,7 @@ static void em_6800_emulate(sample_t *sample_q, int num_cycles, instruction_t *i
       // Execute the instruction specific function
       // (This returns -1 if the result is unknown or invalid
       int result = instr->emulate(operand, ea, sample_q);
+      instruction->ea = ea;
 
       if (instr->optype == WRITEOP || instr->optype == RMWOP) {
 
@@ -591,51 +613,105 @@ static int em_6800_get_PB() {
    return 0;
 }
 
+static int em_6800_get_length(int opcode) {
+   return instr_table[opcode].len;
+}
+
 static int em_6800_read_memory(int address) {
    return memory_read_raw(address);
 }
 
-static char *em_6800_get_state(char *buffer) {
+static char *em_6800_write_state(char *buffer, const int *reg) {
    strcpy(buffer, default_state);
-   if (A >= 0) {
-      write_hex2(buffer + OFFSET_A, A);
+   if (reg[REG_A] >= 0) {
+      write_hex2(buffer + OFFSET_A, reg[REG_A]);
    }
-   if (B >= 0) {
-      write_hex2(buffer + OFFSET_B, B);
+   if (reg[REG_B] >= 0) {
+      write_hex2(buffer + OFFSET_B, reg[REG_B]);
    }
-   if (X >= 0) {
-      write_hex4(buffer + OFFSET_X, X);
+   if (reg[REG_X] >= 0) {
+      write_hex4(buffer + OFFSET_X, reg[REG_X]);
    }
-   if (S >= 0) {
-      write_hex4(buffer + OFFSET_S, S);
+   if (reg[REG_S] >= 0) {
+      write_hex4(buffer + OFFSET_S, reg[REG_S]);
    }
-   if (H >= 0) {
-      buffer[OFFSET_H] = '0' + H;
+   if (reg[REG_H] >= 0) {
+      buffer[OFFSET_H] = '0' + reg[REG_H];
    }
-   if (I >= 0) {
-      buffer[OFFSET_I] = '0' + I;
+   if (reg[REG_I] >= 0) {
+      buffer[OFFSET_I] = '0' + reg[REG_I];
    }
-   if (N >= 0) {
-      buffer[OFFSET_N] = '0' + N;
+   if (reg[REG_N] >= 0) {
+      buffer[OFFSET_N] = '0' + reg[REG_N];
    }
-   if (Z >= 0) {
-      buffer[OFFSET_Z] = '0' + Z;
+   if (reg[REG_Z] >= 0) {
+      buffer[OFFSET_Z] = '0' + reg[REG_Z];
    }
-   if (V >= 0) {
-      buffer[OFFSET_V] = '0' + V;
+   if (reg[REG_V] >= 0) {
+      buffer[OFFSET_V] = '0' + reg[REG_V];
    }
-   if (C >= 0) {
-      buffer[OFFSET_C] = '0' + C;
+   if (reg[REG_C] >= 0) {
+      buffer[OFFSET_C] = '0' + reg[REG_C];
    }
    return buffer + OFFSET_END;
 }
 
+static char *em_6800_get_state(char *buffer) {
+   return em_6800_write_state(buffer, STATE->reg);
+}
+
 static int em_6800_get_and_clear_fail() {
    int ret = failflag;
    failflag = 0;
    return ret;
 }
 
+static int em_6800_save_state(int *buffer) {
+   memcpy(buffer, STATE->reg, sizeof(STATE->reg));
+   return NUM_REGS;
+}
+
+static void em_6800_restore_state(const int *buffer) {
+   memcpy(STATE->reg, buffer, sizeof(STATE->reg));
+}
+
+static int em_6800_step(bus_cycle_t *sample_q, int num_samples, int rst_seen, step_t *step) {
+   instruction_t *instruction = step->instruction;
+
+   int intr_seen = em_6800_match_interrupt(sample_q, num_samples);
+
+   int num_cycles = (rst_seen > 0) ? rst_seen : em_6800_count_cycles(sample_q, intr_seen, step->next_opcode);
+
+   // Deal with partial final instruction
+   if (num_samples <= num_cycles || num_cycles == 0) {
+      step->num_cycles = 0;
+      return 0;
+   }
+
+   if (step->before) {
+      step->before(num_cycles);
+   }
+
+   step->kind  = (intr_seen ? STEP_INTERRUPT : 0) | (rst_seen ? STEP_RESET : 0);
+   step->oldpc = PC;
+   step->oldpb = 0;
+   instruction->ea = -1;
+
+   if (rst_seen) {
+      em_6800_reset(sample_q, num_cycles, instruction);
+   } else if (intr_seen) {
+      em_6800_interrupt(sample_q, num_cycles, instruction);
+   } else {
+      em_6800_emulate(sample_q, num_cycles, instruction);
+   }
+
+   step->num_cycles = num_cycles;
+   step->fail = failflag;
+   failflag = 0;
+   step->num_state = em_6800_save_state(step->state);
+   return num_cycles;
+}
+
 cpu_emulator_t em_6800 = {
    .init = em_6800_init,
    .match_interrupt = em_6800_match_interrupt,
@@ -646,9 +722,14 @@ cpu_emulator_t em_6800 = {
    .disassemble = em_6800_disassemble,
    .get_PC = em_6800_get_PC,
    .get_PB = em_6800_get_PB,
+   .get_length = em_6800_get_length,
    .read_memory = em_6800_read_memory,
    .get_state = em_6800_get_state,
-   .get_and_clear_fail = em_6800_get_and_clear_fail
+   .write_state = em_6800_write_state,
+   .get_and_clear_fail = em_6800_get_and_clear_fail,
+   .save_state = em_6800_save_state,
+   .restore_state = em_6800_restore_state,
+   .step = em_6800_step
 };
 
 // ====================================================================
@@ -883,69 +964,69 @@ static int tst_helper(int val) {
 // Individual Instructions
 // ====================================================================
 
-static int op_ABA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ABA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = add_helper(A, B, 0);
    return -1;
 }
 
-static int op_ADCA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ADCA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = add_helper(A, operand, C);
    return -1;
 }
-static int op_ADCB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ADCB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = add_helper(B, operand, C);
    return -1;
 }
 
-static int op_ADDA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ADDA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = add_helper(A, operand, 0);
    return -1;
 }
 
-static int op_ADDB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ADDB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = add_helper(A, operand, 0);
    return -1;
 }
 
-static int op_ANDA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ANDA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = and_helper(A, operand);
    return -1;
 }
 
-static int op_ANDB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ANDB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = and_helper(B, operand);
    return -1;
 }
 
-static int op_ASL(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ASL(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return asl_helper(operand);
 }
 
-static int op_ASLA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ASLA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = asl_helper(A);
    return -1;
 }
 
-static int op_ASLB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ASLB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = asl_helper(B);
    return -1;
 }
 
-static int op_ASR(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ASR(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return asr_helper(operand);
 }
 
-static int op_ASRA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ASRA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = asr_helper(A);
    return -1;
 }
 
-static int op_ASRB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ASRB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = asr_helper(B);
    return -1;
 }
 
-static int op_BCC(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BCC(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if !C
    if (C == 0) {
       PC = ea;
@@ -955,7 +1036,7 @@ static int op_BCC(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BCS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BCS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (C == 1) {
       PC = ea;
    } else if (C < 0) {
@@ -964,7 +1045,7 @@ static int op_BCS(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BEQ(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BEQ(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Brach if Z=1
    if (Z == 1) {
       PC = ea;
@@ -974,7 +1055,7 @@ static int op_BEQ(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BGE(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BGE(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if N = V
    if (N >= 0 && V >= 0) {
       if (N == V) {
@@ -986,7 +1067,7 @@ static int op_BGE(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BGT(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BGT(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if !Z and N = V
    // TODO: narrow the scope of this test
    if (Z >= 0 && N >= 0 && V >= 0) {
@@ -999,7 +1080,7 @@ static int op_BGT(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BHI(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BHI(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if !C and !Z
    //  C  Z    taken
    // -1 -1 => -1
@@ -1019,17 +1100,17 @@ static int op_BHI(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BITA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BITA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    and_helper(A, operand);
    return -1;
 }
 
-static int op_BITB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BITB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    and_helper(B, operand);
    return -1;
 }
 
-static int op_BLE(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BLE(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if Z OR N != V
    // TODO: narrow the scope of this test
    if (Z >= 0 && N >= 0 && V >= 0) {
@@ -1042,7 +1123,7 @@ static int op_BLE(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BLS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BLS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if C or Z
    //  C  Z    taken
    // -1 -1 => -1
@@ -1062,7 +1143,7 @@ static int op_BLS(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BLT(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BLT(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if N != V
    if (N >= 0 && V >= 0) {
       if (N != V) {
@@ -1074,7 +1155,7 @@ static int op_BLT(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BMI(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BMI(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if N=1
    if (N == 1) {
       PC = ea;
@@ -1084,7 +1165,7 @@ static int op_BMI(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BNE(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BNE(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if Z=0
    if (Z == 0) {
       PC = ea;
@@ -1094,7 +1175,7 @@ static int op_BNE(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BPL(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BPL(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if N=0
    if (N == 0) {
       PC = ea;
@@ -1104,20 +1185,20 @@ static int op_BPL(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BRA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BRA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    PC = ea;
    return -1;
 }
 
-static int op_BSR(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BSR(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    int idx = bsr_rel_pcl;
-   push8(sample_q[idx].data);
-   push8(sample_q[idx + 1].data);
+   push8(bus_data(sample_q[idx]));
+   push8(bus_data(sample_q[idx + 1]));
    PC = ea;
    return -1;
 }
 
-static int op_BVC(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BVC(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if V=0
    if (V == 0) {
       PC = ea;
@@ -1127,7 +1208,7 @@ static int op_BVC(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_BVS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_BVS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // Branch if V=1
    if (V == 1) {
       PC = ea;
@@ -1137,63 +1218,63 @@ static int op_BVS(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_CBA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CBA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    sub_helper(A, B, 0);
    return -1;
 }
 
-static int op_CLC(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CLC(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    C = 0;
    return -1;
 }
 
-static int op_CLI(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CLI(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    I = 0;
    return -1;
 }
 
-static int op_CLR(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CLR(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return clr_helper();
 }
 
-static int op_CLRA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CLRA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return A = clr_helper();
 }
 
-static int op_CLRB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CLRB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return B = clr_helper();
 }
 
-static int op_CLV(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CLV(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    V = 0;
    return -1;
 }
 
-static int op_CMPA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CMPA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    sub_helper(A, operand, 0);
    return -1;
 }
 
-static int op_CMPB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CMPB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    sub_helper(B, operand, 0);
    return -1;
 }
 
-static int op_COM(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_COM(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return com_helper(operand);
 }
 
-static int op_COMA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_COMA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = com_helper(A);
    return -1;
 }
 
-static int op_COMB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_COMB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = com_helper(B);
    return -1;
 }
 
-static int op_CPX(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_CPX(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (X >= 0) {
       int xl = X & 0xff;
       int xh = (X >> 8) & 0xff;
@@ -1211,7 +1292,7 @@ static int op_CPX(operand_t operand, ea_t ea, sample_t *sample_q) {
 }
 
 // Taken from the 6809 decoder
-static int op_DAA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_DAA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (A >= 0 && H >= 0 && C >= 0) {
       int correction = 0x00;
       if (H == 1 || (A & 0x0f) > 0x09) {
@@ -1235,28 +1316,28 @@ static int op_DAA(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_DEC(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_DEC(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return dec_helper(operand);
 }
 
-static int op_DECA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_DECA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = dec_helper(A);
    return -1;
 }
 
-static int op_DECB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_DECB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = dec_helper(B);
    return -1;
 }
 
-static int op_DES(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_DES(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (S >= 0) {
       S = (S - 1) & 0xFFFF;
    }
    return -1;
 }
 
-static int op_DEX(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_DEX(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (X >= 0) {
       X = (X - 1) & 0xFFFF;
       Z = (X == 0);
@@ -1264,38 +1345,38 @@ static int op_DEX(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_EORA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_EORA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = eor_helper(A, operand);
    return -1;
 }
 
-static int op_EORB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_EORB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = eor_helper(B, operand);
    return -1;
 }
 
-static int op_INC(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_INC(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return inc_helper(operand);
 }
 
-static int op_INCA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_INCA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = inc_helper(A);
    return -1;
 }
 
-static int op_INCB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_INCB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = inc_helper(B);
    return -1;
 }
 
-static int op_INS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_INS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (S >= 0) {
       S = (S + 1) & 0xFFFF;
    }
    return -1;
 }
 
-static int op_INX(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_INX(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (X >= 0) {
       X = (X + 1) & 0xFFFF;
       Z = (X == 0);
@@ -1303,130 +1384,130 @@ static int op_INX(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_JMP(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_JMP(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    PC = ea;
    return -1;
 }
 
-static int op_JSR(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_JSR(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    PC = ea;
-   int idx = sample_q[0].data == 0xAD ? jsr_idx_pcl : jsr_ext_pcl;
-   push8(sample_q[idx].data);
-   push8(sample_q[idx + 1].data);
+   int idx = bus_data(sample_q[0]) == 0xAD ? jsr_idx_pcl : jsr_ext_pcl;
+   push8(bus_data(sample_q[idx]));
+   push8(bus_data(sample_q[idx + 1]));
    return -1;
 }
 
-static int op_LDAA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LDAA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = lda_helper(operand);
    return -1;
 }
 
-static int op_LDAB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LDAB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = lda_helper(operand);
    return -1;
 }
 
-static int op_LDS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LDS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    S = operand;
    set_NZ16(S);
    V = 0;
    return -1;
 }
 
-static int op_LDX(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LDX(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    X = operand;
    set_NZ16(X);
    V = 0;
    return -1;
 }
 
-static int op_LSR(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LSR(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return lsr_helper(operand);
 }
 
-static int op_LSRA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LSRA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = lsr_helper(A);
    return -1;
 }
 
-static int op_LSRB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_LSRB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = lsr_helper(B);
    return -1;
 }
 
-static int op_NEG(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_NEG(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return neg_helper(operand);
 }
 
-static int op_NEGA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_NEGA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = neg_helper(A);
    return -1;
 }
 
-static int op_NEGB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_NEGB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = neg_helper(B);
    return -1;
 }
 
-static int op_ORAA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ORAA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = ora_helper(A, operand);
    return -1;
 }
 
-static int op_ORAB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ORAB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = ora_helper(B, operand);
    return -1;
 }
 
-static int op_PSHA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_PSHA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = psh_helper(A, operand);
    return -1;
 }
 
-static int op_PSHB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_PSHB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = psh_helper(B, operand);
    return -1;
 }
 
-static int op_PULA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_PULA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = pul_helper(operand);
    return -1;
 }
 
-static int op_PULB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_PULB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = pul_helper(operand);
    return -1;
 }
 
-static int op_ROL(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ROL(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return rol_helper(operand);
 }
 
-static int op_ROLA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ROLA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = rol_helper(A);
    return -1;
 }
 
-static int op_ROLB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ROLB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = rol_helper(B);
    return -1;
 }
 
-static int op_ROR(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_ROR(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    return ror_helper(operand);
 }
 
-static int op_RORA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_RORA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = ror_helper(A);
    return -1;
 }
 
-static int op_RORB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_RORB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = ror_helper(B);
    return -1;
 }
 
-static int op_RTI(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_RTI(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // 0 = opcode
    // 1 = dead
    // 2 = dead
@@ -1438,70 +1519,70 @@ static int op_RTI(operand_t operand, ea_t ea, sample_t *sample_q) {
    // 8 = PCH
    // 9 = PCL
    for (int i = 3; i <= 9; i++) {
-      pop8(sample_q[i].data);
+      pop8(bus_data(sample_q[i]));
    }
-   set_FLAGS(sample_q[3].data);
-   B = sample_q[4].data;
-   A = sample_q[5].data;
-   X = (sample_q[6].data << 8) + sample_q[7].data;
-   PC = (sample_q[8].data << 8) + sample_q[9].data;
+   set_FLAGS(bus_data(sample_q[3]));
+   B = bus_data(sample_q[4]);
+   A = bus_data(sample_q[5]);
+   X = (bus_data(sample_q[6]) << 8) + bus_data(sample_q[7]);
+   PC = (bus_data(sample_q[8]) << 8) + bus_data(sample_q[9]);
    return -1;
 }
 
-static int op_RTS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_RTS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // 0 = opcode
    // 1 = dead
    // 2 = dead
    // 3 = PCH
    // 4 = PCL
    for (int i = 3; i <= 4; i++) {
-      pop8(sample_q[i].data);
+      pop8(bus_data(sample_q[i]));
    }
-   PC = (sample_q[3].data << 8) + sample_q[4].data;
+   PC = (bus_data(sample_q[3]) << 8) + bus_data(sample_q[4]);
    return -1;
 }
 
-static int op_SBA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SBA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = sub_helper(A, B, 0);
    return -1;
 }
 
-static int op_SBCA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SBCA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = sub_helper(A, operand, C);
    return -1;
 }
 
-static int op_SBCB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SBCB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = sub_helper(B, operand, C);
    return -1;
 }
 
-static int op_SEC(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SEC(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    C = 1;
    return -1;
 }
 
-static int op_SEI(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SEI(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    I = 1;
    return -1;
 }
 
-static int op_SEV(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SEV(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    V = 1;
    return -1;
 }
 
-static int op_STAA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_STAA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = sta_helper(A, operand);
    return operand;
 }
 
-static int op_STAB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_STAB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = sta_helper(B, operand);
    return operand;
 }
 
-static int op_STS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_STS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (S >= 0) {
       if (operand != S) {
          failflag = 1;
@@ -1513,7 +1594,7 @@ static int op_STS(operand_t operand, ea_t ea, sample_t *sample_q) {
    return operand;
 }
 
-static int op_STX(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_STX(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (X >= 0) {
       if (operand != X) {
          failflag = 1;
@@ -1525,17 +1606,17 @@ static int op_STX(operand_t operand, ea_t ea, sample_t *sample_q) {
    return operand;
 }
 
-static int op_SUBA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SUBA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = sub_helper(A, operand, 0);
    return -1;
 }
 
-static int op_SUBB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_SUBB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    B = sub_helper(B, operand, 0);
    return -1;
 }
 
-static int op_TAB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TAB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (A >= 0) {
       B = A;
       set_NZ(B);
@@ -1547,12 +1628,12 @@ static int op_TAB(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_TAP(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TAP(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    set_FLAGS(A);
    return -1;
 }
 
-static int op_TBA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TBA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (B >= 0) {
       A = B;
       set_NZ(A);
@@ -1564,27 +1645,27 @@ static int op_TBA(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_TPA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TPA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    A = get_FLAGS();
    return -1;
 }
 
-static int op_TST(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TST(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    tst_helper(operand);
    return -1;
 }
 
-static int op_TSTA(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TSTA(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    tst_helper(A);
    return -1;
 }
 
-static int op_TSTB(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TSTB(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    tst_helper(B);
    return -1;
 }
 
-static int op_TSX(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TSX(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (S >= 0) {
       X = (S + 1) & 0xffff;
    } else {
@@ -1593,7 +1674,7 @@ static int op_TSX(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_TXS(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_TXS(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    if (X >= 0) {
       S = (X - 1) & 0xffff;
    } else {
@@ -1602,7 +1683,7 @@ static int op_TXS(operand_t operand, ea_t ea, sample_t *sample_q) {
    return -1;
 }
 
-static int op_WAI(operand_t operand, ea_t ea, sample_t *sample_q) {
+static int op_WAI(operand_t operand, ea_t ea, bus_cycle_t *sample_q) {
    // TODO
    return -1;
 }
@@ -1611,7 +1692,7 @@ static int op_WAI(operand_t operand, ea_t ea, sample_t *sample_q) {
 // Opcode Tables
 // ====================================================================
 
-static InstrType instr_table_6800[] = {
+static const InstrType instr_table_6800[] = {
    /* 00 */   { "???  ", 1,   INH,  2,     OTHER,       0},
    /* 01 */   { "NOP  ", 0,   INH,  2,     OTHER,       0},
    /* 02 */   { "???  ", 1,   INH,  2,     OTHER,       0},
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <argp.h>
+#include <pthread.h>
+
+#include "fanout.h"
+#include "capture.h"
+#include "ring.h"
+#include "output.h"
+#include "profiler.h"
+#include "context.h"
+#include "decoder.h"
+
+// Number of blocks of the capture in flight (a power of 2)
+#define NUM_BLOCKS 8
+
+// Maximum number of options on one line of the configuration file
+#define MAX_LINE_ARGS 64
+
+// FNV-1a
+#define HASH_BASIS 0xcbf29ce484222325ULL
+#define HASH_PRIME 0x100000001b3ULL
+
+// A copy of a block of the capture, preceeded by its history
+typedef struct {
+   uint8_t *buffer;
+   size_t   len;
+} block_t;
+
+// The hash of the instructions up to the end of an interval of them
+typedef struct {
+   uint64_t hash;
+   uint64_t instr;    // instruction number at the start of the interval
+   uint32_t sample;   // sample number at the start of the interval
+} mark_t;
+
+typedef struct {
+   char            *text;         // the line, split into the name and options
+   char            *name;
+   int              line;
+   int              argc;
+   char           **argv;
+   context_t       *context;
+   FILE            *file;
+   sink_t          *sink;
+   pthread_t        thread;
+
+   // Blocks are passed to the decoder, and returned once decoded
+   ring_t          *full;
+   ring_t          *done;
+
+   uint64_t         hash;
+   uint64_t         num_instr;    // instructions decoded
+   uint64_t         num_hashed;   // instructions hashed (from the first reset)
+   uint64_t         num_fails;
+   int              reset_seen;
+   mark_t           interval;     // the interval being hashed
+
+   mark_t          *marks;
+   size_t           num_marks;
+   size_t           marks_size;
+} instance_t;
+
+// ====================================================================
+// Instruction hashing
+// ====================================================================
+
+static inline uint64_t hash_int(uint64_t hash, int value) {
+   for (int i = 0; i < 4; i++) {
+      hash = (hash ^ (uint8_t) (value >> (i * 8))) * HASH_PRIME;
+   }
+   return hash;
+}
+
+// Hash the decoded instruction, rather than the text it's shown as, so
+// decoders that differ only in what they show still match
+static void hash_step(instance_t *inst, const step_t *step) {
+   const instruction_t *instr = step->instruction;
+   uint64_t hash = inst->hash;
+   hash = hash_int(hash, instr->pc);
+   hash = hash_int(hash, instr->pb);
+   hash = hash_int(hash, instr->opcode);
+   hash = hash_int(hash, instr->opcount);
+   const uint8_t operands[] = { instr->op1, instr->op2, instr->op3 };
+   for (int i = 0; i < instr->opcount && i < 3; i++) {
+      hash = hash_int(hash, operands[i]);
+   }
+   hash = hash_int(hash, step->num_cycles);
+   hash = hash_int(hash, step->fail);
+   for (int i = 0; i < step->num_state; i++) {
+      hash = hash_int(hash, step->state[i]);
+   }
+   inst->hash = hash;
+}
+
+static void add_mark(instance_t *inst) {
+   if (inst->num_marks == inst->marks_size) {
+      inst->marks_size = inst->marks_size ? inst->marks_size * 2 : 1024;
+      inst->marks = (mark_t *)realloc(inst->marks, inst->marks_size * sizeof(mark_t));
+   }
+   inst->interval.hash = inst->hash;
+   inst->marks[inst->num_marks++] = inst->interval;
+}
+
+static void fanout_hook(void *data, const bus_window_t *window, step_t *step, int real_cycles) {
+   instance_t *inst = (instance_t *)data;
+   // Like the test scripts, ignore everything before the first reset
+   if ((step->kind & STEP_RESET) && !inst->reset_seen) {
+      inst->reset_seen = 1;
+      inst->hash = HASH_BASIS;
+      inst->num_hashed = 0;
+      inst->num_marks = 0;
+   }
+   if (inst->num_hashed % FANOUT_INTERVAL == 0) {
+      inst->interval.instr = inst->num_instr;
+      inst->interval.sample = window->sample_count[0];
+   }
+   hash_step(inst, step);
+   inst->num_instr++;
+   inst->num_hashed++;
+   inst->num_fails += step->fail != 0;
+   if (inst->num_hashed % FANOUT_INTERVAL == 0) {
+      add_mark(inst);
+   }
+}
+
+// ====================================================================
+// Decoder threads
+// ====================================================================
+
+static void *instance_main(void *arg) {
+   instance_t *inst = (instance_t *)arg;
+   context = inst->context;
+   output_set_sink(inst->sink);
+   decoder_begin();
+   block_t *block;
+   while ((block = (block_t *)ring_pop(inst->full))->len > 0) {
+      decoder_feed(block->buffer + CAPTURE_HISTORY, block->len);
+      ring_push(inst->done, block);
+   }
+   decoder_end();
+   if (inst->num_hashed % FANOUT_INTERVAL != 0) {
+      add_mark(inst);
+   }
+   if (context->arguments.profile) {
+      profiler_done();
+   }
+   return NULL;
+}
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+// Read the configurations, returning the number (or -1 on error)
+static int read_config(const char *filename, int argc, char *argv[], instance_t *instances) {
+   FILE *f = fopen(filename, "r");
+   if (!f) {
+      perror("failed to open fanout file");
+      return -1;
+   }
+   int num = 0;
+   int line = 0;
+   char *text = NULL;
+   size_t size = 0;
+   while (getline(&text, &size, f) >= 0) {
+      line++;
+      // The options of each line are kept for the lifetime of the decoder
+      char *copy = strdup(text);
+      char *name = strtok(copy, " \t\r\n");
+      if (!name || *name == '#') {
+         free(copy);
+         continue;
+      }
+      if (num == FANOUT_MAX) {
+         fprintf(stderr, "%s:%d: too many configurations (maximum %d)\n", filename, line, FANOUT_MAX);
+         free(copy);
+         num = -1;
+         break;
+      }
+      instance_t *inst = instances + num++;
+      inst->text = copy;
+      inst->name = name;
+      inst->line = line;
+      inst->argv = (char **)malloc((argc + MAX_LINE_ARGS + 1) * sizeof(char *));
+      memcpy(inst->argv, argv, argc * sizeof(char *));
+      inst->argc = argc;
+      char *opt;
+      while ((opt = strtok(NULL, " \t\r\n")) != NULL) {
+         if (inst->argc == argc + MAX_LINE_ARGS) {
+            fprintf(stderr, "%s:%d: too many options\n", filename, line);
+            num = -1;
+            break;
+         }
+         inst->argv[inst->argc++] = opt;
+      }
+      inst->argv[inst->argc] = NULL;
+      if (num < 0) {
+         break;
+      }
+   }
+   free(text);
+   fclose(f);
+   if (num == 0) {
+      fprintf(stderr, "%s: no configurations\n", filename);
+      return -1;
+   }
+   return num;
+}
+
+// Create the context for a decoder, returning non-zero on error
+static int configure(instance_t *inst, const char *filename, arguments_t *common) {
+   context_t *saved = context;
+   inst->context = context_create();
+   context = inst->context;
+   int ret = decoder_configure(inst->argc, inst->argv, ARGP_NO_EXIT);
+   arguments_t *args = &context->arguments;
+   if (!ret) {
+      args->filename = NULL;
+      ret = decoder_check_fed();
+   }
+   if (!ret && (args->byte != common->byte || args->skip != common->skip)) {
+      fprintf(stderr, "--byte and --skip must be the same for every decoder\n");
+      ret = 1;
+   }
+   if (!ret) {
+      inst->file = fopen(inst->name, "w");
+      if (!inst->file) {
+         perror(inst->name);
+         ret = 1;
+      }
+   }
+   if (ret) {
+      fprintf(stderr, "%s:%d: failed to configure decoder\n", filename, inst->line);
+   } else {
+      inst->sink = sink_create_stream(inst->file, 0);
+      inst->full = ring_create(NUM_BLOCKS);
+      inst->done = ring_create(NUM_BLOCKS);
+      inst->hash = HASH_BASIS;
+      decoder_set_hook(fanout_hook, inst);
+   }
+   context = saved;
+   return ret;
+}
+
+// Compare an instance with the reference, returning non-zero if they diverge
+static int compare(instance_t *ref, instance_t *inst) {
+   size_t n = ref->num_marks < inst->num_marks ? ref->num_marks : inst->num_marks;
+   size_t i = 0;
+   while (i < n && ref->marks[i].hash == inst->marks[i].hash) {
+      i++;
+   }
+   if (i < n) {
+      fprintf(stderr, "%s: diverges from %s within %d instructions of instruction %" PRIu64 " (sample %08x), in %s instruction %" PRIu64 " (sample %08x)\n",
+              inst->name, ref->name, FANOUT_INTERVAL, inst->marks[i].instr, inst->marks[i].sample, ref->name, ref->marks[i].instr, ref->marks[i].sample);
+      return 1;
+   }
+   if (ref->num_hashed != inst->num_hashed) {
+      fprintf(stderr, "%s: matches %s until it ends, after %" PRIu64 " instructions (%s has %" PRIu64 ")\n",
+              inst->name, ref->name, inst->num_hashed, ref->name, ref->num_hashed);
+      return 1;
+   }
+   fprintf(stderr, "%s: matches %s\n", inst->name, ref->name);
+   return 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+int fanout_run(int argc, char *argv[]) {
+   arguments_t *common = &context->arguments;
+   instance_t *instances = (instance_t *)calloc(FANOUT_MAX, sizeof(instance_t));
+   int num = read_config(common->fanout_file, argc, argv, instances);
+   int ret = num < 0;
+   for (int i = 0; i < num && !ret; i++) {
+      ret = configure(instances + i, common->fanout_file, common);
+   }
+
+   capture_t *capture = NULL;
+   if (!ret) {
+      capture = capture_open(common->filename, common->split);
+      if (capture == NULL) {
+         perror("failed to open capture file");
+         ret = 2;
+      }
+   }
+
+   if (!ret) {
+      size_t align = common->byte ? sizeof(uint8_t) : sizeof(uint16_t);
+      if (common->skip) {
+         capture_skip(capture, (uint64_t) common->skip * align);
+      }
+      for (int i = 0; i < num; i++) {
+         if (pthread_create(&instances[i].thread, NULL, instance_main, instances + i) != 0) {
+            perror("failed to create decoder thread");
+            exit(1);
+         }
+      }
+      // Every decoder is passed each block, and returns the blocks in the
+      // same order, so the oldest is free once returned by all of them
+      block_t blocks[NUM_BLOCKS];
+      uint64_t n = 0;
+      size_t len;
+      do {
+         block_t *block = blocks + (n % NUM_BLOCKS);
+         if (n < NUM_BLOCKS) {
+            block->buffer = (uint8_t *)malloc(CAPTURE_HISTORY + CAPTURE_WINDOW);
+         } else {
+            for (int i = 0; i < num; i++) {
+               ring_pop(instances[i].done);
+            }
+         }
+         const uint8_t *data;
+         len = capture_next(capture, &data, align);
+         if (len > 0) {
+            memcpy(block->buffer, data - CAPTURE_HISTORY, CAPTURE_HISTORY + len);
+         }
+         block->len = len;
+         for (int i = 0; i < num; i++) {
+            ring_push(instances[i].full, block);
+         }
+         n++;
+      } while (len > 0);
+      for (int i = 0; i < num; i++) {
+         pthread_join(instances[i].thread, NULL);
+      }
+      for (uint64_t i = 0; i < n && i < NUM_BLOCKS; i++) {
+         free(blocks[i].buffer);
+      }
+      capture_close(capture);
+
+      for (int i = 0; i < num; i++) {
+         instance_t *inst = instances + i;
+         int failed = sink_close(inst->sink);
+         inst->sink = NULL;
+         if (fclose(inst->file) || failed) {
+            perror(inst->name);
+            ret = 1;
+         }
+         inst->file = NULL;
+         fprintf(stderr, "%s: %" PRIu64 " instructions, %" PRIu64 " prediction failures\n", inst->name, inst->num_instr, inst->num_fails);
+      }
+      int diverged = 0;
+      for (int i = 1; i < num; i++) {
+         diverged += compare(instances, instances + i);
+      }
+      if (!ret && diverged) {
+         ret = 3;
+      }
+   }
+
+   for (int i = 0; i < FANOUT_MAX; i++) {
+      instance_t *inst = instances + i;
+      if (inst->context) {
+         context_destroy(inst->context);
+      }
+      if (inst->sink) {
+         sink_close(inst->sink);
+      }
+      if (inst->file) {
+         fclose(inst->file);
+      }
+      if (inst->full) {
+         ring_destroy(inst->full);
+         ring_destroy(inst->done);
+      }
+      free(inst->text);
+      free(inst->argv);
+      free(inst->marks);
+   }
+   free(instances);
+   return ret;
+}
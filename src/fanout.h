@@ -0,0 +1,33 @@
+#ifndef _INCLUDE_FANOUT_H
+#define _INCLUDE_FANOUT_H
+
+// Fan-out decode: the capture is read once, and the same blocks of samples
+// are fed to several independently configured decoders (each with its own
+// context), each running on its own thread and writing its own output file
+// (including any profiler output).
+//
+// The configurations are read from a file, one per line, being the name
+// of the output file followed by the options for that decoder, which are
+// added to (and so override) those on the command line. Blank lines, and
+// those starting with #, are ignored.
+//
+// As each decoder runs, a hash of the instructions it decodes (their
+// address, opcode, operands, cycles, prediction failure and the registers
+// afterwards, but not how they're shown) is recorded every so many
+// instructions, from the first reset (if any). Once all are done, each is
+// compared with the first, and the interval in which they diverge written
+// to stderr.
+
+#define FANOUT_MAX      64
+
+// Instructions between each hash
+#define FANOUT_INTERVAL 1024
+
+// Decode the capture with each configuration in arguments.fanout_file,
+// in addition to the command line argv (as already parsed into the
+// current context)
+//
+// Returns the exit status of the command line tool (3 if any diverge)
+int fanout_run(int argc, char *argv[]);
+
+#endif
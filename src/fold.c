@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "fold.h"
+#include "output.h"
+
+typedef struct {
+   trace_instr_t rec;
+   int           state[MAX_EM_STATE];
+} line_t;
+
+struct fold {
+   cpu_emulator_t *em;
+   int             max_len;
+   fold_emit_t     emit;
+
+   // Keys of the last FOLD_MAX lines written
+   uint64_t        keys[FOLD_MAX];
+   uint64_t        num_keys;
+
+   // Length of the loop that might be repeating (0 if none)
+   int             period;
+
+   // Lines of the iteration in progress, held back until it's complete
+   int             held;
+   line_t          lines[FOLD_MAX];
+
+   // Complete iterations folded, with their cycles, and the registers
+   // after the last
+   uint64_t        iterations;
+   uint64_t        cycles;
+   int             state[MAX_EM_STATE];
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+// Returns 0 for an instruction that can't be part of a loop
+static uint64_t make_key(const trace_instr_t *rec) {
+   if ((rec->flags & TRACE_FAIL) || rec->kind || rec->pc < 0) {
+      return 0;
+   }
+   return (1ULL << 63) | ((uint64_t) (rec->pb & 0x1ff) << 40) | ((uint64_t) rec->opcode << 32) | (uint32_t) rec->pc;
+}
+
+static void add_key(fold_t *fold, uint64_t key) {
+   fold->keys[fold->num_keys++ % FOLD_MAX] = key;
+}
+
+// Key of the line n back (1 being the last written)
+static uint64_t key_back(fold_t *fold, int n) {
+   return fold->keys[(fold->num_keys - n) % FOLD_MAX];
+}
+
+static void hold_line(fold_t *fold, const trace_instr_t *rec, const int *state) {
+   line_t *line = fold->lines + fold->held++;
+   line->rec = *rec;
+   memcpy(line->state, state, sizeof(line->state));
+   if (fold->held == fold->period) {
+      // A whole iteration has repeated, so fold it
+      for (int i = 0; i < fold->held; i++) {
+         fold->cycles += fold->lines[i].rec.real_cycles;
+      }
+      memcpy(fold->state, line->state, sizeof(fold->state));
+      fold->iterations++;
+      fold->held = 0;
+   }
+}
+
+// Write the summary and then the lines held back
+static void end_loop(fold_t *fold) {
+   if (fold->iterations) {
+      char buffer[256];
+      fold->em->write_state(buffer, fold->state);
+      output_printf("... %d instruction loop repeated %" PRIu64 " time%s (%" PRIu64 " cycles) : %s\n",
+                    fold->period, fold->iterations, fold->iterations == 1 ? "" : "s", fold->cycles, buffer);
+      // Nothing (e.g. an outer loop) matches across the lines folded
+      add_key(fold, 0);
+   }
+   for (int i = 0; i < fold->held; i++) {
+      fold->emit(&fold->lines[i].rec, fold->lines[i].state);
+      add_key(fold, make_key(&fold->lines[i].rec));
+   }
+   fold->period = 0;
+   fold->held = 0;
+   fold->iterations = 0;
+   fold->cycles = 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+fold_t *fold_create(cpu_emulator_t *em, int max_len, fold_emit_t emit) {
+   fold_t *fold = (fold_t *)calloc(1, sizeof(fold_t));
+   fold->em = em;
+   fold->max_len = max_len < FOLD_MAX ? max_len : FOLD_MAX;
+   fold->emit = emit;
+   return fold;
+}
+
+void fold_instruction(fold_t *fold, const trace_instr_t *rec, const int *state) {
+   // Any other output since the last instruction (which precedes its line)
+   // has been held back, so an instruction with any isn't folded
+   uint64_t key = output_held() ? 0 : make_key(rec);
+   output_hold(0);
+   if (fold->period) {
+      // Still in the loop?
+      if (key && key == key_back(fold, fold->period - fold->held)) {
+         hold_line(fold, rec, state);
+         output_hold(1);
+         return;
+      }
+      end_loop(fold);
+   }
+   output_release();
+   if (key) {
+      // An instruction seen recently might start the second iteration of a loop
+      int n = fold->num_keys < (uint64_t) fold->max_len ? (int) fold->num_keys : fold->max_len;
+      for (int i = 1; i <= n; i++) {
+         if (key_back(fold, i) == key) {
+            fold->period = i;
+            hold_line(fold, rec, state);
+            output_hold(1);
+            return;
+         }
+      }
+   }
+   fold->emit(rec, state);
+   add_key(fold, key);
+   output_hold(1);
+}
+
+void fold_flush(fold_t *fold) {
+   output_hold(0);
+   if (fold->period) {
+      end_loop(fold);
+   }
+   output_release();
+   fold->num_keys = 0;
+}
+
+void fold_destroy(fold_t *fold) {
+   free(fold);
+}
@@ -0,0 +1,40 @@
+#ifndef _INCLUDE_FOLD_H
+#define _INCLUDE_FOLD_H
+
+#include "defs.h"
+#include "trace.h"
+
+// Loop folding (--fold): collapses the instruction lines of a tight loop
+// (e.g. polling a status register, or a delay loop) into the lines of one
+// iteration, followed by a summary line with the number of iterations
+// folded, their cycles, and the registers on leaving the loop.
+//
+// A loop is a repeating sequence of instructions (by address and opcode),
+// so registers that change on each iteration (e.g. loop counters) don't
+// break it. Lines are held back while a loop might be repeating, and an
+// iteration that's not complete when the loop is left is shown as normal.
+// Any other output (e.g. memory logging) during a loop ends it, as do
+// interrupts, resets and failed predictions.
+
+// Longest loop that can be folded (in instructions)
+#define FOLD_MAX 64
+
+typedef struct fold fold_t;
+
+// Writes the line of an instruction
+typedef void (*fold_emit_t)(const trace_instr_t *rec, const int *state);
+
+// Create a fold of loops of up to max_len instructions
+fold_t *fold_create(cpu_emulator_t *em, int max_len, fold_emit_t emit);
+
+// Pass on the line of an instruction (state is as save_state, and must be
+// included for every instruction, as the summary shows the registers)
+void fold_instruction(fold_t *fold, const trace_instr_t *rec, const int *state);
+
+// Write out anything held back, and start again (at the start of a window,
+// or the end of the decode)
+void fold_flush(fold_t *fold);
+
+void fold_destroy(fold_t *fold);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+struct history {
+   int            size;
+   // Allocated on the first instruction, once the size of the state is known
+   trace_instr_t *records;
+   int           *states;
+   int            num_state;
+   // The next to be written, and how many are held
+   int            next;
+   int            count;
+};
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+history_t *history_create(int size) {
+   history_t *history = (history_t *)calloc(1, sizeof(history_t));
+   history->size = size;
+   return history;
+}
+
+void history_add(history_t *history, const trace_instr_t *rec, const int *state, int num_state) {
+   if (!history->records) {
+      history->num_state = num_state;
+      history->records = (trace_instr_t *)malloc(history->size * sizeof(trace_instr_t));
+      history->states = (int *)malloc(history->size * num_state * sizeof(int));
+   }
+   history->records[history->next] = *rec;
+   memcpy(history->states + history->next * history->num_state, state, history->num_state * sizeof(int));
+   if (++history->next == history->size) {
+      history->next = 0;
+   }
+   if (history->count < history->size) {
+      history->count++;
+   }
+}
+
+void history_replay(history_t *history, history_emit_t emit) {
+   int i = history->next - history->count;
+   if (i < 0) {
+      i += history->size;
+   }
+   for (int n = 0; n < history->count; n++) {
+      emit(history->records + i, history->states + i * history->num_state);
+      if (++i == history->size) {
+         i = 0;
+      }
+   }
+   history->count = 0;
+}
+
+void history_destroy(history_t *history) {
+   free(history->records);
+   free(history->states);
+   free(history);
+}
@@ -0,0 +1,32 @@
+#ifndef _INCLUDE_HISTORY_H
+#define _INCLUDE_HISTORY_H
+
+#include "defs.h"
+#include "trace.h"
+
+// Pre-trigger history (--pre_trigger): while the output is off, the last N
+// instructions that would otherwise have been shown are kept in a ring, as
+// their records and registers (as in a trace). They're only formatted if a
+// trigger then starts the output, so the lines leading up to it are shown
+// at no more cost than keeping the records until then.
+
+// Most instructions that can be kept
+#define HISTORY_MAX 1000000
+
+typedef struct history history_t;
+
+// Writes the line of an instruction
+typedef void (*history_emit_t)(const trace_instr_t *rec, const int *state);
+
+history_t *history_create(int size);
+
+// Keep an instruction (state is as save_state, of num_state ints), in place
+// of the oldest if full
+void history_add(history_t *history, const trace_instr_t *rec, const int *state, int num_state);
+
+// Write the lines of the instructions kept, oldest first, and forget them
+void history_replay(history_t *history, history_emit_t emit);
+
+void history_destroy(history_t *history);
+
+#endif
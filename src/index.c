@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "index.h"
+#include "memory.h"
+
+#define INDEX_MAGIC "D6502IDX"
+
+typedef struct {
+   char        magic[8];
+   uint32_t    version;
+   uint32_t    interval;
+   cache_key_t key;
+   uint64_t    num_checkpoints;
+   uint64_t    table_offset;
+} index_header_t;
+
+struct index {
+   FILE               *file;
+   char               *filename;
+   char               *tmpname;
+   int                 creating;
+   int                 failed;
+   index_header_t      header;
+   index_checkpoint_t *table;
+   uint64_t            size;     // allocated entries in the table
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static index_t *new_index(const char *filename, const cache_key_t *key) {
+   index_t *index = (index_t *)calloc(1, sizeof(index_t));
+   memcpy(index->header.magic, INDEX_MAGIC, sizeof(index->header.magic));
+   index->header.version = INDEX_VERSION;
+   index->header.key = *key;
+   index->filename = strdup(filename);
+   index->tmpname = (char *)malloc(strlen(filename) + 5);
+   sprintf(index->tmpname, "%s.tmp", filename);
+   return index;
+}
+
+static void free_index(index_t *index) {
+   free(index->filename);
+   free(index->tmpname);
+   free(index->table);
+   free(index);
+}
+
+// Find the last checkpoint no later than the first instruction that is
+// at or after both limits (the checkpoints are in order of both), or -1
+// if there isn't one
+static int64_t find_checkpoint(index_t *index, uint64_t instruction, uint32_t cycle_count) {
+   int64_t lo = 0;
+   int64_t hi = (int64_t) index->header.num_checkpoints - 1;
+   int64_t found = -1;
+   while (lo <= hi) {
+      int64_t mid = (lo + hi) / 2;
+      index_checkpoint_t *checkpoint = index->table + mid;
+      if (checkpoint->instruction <= instruction || checkpoint->cycle_count <= cycle_count) {
+         found = mid;
+         lo = mid + 1;
+      } else {
+         hi = mid - 1;
+      }
+   }
+   return found;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+index_t *index_open(const char *filename, const cache_key_t *key) {
+   FILE *fp = fopen(filename, "rb");
+   if (!fp) {
+      return NULL;
+   }
+   index_t *index = new_index(filename, key);
+   index_header_t header;
+   if (fread(&header, sizeof(header), 1, fp) != 1 ||
+       memcmp(header.magic, index->header.magic, sizeof(header.magic)) ||
+       header.version != index->header.version ||
+       memcmp(&header.key, &index->header.key, sizeof(header.key)) ||
+       header.num_checkpoints == 0) {
+      fclose(fp);
+      free_index(index);
+      return NULL;
+   }
+   index->header = header;
+   index->table = (index_checkpoint_t *)malloc(header.num_checkpoints * sizeof(index_checkpoint_t));
+   if (fseek(fp, header.table_offset, SEEK_SET) ||
+       fread(index->table, sizeof(index_checkpoint_t), header.num_checkpoints, fp) != header.num_checkpoints) {
+      fclose(fp);
+      free_index(index);
+      return NULL;
+   }
+   index->file = fp;
+   return index;
+}
+
+index_t *index_create(const char *filename, const cache_key_t *key, int interval) {
+   index_t *index = new_index(filename, key);
+   index->file = fopen(index->tmpname, "wb");
+   if (!index->file) {
+      free_index(index);
+      return NULL;
+   }
+   index->creating = 1;
+   index->header.interval = interval;
+   // The header is rewritten with the table offset when closed
+   if (fwrite(&index->header, sizeof(index->header), 1, index->file) != 1) {
+      fclose(index->file);
+      remove(index->tmpname);
+      free_index(index);
+      return NULL;
+   }
+   return index;
+}
+
+void index_add(index_t *index, index_checkpoint_t *checkpoint, const int *state, int num_state) {
+   uint64_t num = index->header.num_checkpoints;
+   if (num == index->size) {
+      index->size = index->size ? index->size * 2 : 1024;
+      index->table = (index_checkpoint_t *)realloc(index->table, index->size * sizeof(index_checkpoint_t));
+   }
+   checkpoint->offset = ftell(index->file);
+   index->table[num] = *checkpoint;
+   index->header.num_checkpoints++;
+   fwrite(&num_state, sizeof(num_state), 1, index->file);
+   fwrite(state, sizeof(int), num_state, index->file);
+   if (memory_save(index->file, num % INDEX_KEYFRAME == 0)) {
+      index->failed = 1;
+   }
+}
+
+const index_checkpoint_t *index_restore(index_t *index, uint64_t instruction, uint32_t cycle_count, int *state, int *num_state) {
+   int64_t num = find_checkpoint(index, instruction, cycle_count);
+   if (num < 0) {
+      return NULL;
+   }
+   // Replay the memory model from the previous full save
+   for (int64_t i = num - num % INDEX_KEYFRAME; i <= num; i++) {
+      if (fseek(index->file, index->table[i].offset, SEEK_SET) ||
+          fread(num_state, sizeof(int), 1, index->file) != 1 ||
+          *num_state < 0 || *num_state > INDEX_MAX_STATE ||
+          fread(state, sizeof(int), *num_state, index->file) != (size_t) *num_state ||
+          memory_restore(index->file)) {
+         index->failed = 1;
+         return NULL;
+      }
+   }
+   return index->table + num;
+}
+
+int index_close(index_t *index) {
+   int failed = index->failed;
+   if (index->creating) {
+      index->header.table_offset = ftell(index->file);
+      if (fwrite(index->table, sizeof(index_checkpoint_t), index->header.num_checkpoints, index->file) != index->header.num_checkpoints ||
+          fseek(index->file, 0, SEEK_SET) ||
+          fwrite(&index->header, sizeof(index->header), 1, index->file) != 1) {
+         failed = 1;
+      }
+      failed |= fclose(index->file) != 0;
+      if (failed || rename(index->tmpname, index->filename)) {
+         remove(index->tmpname);
+         failed = 1;
+      }
+   } else {
+      fclose(index->file);
+   }
+   free_index(index);
+   return failed;
+}
@@ -0,0 +1,61 @@
+#ifndef _INCLUDE_INDEX_H
+#define _INCLUDE_INDEX_H
+
+#include <inttypes.h>
+
+#include "cache.h"
+
+// Random access index: periodic checkpoints of the complete decoder
+// state (CPU registers and flags, the memory model, and the state of the
+// decoder itself), so a window in the middle of a long capture can be
+// decoded by restoring the nearest checkpoint, rather than decoding from
+// the start (or from an unknown state).
+//
+// The memory model is saved in full every INDEX_KEYFRAME checkpoints,
+// and as just the pages changed since the previous checkpoint otherwise,
+// so restoring a checkpoint applies at most INDEX_KEYFRAME of these.
+//
+// The header holds the same fingerprint of the capture and options as
+// the bus cycle cache (see cache.h), plus the emulation options.
+
+#define INDEX_VERSION 3
+
+#define INDEX_KEYFRAME 64
+
+// The most ints of decoder state that can be saved in a checkpoint
+#define INDEX_MAX_STATE 64
+
+typedef struct {
+   uint64_t instruction;   // number of instructions decoded before this one
+   uint32_t sample_count;  // of the first bus cycle of the instruction
+   uint32_t cycle_count;
+   uint64_t offset;        // of the saved state in the index file
+} index_checkpoint_t;
+
+typedef struct index index_t;
+
+// Open an existing index, returns NULL if missing or the key differs
+index_t *index_open(const char *filename, const cache_key_t *key);
+
+// Create a new index, which the caller adds a checkpoint to every
+// interval instructions (recorded in the header)
+index_t *index_create(const char *filename, const cache_key_t *key, int interval);
+
+// Add a checkpoint (when creating), with the decoder state plus the
+// current state of the memory model
+void index_add(index_t *index, index_checkpoint_t *checkpoint, const int *state, int num_state);
+
+// Restore the last checkpoint no later than the first instruction at or
+// after both instruction and cycle_count, returning it (or NULL if there
+// isn't one)
+//
+// The memory model is restored directly, the decoder state is copied
+// into state (which should have room for INDEX_MAX_STATE ints).
+const index_checkpoint_t *index_restore(index_t *index, uint64_t instruction, uint32_t cycle_count, int *state, int *num_state);
+
+// Close the index, renaming it into place if it was created
+//
+// Returns non-zero if the index could not be read or written
+int index_close(index_t *index);
+
+#endif
@@ -0,0 +1,544 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "layout.h"
+#include "disasm.h"
+#include "memory.h"
+#include "output.h"
+
+#define MAX_EMITS 64
+#define MAX_TEXT  256
+
+// Longest disassembly allowed for when checking the length of a line
+#define MAX_DISASSEMBLY 32
+
+typedef enum {
+   EMIT_TEXT,     // literal text
+   EMIT_SAMPLE,   // bus cycle number
+   EMIT_PB,       // program bank (65C816)
+   EMIT_ROMNO,    // BBC rom number (from the memory model)
+   EMIT_PC,
+   EMIT_HEX,      // instruction bytes
+   EMIT_INSTR,    // disassembly
+   EMIT_CYCLES,
+   EMIT_STATE,    // all the registers
+   EMIT_REG,      // one register, from the state
+   EMIT_FLAGS,    // all the flags, from the state
+   EMIT_FWA,      // BBC floating-point work areas (from the memory model)
+   EMIT_USER      // user signal
+} emit_type_t;
+
+typedef struct {
+   emit_type_t type;
+   int         width;    // minimum width, padded with spaces
+   int         offset;   // of the text, or the register in the state
+   int         len;
+} emit_t;
+
+struct layout {
+   cpu_emulator_t *em;
+   int             hex_bytes;
+   int             uses;
+   int             num_emits;
+   emit_t          emits[MAX_EMITS];
+   int             text_len;
+   char            text[MAX_TEXT];
+   // The state with every register unknown, naming the registers
+   char            state[OUTPUT_MAX_LINE];
+   int             state_len;
+   // Offsets of the flags in the state
+   int             num_flags;
+   int             flags[MAX_EM_STATE];
+};
+
+// escaping is to avoid unwanted trigraphs
+static const char default_fwa[] = "\?\?-\?\?:\?\?\?\?\?\?\?\?:\?\?:\?\? = \?\?\?\?\?\?\?\?\?\?\?\?\?\?\?";
+
+#define OFFSET_SIGN      0
+#define OFFSET_EXP       3
+#define OFFSET_MANTISSA  6
+#define OFFSET_ROUND    15
+#define OFFSET_OVERFLOW 18
+#define OFFSET_VALUE    23
+
+// Length of the FWA field ("FWA ... : FWB ...")
+#define FWA_LEN (2 * (sizeof(default_fwa) - 1) + 11)
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static char *write_fwa(const layout_t *layout, char *bp, const char *name, int a_sign, int a_exp, int a_mantissa, int a_round, int a_overflow) {
+   cpu_emulator_t *em = layout->em;
+   char fwabuf[80];
+   strcpy(fwabuf, default_fwa);
+   int sign     = em->read_memory(a_sign);
+   int exp      = em->read_memory(a_exp);
+   int man1     = em->read_memory(a_mantissa);
+   int man2     = em->read_memory(a_mantissa + 1);
+   int man3     = em->read_memory(a_mantissa + 2);
+   int man4     = em->read_memory(a_mantissa + 3);
+   int round    = em->read_memory(a_round);
+   int overflow = a_overflow >= 0 ? em->read_memory(a_overflow) : -1;
+   if (sign >= 0) {
+      write_hex2(fwabuf + OFFSET_SIGN, sign);
+   }
+   if (exp >= 0) {
+      write_hex2(fwabuf + OFFSET_EXP, exp);
+   }
+   if (man1 >= 0) {
+      write_hex2(fwabuf + OFFSET_MANTISSA + 0, man1);
+   }
+   if (man2 >= 0) {
+      write_hex2(fwabuf + OFFSET_MANTISSA + 2, man2);
+   }
+   if (man3 >= 0) {
+      write_hex2(fwabuf + OFFSET_MANTISSA + 4, man3);
+   }
+   if (man4 >= 0) {
+      write_hex2(fwabuf + OFFSET_MANTISSA + 6, man4);
+   }
+   if (round >= 0) {
+      write_hex2(fwabuf + OFFSET_ROUND, round);
+   }
+   if (overflow >= 0) {
+      write_hex2(fwabuf + OFFSET_OVERFLOW, overflow);
+   }
+   if (sign >= 0 && exp >= 0 && man1 >= 0 && man2 >= 0 && man3 >= 0 && man4 >= 0 && round >= 0) {
+
+      // Real numbers are held in binary floating point format. In the
+      // default (40-bit) mode the mantissa is held as a 4 byte binary
+      // fraction in sign and magnitude format. Bit 7 of the MSB of
+      // the mantissa is the sign bit. When working out the value of
+      // the mantissa, this bit is assumed to be 1 (a decimal value of
+      // 0.5). The exponent is held as a single byte in 'excess 127'
+      // format. In other words, if the actual exponent is zero, the
+      // value stored in the exponent byte is 127.
+
+      // Build up a 32 bit mantissa
+      uint64_t mantissa = man1;
+      mantissa = (mantissa << 8) + man2;
+      mantissa = (mantissa << 8) + man3;
+      mantissa = (mantissa << 8) + man4;
+
+      // Extend this to 40 bits with the rounding byte
+      mantissa = (mantissa << 8) + round;
+
+      // Combine with the exponent
+      double value = ((double) mantissa) * pow(2.0, exp - 128 - 40);
+      // Take account of the sign
+      if (sign & 128) {
+         value = -value;
+      }
+      // Print it to the fwabuf
+      sprintf(fwabuf + OFFSET_VALUE, "%-+15.8E", value);
+   }
+   return bp + sprintf(bp, "%s %s", name, fwabuf);
+}
+
+static layout_t *new_layout(cpu_emulator_t *em, int c816) {
+   layout_t *layout = (layout_t *)calloc(1, sizeof(layout_t));
+   layout->em = em;
+   layout->hex_bytes = c816 ? 4 : 3;
+   int unknown[MAX_EM_STATE];
+   for (int i = 0; i < MAX_EM_STATE; i++) {
+      unknown[i] = -1;
+   }
+   layout->state_len = em->write_state(layout->state, unknown) - layout->state;
+   return layout;
+}
+
+static emit_t *add_emit(layout_t *layout, emit_type_t type, int width) {
+   if (layout->num_emits == MAX_EMITS) {
+      return NULL;
+   }
+   emit_t *e = layout->emits + layout->num_emits++;
+   e->type = type;
+   e->width = width;
+   if (type == EMIT_STATE || type == EMIT_REG || type == EMIT_FLAGS) {
+      layout->uses |= LAYOUT_STATE;
+   } else if (type == EMIT_ROMNO) {
+      layout->uses |= LAYOUT_ROMNO;
+   } else if (type == EMIT_FWA) {
+      layout->uses |= LAYOUT_FWA;
+   }
+   return e;
+}
+
+// Adjacent text is merged into one emit
+static int add_text(layout_t *layout, const char *text, int len) {
+   if (layout->text_len + len > MAX_TEXT) {
+      return 1;
+   }
+   emit_t *e = layout->num_emits ? layout->emits + layout->num_emits - 1 : NULL;
+   if (!e || e->type != EMIT_TEXT || e->width) {
+      if (!(e = add_emit(layout, EMIT_TEXT, 0))) {
+         return 1;
+      }
+      e->offset = layout->text_len;
+      e->len = 0;
+   }
+   memcpy(layout->text + layout->text_len, text, len);
+   layout->text_len += len;
+   e->len += len;
+   return 0;
+}
+
+// Find a register in the state by name, returning the length of the name
+// (or 0 if not found); with exact clear, the longest that prefixes name
+static int find_register(layout_t *layout, const char *name, int exact, emit_t *e) {
+   int best = 0;
+   const char *p = layout->state;
+   while (*p) {
+      const char *eq = strchr(p, '=');
+      if (!eq) {
+         break;
+      }
+      const char *value = eq + 1;
+      const char *end = strchr(value, ' ');
+      if (!end) {
+         end = value + strlen(value);
+      }
+      int len = eq - p;
+      int match = exact ? ((int) strlen(name) == len && !strncmp(name, p, len)) : !strncmp(name, p, len);
+      // The first of the same name (e.g. the 65C816 X register, not flag)
+      if (match && len > best) {
+         best = len;
+         e->offset = value - layout->state;
+         e->len = end - value;
+      }
+      p = *end ? end + 1 : end;
+   }
+   return best;
+}
+
+// The flags are the registers shown as a single digit
+static void find_flags(layout_t *layout) {
+   layout->num_flags = 0;
+   const char *p = layout->state;
+   while ((p = strchr(p, '=')) != NULL) {
+      p++;
+      if (p[0] && (p[1] == ' ' || p[1] == 0) && layout->num_flags < MAX_EM_STATE) {
+         layout->flags[layout->num_flags++] = p - layout->state;
+      }
+   }
+}
+
+// The most characters an emit can write
+static int max_len(const layout_t *layout, const emit_t *e) {
+   int len;
+   switch (e->type) {
+   case EMIT_TEXT:   len = e->len;                      break;
+   case EMIT_SAMPLE: len = 8;                           break;
+   case EMIT_PB:     len = 2;                           break;
+   case EMIT_ROMNO:  len = 2;                           break;
+   case EMIT_PC:     len = 4;                           break;
+   case EMIT_HEX:    len = layout->hex_bytes * 3 - 1;   break;
+   case EMIT_INSTR:  len = MAX_DISASSEMBLY;             break;
+   case EMIT_CYCLES: len = 1;                           break;
+   case EMIT_STATE:  len = layout->state_len;           break;
+   case EMIT_REG:    len = e->len;                      break;
+   case EMIT_FLAGS:  len = layout->num_flags;           break;
+   case EMIT_FWA:    len = FWA_LEN;                     break;
+   default:          len = 1;                           break;
+   }
+   return len > e->width ? len : e->width;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+layout_t *layout_create_default(cpu_emulator_t *em, arguments_t *args, int c816, int fail) {
+   layout_t *layout = new_layout(em, c816);
+   // Show sample count
+   if (args->show_samplenums) {
+      add_emit(layout, EMIT_SAMPLE, 0);
+      add_text(layout, " : ", 3);
+   }
+   // Show address
+   if (fail || args->show_address) {
+      if (c816) {
+         add_emit(layout, EMIT_PB, 0);
+      }
+      if (args->show_romno) {
+         add_emit(layout, EMIT_ROMNO, 0);
+      }
+      add_emit(layout, EMIT_PC, 0);
+      add_text(layout, " : ", 3);
+   }
+   // Show hex bytes
+   if (fail || args->show_hex) {
+      add_emit(layout, EMIT_HEX, 0);
+      add_text(layout, " : ", 3);
+   }
+   // Pad the disassembly to 14 characters if there is more to come, to match python
+   int pad = (fail || args->show_cycles || args->show_state || args->show_bbcfwa) ? 14 : 0;
+   if (fail || args->show_something) {
+      add_emit(layout, EMIT_INSTR, pad);
+   } else if (pad) {
+      add_text(layout, "              ", pad);
+   }
+   // Show cycles (don't include with fail as it is inconsistent depending on whether rdy is present)
+   if (args->show_cycles) {
+      add_text(layout, " : ", 3);
+      add_emit(layout, EMIT_CYCLES, 0);
+   }
+   // Show register state
+   if (fail || args->show_state) {
+      add_text(layout, " : ", 3);
+      add_emit(layout, EMIT_STATE, 0);
+   }
+   // Show BBC floating point work area FWA, FWB
+   if (args->show_bbcfwa) {
+      add_text(layout, " : ", 3);
+      add_emit(layout, EMIT_FWA, 0);
+   }
+   // Show the user defined signal value
+   if (args->idx_user >= 0) {
+      add_text(layout, " : ", 3);
+      add_emit(layout, EMIT_USER, 0);
+   }
+   // Show any errors
+   if (fail) {
+      add_text(layout, " prediction failed", 18);
+   }
+   return layout;
+}
+
+layout_t *layout_create(cpu_emulator_t *em, const char *format, int c816, int fail) {
+   layout_t *layout = new_layout(em, c816);
+   find_flags(layout);
+   const char *p = format;
+   const char *error = NULL;
+   while (*p && !error) {
+      if (*p != '%') {
+         const char *q = strchr(p, '%');
+         int len = q ? q - p : (int) strlen(p);
+         if (add_text(layout, p, len)) {
+            error = "too long";
+         }
+         p += len;
+         continue;
+      }
+      p++;
+      int width = 0;
+      while (*p >= '0' && *p <= '9') {
+         width = width * 10 + (*p++ - '0');
+      }
+      emit_t field = { .width = width };
+      int ok = 1;
+      switch (*p) {
+      case '%':
+         if (add_text(layout, "%", 1)) {
+            error = "too long";
+         }
+         p++;
+         continue;
+      case 'Y': field.type = EMIT_SAMPLE; p++; break;
+      case 'r': field.type = EMIT_ROMNO;  p++; break;
+      case 'h': field.type = EMIT_HEX;    p++; break;
+      case 'i': field.type = EMIT_INSTR;  p++; break;
+      case 'y': field.type = EMIT_CYCLES; p++; break;
+      case 's': field.type = EMIT_STATE;  p++; break;
+      case 'f': field.type = EMIT_FWA;    p++; break;
+      case 'u': field.type = EMIT_USER;   p++; break;
+      case 'a':
+         // As the address column: the bank (on the 65C816) and pc
+         if (c816) {
+            ok = add_emit(layout, EMIT_PB, 0) != NULL;
+            field.width = width > 2 ? width - 2 : 0;
+         }
+         field.type = EMIT_PC;
+         p++;
+         break;
+      case '{': {
+         const char *end = strchr(p, '}');
+         char name[16];
+         int len = end ? end - p - 1 : 0;
+         if (len <= 0 || len >= (int) sizeof(name)) {
+            error = "bad register name";
+            break;
+         }
+         memcpy(name, p + 1, len);
+         name[len] = 0;
+         if (!strcmp(name, "P")) {
+            field.type = EMIT_FLAGS;
+         } else if (find_register(layout, name, 1, &field)) {
+            field.type = EMIT_REG;
+         } else {
+            error = "unknown register";
+         }
+         p = end + 1;
+         break;
+      }
+      default: {
+         int len = find_register(layout, p, 0, &field);
+         if (len) {
+            field.type = EMIT_REG;
+            p += len;
+         } else if (*p == 'P') {
+            field.type = EMIT_FLAGS;
+            p++;
+         } else {
+            error = "unknown field";
+         }
+         break;
+      }
+      }
+      if (error) {
+         break;
+      }
+      emit_t *e = ok ? add_emit(layout, field.type, field.width) : NULL;
+      if (!e) {
+         error = "too long";
+         break;
+      }
+      e->offset = field.offset;
+      e->len = field.len;
+   }
+   if (!error && fail && add_text(layout, " prediction failed", 18)) {
+      error = "too long";
+   }
+   if (!error) {
+      int len = 0;
+      for (int i = 0; i < layout->num_emits; i++) {
+         len += max_len(layout, layout->emits + i);
+      }
+      if (len >= OUTPUT_MAX_LINE) {
+         error = "line too long";
+      }
+   }
+   if (error) {
+      fprintf(stderr, "--format: %s at \"%s\"\n", error, p);
+      free(layout);
+      return NULL;
+   }
+   return layout;
+}
+
+int layout_uses(const layout_t *layout) {
+   return layout->uses;
+}
+
+char *layout_write(const layout_t *layout, char *bp, const trace_instr_t *rec, const int *state, int slot) {
+
+   // Try to minimise the calls to printf as these are quite expensive
+
+   char regs[OUTPUT_MAX_LINE];
+   int have_regs = 0;
+   const emit_t *e = layout->emits;
+   const emit_t *end = e + layout->num_emits;
+   for (; e < end; e++) {
+      char *start = bp;
+      switch (e->type) {
+      case EMIT_TEXT:
+         memcpy(bp, layout->text + e->offset, e->len);
+         bp += e->len;
+         break;
+      case EMIT_SAMPLE:
+         write_hex8(bp, rec->sample_count);
+         bp += 8;
+         break;
+      case EMIT_PB:
+         if (rec->pb < 0) {
+            *bp++ = '?';
+            *bp++ = '?';
+         } else {
+            write_hex2(bp, rec->pb);
+            bp += 2;
+         }
+         break;
+      case EMIT_ROMNO:
+         bp += write_bankid(bp, rec->pc);
+         break;
+      case EMIT_PC:
+         if (rec->pc < 0) {
+            *bp++ = '?';
+            *bp++ = '?';
+            *bp++ = '?';
+            *bp++ = '?';
+         } else {
+            write_hex4(bp, rec->pc);
+            bp += 4;
+         }
+         break;
+      case EMIT_HEX: {
+         const uint8_t bytes[4] = { rec->opcode, rec->op1, rec->op2, rec->op3 };
+         int none = rec->kind & (STEP_RESET | STEP_INTERRUPT);
+         for (int i = 0; i < layout->hex_bytes; i++) {
+            if (i) {
+               *bp++ = ' ';
+            }
+            if (none || i > rec->opcount) {
+               *bp++ = ' ';
+               *bp++ = ' ';
+            } else {
+               write_hex2(bp, bytes[i]);
+               bp += 2;
+            }
+         }
+         break;
+      }
+      case EMIT_INSTR:
+         if (rec->kind & STEP_RESET) {
+            bp += write_s(bp, "RESET !!");
+         } else if (rec->kind & STEP_INTERRUPT) {
+            bp += write_s(bp, "INTERRUPT !!");
+         } else {
+            instruction_t instr = {
+               .pc      = rec->pc,
+               .pb      = rec->pb,
+               .opcode  = rec->opcode,
+               .op1     = rec->op1,
+               .op2     = rec->op2,
+               .op3     = rec->op3,
+               .opcount = rec->opcount,
+               .ea      = rec->ea
+            };
+            bp += disasm_instruction(slot, bp, &instr);
+         }
+         break;
+      case EMIT_CYCLES:
+         // No instruction is more then 8 cycles
+         write_hex1(bp++, rec->real_cycles);
+         break;
+      case EMIT_STATE:
+         bp = layout->em->write_state(bp, state);
+         break;
+      case EMIT_REG:
+      case EMIT_FLAGS:
+         if (!have_regs) {
+            layout->em->write_state(regs, state);
+            have_regs = 1;
+         }
+         if (e->type == EMIT_REG) {
+            memcpy(bp, regs + e->offset, e->len);
+            bp += e->len;
+         } else {
+            for (int i = 0; i < layout->num_flags; i++) {
+               *bp++ = regs[layout->flags[i]];
+            }
+         }
+         break;
+      case EMIT_FWA:
+         bp = write_fwa(layout, bp, "FWA", 0x2e, 0x30, 0x31, 0x35, 0x2f);
+         bp += write_s(bp, " : ");
+         bp = write_fwa(layout, bp, "FWB", 0x3b, 0x3c, 0x3d, 0x41,   -1);
+         break;
+      case EMIT_USER:
+         *bp++ = rec->user >= 0 ? '0' + rec->user : '?';
+         break;
+      }
+      while (bp - start < e->width) {
+         *bp++ = ' ';
+      }
+   }
+   return bp;
+}
+
+void layout_destroy(layout_t *layout) {
+   free(layout);
+}
@@ -0,0 +1,50 @@
+#ifndef _INCLUDE_LAYOUT_H
+#define _INCLUDE_LAYOUT_H
+
+#include <stddef.h>
+
+#include "defs.h"
+#include "trace.h"
+
+// The layout of the line of output for an instruction, compiled once
+// (from the output options, or a --format string) into a flat plan of
+// emit operations, so each line is written without testing every option.
+//
+// A --format string is text with these fields:
+//   %Y  bus cycle number           %a  address
+//   %r  BBC rom number             %h  hex bytes
+//   %i  disassembly                %y  number of bus cycles
+//   %s  register/flag state        %f  BBC floating-point work areas
+//   %u  user signal                %%  a %
+//   %R or %{R}  register (or flag) R, named as in the state, e.g. %A, %X,
+//               %SP, %{Y} (as %Y is the bus cycle number)
+//   %P  all the flags
+// Any field can have a minimum width, e.g. %14i, padded with spaces.
+
+// What a layout uses, other than the instruction record
+#define LAYOUT_STATE 1   // the registers
+#define LAYOUT_ROMNO 2   // the memory model, for the BBC rom number
+#define LAYOUT_FWA   4   // the memory model, for the BBC floating-point work areas
+
+typedef struct layout layout_t;
+
+// Compile the layout of the output options (fail is set for the layout of
+// an instruction that failed prediction, which shows more)
+layout_t *layout_create_default(cpu_emulator_t *em, arguments_t *args, int c816, int fail);
+
+// Compile a --format string, returning NULL (with a message on stderr) if
+// it's not valid
+layout_t *layout_create(cpu_emulator_t *em, const char *format, int c816, int fail);
+
+int layout_uses(const layout_t *layout);
+
+// Write the line for an instruction (without a newline), from its record
+// and the registers afterwards (as save_state), returning the end
+//
+// Other than with LAYOUT_ROMNO or LAYOUT_FWA, this can be called on any
+// thread (slot is as for disasm_instruction).
+char *layout_write(const layout_t *layout, char *bp, const trace_instr_t *rec, const int *state, int slot);
+
+void layout_destroy(layout_t *layout);
+
+#endif
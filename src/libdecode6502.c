@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <argp.h>
+
+#include "decode6502.h"
+#include "defs.h"
+#include "capture.h"
+#include "output.h"
+#include "context.h"
+#include "decoder.h"
+
+// Length of the state string in a record (the longest is the 65C816)
+#define STATE_SIZE 128
+
+typedef struct {
+   decode6502_record_t record;
+   char                state[STATE_SIZE];
+   char               *text;
+} entry_t;
+
+struct decode6502 {
+   context_t      *context;
+   int             configured;
+   int             ended;
+
+   // Samples are passed to the decoder a whole number at a time, each
+   // block preceeded by the history (see decoder_feed)
+   size_t          align;
+   uint64_t        to_skip;
+   uint8_t        *buffer;
+   size_t          buffer_size;
+   size_t          held;         // bytes after the history not yet decoded
+
+   // Output is collected in the chunk, and moved to pending as it fills
+   output_chunk_t *chunk;
+   char           *pending;
+   size_t          pending_len;
+   size_t          pending_size;
+
+   // The records decoded, but not yet returned
+   entry_t        *queue;
+   size_t          queue_head;
+   size_t          queue_len;
+   size_t          queue_size;
+
+   // The record last returned (which owns its text)
+   entry_t         last;
+};
+
+// The decoder being worked on by this thread (the output handoff has no
+// other way to find it)
+static __thread decode6502_t *active;
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static context_t *enter(decode6502_t *d) {
+   context_t *saved = context;
+   context = d->context;
+   active = d;
+   return saved;
+}
+
+static void leave(context_t *saved) {
+   context = saved;
+   active = NULL;
+}
+
+static void pending_append(decode6502_t *d, const char *text, size_t len) {
+   if (d->pending_len + len > d->pending_size) {
+      d->pending_size = (d->pending_len + len) * 2;
+      d->pending = (char *)realloc(d->pending, d->pending_size);
+   }
+   memcpy(d->pending + d->pending_len, text, len);
+   d->pending_len += len;
+}
+
+// Move the text in the chunk to the pending text
+static void collect_output(decode6502_t *d) {
+   pending_append(d, d->chunk->text, d->chunk->len);
+   d->chunk->len = 0;
+   d->chunk->num_profile = 0;
+}
+
+static output_chunk_t *lib_handoff(output_chunk_t *chunk) {
+   collect_output(active);
+   return chunk;
+}
+
+// Add a record to the queue, taking the pending text
+static entry_t *queue_record(decode6502_t *d, int kind) {
+   if (d->queue_len == d->queue_size) {
+      d->queue_size = d->queue_size ? d->queue_size * 2 : 256;
+      d->queue = (entry_t *)realloc(d->queue, d->queue_size * sizeof(entry_t));
+   }
+   entry_t *e = d->queue + d->queue_len++;
+   memset(e, 0, sizeof(entry_t));
+   e->record.kind = kind;
+   e->text = (char *)malloc(d->pending_len + 1);
+   memcpy(e->text, d->pending, d->pending_len);
+   e->text[d->pending_len] = '\0';
+   e->record.text_len = d->pending_len;
+   d->pending_len = 0;
+   return e;
+}
+
+static void lib_hook(void *data, const bus_window_t *window, step_t *step, int real_cycles) {
+   decode6502_t *d = (decode6502_t *)data;
+   collect_output(d);
+   entry_t *e = queue_record(d, (step->kind & STEP_RESET) ? DECODE6502_RESET : (step->kind & STEP_INTERRUPT) ? DECODE6502_INTERRUPT : DECODE6502_INSTRUCTION);
+   decode6502_record_t *r = &e->record;
+   instruction_t *instruction = step->instruction;
+   r->sample_count = window->sample_count[0];
+   r->cycle_count  = window->cycle_count[0];
+   r->num_cycles   = step->num_cycles;
+   r->real_cycles  = real_cycles;
+   r->pc           = instruction->pc;
+   r->pb           = context->arguments.cpu_type == CPU_65C816 ? instruction->pb : -1;
+   r->opcode       = instruction->opcode;
+   r->op1          = instruction->op1;
+   r->op2          = instruction->op2;
+   r->op3          = instruction->op3;
+   r->opcount      = instruction->opcount;
+   r->ea           = instruction->ea;
+   r->fail         = step->fail;
+   char *end = decoder_emulator()->get_state(e->state);
+   *end = '\0';
+}
+
+static int check_options(arguments_t *args) {
+   if (args->filename) {
+      fprintf(stderr, "a capture file can't be given to the library\n");
+      return 1;
+   }
+   if (args->profile) {
+      fprintf(stderr, "--profile is not supported by the library\n");
+      return 1;
+   }
+   if (args->fanout_file) {
+      fprintf(stderr, "--fanout is not supported by the library\n");
+      return 1;
+   }
+   return decoder_check_fed();
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+decode6502_t *decode6502_create() {
+   decode6502_t *d = (decode6502_t *)calloc(1, sizeof(decode6502_t));
+   if (!d) {
+      return NULL;
+   }
+   d->context = context_create();
+   d->chunk = (output_chunk_t *)malloc(sizeof(output_chunk_t));
+   if (!d->context || !d->chunk) {
+      decode6502_destroy(d);
+      return NULL;
+   }
+   return d;
+}
+
+int decode6502_configure(decode6502_t *d, int argc, char *argv[]) {
+   if (d->configured) {
+      fprintf(stderr, "decoder is already configured\n");
+      return 1;
+   }
+   context_t *saved = enter(d);
+   int ret = decoder_configure(argc, argv, ARGP_NO_EXIT);
+   arguments_t *args = &context->arguments;
+   if (!ret) {
+      ret = check_options(args);
+   }
+   if (!ret) {
+      d->align = args->byte ? sizeof(uint8_t) : sizeof(uint16_t);
+      d->to_skip = (uint64_t) args->skip * d->align;
+      d->buffer_size = CAPTURE_HISTORY + CAPTURE_WINDOW;
+      d->buffer = (uint8_t *)calloc(1, d->buffer_size);
+      decoder_set_hook(lib_hook, d);
+      output_divert(lib_handoff, d->chunk);
+      decoder_begin();
+      d->configured = 1;
+   }
+   leave(saved);
+   return ret;
+}
+
+int decode6502_feed(decode6502_t *d, const void *samples, size_t len) {
+   if (!d->configured || d->ended) {
+      return 1;
+   }
+   const uint8_t *data = (const uint8_t *)samples;
+   if (d->to_skip) {
+      size_t n = d->to_skip < len ? d->to_skip : len;
+      d->to_skip -= n;
+      data += n;
+      len -= n;
+   }
+   if (CAPTURE_HISTORY + d->held + len > d->buffer_size) {
+      d->buffer_size = (CAPTURE_HISTORY + d->held + len) * 2;
+      d->buffer = (uint8_t *)realloc(d->buffer, d->buffer_size);
+   }
+   memcpy(d->buffer + CAPTURE_HISTORY + d->held, data, len);
+   d->held += len;
+   size_t num = d->held - d->held % d->align;
+   if (num > 0) {
+      context_t *saved = enter(d);
+      decoder_feed(d->buffer + CAPTURE_HISTORY, num);
+      leave(saved);
+      // Keep the history, and any partial sample, for the next block
+      memmove(d->buffer, d->buffer + num, CAPTURE_HISTORY + d->held - num);
+      d->held -= num;
+   }
+   return 0;
+}
+
+int decode6502_end(decode6502_t *d) {
+   if (!d->configured || d->ended) {
+      return 1;
+   }
+   context_t *saved = enter(d);
+   decoder_end();
+   output_restore();
+   collect_output(d);
+   if (d->pending_len) {
+      entry_t *e = queue_record(d, DECODE6502_TEXT);
+      e->record.pc = -1;
+      e->record.pb = -1;
+      e->record.ea = -1;
+   }
+   leave(saved);
+   d->ended = 1;
+   return 0;
+}
+
+int decode6502_next(decode6502_t *d, decode6502_record_t *record) {
+   free(d->last.text);
+   d->last.text = NULL;
+   if (d->queue_head == d->queue_len) {
+      d->queue_head = 0;
+      d->queue_len = 0;
+      return 0;
+   }
+   d->last = d->queue[d->queue_head++];
+   *record = d->last.record;
+   record->state = d->last.state;
+   record->text = d->last.text;
+   return 1;
+}
+
+void decode6502_destroy(decode6502_t *d) {
+   if (!d) {
+      return;
+   }
+   if (d->context) {
+      if (d->configured && !d->ended) {
+         decode6502_end(d);
+      }
+      context_destroy(d->context);
+   }
+   for (size_t i = d->queue_head; i < d->queue_len; i++) {
+      free(d->queue[i].text);
+   }
+   free(d->last.text);
+   free(d->queue);
+   free(d->pending);
+   free(d->buffer);
+   free(d->chunk);
+   free(d);
+}
@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memmap.h"
+
+#define MAX_LINE   256
+#define MAX_TOKENS 16
+
+// ====================================================================
+// Built-in machines
+// ====================================================================
+
+static const char *beeb_map =
+   "latch rom FE30 0F\n"
+   "ram swrom 40000\n"
+   "map 8000-BFFF swrom[rom] cw\n"
+   "map FC00-FEFF main w\n"
+   "map 0000-FFFFFF main cw\n"
+   "tube FEE0-FEE8\n";
+
+static const char *master_map =
+   "latch rom FE30 8F\n"
+   "latch acccon FE34 FF\n"
+   "ram swrom 40000\n"
+   "ram lynne 5000\n"                  // 20KB overlaid at 3000-7FFF
+   "ram hazel 2000\n"                  //  8KB overlaid at C000-DFFF
+   "ram andy 1000\n"                   //  4KB overlaid at 8000-8FFF
+   "map C000-DFFF hazel cw when acccon&08\n"
+   "map 8000-8FFF andy cw when rom&80\n"
+   "map 3000-7FFF lynne cw when vdu=1 acccon&02\n"
+   "map 3000-7FFF lynne cw when vdu=0 acccon&04\n"
+   "map 8000-BFFF swrom[rom&0F] cw when rom&0C=04\n"
+   "map 8000-BFFF swrom[rom&0F] c\n"
+   "map 0000-7FFF main cw\n"
+   "map FC00-FEFF main w\n"
+   "map 0000-FFFFFF main c\n"
+   "tube FEE0-FEE8\n";
+
+static const char *elk_map =
+   "latch rom FE05 0F\n"
+   "ram swrom 40000\n"
+   "map 8000-BFFF swrom[rom] cw\n"
+   "map FC00-FEFF main w\n"
+   "map 0000-FFFFFF main cw\n"
+   "tube FCE0-FCE8\n";
+
+// RAM from 0000->01FF aliased 8 times from 0000->1FFF
+//     (i.e. A10,11,12 are don't care)
+// RAM from A000->A080 aliases 8 times from A000->AFFF
+//     (i.e. A9,10,11 are don't care)
+//
+// TODO: correctly handle aliasing
+static const char *mek6800d2_map =
+   "map 0000-1FFF main cw\n"
+   "map A000-AFFF main cw\n"
+   "map 0000-FFFFFF main rw\n";
+
+static const char *atom_map =
+   "map 0000-9FFF main cw\n"
+   "map 0000-FFFFFF main rw\n";
+
+// The 65C816 Blitter, which boots with bank 0 mapped to bank FF
+static const char *blitter_map =
+   "latch rom FFFE30 0F\n"
+   "latch boot FFFE31 20 20\n"
+   "ram swrom 40000\n"
+   "remap 000000-00FFFF FF0000 when boot&20\n"
+   "map FF8000-FFBFFF swrom[rom] cw\n"
+   "map FFFC00-FFFEFF main w\n"
+   "map 000000-FFFFFF main cw\n"
+   "tube FEE0-FEE8\n";
+
+static const char *default_map =
+   "map 000000-FFFFFF main cw\n";
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static int parse_hex(const char *token, int *value) {
+   char *end;
+   long v = strtol(token, &end, 16);
+   if (!*token || *end || v < 0 || v > 0xFFFFFF) {
+      return 1;
+   }
+   *value = (int) v;
+   return 0;
+}
+
+static int parse_range(const char *token, int *lo, int *hi) {
+   char buf[32];
+   const char *dash = strchr(token, '-');
+   if (!dash || dash - token >= (int) sizeof(buf)) {
+      return 1;
+   }
+   memcpy(buf, token, dash - token);
+   buf[dash - token] = 0;
+   return parse_hex(buf, lo) || parse_hex(dash + 1, hi) || *lo > *hi;
+}
+
+// Returns the index of a variable, adding it if create is set, or -1
+static int find_var(memmap_t *map, const char *name, int len, int create) {
+   for (int i = 0; i < map->num_vars; i++) {
+      if ((int) strlen(map->var_names[i]) == len && !strncmp(map->var_names[i], name, len)) {
+         return i;
+      }
+   }
+   if (!create || map->num_vars == MEMMAP_MAX_VARS || len >= (int) sizeof(map->var_names[0])) {
+      return -1;
+   }
+   memcpy(map->var_names[map->num_vars], name, len);
+   map->var_names[map->num_vars][len] = 0;
+   return map->num_vars++;
+}
+
+static int find_region(memmap_t *map, const char *name, int len) {
+   for (int i = 0; i < map->num_rams; i++) {
+      if ((int) strlen(map->rams[i].name) == len && !strncmp(map->rams[i].name, name, len)) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+// Parse VAR or VAR&MASK, and then =VALUE if allowed
+static const char *parse_term(memmap_t *map, const char *token, memmap_cond_t *cond, int with_value) {
+   int len = strcspn(token, "&=]");
+   cond->var = find_var(map, token, len, 0);
+   if (cond->var < 0) {
+      return "unknown variable";
+   }
+   cond->mask = -1;
+   cond->value = -1;
+   char buf[32];
+   const char *p = token + len;
+   if (*p == '&') {
+      p++;
+      len = strcspn(p, "=]");
+      if (len >= (int) sizeof(buf)) {
+         return "bad mask";
+      }
+      memcpy(buf, p, len);
+      buf[len] = 0;
+      if (parse_hex(buf, &cond->mask)) {
+         return "bad mask";
+      }
+      p += len;
+   }
+   if (*p == '=' && with_value) {
+      if (parse_hex(p + 1, &cond->value)) {
+         return "bad value";
+      }
+   } else if (*p && *p != ']') {
+      return "bad condition";
+   }
+   if (cond->mask < 0 && cond->value < 0) {
+      // A bare VAR is only allowed for a bank
+      return with_value ? "a condition needs a mask or value" : NULL;
+   }
+   return NULL;
+}
+
+static const char *parse_when(memmap_t *map, char **tokens, int num, memmap_when_t *when) {
+   when->num_conds = 0;
+   if (num == 0) {
+      return NULL;
+   }
+   if (strcmp(tokens[0], "when")) {
+      return "expected when";
+   }
+   for (int i = 1; i < num; i++) {
+      if (when->num_conds == MEMMAP_MAX_CONDS) {
+         return "too many conditions";
+      }
+      const char *error = parse_term(map, tokens[i], when->conds + when->num_conds++, 1);
+      if (error) {
+         return error;
+      }
+   }
+   return NULL;
+}
+
+static const char *parse_map(memmap_t *map, char **tokens, int num) {
+   if (num < 3) {
+      return "expected map LO-HI RAM ACCESS";
+   }
+   if (map->num_rules == MEMMAP_MAX_RULES) {
+      return "too many map lines";
+   }
+   memmap_rule_t *rule = map->rules + map->num_rules;
+   if (parse_range(tokens[0], &rule->lo, &rule->hi)) {
+      return "bad range";
+   }
+   if ((rule->lo & 0xFF) || ((rule->hi + 1) & 0xFF)) {
+      return "a map range must be whole pages (of 256 bytes)";
+   }
+   const char *ram = tokens[1];
+   int len = strcspn(ram, "[");
+   rule->region = find_region(map, ram, len);
+   if (rule->region < 0) {
+      return "unknown ram";
+   }
+   rule->bank_var = -1;
+   rule->bank_mask = -1;
+   if (ram[len] == '[') {
+      if (rule->region == 0) {
+         return "main can't be banked";
+      }
+      memmap_cond_t bank;
+      const char *error = parse_term(map, ram + len + 1, &bank, 0);
+      if (error) {
+         return error;
+      }
+      if (ram[strlen(ram) - 1] != ']') {
+         return "expected ]";
+      }
+      rule->bank_var = bank.var;
+      rule->bank_mask = bank.mask;
+   }
+   rule->access = 0;
+   if (strcmp(tokens[2], "-")) {
+      for (const char *p = tokens[2]; *p; p++) {
+         switch (*p) {
+         case 'c':
+            rule->access |= MEMMAP_CHECK;
+            break;
+         case 'r':
+            rule->access |= MEMMAP_READ;
+            break;
+         case 'w':
+            rule->access |= MEMMAP_WRITE;
+            break;
+         default:
+            return "bad access (expected c, r, w or -)";
+         }
+      }
+   }
+   const char *error = parse_when(map, tokens + 3, num - 3, &rule->when);
+   if (error) {
+      return error;
+   }
+   map->num_rules++;
+   return NULL;
+}
+
+static const char *parse_line(memmap_t *map, char **tokens, int num) {
+   const char *keyword = tokens[0];
+   tokens++;
+   num--;
+   if (!strcmp(keyword, "ram")) {
+      if (num != 2) {
+         return "expected ram NAME SIZE";
+      }
+      if (map->num_rams == MEMMAP_MAX_RAMS) {
+         return "too many rams";
+      }
+      memmap_ram_t *region = map->rams + map->num_rams;
+      if (strlen(tokens[0]) >= sizeof(region->name) || find_region(map, tokens[0], strlen(tokens[0])) >= 0) {
+         return "bad or duplicate ram name";
+      }
+      if (parse_hex(tokens[1], &region->size) || region->size == 0) {
+         return "bad size";
+      }
+      strcpy(region->name, tokens[0]);
+      map->num_rams++;
+   } else if (!strcmp(keyword, "latch")) {
+      if (num < 3 || num > 4) {
+         return "expected latch NAME ADDR MASK [INIT]";
+      }
+      if (map->num_latches == MEMMAP_MAX_LATCHES) {
+         return "too many latches";
+      }
+      memmap_latch_t *latch = map->latches + map->num_latches;
+      latch->var = find_var(map, tokens[0], strlen(tokens[0]), 1);
+      if (latch->var < 0 || latch->var == MEMMAP_VAR_VDU) {
+         return "bad latch name (or too many)";
+      }
+      if (parse_hex(tokens[1], &latch->address) || parse_hex(tokens[2], &latch->mask)) {
+         return "bad address or mask";
+      }
+      if (num == 4 && parse_hex(tokens[3], map->var_init + latch->var)) {
+         return "bad initial value";
+      }
+      map->num_latches++;
+   } else if (!strcmp(keyword, "map")) {
+      return parse_map(map, tokens, num);
+   } else if (!strcmp(keyword, "remap")) {
+      if (num < 2) {
+         return "expected remap LO-HI TO";
+      }
+      if (map->remap_lo >= 0) {
+         return "only one remap is allowed";
+      }
+      if (parse_range(tokens[0], &map->remap_lo, &map->remap_hi) || parse_hex(tokens[1], &map->remap_to)) {
+         return "bad range or address";
+      }
+      return parse_when(map, tokens + 2, num - 2, &map->remap_when);
+   } else if (!strcmp(keyword, "tube")) {
+      if (num != 1 || parse_range(tokens[0], &map->tube_lo, &map->tube_hi)) {
+         return "expected tube LO-HI";
+      }
+   } else {
+      return "unknown keyword";
+   }
+   return NULL;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+memmap_t *memmap_parse(const char *text, const char *name) {
+   memmap_t *map = (memmap_t *)calloc(1, sizeof(memmap_t));
+   // The variables and the block of memory that are always there
+   find_var(map, "rom", 3, 1);
+   find_var(map, "acccon", 6, 1);
+   find_var(map, "vdu", 3, 1);
+   strcpy(map->rams[0].name, "main");
+   map->num_rams = 1;
+   map->remap_lo = -1;
+   map->tube_lo = -1;
+   map->tube_hi = -1;
+
+   int line = 0;
+   while (*text) {
+      line++;
+      char buf[MAX_LINE];
+      int len = strcspn(text, "\n");
+      if (len >= MAX_LINE) {
+         fprintf(stderr, "%s:%d: line too long\n", name, line);
+         free(map);
+         return NULL;
+      }
+      memcpy(buf, text, len);
+      buf[len] = 0;
+      text += len + (text[len] == '\n');
+      char *hash = strchr(buf, '#');
+      if (hash) {
+         *hash = 0;
+      }
+      char *tokens[MAX_TOKENS];
+      int num = 0;
+      char *save;
+      for (char *token = strtok_r(buf, " \t\r", &save); token; token = strtok_r(NULL, " \t\r", &save)) {
+         if (num == MAX_TOKENS) {
+            break;
+         }
+         tokens[num++] = token;
+      }
+      if (num == 0) {
+         continue;
+      }
+      const char *error = num == MAX_TOKENS ? "too many words" : parse_line(map, tokens, num);
+      if (error) {
+         fprintf(stderr, "%s:%d: %s\n", name, line, error);
+         free(map);
+         return NULL;
+      }
+   }
+   return map;
+}
+
+memmap_t *memmap_load(const char *filename) {
+   FILE *fp = fopen(filename, "r");
+   if (!fp) {
+      perror(filename);
+      return NULL;
+   }
+   fseek(fp, 0, SEEK_END);
+   long size = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+   char *text = (char *)malloc(size + 1);
+   size_t len = fread(text, 1, size, fp);
+   text[len] = 0;
+   fclose(fp);
+   memmap_t *map = memmap_parse(text, filename);
+   free(text);
+   return map;
+}
+
+memmap_t *memmap_builtin(machine_t machine) {
+   switch (machine) {
+   case MACHINE_BEEB:
+      return memmap_parse(beeb_map, "beeb");
+   case MACHINE_MASTER:
+      return memmap_parse(master_map, "master");
+   case MACHINE_ELK:
+      return memmap_parse(elk_map, "elk");
+   case MACHINE_ATOM:
+      return memmap_parse(atom_map, "atom");
+   case MACHINE_MEK6800D2:
+      return memmap_parse(mek6800d2_map, "mek6800d2");
+   case MACHINE_BLITTER:
+      return memmap_parse(blitter_map, "blitter");
+   default:
+      return memmap_parse(default_map, "default");
+   }
+}
+
+uint32_t memmap_file_hash(const char *filename) {
+   // FNV-1a
+   uint32_t hash = 2166136261u;
+   FILE *fp = fopen(filename, "r");
+   if (fp) {
+      int c;
+      while ((c = getc(fp)) != EOF) {
+         hash = (hash ^ (uint8_t) c) * 16777619u;
+      }
+      fclose(fp);
+   }
+   return hash;
+}
+
+void memmap_destroy(memmap_t *map) {
+   free(map);
+}
@@ -0,0 +1,148 @@
+#ifndef _INCLUDE_MEMMAP_H
+#define _INCLUDE_MEMMAP_H
+
+#include <stdint.h>
+
+#include "defs.h"
+
+// Machine descriptions: how the address space of a machine maps on to its
+// blocks of memory, from which the memory model builds a table with an
+// entry for each 256 byte page (see memory.c). The built-in machines are
+// described the same way, and --machine_file reads a description instead.
+//
+// Each line of a description is one of:
+//
+//   ram NAME SIZE               a block of memory (main is always there,
+//                               the size of the address space)
+//   latch NAME ADDR MASK [INIT] a write to ADDR sets the variable NAME to
+//                               the data & MASK (initially INIT, or 0)
+//   map LO-HI RAM ACCESS [when COND...]
+//                               LO..HI is at the start of the block RAM, or
+//                               in RAM[VAR] or RAM[VAR&MASK] for banks the
+//                               size of LO..HI (main is never banked, and is
+//                               at the same address)
+//   remap LO-HI TO [when COND...]
+//                               accesses to LO..HI are moved to TO while
+//                               the conditions hold
+//   tube LO-HI                  the tube registers (decoded with --bbctube)
+//
+// ACCESS is any of c (reads are checked against what's known, and then
+// remembered), r (reads are just remembered) and w (writes are remembered,
+// otherwise they're ignored), or - for none of them. Each page is mapped
+// by the first map line covering it whose conditions all hold, and is
+// otherwise not modelled. A condition is VAR&MASK (any bit set),
+// VAR&MASK=VALUE or VAR=VALUE. The variables are the latches, plus vdu,
+// which is 1 if the last instruction was fetched by the Master's VDU
+// driver. Addresses and numbers are hex, and # starts a comment.
+
+#define MEMMAP_MAX_VARS    8
+#define MEMMAP_MAX_RAMS    8
+#define MEMMAP_MAX_LATCHES 8
+#define MEMMAP_MAX_RULES   32
+#define MEMMAP_MAX_CONDS   4
+
+// The variables the memory model itself uses (the latches can add more)
+#define MEMMAP_VAR_ROM    0   // labels the sideways ROM (see write_bankid)
+#define MEMMAP_VAR_ACCCON 1   // labels the Master's shadow RAM, and for vdu
+#define MEMMAP_VAR_VDU    2
+
+// Access flags of a page
+#define MEMMAP_CHECK 1
+#define MEMMAP_READ  2
+#define MEMMAP_WRITE 4
+
+typedef struct {
+   int var;
+   int mask;
+   int value;   // -1 for any bit of the mask set
+} memmap_cond_t;
+
+typedef struct {
+   int           num_conds;
+   memmap_cond_t conds[MEMMAP_MAX_CONDS];
+} memmap_when_t;
+
+typedef struct {
+   int           lo;
+   int           hi;
+   int           region;
+   int           bank_var;   // -1 if not banked
+   int           bank_mask;
+   int           access;
+   memmap_when_t when;
+} memmap_rule_t;
+
+typedef struct {
+   char name[16];
+   int  size;                // 0 for main (the size of the address space)
+} memmap_ram_t;
+
+typedef struct {
+   int address;
+   int var;
+   int mask;
+} memmap_latch_t;
+
+typedef struct {
+   int             num_vars;
+   char            var_names[MEMMAP_MAX_VARS][16];
+   int             var_init[MEMMAP_MAX_VARS];
+
+   int             num_rams;
+   memmap_ram_t    rams[MEMMAP_MAX_RAMS];
+
+   int             num_latches;
+   memmap_latch_t  latches[MEMMAP_MAX_LATCHES];
+
+   int             num_rules;
+   memmap_rule_t   rules[MEMMAP_MAX_RULES];
+
+   // At most one remap (remap_lo is -1 if none)
+   int             remap_lo;
+   int             remap_hi;
+   int             remap_to;
+   memmap_when_t   remap_when;
+
+   // The tube registers (tube_lo is -1 if none)
+   int             tube_lo;
+   int             tube_hi;
+} memmap_t;
+
+// Parse a description, returning NULL (with a message on stderr, naming
+// it name) if it's not valid
+memmap_t *memmap_parse(const char *text, const char *name);
+
+// Read a description from a file, likewise
+memmap_t *memmap_load(const char *filename);
+
+// The description of a built-in machine
+memmap_t *memmap_builtin(machine_t machine);
+
+// A hash of the contents of a description file (for the index key)
+uint32_t memmap_file_hash(const char *filename);
+
+// Returns 1 if all the conditions hold, given the variables
+static inline int memmap_holds(const memmap_when_t *when, const int *vars) {
+   for (int i = 0; i < when->num_conds; i++) {
+      const memmap_cond_t *cond = when->conds + i;
+      int value = vars[cond->var] & cond->mask;
+      if (cond->value < 0 ? value == 0 : value != cond->value) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+// Returns 1 if any of the conditions depend on the variable
+static inline int memmap_uses(const memmap_when_t *when, int var) {
+   for (int i = 0; i < when->num_conds; i++) {
+      if (when->conds[i].var == var) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+void memmap_destroy(memmap_t *map);
+
+#endif
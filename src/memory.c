@@ -1,56 +1,109 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "defs.h"
 #include "tube_decode.h"
 #include "memory.h"
-
-// Sideways ROM
-
-#define SWROM_SIZE          0x4000
-#define SWROM_NUM_BANKS     16
-
-// Standard sideways ROM (upto 16 banks)
-static int *swrom         = NULL;
-static int rom_latch      = 0;
-
-// Extra Master registers
-static int acccon_latch   = 0;
-static int *lynne;           // 20KB overlaid at 3000-7FFF
-static int *hazel;           //  8KB overlaid at C000-DFFF
-static int *andy;            //  4KB overlaid at 8000-8FFF
-static int vdu_op;           // the last instruction fetch was by the VDU driver
-
-// Main Memory
-
-static int *memory        = NULL;
-static int mem_model      = 0;
-static int mem_rd_logging = 0;
-static int mem_wr_logging = 0;
-static int addr_digits    = 0;
-
-// IO
-static int tube_low       = -1;
-static int tube_high      = -1;
-
-static char buffer[256];
-
-// Machine specific memory rd/wr handlers
-static void (*memory_read_fn)(int data, int ea);
-static int (*memory_write_fn)(int data, int ea);
-
-// Pre-calculate a label for each 4K page in memory
-// These are manipulated as the ROM and ACCCON latches are modified
-static char bank_id[32];
+#include "output.h"
+#include "context.h"
+#include "memmap.h"
+
+// Regions of RAM
+
+// Each block of RAM is a region, held sparsely as pages that are allocated
+// the first time they're written: a byte of data for each location, and a
+// bitmap of which are known (an unknown location reads as -1). So only
+// what the program actually touches takes any memory.
+
+#define MAX_REGIONS   MEMMAP_MAX_RAMS
+#define PAGE_BITS     12
+#define PAGE_SIZE     (1 << PAGE_BITS)
+
+// Checkpoints
+
+// Each region is saved in chunks of REGION_PAGE locations. Only the chunks
+// that have changed since the previous checkpoint are saved, which are
+// marked in each page as they're written.
+
+#define REGION_PAGE   256
+#define REGION_END    0xFFFFFFFF
+
+typedef struct {
+   uint8_t  data[PAGE_SIZE];
+   uint64_t known[PAGE_SIZE / 64];
+   uint16_t changed;     // a bit per chunk, since the previous checkpoint
+} page_t;
+
+typedef struct {
+   page_t **pages;
+   int      size;
+} region_t;
+
+// The page map
+
+// The machine is described by rules (see memmap.h), from which a table is
+// built of where each 256 byte page of the address space is, and how it's
+// accessed, so each access is one lookup. As a latch is written, just the
+// pages that depend on it are mapped again.
+
+typedef struct {
+   uint32_t offset;      // where the page is in the region
+   uint8_t  region;
+   uint8_t  access;      // MEMMAP_CHECK, MEMMAP_READ and MEMMAP_WRITE
+} page_map_t;
+
+typedef struct {
+   int first;
+   int last;
+} page_range_t;
+
+// The state is per context (see context.h)
+struct memory_state {
+   // The description of the machine, and its variables (the latches)
+   memmap_t *map;
+   int vars[MEMMAP_MAX_VARS];
+
+   // The page map, and the pages to map again when each variable changes
+   page_map_t *page_map;
+   int num_pages;
+   int remap_on;
+   int num_depends[MEMMAP_MAX_VARS];
+   page_range_t depends[MEMMAP_MAX_VARS][MEMMAP_MAX_RULES];
+
+   int mem_model;
+   int mem_rd_logging;
+   int mem_wr_logging;
+   int addr_digits;
+
+   // The accesses since memory_clear_records, when recording
+   int recording;
+   int num_records;
+   mem_record_t records[MEM_MAX_RECORDS];
+
+   region_t regions[MAX_REGIONS];
+   int num_regions;
+
+   // IO
+   int tube_low;
+   int tube_high;
+
+   char buffer[256];
+
+   // Pre-calculate a label for each 4K page in memory
+   // These are manipulated as the ROM and ACCCON latches are modified
+   char bank_id[32];
+};
 
 #define TO_HEX(value) ((value) + ((value) < 10 ? '0' : 'A' - 10))
 
 int write_bankid(char *bp, int ea) {
+   struct memory_state *m = context->memory;
   if (ea < 0 || ea >= 0x10000) {
       *bp++ = ' ';
       *bp++ = ' ';
    } else {
-      char *bid = bank_id + ((ea & 0xF000) >> 11);
+      char *bid = m->bank_id + ((ea & 0xF000) >> 11);
       *bp++ = *bid++;
       *bp++ = *bid++;
    }
@@ -58,19 +111,21 @@ int write_bankid(char *bp, int ea) {
 }
 
 static inline int write_addr(char *bp, int ea) {
+   struct memory_state *m = context->memory;
    bp += write_bankid(bp, ea);
-   int shift = (addr_digits - 1) << 2; // 6 => 20
-   for (int i = 0; i < addr_digits; i++) {
+   int shift = (m->addr_digits - 1) << 2; // 6 => 20
+   for (int i = 0; i < m->addr_digits; i++) {
       int value = (ea >> shift) & 0xf;
       *bp++ = TO_HEX(value);
       shift -= 4;
    }
-   return addr_digits + 2;
+   return m->addr_digits + 2;
 }
 
 
 static inline void log_memory_access(char *msg, int data, int ea, int ignored) {
-   char *bp = buffer;
+   struct memory_state *m = context->memory;
+   char *bp = m->buffer;
    bp += write_s(bp, msg);
    bp += write_addr(bp, ea);
    bp += write_s(bp, " = ");
@@ -80,12 +135,13 @@ static inline void log_memory_access(char *msg, int data, int ea, int ignored) {
    bp += write_s(bp, " (ignored)");
    }
    *bp++ = 0;
-   puts(buffer);
+   output_puts(m->buffer);
 }
 
 
 static inline void log_memory_fail(int ea, int expected, int actual) {
-   char *bp = buffer;
+   struct memory_state *m = context->memory;
+   char *bp = m->buffer;
    bp += write_s(bp, "memory modelling failed at ");
    bp += write_addr(bp, ea);
    bp += write_s(bp, ": expected ");
@@ -95,27 +151,84 @@ static inline void log_memory_fail(int ea, int expected, int actual) {
    write_hex2(bp, actual);
    bp += 2;
    *bp++ = 0;
-   puts(buffer);
+   output_puts(m->buffer);
+}
+
+static inline void record_access(int data, int ea, int write) {
+   struct memory_state *m = context->memory;
+   if (m->num_records < MEM_MAX_RECORDS) {
+      m->records[m->num_records++] = (mem_record_t) { .ea = ea, .data = data, .write = write };
+   }
 }
 
 static void set_tube_window(int low, int high) {
-   tube_low = low;
-   tube_high = high;
+   struct memory_state *m = context->memory;
+   m->tube_low = low;
+   m->tube_high = high;
 }
 
-static int *init_ram(int size) {
-   int *ram =  malloc(size * sizeof(int));
-   for (int i = 0; i < size; i++) {
-      ram[i] = -1;
-   }
+static region_t *init_ram(int size) {
+   struct memory_state *m = context->memory;
+   assert(m->num_regions < MAX_REGIONS);
+   region_t *ram = m->regions + m->num_regions++;
+   ram->pages = (page_t **)calloc((size + PAGE_SIZE - 1) >> PAGE_BITS, sizeof(page_t *));
+   ram->size  = size;
    return ram;
 }
 
+static void free_ram(region_t *ram) {
+   for (int i = 0; i < ram->size >> PAGE_BITS; i++) {
+      free(ram->pages[i]);
+      ram->pages[i] = NULL;
+   }
+}
+
+// Returns the data at a location, or -1 if it's unknown (which includes
+// anything beyond the end, e.g. an operand fetched after FFFF)
+static inline int ram_read(const region_t *ram, int addr) {
+   if ((unsigned) addr >= (unsigned) ram->size) {
+      return -1;
+   }
+   const page_t *page = ram->pages[addr >> PAGE_BITS];
+   int i = addr & (PAGE_SIZE - 1);
+   if (page && (page->known[i >> 6] >> (i & 63) & 1)) {
+      return page->data[i];
+   }
+   return -1;
+}
+
+static inline void ram_write(region_t *ram, int addr, int data) {
+   if ((unsigned) addr >= (unsigned) ram->size) {
+      return;
+   }
+   page_t *page = ram->pages[addr >> PAGE_BITS];
+   if (!page) {
+      page = ram->pages[addr >> PAGE_BITS] = (page_t *)calloc(1, sizeof(page_t));
+   }
+   int i = addr & (PAGE_SIZE - 1);
+   uint64_t bit = 1ull << (i & 63);
+   if (page->data[i] != data || !(page->known[i >> 6] & bit)) {
+      page->data[i] = data;
+      page->known[i >> 6] |= bit;
+      page->changed |= 1 << (i / REGION_PAGE);
+   }
+}
+
+// Check a read against what's known of the location, then remember it
+static inline void ram_check(region_t *ram, int addr, int data, int ea) {
+   int expected = ram_read(ram, addr);
+   if (expected >= 0 && expected != data) {
+      log_memory_fail(ea, expected, data);
+      failflag |= 1;
+   }
+   ram_write(ram, addr, data);
+}
+
 
-static void set_rom_latch(int data) {
-   rom_latch = data;
+static void set_rom_label(int data) {
+   struct memory_state *m = context->memory;
    // Update the bank id string
-   char *bid = bank_id + 16; // 8xxx
+   char *bid = m->bank_id + 16; // 8xxx
    char c = TO_HEX(data & 0xf);
    if (data & 0x80) {
       // Andy RAM is paged in to &8000-&8FFF
@@ -132,12 +245,12 @@ static void set_rom_latch(int data) {
    *bid++ = ':';
 }
 
-static void set_acccon_latch(int data) {
+static void set_acccon_label(int data) {
+   struct memory_state *m = context->memory;
    char *bid;
-   acccon_latch = data;
    // Update the bank id string for Lynnn (Shadow RAM) based on bit 2
-   // TODO: this is not sufficient; needs to take account of vdu_op which changes each instruction
-   bid = bank_id + 6; // 3xxx
+   // TODO: this is not sufficient; needs to take account of vdu which changes each instruction
+   bid = m->bank_id + 6; // 3xxx
    for (int i = 0; i < 5; i++) {
       if (data & 0x04) {
          // Shadow RAM is paged into &3000-7FFF
@@ -150,7 +263,7 @@ static void set_acccon_latch(int data) {
       }
    }
    // Update the bank id string Hazel (MOS Overlay) based on bit 3
-   bid = bank_id + 24; // Cxxx
+   bid = m->bank_id + 24; // Cxxx
    for (int i = 0; i < 2; i++) {
       if (data & 0x08) {
          // Hazel RAM is paged into &C000-&DFFF
@@ -166,386 +279,358 @@ static void set_acccon_latch(int data) {
 }
 
 // ==================================================
-// Beeb Memory Handlers
+// Page Map
 // ==================================================
 
-static inline int *get_memptr_beeb(int ea) {
-   if (ea >= 0x8000 && ea < 0xC000) {
-      return swrom + (rom_latch << 14) + (ea & 0x3FFF);
-   } else {
-      return memory + ea;
-   }
-}
-
-static void memory_read_beeb(int data, int ea) {
-   if (ea < 0xfc00 || ea >= 0xff00) {
-      int *memptr = get_memptr_beeb(ea);
-      if (*memptr >=0 && *memptr != data) {
-         log_memory_fail(ea, *memptr, data);
-         failflag |= 1;
+// Map the pages first..last, each by the first rule that covers it, and
+// whose conditions hold. The same rules cover each page up to the next end
+// of one, so that's a span of pages mapped by one rule.
+static void map_pages(int first, int last) {
+   struct memory_state *m = context->memory;
+   for (int p = first; p <= last; ) {
+      int ea = p << 8;
+      int end = last;
+      const memmap_rule_t *found = NULL;
+      for (int i = 0; i < m->map->num_rules; i++) {
+         const memmap_rule_t *rule = m->map->rules + i;
+         if (ea < rule->lo) {
+            if ((rule->lo >> 8) - 1 < end) {
+               end = (rule->lo >> 8) - 1;
+            }
+         } else if (ea <= rule->hi) {
+            if ((rule->hi >> 8) < end) {
+               end = rule->hi >> 8;
+            }
+            if (!found && memmap_holds(&rule->when, m->vars)) {
+               found = rule;
+            }
+         }
       }
-      *memptr = data;
-   }
-}
-
-static int memory_write_beeb(int data, int ea) {
-   if (ea == 0xfe30) {
-      set_rom_latch(data & 0xf);
-   }
-   int *memptr = get_memptr_beeb(ea);
-   *memptr = data;
-   return 0;
-}
-
-static void init_beeb(int logtube) {
-   swrom = init_ram(SWROM_NUM_BANKS * SWROM_SIZE);
-   memory_read_fn  = memory_read_beeb;
-   memory_write_fn = memory_write_beeb;
-   if (logtube) {
-      set_tube_window(0xfee0, 0xfee8);
-   }
-}
-
-// ==================================================
-// Master Memory Handlers
-// ==================================================
-
-static inline int *get_memptr_master(int ea) {
-   if ((acccon_latch & 0x08) && ea >= 0xc000 && ea < 0xe000) {
-      return hazel + (ea & 0x1FFF);
-   } else if ((rom_latch & 0x80) && ea >= 0x8000 && ea < 0x9000) {
-      return andy + (ea & 0x0FFF);
-   } else if (ea >= 0x3000 && ea < 0x8000 && (acccon_latch & (vdu_op ? 0x02 : 0x04))) {
-      return lynne + (ea - 0x3000);
-   } else if (ea >= 0x8000 && ea < 0xC000) {
-      return swrom + ((rom_latch & 0xf) << 14) + (ea & 0x3FFF);
-   } else {
-      return memory + ea;
-   }
-}
-
-static void memory_read_master(int data, int ea) {
-   if (ea < 0xfc00 || ea >= 0xff00) {
-      int *memptr = get_memptr_master(ea);
-      if (*memptr >=0 && *memptr != data) {
-         log_memory_fail(ea, *memptr, data);
-         failflag |= 1;
+      page_map_t page = { 0, 0, 0 };
+      if (found) {
+         // Main is the address space itself, the others start at LO
+         if (found->region == 0) {
+            page.offset = ea;
+         } else {
+            int bank = found->bank_var < 0 ? 0 : m->vars[found->bank_var] & found->bank_mask;
+            page.offset = bank * (found->hi - found->lo + 1) + (ea - found->lo);
+         }
+         page.region = found->region;
+         page.access = found->access;
+      }
+      for (; p <= end; p++) {
+         m->page_map[p] = page;
+         page.offset += 0x100;
       }
-      *memptr = data;
-   }
-}
-
-static int memory_write_master(int data, int ea) {
-   if (ea == 0xfe30) {
-      set_rom_latch(data & 0x8f);
-   }
-   if (ea == 0xfe34) {
-      set_acccon_latch(data & 0xff);
-   }
-   // Determine if the access is writeable
-   if ((ea < 0x8000) ||
-       (ea < 0x9000 && (rom_latch & 0x80)) ||
-       (ea < 0xc000 && ((rom_latch & 0x0c) == 0x04)) ||
-       (ea >= 0xc000 && ea < 0xe000 && (acccon_latch & 0x08)) ||
-       (ea >= 0xfc00 && ea < 0xff00)) {
-      int *memptr = get_memptr_master(ea);
-      *memptr = data;
-      return 0;
-   } else {
-      return 1;
-   }
-}
-
-static void init_master(int logtube) {
-   swrom = init_ram(SWROM_NUM_BANKS * SWROM_SIZE);
-   lynne = init_ram(20480); // 20KB overlaid at 3000-7FFF
-   hazel = init_ram(8192);  //  8KB overlaid at C000-DFFF
-   andy  = init_ram(4096);  //  4KB overlaid at 8000-8FFF
-   memory_read_fn  = memory_read_master;
-   memory_write_fn = memory_write_master;
-   if (logtube) {
-      set_tube_window(0xfee0, 0xfee8);
-   }
-}
-
-// ==================================================
-// Elk Memory Handlers
-// ==================================================
-
-static inline int *get_memptr_elk(int ea) {
-   if (ea >= 0x8000 && ea < 0xC000) {
-      return swrom + (rom_latch << 14) + (ea & 0x3FFF);
-   } else {
-      return memory + ea;
    }
 }
 
-static void memory_read_elk(int data, int ea) {
-   if (ea < 0xfc00 || ea >= 0xff00) {
-      int *memptr = get_memptr_elk(ea);
-      if (*memptr >=0 && *memptr != data) {
-         log_memory_fail(ea, *memptr, data);
-         failflag |= 1;
+// Work out which pages depend on each variable, as ranges of pages, in
+// order and not overlapping
+static void find_depends() {
+   struct memory_state *m = context->memory;
+   for (int var = 0; var < MEMMAP_MAX_VARS; var++) {
+      page_range_t *ranges = m->depends[var];
+      int num = 0;
+      for (int i = 0; i < m->map->num_rules; i++) {
+         const memmap_rule_t *rule = m->map->rules + i;
+         if ((rule->bank_var != var && !memmap_uses(&rule->when, var)) || rule->lo >= m->num_pages << 8) {
+            continue;
+         }
+         page_range_t range = { rule->lo >> 8, (rule->hi < m->num_pages << 8 ? rule->hi : (m->num_pages << 8) - 1) >> 8 };
+         int j = num++;
+         while (j > 0 && ranges[j - 1].first > range.first) {
+            ranges[j] = ranges[j - 1];
+            j--;
+         }
+         ranges[j] = range;
       }
-      *memptr = data;
+      // Merge any that overlap (or touch)
+      int merged = 0;
+      for (int i = 0; i < num; i++) {
+         if (merged && ranges[i].first <= ranges[merged - 1].last + 1) {
+            if (ranges[i].last > ranges[merged - 1].last) {
+               ranges[merged - 1].last = ranges[i].last;
+            }
+         } else {
+            ranges[merged++] = ranges[i];
+         }
+      }
+      m->num_depends[var] = merged;
    }
 }
 
-static int memory_write_elk(int data, int ea) {
-   if (ea == 0xfe05) {
-      set_rom_latch(data & 0xf);
+static void set_var(int var, int value) {
+   struct memory_state *m = context->memory;
+   // Update the bank id string
+   if (var == MEMMAP_VAR_ROM) {
+      set_rom_label(value);
+   } else if (var == MEMMAP_VAR_ACCCON) {
+      set_acccon_label(value);
    }
-   int *memptr = get_memptr_elk(ea);
-   *memptr = data;
-   return 0;
-}
-
-static void init_elk(int logtube) {
-   swrom = init_ram(SWROM_NUM_BANKS * SWROM_SIZE);
-   memory_read_fn  = memory_read_elk;
-   memory_write_fn = memory_write_elk;
-   if (logtube) {
-      set_tube_window(0xfce0, 0xfce8);
+   if (m->vars[var] == value) {
+      return;
    }
-}
-
-// ==================================================
-// MEK6800D2 Memory Handlers
-// ==================================================
-
-// RAM from 0000->01FF aliased 8 times from 0000->1FFF
-//     (i.e. A10,11,12 are don't care)
-// RAM from A000->A080 aliases 8 times from A000->AFFF
-//     (i.e. A9,10,11 are don't care)
-//
-// TODO: correctly handle aliasing
-
-static void memory_read_mek6800d2(int data, int ea) {
-   if (ea < 0x2000 || (ea >= 0xA000 && ea <= 0xAFFF)) {
-      if (memory[ea] >= 0 && memory[ea] != data) {
-         log_memory_fail(ea,memory[ea], data);
-         failflag |= 1;
-      }
+   m->vars[var] = value;
+   for (int i = 0; i < m->num_depends[var]; i++) {
+      map_pages(m->depends[var][i].first, m->depends[var][i].last);
    }
-   memory[ea] = data;
-}
-
-static int memory_write_mek6800d2(int data, int ea) {
-   memory[ea] = data;
-   return 0;
-}
-
-static void init_mek6800d2(int logtube) {
-   memory_read_fn  = memory_read_mek6800d2;
-   memory_write_fn = memory_write_mek6800d2;
-}
-
-// ==================================================
-// Atom Memory Handlers
-// ==================================================
-
-static void memory_read_atom(int data, int ea) {
-   if (ea < 0xA000) {
-      if (memory[ea] >= 0 && memory[ea] != data) {
-         log_memory_fail(ea,memory[ea], data);
-         failflag |= 1;
-      }
+   if (m->map->remap_lo >= 0 && memmap_uses(&m->map->remap_when, var)) {
+      m->remap_on = memmap_holds(&m->map->remap_when, m->vars);
    }
-   memory[ea] = data;
-}
-
-static int memory_write_atom(int data, int ea) {
-   memory[ea] = data;
-   return 0;
 }
 
-static void init_atom(int logtube) {
-   memory_read_fn  = memory_read_atom;
-   memory_write_fn = memory_write_atom;
-}
-
-// ==================================================
-// Blitter (65816) Memory Handlers
-// ==================================================
-
-static int boot_mode = 0x20;
-
-static inline int remap_address_blitter(int ea) {
-   if (boot_mode && ((ea & 0xff0000) == 0)) {
-      ea |= 0xff0000;
+static inline int remap_address(int ea) {
+   struct memory_state *m = context->memory;
+   if (m->remap_on && ea >= m->map->remap_lo && ea <= m->map->remap_hi) {
+      ea += m->map->remap_to - m->map->remap_lo;
    }
    return ea;
 }
 
-static inline int *get_memptr_blitter(int ea) {
-   if (ea >= 0xff8000 && ea < 0xffC000) {
-      return swrom + (rom_latch << 14) + (ea & 0x3FFF);
-   } else {
-      return memory + ea;
+static void memory_read_mapped(int data, int ea) {
+   struct memory_state *m = context->memory;
+   ea = remap_address(ea);
+   if (ea >= m->num_pages << 8) {
+      return;
    }
-}
-
-static void memory_read_blitter(int data, int ea) {
-   ea = remap_address_blitter(ea);
-   if (ea < 0xfffc00 || ea >= 0xffff00) {
-      int *memptr = get_memptr_blitter(ea);
-      if (*memptr >=0 && *memptr != data) {
-         log_memory_fail(ea, *memptr, data);
-         failflag |= 1;
-      }
-      *memptr = data;
+   const page_map_t *page = m->page_map + (ea >> 8);
+   if (page->access & MEMMAP_CHECK) {
+      ram_check(m->regions + page->region, page->offset + (ea & 0xFF), data, ea);
+   } else if (page->access & MEMMAP_READ) {
+      ram_write(m->regions + page->region, page->offset + (ea & 0xFF), data);
    }
 }
 
-static int memory_write_blitter(int data, int ea) {
-   ea = remap_address_blitter(ea);
-   if (ea == 0xfffe30) {
-      set_rom_latch(data & 0xf);
-   }
-   if (ea == 0xfffe31) {
-      boot_mode = data & 0x20;
+// Returns 1 if the write is ignored
+static int memory_write_mapped(int data, int ea) {
+   struct memory_state *m = context->memory;
+   ea = remap_address(ea);
+   for (int i = 0; i < m->map->num_latches; i++) {
+      if (ea == m->map->latches[i].address) {
+         set_var(m->map->latches[i].var, data & m->map->latches[i].mask);
+      }
    }
-   int *memptr = get_memptr_blitter(ea);
-   *memptr = data;
-   return 0;
-}
-
-static void init_blitter(int logtube) {
-   swrom = init_ram(SWROM_NUM_BANKS * SWROM_SIZE);
-   memory_read_fn  = memory_read_blitter;
-   memory_write_fn = memory_write_blitter;
-   if (logtube) {
-      set_tube_window(0xfee0, 0xfee8);
+   if (ea >= m->num_pages << 8) {
+      return 0;
    }
-}
-
-// ==================================================
-// Default Memory Handlers
-// ==================================================
-
-static void memory_read_default(int data, int ea) {
-   if (memory[ea] >= 0 && memory[ea] != data) {
-      log_memory_fail(ea,memory[ea], data);
-      failflag |= 1;
+   const page_map_t *page = m->page_map + (ea >> 8);
+   if (!(page->access & MEMMAP_WRITE)) {
+      return 1;
    }
-   memory[ea] = data;
-}
-
-static int memory_write_default(int data, int ea) {
-   memory[ea] = data;
+   ram_write(m->regions + page->region, page->offset + (ea & 0xFF), data);
    return 0;
 }
 
-static void init_default(int logtube) {
-   memory_read_fn  = memory_read_default;
-   memory_write_fn = memory_write_default;
-}
-
 // ==================================================
 // Public Methods
 // ==================================================
 
-void memory_init(int size, machine_t machine, int logtube) {
-   memory = init_ram(size);
-   // Setup the machine specific memory read/write handler
-   switch (machine) {
-   case MACHINE_BEEB:
-      init_beeb(logtube);
-      break;
-   case MACHINE_MASTER:
-      init_master(logtube);
-      break;
-   case MACHINE_ELK:
-      init_elk(logtube);
-      break;
-   case MACHINE_ATOM:
-      init_atom(logtube);
-      break;
-   case MACHINE_MEK6800D2:
-      init_mek6800d2(logtube);
-      break;
-   case MACHINE_BLITTER:
-      init_blitter(logtube);
-      break;
-   default:
-      init_default(logtube);
-      break;
+void memory_init(int size, machine_t machine, const char *machine_file, int logtube) {
+   memmap_t *description = machine_file ? memmap_load(machine_file) : memmap_builtin(machine);
+   if (!description) {
+      exit(1);
+   }
+   memory_destroy();
+   struct memory_state *m = (struct memory_state *)calloc(1, sizeof(struct memory_state));
+   context->memory = m;
+   m->map = description;
+   m->tube_low  = -1;
+   m->tube_high = -1;
+   for (int i = 0; i < m->map->num_rams; i++) {
+      init_ram(m->map->rams[i].size ? m->map->rams[i].size : size);
+   }
+   memcpy(m->vars, m->map->var_init, sizeof(m->vars));
+   m->num_pages = size >> 8;
+   m->page_map = (page_map_t *)malloc(m->num_pages * sizeof(page_map_t));
+   find_depends();
+   map_pages(0, m->num_pages - 1);
+   m->remap_on = m->map->remap_lo >= 0 && memmap_holds(&m->map->remap_when, m->vars);
+   if (logtube && m->map->tube_lo >= 0) {
+      set_tube_window(m->map->tube_lo, m->map->tube_hi);
    }
    // Calculate the number of digits to represent an address
-   addr_digits = 0;
+   m->addr_digits = 0;
    size--;
    while (size) {
       size >>= 1;
-      addr_digits++;
+      m->addr_digits++;
    }
-   addr_digits = (addr_digits + 3) >> 2;
+   m->addr_digits = (m->addr_digits + 3) >> 2;
    // Initialize bank labels (2 chars per 4K page)
    for (int i = 0; i < 32; i++) {
-      bank_id[i] = ' ';
+      m->bank_id[i] = ' ';
    }
 }
 
 void memory_destroy() {
-   if (swrom) {
-      free(swrom);
+   struct memory_state *m = context->memory;
+   if (!m) {
+      return;
    }
-   if (memory) {
-      free(memory);
+   for (int i = 0; i < m->num_regions; i++) {
+      free_ram(m->regions + i);
+      free(m->regions[i].pages);
    }
+   free(m->page_map);
+   memmap_destroy(m->map);
+   free(m);
+   context->memory = NULL;
 }
 
 void memory_set_modelling(int bitmask) {
-   mem_model = bitmask;
+   struct memory_state *m = context->memory;
+   m->mem_model = bitmask;
 }
 
 void memory_set_rd_logging(int bitmask) {
-   mem_rd_logging = bitmask;
+   struct memory_state *m = context->memory;
+   m->mem_rd_logging = bitmask;
 }
 
 void memory_set_wr_logging(int bitmask) {
-   mem_wr_logging = bitmask;
+   struct memory_state *m = context->memory;
+   m->mem_wr_logging = bitmask;
+}
+
+void memory_set_recording(int on) {
+   struct memory_state *m = context->memory;
+   m->recording = on;
+   m->num_records = 0;
+}
+
+void memory_clear_records() {
+   struct memory_state *m = context->memory;
+   m->num_records = 0;
+}
+
+int memory_records(const mem_record_t **recorded) {
+   struct memory_state *m = context->memory;
+   *recorded = m->records;
+   return m->num_records;
 }
 
 void memory_read(int data, int ea, mem_access_t type) {
+   struct memory_state *m = context->memory;
    assert(ea >= 0);
    assert(data >= 0);
-   // Update the vdu_op state every fetch (used by the master only)
+   // Update the vdu state every fetch (used by the master only)
    if (type == MEM_FETCH) {
-      vdu_op = ((acccon_latch & 0x08) == 0x00) && ((ea & 0xffe000) == 0xc000);
+      int vdu = ((m->vars[MEMMAP_VAR_ACCCON] & 0x08) == 0x00) && ((ea & 0xffe000) == 0xc000);
+      if (vdu != m->vars[MEMMAP_VAR_VDU]) {
+         set_var(MEMMAP_VAR_VDU, vdu);
+      }
       type = MEM_INSTR;
    }
+   if (m->recording && type != MEM_INSTR) {
+      record_access(data, ea, 0);
+   }
    // Log memory read
-   if (mem_rd_logging & (1 << type)) {
+   if (m->mem_rd_logging & (1 << type)) {
       log_memory_access("Rd: ", data, ea, 0);
    }
-   // Delegate memory read to machine specific handler
-   if (mem_model & (1 << type)) {
-      (*memory_read_fn)(data, ea);
+   // Model the read through the page map
+   if (m->mem_model & (1 << type)) {
+      memory_read_mapped(data, ea);
    }
    // Pass on to tube decoding
-   if (ea >= tube_low && ea <= tube_high) {
+   if (ea >= m->tube_low && ea <= m->tube_high) {
       tube_read(ea & 7, data);
    }
 }
 
 void memory_write(int data, int ea, mem_access_t type) {
+   struct memory_state *m = context->memory;
    assert(ea >= 0);
    assert(data >= 0);
-   // Delegate memory write to machine specific handler
+   // Model the write through the page map
    int ignored = 0;
-   if (mem_model & (1 << type)) {
-      ignored = (*memory_write_fn)(data, ea);
+   if (m->mem_model & (1 << type)) {
+      ignored = memory_write_mapped(data, ea);
    }
    // Log memory write
-   if (mem_wr_logging & (1 << type)) {
+   if (m->mem_wr_logging & (1 << type)) {
       log_memory_access("Wr: ", data, ea, ignored);
    }
+   if (m->recording) {
+      record_access(data, ea, 1);
+   }
    // Pass on to tube decoding
-   if (ea >= tube_low && ea <= tube_high) {
+   if (ea >= m->tube_low && ea <= m->tube_high) {
       tube_write(ea & 7, data);
    }
 }
 
 int memory_read_raw(int ea) {
-   return memory[ea];
+   struct memory_state *m = context->memory;
+   // The main RAM is always the first region
+   return ram_read(m->regions, ea);
+}
+
+int memory_save(FILE *file, int full) {
+   struct memory_state *m = context->memory;
+   fwrite(m->vars, sizeof(m->vars), 1, file);
+   fwrite(m->bank_id, sizeof(m->bank_id), 1, file);
+   // A full save replaces everything, so any page not in it is unknown
+   uint32_t all = full;
+   fwrite(&all, sizeof(all), 1, file);
+   for (int i = 0; i < m->num_regions; i++) {
+      region_t *region = m->regions + i;
+      for (int p = 0; p < region->size >> PAGE_BITS; p++) {
+         page_t *page = region->pages[p];
+         if (!page) {
+            continue;
+         }
+         for (int chunk = 0; chunk < PAGE_SIZE / REGION_PAGE; chunk++) {
+            if (full || (page->changed & (1 << chunk))) {
+               uint32_t id = (i << 24) | (p << PAGE_BITS) | (chunk * REGION_PAGE);
+               fwrite(&id, sizeof(id), 1, file);
+               fwrite(page->data + chunk * REGION_PAGE, REGION_PAGE, 1, file);
+               fwrite(page->known + chunk * REGION_PAGE / 64, REGION_PAGE / 8, 1, file);
+            }
+         }
+         page->changed = 0;
+      }
+   }
+   uint32_t end = REGION_END;
+   fwrite(&end, sizeof(end), 1, file);
+   return ferror(file);
+}
+
+int memory_restore(FILE *file) {
+   struct memory_state *m = context->memory;
+   uint32_t all;
+   if (fread(m->vars, sizeof(m->vars), 1, file) != 1 || fread(m->bank_id, sizeof(m->bank_id), 1, file) != 1 || fread(&all, sizeof(all), 1, file) != 1) {
+      return 1;
+   }
+   map_pages(0, m->num_pages - 1);
+   m->remap_on = m->map->remap_lo >= 0 && memmap_holds(&m->map->remap_when, m->vars);
+   if (all) {
+      for (int i = 0; i < m->num_regions; i++) {
+         free_ram(m->regions + i);
+      }
+   }
+   uint32_t id;
+   while (fread(&id, sizeof(id), 1, file) == 1) {
+      if (id == REGION_END) {
+         return 0;
+      }
+      int i = id >> 24;
+      int addr = id & 0xFFFFFF;
+      if (i >= m->num_regions || addr >= m->regions[i].size || addr % REGION_PAGE) {
+         return 1;
+      }
+      page_t **pp = m->regions[i].pages + (addr >> PAGE_BITS);
+      if (!*pp) {
+         *pp = (page_t *)calloc(1, sizeof(page_t));
+      }
+      int offset = addr & (PAGE_SIZE - 1);
+      if (fread((*pp)->data + offset, REGION_PAGE, 1, file) != 1 ||
+          fread((*pp)->known + offset / 64, REGION_PAGE / 8, 1, file) != 1) {
+         return 1;
+      }
+      // So a checkpoint made after this is complete
+      (*pp)->changed |= 1 << (offset / REGION_PAGE);
+   }
+   return 1;
 }
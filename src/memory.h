@@ -1,6 +1,8 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdio.h>
+
 #include "defs.h"
 
 typedef enum {
@@ -11,7 +13,18 @@ typedef enum {
    MEM_FETCH    = 4,
 } mem_access_t;
 
-void memory_init(int size, machine_t machine, int logtube);
+// A memory access (other than an instruction fetch), recorded for the
+// triggers (see trigger.h)
+typedef struct {
+   int ea;
+   int data;
+   int write;
+} mem_record_t;
+
+// The most accesses recorded between memory_clear_records calls
+#define MEM_MAX_RECORDS 32
+
+void memory_init(int size, machine_t machine, const char *machine_file, int logtube);
 
 void memory_set_modelling(int bitmask);
 
@@ -19,6 +32,15 @@ void memory_set_rd_logging(int bitmask);
 
 void memory_set_wr_logging(int bitmask);
 
+// Record the accesses (other than instruction fetches) as they're made
+void memory_set_recording(int on);
+
+// Forget the accesses recorded so far (e.g. at the start of an instruction)
+void memory_clear_records();
+
+// Returns the number of accesses recorded since memory_clear_records
+int memory_records(const mem_record_t **records);
+
 void memory_read(int data, int ea, mem_access_t type);
 
 void memory_write(int data, int ea, mem_access_t type);
@@ -27,6 +49,13 @@ int memory_read_raw(int ea);
 
 int memory_read_raw(int ea);
 
+// Save the memory model state to a checkpoint: either all of it, or just
+// the pages that have changed since the previous checkpoint
+int memory_save(FILE *file, int full);
+
+// Restore a checkpoint written by memory_save (on top of the previous one)
+int memory_restore(FILE *file);
+
 void memory_destroy();
 
 int write_bankid(char *buffer, int ea);
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "profiler.h"
+#include "context.h"
+
+struct output_state {
+   // Where the output is written (normally own, on stdout)
+   sink_t           *sink;
+   sink_t           *own;
+   // The chunk currently being filled (NULL if writing directly to the sink)
+   output_chunk_t   *current;
+   output_handoff_t  handoff;
+   // Set while decoding up to the start of a window, when nothing is output
+   int               suppressed;
+   // Set if the instruction lines are deferred
+   int               defer_lines;
+   // Text held back (see output_hold)
+   int               holding;
+   char             *held;
+   size_t            held_len;
+   size_t            held_size;
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static void reset_chunk(output_chunk_t *chunk) {
+   chunk->len = 0;
+   chunk->num_profile = 0;
+   chunk->num_lines = 0;
+   chunk->formatted = 0;
+}
+
+static void output_next_chunk() {
+   struct output_state *out = context->output;
+   out->current = out->handoff(out->current);
+   reset_chunk(out->current);
+}
+
+// Append text to the current chunk, moving on to the next if it's full
+static void output_append(const char *s, size_t len) {
+   struct output_state *out = context->output;
+   while (len > 0) {
+      size_t space = OUTPUT_CHUNK_SIZE - out->current->len;
+      if (space == 0) {
+         output_next_chunk();
+         continue;
+      }
+      size_t n = len < space ? len : space;
+      memcpy(out->current->text + out->current->len, s, n);
+      out->current->len += n;
+      s += n;
+      len -= n;
+   }
+}
+
+static void output_hold_text(const char *s, size_t len) {
+   struct output_state *out = context->output;
+   if (out->held_len + len > out->held_size) {
+      out->held_size = 2 * (out->held_len + len);
+      out->held = (char *)realloc(out->held, out->held_size);
+   }
+   memcpy(out->held + out->held_len, s, len);
+   out->held_len += len;
+}
+
+// Write text to the current chunk, or the sink
+static void output_text(const char *s, size_t len) {
+   struct output_state *out = context->output;
+   if (out->holding) {
+      output_hold_text(s, len);
+   } else if (out->current) {
+      output_append(s, len);
+   } else {
+      sink_write(out->sink, s, len);
+   }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+void output_create() {
+   struct output_state *out = (struct output_state *)calloc(1, sizeof(struct output_state));
+   context->output = out;
+   out->own = sink_create_stream(stdout, 0);
+   out->sink = out->own;
+}
+
+void output_destroy() {
+   struct output_state *out = context->output;
+   sink_close(out->own);
+   free(out->held);
+   free(out);
+   context->output = NULL;
+}
+
+int output_printf(const char *fmt, ...) {
+   struct output_state *out = context->output;
+   va_list ap;
+   int n;
+   if (out->suppressed) {
+      return 0;
+   }
+   va_start(ap, fmt);
+   if (out->holding) {
+      char buffer[1024];
+      n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+      if (n >= (int) sizeof(buffer)) {
+         n = sizeof(buffer) - 1;
+      }
+      if (n > 0) {
+         output_hold_text(buffer, n);
+      }
+   } else if (out->current) {
+      char buffer[1024];
+      size_t space = OUTPUT_CHUNK_SIZE - out->current->len;
+      n = vsnprintf(out->current->text + out->current->len, space, fmt, ap);
+      if (n >= 0 && (size_t) n < space) {
+         // The normal case: formatted directly into the chunk
+         out->current->len += n;
+      } else {
+         // Didn't fit, so format again into a temporary buffer
+         va_end(ap);
+         va_start(ap, fmt);
+         n = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+         if (n >= (int) sizeof(buffer)) {
+            n = sizeof(buffer) - 1;
+         }
+         if (n > 0) {
+            output_append(buffer, n);
+         }
+      }
+   } else {
+      n = sink_vprintf(out->sink, fmt, ap);
+   }
+   va_end(ap);
+   return n;
+}
+
+void output_puts(const char *s) {
+   struct output_state *out = context->output;
+   if (out->suppressed) {
+      return;
+   }
+   output_text(s, strlen(s));
+   output_text("\n", 1);
+}
+
+void output_putchar(int c) {
+   struct output_state *out = context->output;
+   if (out->suppressed) {
+      return;
+   }
+   char ch = c;
+   output_text(&ch, 1);
+}
+
+void output_write(const char *s, size_t len) {
+   struct output_state *out = context->output;
+   if (out->suppressed) {
+      return;
+   }
+   output_text(s, len);
+}
+
+void output_profile_instruction(int pc, int opcode, int op1, int op2, int num_cycles) {
+   struct output_state *out = context->output;
+   if (out->suppressed) {
+      return;
+   }
+   if (out->current) {
+      if (out->current->num_profile == OUTPUT_CHUNK_PROFILE) {
+         output_next_chunk();
+      }
+      output_profile_t *p = out->current->profile + out->current->num_profile++;
+      p->pos        = out->current->len;
+      p->pc         = pc;
+      p->opcode     = opcode;
+      p->op1        = op1;
+      p->op2        = op2;
+      p->num_cycles = num_cycles;
+   } else {
+      profiler_profile_instruction(pc, opcode, op1, op2, num_cycles);
+   }
+}
+
+void output_line(const trace_instr_t *instr, const int *state, int num_state) {
+   struct output_state *out = context->output;
+   if (out->suppressed) {
+      return;
+   }
+   if (out->current->num_lines == OUTPUT_CHUNK_LINES) {
+      output_next_chunk();
+   }
+   output_line_t *line = out->current->lines + out->current->num_lines++;
+   line->pos         = out->current->len;
+   line->num_profile = out->current->num_profile;
+   line->instr       = *instr;
+   if (instr->flags & TRACE_STATE) {
+      memcpy(line->state, state, num_state * sizeof(int));
+   }
+}
+
+int output_open(const char *filename, int async) {
+   struct output_state *out = context->output;
+   sink_t *sink = filename ? sink_create_file(filename, async) : sink_create_stream(stdout, async);
+   if (!sink) {
+      return 1;
+   }
+   int own = out->sink == out->own;
+   sink_close(out->own);
+   out->own = sink;
+   if (own) {
+      out->sink = sink;
+   }
+   return 0;
+}
+
+void output_set_sink(sink_t *sink) {
+   struct output_state *out = context->output;
+   out->sink = sink ? sink : out->own;
+}
+
+sink_t *output_sink() {
+   struct output_state *out = context->output;
+   return out->sink;
+}
+
+int output_flush() {
+   struct output_state *out = context->output;
+   return sink_flush(out->sink);
+}
+
+void output_suppress(int suppress) {
+   struct output_state *out = context->output;
+   out->suppressed = suppress;
+}
+
+void output_hold(int hold) {
+   struct output_state *out = context->output;
+   out->holding = hold;
+}
+
+size_t output_held() {
+   struct output_state *out = context->output;
+   return out->held_len;
+}
+
+void output_release() {
+   struct output_state *out = context->output;
+   size_t len = out->held_len;
+   out->held_len = 0;
+   output_text(out->held, len);
+}
+
+void output_divert(output_handoff_t handoff, output_chunk_t *chunk) {
+   struct output_state *out = context->output;
+   out->handoff = handoff;
+   out->current = chunk;
+   reset_chunk(out->current);
+}
+
+void output_defer_lines(int defer) {
+   struct output_state *out = context->output;
+   out->defer_lines = defer;
+}
+
+int output_lines_deferred() {
+   struct output_state *out = context->output;
+   return out->defer_lines;
+}
+
+output_chunk_t *output_restore() {
+   struct output_state *out = context->output;
+   output_chunk_t *chunk = out->current;
+   out->current = NULL;
+   out->handoff = NULL;
+   out->defer_lines = 0;
+   return chunk;
+}
+
+void output_format(output_chunk_t *chunk, output_format_t format, int formatter) {
+   if (chunk->formatted || chunk->num_lines == 0) {
+      return;
+   }
+   // Merge the lines into the text, moving the profiled instructions
+   // along with the text they follow
+   char *bp = chunk->formatted_text;
+   size_t pos = 0;
+   int n = 0;
+   for (int i = 0; i <= chunk->num_lines; i++) {
+      output_line_t *line = i < chunk->num_lines ? chunk->lines + i : NULL;
+      int num_profile = line ? line->num_profile : chunk->num_profile;
+      for (; n < num_profile; n++) {
+         output_profile_t *p = chunk->profile + n;
+         memcpy(bp, chunk->text + pos, p->pos - pos);
+         bp += p->pos - pos;
+         pos = p->pos;
+         p->pos = bp - chunk->formatted_text;
+      }
+      size_t end = line ? line->pos : chunk->len;
+      memcpy(bp, chunk->text + pos, end - pos);
+      bp += end - pos;
+      pos = end;
+      if (line) {
+         bp = format(bp, line, formatter);
+         *bp++ = '\n';
+      }
+   }
+   chunk->formatted_len = bp - chunk->formatted_text;
+   chunk->formatted = 1;
+}
+
+void output_replay(output_chunk_t *chunk) {
+   struct output_state *out = context->output;
+   const char *text = chunk->formatted ? chunk->formatted_text : chunk->text;
+   size_t len = chunk->formatted ? chunk->formatted_len : chunk->len;
+   size_t pos = 0;
+   for (int i = 0; i < chunk->num_profile; i++) {
+      output_profile_t *p = chunk->profile + i;
+      if (p->pos > pos) {
+         sink_write(out->sink, text + pos, p->pos - pos);
+         pos = p->pos;
+      }
+      profiler_profile_instruction(p->pc, p->opcode, p->op1, p->op2, p->num_cycles);
+   }
+   if (len > pos) {
+      sink_write(out->sink, text + pos, len - pos);
+   }
+}
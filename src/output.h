@@ -0,0 +1,139 @@
+#ifndef _INCLUDE_OUTPUT_H
+#define _INCLUDE_OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "defs.h"
+#include "trace.h"
+#include "sink.h"
+
+// All text written to stdout while decoding should go through these
+// methods rather than stdio, so that it can be handed off in chunks to
+// another thread for writing. Text written after decoding (e.g. by the
+// profilers) should go to output_sink(), as each context can write to
+// a different file. Either way, it ends up in the context's sink (see
+// sink.h), rather than stdio's stdout.
+//
+// Profiled instructions are recorded in the same chunks, as the call
+// profiler can itself produce output, which must keep its place in the
+// text stream.
+//
+// When the chunks are written by another thread, the instruction lines can
+// also be deferred: the decoder records each instruction (as in a trace),
+// and the lines are formatted later (see output_format), possibly by
+// several threads in parallel, and then written in order.
+
+#define OUTPUT_CHUNK_SIZE    (1 << 16)
+#define OUTPUT_CHUNK_PROFILE 4096
+#define OUTPUT_CHUNK_LINES   1024
+
+// Longest formatted line, including the newline
+#define OUTPUT_MAX_LINE      256
+
+typedef struct {
+   size_t pos;   // offset into the text at which the instruction was profiled
+   int pc;
+   int opcode;
+   int op1;
+   int op2;
+   int num_cycles;
+} output_profile_t;
+
+typedef struct {
+   size_t        pos;          // offset into the text at which the line goes
+   int           num_profile;  // number of profiled instructions before it
+   trace_instr_t instr;
+   int           state[MAX_EM_STATE];  // if instr.flags has TRACE_STATE
+} output_line_t;
+
+typedef struct {
+   size_t           len;
+   int              num_profile;
+   int              num_lines;
+   char             text[OUTPUT_CHUNK_SIZE];
+   output_profile_t profile[OUTPUT_CHUNK_PROFILE];
+   output_line_t    lines[OUTPUT_CHUNK_LINES];
+   // The text with the lines in place, once formatted (the profiled
+   // instructions are then relative to this)
+   int              formatted;
+   size_t           formatted_len;
+   char             formatted_text[OUTPUT_CHUNK_SIZE + OUTPUT_CHUNK_LINES * OUTPUT_MAX_LINE];
+} output_chunk_t;
+
+// Passed a full chunk, and returns an empty one to continue with
+typedef output_chunk_t *(*output_handoff_t)(output_chunk_t *chunk);
+
+// Formats a deferred line into buffer (without the newline), returning the
+// end; this must only depend on the line (and the configuration), as it
+// may be called from any thread
+//
+// formatter identifies the thread, for any state of its own: 0 for the
+// output stage, and 1 on for each formatter of the pipeline
+typedef char *(*output_format_t)(char *buffer, const output_line_t *line, int formatter);
+
+// Allocate (and free) the output state of the current context
+void output_create();
+
+void output_destroy();
+
+int output_printf(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+void output_puts(const char *s);
+
+void output_putchar(int c);
+
+void output_write(const char *s, size_t len);
+
+void output_profile_instruction(int pc, int opcode, int op1, int op2, int num_cycles);
+
+// Record the line for an instruction, to be formatted later (state is
+// only copied if instr has TRACE_STATE)
+void output_line(const trace_instr_t *instr, const int *state, int num_state);
+
+// Write the output to filename (or stdout if NULL) through a sink of the
+// context's own, returning non-zero if it can't be created
+int output_open(const char *filename, int async);
+
+// Write the output to sink rather than the context's own (or back to that
+// if NULL); sink is left open when the context is destroyed
+void output_set_sink(sink_t *sink);
+
+sink_t *output_sink();
+
+// Write out everything buffered, returning non-zero if any write failed
+int output_flush();
+
+// Discard all output (including profiled instructions) while set
+void output_suppress(int suppress);
+
+// Hold back any text while set (e.g. while lines are held back by loop
+// folding), which is written once released
+void output_hold(int hold);
+
+// Length of the text held back
+size_t output_held();
+
+// Write out the text held back
+void output_release();
+
+// Start collecting output in chunk, rather than writing to stdout
+void output_divert(output_handoff_t handoff, output_chunk_t *chunk);
+
+// While diverted, whether the instruction lines are deferred (with
+// output_line) rather than written as text
+void output_defer_lines(int defer);
+
+int output_lines_deferred();
+
+// Stop collecting output, returning the final (partial) chunk
+output_chunk_t *output_restore();
+
+// Format the deferred lines of a chunk (which can be on any thread)
+void output_format(output_chunk_t *chunk, output_format_t format, int formatter);
+
+// Write out a chunk, calling the profiler in the original order (any
+// deferred lines must have been formatted)
+void output_replay(output_chunk_t *chunk);
+
+#endif
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pipeline.h"
+#include "ring.h"
+#include "output.h"
+#include "context.h"
+
+// Number of buffers in flight between each pair of stages
+#define NUM_BLOCKS  4
+#define NUM_BATCHES 16
+#define NUM_CHUNKS  8
+
+// Additional chunks in flight for each formatter
+#define FORMAT_CHUNKS 4
+
+#define MAX_FORMATTERS (PIPELINE_MAX_THREADS - 4)
+
+// A block of the capture, preceeded by its history: either in place in
+// the mapping, or copied to the buffer (when the capture isn't mapped, or
+// the block is only a copy that capture_next reuses)
+typedef struct {
+   const uint8_t *data;
+   size_t         len;
+   int            in_place;
+   uint8_t       *buffer;
+} block_t;
+
+typedef struct {
+   int          num;
+   // The bus cycles, and their counts, each after the headroom
+   bus_cycle_t  bus[PIPELINE_HEADROOM + PIPELINE_BATCH];
+   uint32_t     sample_count[PIPELINE_HEADROOM + PIPELINE_BATCH];
+   uint32_t     cycle_count[PIPELINE_HEADROOM + PIPELINE_BATCH];
+   // Which are boundaries (see bus_window_t), a bit each from the headroom on
+   uint64_t     boundary[(PIPELINE_HEADROOM + PIPELINE_BATCH + 63) / 64];
+} batch_t;
+
+typedef struct {
+   context_t *context;
+   int        index;      // from 1 (see output_format_t)
+   pthread_t  thread;
+   ring_t    *in;
+   ring_t    *out;
+} formatter_t;
+
+// The state is per context (see context.h), and the stage threads work
+// on the context of the thread that started them
+struct pipeline_state {
+   capture_t *capture;
+   size_t align;
+   int stats;
+   void (*consume)(const bus_window_t *batch, int num);
+   output_format_t format;
+
+   // Each connection between stages is a ring of full buffers, and a ring
+   // returning the empty buffers for reuse (NULL if the stages are merged)
+   ring_t *block_full;
+   ring_t *block_free;
+   ring_t *batch_full;
+   ring_t *batch_free;
+   ring_t *chunk_full;
+   ring_t *chunk_free;
+   int num_chunks;
+
+   // The chunks are passed to each formatter in turn (rather than through
+   // chunk_full), and taken back in the same order by the output stage
+   int num_formatters;
+   formatter_t formatters[MAX_FORMATTERS];
+   uint64_t chunks_handed_off;
+
+   pthread_t reader_thread;
+   pthread_t emulate_thread;
+   pthread_t output_thread;
+
+   // The buffers currently owned by the extract stage (the batch is just
+   // reused when the emulate stage isn't on its own thread)
+   block_t *current_block;
+   batch_t *current_batch;
+
+   // Set if the extract stage finishes before the end of the capture
+   atomic_int reader_stop;
+
+   // Set once the extract stage has been passed the final (empty) block
+   int reader_done;
+};
+
+// ====================================================================
+// Stage threads
+// ====================================================================
+
+// The whole of a batch, including the headroom
+static bus_window_t batch_window(batch_t *batch) {
+   bus_window_t window = {
+      .bus          = batch->bus,
+      .sample_count = batch->sample_count,
+      .cycle_count  = batch->cycle_count,
+      .boundary     = batch->boundary,
+      .bit          = 0
+   };
+   return window;
+}
+
+static void consume_batch(batch_t *batch) {
+   struct pipeline_state *p = context->pipeline;
+   bus_window_t all = batch_window(batch);
+   bus_window_t window = bus_window_at(&all, PIPELINE_HEADROOM);
+   p->consume(&window, batch->num);
+}
+
+static void *reader_main(void *arg) {
+   context = (context_t *)arg;
+   struct pipeline_state *p = context->pipeline;
+   size_t len;
+   do {
+      block_t *next = (block_t *)ring_pop(p->block_free);
+      // The extract stage has finished with the block it returned
+      if (next->in_place) {
+         capture_release(p->capture, next->data, next->len);
+      }
+      const uint8_t *block;
+      len = atomic_load(&p->reader_stop) ? 0 : capture_next(p->capture, &block, p->align);
+      next->in_place = len > 0 && capture_in_place(p->capture, block);
+      if (next->in_place) {
+         next->data = block;
+      } else {
+         if (len > 0) {
+            memcpy(next->buffer, block - CAPTURE_HISTORY, CAPTURE_HISTORY + len);
+         }
+         next->data = next->buffer + CAPTURE_HISTORY;
+      }
+      next->len = len;
+      ring_push(p->block_full, next);
+   } while (len > 0);
+   return NULL;
+}
+
+// The ring the n'th chunk is passed to, and the one it is written from
+static ring_t *format_ring(uint64_t n) {
+   struct pipeline_state *p = context->pipeline;
+   return p->num_formatters ? p->formatters[n % p->num_formatters].in : p->chunk_full;
+}
+
+static ring_t *output_ring(uint64_t n) {
+   struct pipeline_state *p = context->pipeline;
+   return p->num_formatters ? p->formatters[n % p->num_formatters].out : p->chunk_full;
+}
+
+static output_chunk_t *chunk_handoff(output_chunk_t *chunk) {
+   struct pipeline_state *p = context->pipeline;
+   ring_push(format_ring(p->chunks_handed_off++), chunk);
+   return (output_chunk_t *)ring_pop(p->chunk_free);
+}
+
+static void *emulate_main(void *arg) {
+   context = (context_t *)arg;
+   struct pipeline_state *p = context->pipeline;
+   if (p->chunk_full) {
+      output_divert(chunk_handoff, (output_chunk_t *)ring_pop(p->chunk_free));
+      output_defer_lines(p->format != NULL);
+   }
+   int last = 0;
+   while (!last) {
+      batch_t *batch = (batch_t *)ring_pop(p->batch_full);
+      consume_batch(batch);
+      last = bus_type(batch->bus[PIPELINE_HEADROOM + batch->num - 1]) == LAST;
+      ring_push(p->batch_free, batch);
+   }
+   if (p->chunk_full) {
+      ring_push(format_ring(p->chunks_handed_off++), output_restore());
+      // Tell the later stages there is nothing more to come (the output
+      // stage stops at the first)
+      for (int i = 0; i < (p->num_formatters ? p->num_formatters : 1); i++) {
+         ring_push(format_ring(p->chunks_handed_off++), NULL);
+      }
+   }
+   return NULL;
+}
+
+static void *format_main(void *arg) {
+   formatter_t *formatter = (formatter_t *)arg;
+   context = formatter->context;
+   struct pipeline_state *p = context->pipeline;
+   output_chunk_t *chunk;
+   while ((chunk = (output_chunk_t *)ring_pop(formatter->in)) != NULL) {
+      output_format(chunk, p->format, formatter->index);
+      ring_push(formatter->out, chunk);
+   }
+   ring_push(formatter->out, NULL);
+   return NULL;
+}
+
+static void *output_main(void *arg) {
+   context = (context_t *)arg;
+   struct pipeline_state *p = context->pipeline;
+   output_chunk_t *chunk;
+   uint64_t n = 0;
+   while ((chunk = (output_chunk_t *)ring_pop(output_ring(n++))) != NULL) {
+      // Without formatters, the lines are formatted here
+      output_format(chunk, p->format, 0);
+      output_replay(chunk);
+      ring_push(p->chunk_free, chunk);
+   }
+   return NULL;
+}
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static void start_thread(pthread_t *thread, void *(*main)(void *), void *arg) {
+   if (pthread_create(thread, NULL, main, arg) != 0) {
+      perror("failed to create pipeline thread");
+      exit(1);
+   }
+}
+
+// Size of a ring to hold num items
+static int ring_size(int num) {
+   int size = 1;
+   while (size < num) {
+      size <<= 1;
+   }
+   return size;
+}
+
+// Create a connection between stages, with num items each of size bytes
+static void connect_stages(ring_t **full, ring_t **empty, int num, size_t size) {
+   *full  = ring_create(ring_size(num));
+   *empty = ring_create(ring_size(num));
+   for (int i = 0; i < num; i++) {
+      ring_push(*empty, malloc(size));
+   }
+}
+
+static void disconnect_stages(ring_t **full, ring_t **empty, int num) {
+   for (int i = 0; i < num; i++) {
+      free(ring_pop(*empty));
+   }
+   ring_destroy(*full);
+   ring_destroy(*empty);
+   *full  = NULL;
+   *empty = NULL;
+}
+
+// Print the statistics for a connection between stages
+//
+// The producer stalls when it runs out of empty buffers (or, equivalently,
+// the ring of full buffers is full), and the consumer stalls when the ring
+// of full buffers is empty. So the stage that stalls least is the
+// bottleneck, and a ring that is usually full has a slow consumer.
+//
+// The formatters have no ring of empty buffers (empty is NULL).
+static void print_stats(ring_t *full, ring_t *empty, const char *name, int num) {
+   ring_stats_t f;
+   ring_stats_t e = { 0 };
+   ring_get_stats(full, &f);
+   if (empty) {
+      ring_get_stats(empty, &e);
+   }
+   double mean = f.pushes ? (double) f.occupancy / (double) f.pushes : 0.0;
+   fprintf(stderr, "%-16s: %10" PRIu64 " buffers; mean occupancy %5.1f of %2d; producer stalled %8" PRIu64 " times; consumer stalled %8" PRIu64 " times\n",
+           name, f.pushes, mean, num, f.push_waits + e.pop_waits, f.pop_waits);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+void pipeline_start(capture_t *capture, size_t align, int threads, int stats, void (*consume)(const bus_window_t *batch, int num), output_format_t format) {
+   struct pipeline_state *p = (struct pipeline_state *)calloc(1, sizeof(struct pipeline_state));
+   context->pipeline = p;
+   p->capture = capture;
+   p->align   = align;
+   p->stats   = stats;
+   p->consume = consume;
+   p->format  = format;
+   if (threads > PIPELINE_MAX_THREADS) {
+      threads = PIPELINE_MAX_THREADS;
+   }
+   // Connect the stages, starting from the output end
+   if (threads >= 2) {
+      connect_stages(&p->batch_full, &p->batch_free, NUM_BATCHES, sizeof(batch_t));
+      p->current_batch = (batch_t *)ring_pop(p->batch_free);
+   } else {
+      p->current_batch = (batch_t *)malloc(sizeof(batch_t));
+   }
+   p->current_batch->num = 0;
+   if (threads >= 3 && p->capture) {
+      atomic_init(&p->reader_stop, 0);
+      connect_stages(&p->block_full, &p->block_free, NUM_BLOCKS, sizeof(block_t));
+      // The block buffers are allocated separately from the descriptors
+      for (int i = 0; i < NUM_BLOCKS; i++) {
+         block_t *block = (block_t *)ring_pop(p->block_free);
+         block->in_place = 0;
+         block->buffer = (uint8_t *)malloc(CAPTURE_HISTORY + CAPTURE_WINDOW);
+         ring_push(p->block_free, block);
+      }
+      // The reader passes on the mapping in place, and releases each block
+      // once it's returned
+      capture_hold(capture);
+   }
+   if (threads >= 5 && p->format) {
+      p->num_formatters = threads - 4;
+      for (int i = 0; i < p->num_formatters; i++) {
+         p->formatters[i].context = context;
+         p->formatters[i].index   = i + 1;
+         p->formatters[i].in  = ring_create(ring_size(NUM_CHUNKS + FORMAT_CHUNKS * p->num_formatters + 1));
+         p->formatters[i].out = ring_create(ring_size(NUM_CHUNKS + FORMAT_CHUNKS * p->num_formatters + 1));
+      }
+   }
+   if (threads >= 4) {
+      p->num_chunks = NUM_CHUNKS + FORMAT_CHUNKS * p->num_formatters;
+      connect_stages(&p->chunk_full, &p->chunk_free, p->num_chunks, sizeof(output_chunk_t));
+   }
+   // Then start the threads, again from the output end
+   if (p->chunk_full) {
+      start_thread(&p->output_thread, output_main, context);
+   }
+   for (int i = 0; i < p->num_formatters; i++) {
+      start_thread(&p->formatters[i].thread, format_main, p->formatters + i);
+   }
+   if (p->batch_full) {
+      start_thread(&p->emulate_thread, emulate_main, context);
+   }
+   if (p->block_full) {
+      start_thread(&p->reader_thread, reader_main, context);
+   }
+}
+
+size_t pipeline_next_block(const uint8_t **block) {
+   struct pipeline_state *p = context->pipeline;
+   if (!p->block_full) {
+      return capture_next(p->capture, block, p->align);
+   }
+   // Return the previous block for reuse, as it's now finished with
+   if (p->current_block) {
+      ring_push(p->block_free, p->current_block);
+   }
+   p->current_block = (block_t *)ring_pop(p->block_full);
+   *block = p->current_block->data;
+   p->reader_done = p->current_block->len == 0;
+   return p->current_block->len;
+}
+
+int pipeline_room(bus_window_t *window) {
+   struct pipeline_state *p = context->pipeline;
+   bus_window_t all = batch_window(p->current_batch);
+   *window = bus_window_at(&all, PIPELINE_HEADROOM + p->current_batch->num);
+   return PIPELINE_BATCH - p->current_batch->num;
+}
+
+void pipeline_commit(int num) {
+   struct pipeline_state *p = context->pipeline;
+   if (num == 0) {
+      return;
+   }
+   int i = PIPELINE_HEADROOM + p->current_batch->num;
+   bus_window_t all = batch_window(p->current_batch);
+   for (int j = i; j < i + num; j++) {
+      bus_window_mark(&all, j);
+   }
+   p->current_batch->num += num;
+   int last = bus_type(p->current_batch->bus[i + num - 1]) == LAST;
+   if (!p->batch_full) {
+      if (last || p->current_batch->num == PIPELINE_BATCH) {
+         pipeline_flush();
+      }
+   } else if (last) {
+      ring_push(p->batch_full, p->current_batch);
+      p->current_batch = NULL;
+   } else if (p->current_batch->num == PIPELINE_BATCH) {
+      ring_push(p->batch_full, p->current_batch);
+      p->current_batch = (batch_t *)ring_pop(p->batch_free);
+      p->current_batch->num = 0;
+   }
+}
+
+void pipeline_cycle(bus_cycle_t bus, uint32_t sample_count, uint32_t cycle_count) {
+   bus_window_t window;
+   pipeline_room(&window);
+   window.bus[0]          = bus;
+   window.sample_count[0] = sample_count;
+   window.cycle_count[0]  = cycle_count;
+   pipeline_commit(1);
+}
+
+void pipeline_flush() {
+   struct pipeline_state *p = context->pipeline;
+   if (!p->batch_full && p->current_batch->num) {
+      consume_batch(p->current_batch);
+      p->current_batch->num = 0;
+   }
+}
+
+void pipeline_finish() {
+   struct pipeline_state *p = context->pipeline;
+   if (p->block_full) {
+      // Stop the reader, and discard anything it read ahead
+      atomic_store(&p->reader_stop, 1);
+      while (!p->reader_done) {
+         const uint8_t *block;
+         pipeline_next_block(&block);
+      }
+      pthread_join(p->reader_thread, NULL);
+   }
+   if (p->batch_full) {
+      pthread_join(p->emulate_thread, NULL);
+   }
+   for (int i = 0; i < p->num_formatters; i++) {
+      pthread_join(p->formatters[i].thread, NULL);
+   }
+   if (p->chunk_full) {
+      pthread_join(p->output_thread, NULL);
+   }
+   if (p->stats) {
+      if (p->block_full) {
+         print_stats(p->block_full, p->block_free, "reader->extract", NUM_BLOCKS);
+      }
+      if (p->batch_full) {
+         print_stats(p->batch_full, p->batch_free, "extract->emulate", NUM_BATCHES);
+      }
+      if (p->num_formatters) {
+         for (int i = 0; i < p->num_formatters; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "emulate->format%d", i);
+            print_stats(p->formatters[i].in, NULL, name, p->num_chunks);
+            snprintf(name, sizeof(name), "format%d->output", i);
+            print_stats(p->formatters[i].out, NULL, name, p->num_chunks);
+         }
+      } else if (p->chunk_full) {
+         print_stats(p->chunk_full, p->chunk_free, "emulate->output", p->num_chunks);
+      }
+   }
+   // Tear down the connections, reclaiming all the buffers
+   if (p->block_full) {
+      ring_push(p->block_free, p->current_block);
+      p->current_block = NULL;
+      for (int i = 0; i < NUM_BLOCKS; i++) {
+         block_t *block = (block_t *)ring_pop(p->block_free);
+         free(block->buffer);
+         ring_push(p->block_free, block);
+      }
+      disconnect_stages(&p->block_full, &p->block_free, NUM_BLOCKS);
+   }
+   if (p->batch_full) {
+      disconnect_stages(&p->batch_full, &p->batch_free, NUM_BATCHES);
+   } else {
+      free(p->current_batch);
+      p->current_batch = NULL;
+   }
+   for (int i = 0; i < p->num_formatters; i++) {
+      ring_destroy(p->formatters[i].in);
+      ring_destroy(p->formatters[i].out);
+   }
+   if (p->chunk_full) {
+      disconnect_stages(&p->chunk_full, &p->chunk_free, p->num_chunks);
+   }
+   free(context->pipeline);
+   context->pipeline = NULL;
+}
@@ -0,0 +1,79 @@
+#ifndef _INCLUDE_PIPELINE_H
+#define _INCLUDE_PIPELINE_H
+
+#include <stddef.h>
+
+#include "defs.h"
+#include "capture.h"
+#include "output.h"
+
+// The decoder runs as four stages:
+//
+//   reader  -> extract -> emulate -> output
+//
+// - reader:  pages in the capture file, a block at a time (passing on a
+//            mapped capture in place, and copying only a stream)
+// - extract: turns raw samples into bus cycles (bus_cycle_t), which runs
+//            on the calling thread between pipeline_start/finish
+// - emulate: queues the bus cycles, and decodes/emulates instructions
+// - format:  formats the instruction lines, which the emulate stage
+//            records rather than formatting (see output_line)
+// - output:  writes the text output, and runs the profiler
+//
+// With more threads, adjacent stages are split off onto their own
+// thread, connected by bounded single-producer/single-consumer rings:
+//
+//   1 thread:  all stages run in sequence (the original behaviour)
+//   2 threads: reader+extract | emulate+output
+//   3 threads: reader | extract | emulate+output
+//   4 threads: reader | extract | emulate | format+output
+//   5+ threads: reader | extract | emulate | format... | output
+//
+// With 5 or more threads, the rest are a pool of formatters, which are
+// passed the chunks of output in turn, so they are written in order.
+
+#define PIPELINE_MAX_THREADS 16
+
+// Number of bus cycles passed between the extract and emulate stages
+#define PIPELINE_BATCH 4096
+
+// Each batch is preceded by room for this many bus cycles, so the emulate
+// stage can carry the bus cycles it's still looking ahead over from the
+// end of one batch to just in front of the next (with the BEHIND before
+// them), and work on them in place
+#define PIPELINE_HEADROOM (DEPTH + BEHIND)
+
+// Start the pipeline; consume is the emulate stage, called for each batch
+// of bus cycles in order (packed, see bus_cycle_t), the last ending with one
+// of type LAST. It may write to the batch, and to the PIPELINE_HEADROOM bus
+// cycles before it (marking their boundaries, see bus_window_mark).
+//
+// capture may be NULL if the bus cycles come from elsewhere, in which
+// case there is no reader stage
+//
+// format formats the deferred instruction lines, or is NULL if they can
+// only be formatted as they are emulated (when there is no format stage)
+void pipeline_start(capture_t *capture, size_t align, int threads, int stats, void (*consume)(const bus_window_t *batch, int num), output_format_t format);
+
+// Return the next block of the capture (see capture_next)
+size_t pipeline_next_block(const uint8_t **block);
+
+// Return the room left in the next batch (at least one bus cycle), and a
+// window onto it, so the bus cycles can be written to the batch in place
+int pipeline_room(bus_window_t *window);
+
+// Pass the first num bus cycles written to the window from pipeline_room
+// on to the emulate stage (the last may be of type LAST)
+void pipeline_commit(int num);
+
+// Pass a single bus cycle on to the emulate stage (in the next batch)
+void pipeline_cycle(bus_cycle_t bus, uint32_t sample_count, uint32_t cycle_count);
+
+// Pass on the bus cycles batched so far, if the emulate stage isn't on its
+// own thread (so a decode that's being fed keeps up with what it's given)
+void pipeline_flush();
+
+// Wait for the later stages to drain (after the LAST bus cycle)
+void pipeline_finish();
+
+#endif
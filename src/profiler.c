@@ -1,8 +1,12 @@
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
 #include "profiler.h"
+#include "output.h"
 #include "symbols.h"
+#include "disasm.h"
+#include "context.h"
 
 extern profiler_t *profiler_instr_create(char *arg);
 extern profiler_t *profiler_block_create(char *arg);
@@ -10,10 +14,19 @@ extern profiler_t *profiler_call_create(char *arg);
 
 #define MAX_PROFILERS 10
 
-static profiler_t *active_list[MAX_PROFILERS] = { NULL } ;
+struct profiler_state {
+   profiler_t *active_list[MAX_PROFILERS + 1];
+   int active_count;
+};
+
+// The profilers are per context (see context.h), allocated when the first is added
+static profiler_t *no_profilers[1] = { NULL };
+
+static profiler_t **active_profilers() {
+   return context->profiler ? context->profiler->active_list : no_profilers;
+}
 
 void profiler_parse_opt(int key, char *arg, struct argp_state *state) {
-static int active_count = 0;
    switch (key) {
    case 'p':
       if (arg && strlen(arg) > 0) {
@@ -29,8 +42,15 @@ static int active_count = 0;
             instance = profiler_call_create(rest);
          }
          if (instance) {
-            active_list[active_count++] = instance;
-            active_list[active_count] = NULL;
+            if (!context->profiler) {
+               context->profiler = (struct profiler_state *)calloc(1, sizeof(struct profiler_state));
+            }
+            struct profiler_state *profiler = context->profiler;
+            if (profiler->active_count == MAX_PROFILERS) {
+               argp_error(state, "too many profilers");
+            }
+            profiler->active_list[profiler->active_count++] = instance;
+            profiler->active_list[profiler->active_count] = NULL;
          } else {
             argp_error(state, "unknown profiler type %s", type);
          }
@@ -40,7 +60,7 @@ static int active_count = 0;
 }
 
 void profiler_init(cpu_emulator_t *em) {
-   profiler_t **pp = active_list;
+   profiler_t **pp = active_profilers();
    while (*pp) {
       (*pp)->init(*pp, em);
       pp++;
@@ -48,7 +68,7 @@ void profiler_init(cpu_emulator_t *em) {
 }
 
 void profiler_profile_instruction(int pc, int opcode, int op1, int op2, int num_cycles) {
-   profiler_t **pp = active_list;
+   profiler_t **pp = active_profilers();
    while (*pp) {
       (*pp)->profile_instruction(*pp, pc, opcode, op1, op2, num_cycles);
       pp++;
@@ -56,16 +76,26 @@ void profiler_profile_instruction(int pc, int opcode, int op1, int op2, int num_
 }
 
 void profiler_done() {
-   profiler_t **pp = active_list;
+   profiler_t **pp = active_profilers();
    while (*pp) {
-   printf("==============================================================================\n");
-   printf("Profiler: %s; Args: %s\n", (*pp)->name, (*pp)->arg);
-   printf("==============================================================================\n");
+   sink_printf(output_sink(), "==============================================================================\n");
+   sink_printf(output_sink(), "Profiler: %s; Args: %s\n", (*pp)->name, (*pp)->arg);
+   sink_printf(output_sink(), "==============================================================================\n");
       (*pp)->done(*pp);
       pp++;
    }
 }
 
+void profiler_destroy() {
+   profiler_t **pp = active_profilers();
+   while (*pp) {
+      free(*pp);
+      pp++;
+   }
+   free(context->profiler);
+   context->profiler = NULL;
+}
+
 void profiler_output_helper(address_t *profile_counts, int show_bars, int show_other, cpu_emulator_t *em) {
    address_t      *ptr;
 
@@ -107,52 +137,55 @@ void profiler_output_helper(address_t *profile_counts, int show_bars, int show_o
    for (int addr = 0; addr <= OTHER_CONTEXT; addr++) {
       char *name = symbol_lookup(addr);
       if (name) {
-         printf("\n%s\n", name);
+         sink_printf(output_sink(), "\n%s\n", name);
       }
       if (ptr->cycles) {
          double percent = 100.0 * (ptr->cycles) / (double) total_cycles;
          total_percent += percent;
          if (addr == OTHER_CONTEXT) {
-            printf("****");
+            sink_printf(output_sink(), "****");
          } else {
-            printf("%04x", addr);
+            sink_printf(output_sink(), "%04x", addr);
             if (em) {
-               instruction_t instruction;
-               instruction.pc     = addr;
-               instruction.opcode = em->read_memory(addr);
-               instruction.op1    = em->read_memory(addr + 1);
-               instruction.op2    = em->read_memory(addr + 2);
-               int n = em->disassemble(buffer, &instruction);
-               printf(" %s", buffer);
+               instruction_t instruction = {
+                  .pc     = addr,
+                  .pb     = -1,
+                  .opcode = em->read_memory(addr),
+                  .op1    = em->read_memory(addr + 1),
+                  .op2    = em->read_memory(addr + 2),
+                  .op3    = em->read_memory(addr + 3)
+               };
+               int n = disasm_instruction(0, buffer, &instruction);
+               sink_printf(output_sink(), " %s", buffer);
                for (int i = n; i < 12; i++) {
-                  putchar(' ');
+                  sink_putc(output_sink(), ' ');
                }
             }
          }
-         printf(" : %8d cycles (%10.6f%%) %8d ins (%4.2f cpi)", ptr->cycles, percent, ptr->instructions, (double) ptr->cycles / (double) ptr->instructions);
+         sink_printf(output_sink(), " : %8d cycles (%10.6f%%) %8d ins (%4.2f cpi)", ptr->cycles, percent, ptr->instructions, (double) ptr->cycles / (double) ptr->instructions);
          if (show_other) {
-            printf(" %8d calls", ptr->calls);
-            printf(" (");
-            printf(ptr->flags & FLAG_JSR           ? "J" : " ");
-            printf(ptr->flags & FLAG_JMP           ? "j" : " ");
-            printf(ptr->flags & FLAG_BB_TAKEN      ? "B" : " ");
-            printf(ptr->flags & FLAG_FB_TAKEN      ? "F" : " ");
-            printf(ptr->flags & FLAG_BB_NOT_TAKEN  ? "b" : " ");
-            printf(ptr->flags & FLAG_FB_NOT_TAKEN  ? "f" : " ");
-            printf(ptr->flags & FLAG_JMP_IND       ? "i" : " ");
-            printf(ptr->flags & FLAG_JMP_INDX      ? "x" : " ");
-            printf(")");
+            sink_printf(output_sink(), " %8d calls", ptr->calls);
+            sink_printf(output_sink(), " (");
+            sink_printf(output_sink(), ptr->flags & FLAG_JSR           ? "J" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_JMP           ? "j" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_BB_TAKEN      ? "B" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_FB_TAKEN      ? "F" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_BB_NOT_TAKEN  ? "b" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_FB_NOT_TAKEN  ? "f" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_JMP_IND       ? "i" : " ");
+            sink_printf(output_sink(), ptr->flags & FLAG_JMP_INDX      ? "x" : " ");
+            sink_printf(output_sink(), ")");
          }
          if (show_bars) {
-            printf(" ");
+            sink_printf(output_sink(), " ");
             for (int i = 0; i < (int) (bar_scale * ptr->cycles); i++) {
-               printf("*");
+               sink_printf(output_sink(), "*");
             }
          }
-         printf("\n");
+         sink_printf(output_sink(), "\n");
       }
       ptr++;
    }
-   printf("     : %8" PRIu64 " cycles (%10.6f%%) %8" PRIu64 " ins (%4.2f cpi)\n", total_cycles, total_percent, total_instr, (double) total_cycles / (double) total_instr);
-   printf("     : %8" PRIu64 " branch page crossing cycles (%10.6f%%)\n",page_crossing_cycles, (double) page_crossing_cycles * 100.0 / (double) total_cycles);
+   sink_printf(output_sink(), "     : %8" PRIu64 " cycles (%10.6f%%) %8" PRIu64 " ins (%4.2f cpi)\n", total_cycles, total_percent, total_instr, (double) total_cycles / (double) total_instr);
+   sink_printf(output_sink(), "     : %8" PRIu64 " branch page crossing cycles (%10.6f%%)\n",page_crossing_cycles, (double) page_crossing_cycles * 100.0 / (double) total_cycles);
 }
@@ -48,6 +48,7 @@ void profiler_parse_opt(int key, char *arg, struct argp_state *state);
 void profiler_init(cpu_emulator_t *em);
 void profiler_profile_instruction(int pc, int opcode, int op1, int op2, int num_cycles);
 void profiler_done();
+void profiler_destroy();
 
 // Helper methods, for use by profiler implementations
 
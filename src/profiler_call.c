@@ -5,6 +5,7 @@
 
 #include "musl_tsearch.h"
 #include "profiler.h"
+#include "output.h"
 #include "symbols.h"
 
 #define DEBUG           0
@@ -13,7 +14,7 @@
 // (6502 stack can only hold 128 addresses)
 #define CALL_STACK_SIZE 128
 
-static cpu_emulator_t *my_em;
+static __thread cpu_emulator_t *my_em;
 
 typedef struct call_stack {
    int stack[CALL_STACK_SIZE];
@@ -33,9 +34,9 @@ typedef struct {
 } profiler_call_t;
 
 
-// One copy of these means profile_done is not thread safe, not concerned about this
-static uint64_t total_cycles;
-static double total_percent;
+// One copy of these per thread, as profile_done is only called on the thread decoding
+static __thread uint64_t total_cycles;
+static __thread double total_percent;
 
 static int compare_nodes(const void *av, const void *bv) {
    const call_stack_t *a = (call_stack_t *) av;
@@ -88,7 +89,7 @@ static void p_profile_instruction(void *ptr, int pc, int opcode, int op1, int op
       if (instance->current->index < CALL_STACK_SIZE) {
          int addr = (op2 << 8 | op1) & 0xffff;
 #if DEBUG
-         printf("*** pushing %04x to %d\n", addr, current->index);
+         sink_printf(output_sink(), "*** pushing %04x to %d\n", addr, current->index);
 #endif
          // Create a new child node, in case it's not already in the tree
          call_stack_t *child = (call_stack_t *) malloc(sizeof(call_stack_t));
@@ -105,9 +106,9 @@ static void p_profile_instruction(void *ptr, int pc, int opcode, int op1, int op
          }
          instance->current->call_count++;
       } else {
-         printf("warning: call stack overflowed, disabling further profiling\n");
+         sink_printf(output_sink(), "warning: call stack overflowed, disabling further profiling\n");
          for (int i = 0; i < instance->current->index; i++) {
-            printf("warning: stack[%3d] = %04x\n", i, instance->current->stack[i]);
+            sink_printf(output_sink(), "warning: stack[%3d] = %04x\n", i, instance->current->stack[i]);
          }
          instance->profile_enabled = 0;
       }
@@ -115,11 +116,11 @@ static void p_profile_instruction(void *ptr, int pc, int opcode, int op1, int op
    if (opcode == 0x60) {
       if (instance->current->parent) {
 #if DEBUG
-         printf("*** popping %d\n", current->index);
+         sink_printf(output_sink(), "*** popping %d\n", current->index);
 #endif
          instance->current = instance->current->parent;
       } else {
-         printf("warning: call stack underflowed, re-initialize call graph\n");
+         sink_printf(output_sink(), "warning: call stack underflowed, re-initialize call graph\n");
          p_init(ptr, instance->em);
       }
    }
@@ -129,21 +130,21 @@ static void print_node(const call_stack_t *node) {
    int first = 1;
    double percent = 100.0 * (double) node->cycle_count / (double) total_cycles;
    total_percent += percent;
-   printf("%8" PRIu64 " cycles (%10.6f%%) %8" PRIu64 " calls: ", node->cycle_count, percent, node->call_count);
+   sink_printf(output_sink(), "%8" PRIu64 " cycles (%10.6f%%) %8" PRIu64 " calls: ", node->cycle_count, percent, node->call_count);
    for (int i = 0; i < node->index; i++) {
       if (!first) {
-         printf("->");
+         sink_printf(output_sink(), "->");
       }
       first = 0;
       char *name=symbol_lookup(node->stack[i]);
       if (name) {
          if (name[0] == '.') name++;
-         printf("%s", name);
+         sink_printf(output_sink(), "%s", name);
       } else {
-         printf("%04X", node->stack[i]);
+         sink_printf(output_sink(), "%04X", node->stack[i]);
       }
    }
-   printf("\n");
+   sink_printf(output_sink(), "\n");
 }
 
 static void count_call_walker(const void *nodep, const TVISIT which, const int depth) {
@@ -164,7 +165,7 @@ static void p_done(void *ptr) {
    ttwalk(instance->root, count_call_walker);
    total_percent = 0;
    ttwalk(instance->root, dump_call_walker);
-   printf("%8" PRIu64 " cycles (%10.6f%%)\n", total_cycles, total_percent);
+   sink_printf(output_sink(), "%8" PRIu64 " cycles (%10.6f%%)\n", total_cycles, total_percent);
 }
 
 void *profiler_call_create(char *arg) {
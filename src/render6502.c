@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "decoder.h"
+#include "trace.h"
+
+// ====================================================================
+// Trace renderer entry point
+// ====================================================================
+
+// Writes the text output of a decode from the binary trace it wrote with
+// --trace_out, as the decode itself would have written it. The decoder is
+// configured with the options of the original decode, followed by any
+// given here, so for example --profile=call runs the call profiler from
+// the trace, and --quiet leaves just the profiler output.
+
+int main(int argc, char *argv[]) {
+   if (argc < 2 || argv[1][0] == '-') {
+      fprintf(stderr, "usage: %s TRACE [OPTION...]\n", argv[0]);
+      fprintf(stderr, "(the options are as for decode6502, and are added to those of the decode)\n");
+      return 1;
+   }
+   trace_t *trace = trace_open(argv[1]);
+   if (!trace) {
+      return 1;
+   }
+   char **trace_argv;
+   int trace_argc = trace_get_args(trace, &trace_argv);
+   char **args = (char **)malloc((trace_argc + argc + 1) * sizeof(char *));
+   int n = 0;
+   args[n++] = argv[0];
+   for (int i = 1; i < trace_argc; i++) {
+      args[n++] = trace_argv[i];
+   }
+   for (int i = 2; i < argc; i++) {
+      args[n++] = argv[i];
+   }
+   args[n] = NULL;
+
+   context = context_create();
+   int ret = decoder_configure(n, args, 0);
+   if (!ret) {
+      ret = decoder_render(trace);
+   } else {
+      trace_close(trace);
+   }
+   context_destroy(context);
+   free(args);
+   return ret;
+}
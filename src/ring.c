@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ring.h"
+
+// Number of times to yield before falling back to sleeping
+#define RING_YIELDS 64
+
+// How long to sleep for when the other side is slow (in ns)
+#define RING_SLEEP 20000
+
+struct ring {
+   void **slots;
+   int    mask;
+   // Written only by the producer
+   _Alignas(64) atomic_uint_fast64_t head;
+   uint64_t push_waits;
+   uint64_t occupancy;
+   // Written only by the consumer
+   _Alignas(64) atomic_uint_fast64_t tail;
+   uint64_t pop_waits;
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static void ring_wait(int *spins) {
+   if (*spins < RING_YIELDS) {
+      sched_yield();
+   } else {
+      struct timespec ts = { 0, RING_SLEEP };
+      nanosleep(&ts, NULL);
+   }
+   (*spins)++;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+ring_t *ring_create(int size) {
+   ring_t *ring = (ring_t *)aligned_alloc(64, (sizeof(ring_t) + 63) & ~63);
+   ring->slots = (void **)calloc(size, sizeof(void *));
+   ring->mask = size - 1;
+   atomic_init(&ring->head, 0);
+   atomic_init(&ring->tail, 0);
+   ring->push_waits = 0;
+   ring->occupancy = 0;
+   ring->pop_waits = 0;
+   return ring;
+}
+
+void ring_push(ring_t *ring, void *item) {
+   uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+   if (head - tail > (uint64_t) ring->mask) {
+      int spins = 0;
+      ring->push_waits++;
+      do {
+         ring_wait(&spins);
+         tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+      } while (head - tail > (uint64_t) ring->mask);
+   }
+   ring->occupancy += head - tail;
+   ring->slots[head & ring->mask] = item;
+   atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void *ring_pop(ring_t *ring) {
+   uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+   if (head == tail) {
+      int spins = 0;
+      ring->pop_waits++;
+      do {
+         ring_wait(&spins);
+         head = atomic_load_explicit(&ring->head, memory_order_acquire);
+      } while (head == tail);
+   }
+   void *item = ring->slots[tail & ring->mask];
+   atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+   return item;
+}
+
+void ring_get_stats(ring_t *ring, ring_stats_t *stats) {
+   stats->pushes     = atomic_load(&ring->head);
+   stats->occupancy  = ring->occupancy;
+   stats->push_waits = ring->push_waits;
+   stats->pop_waits  = ring->pop_waits;
+}
+
+void ring_destroy(ring_t *ring) {
+   free(ring->slots);
+   free(ring);
+}
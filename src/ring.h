@@ -0,0 +1,32 @@
+#ifndef _INCLUDE_RING_H
+#define _INCLUDE_RING_H
+
+#include <inttypes.h>
+
+// A bounded single-producer/single-consumer queue of pointers, used to
+// connect the stages of the decoder pipeline.
+//
+// Push blocks while the ring is full, and pop blocks while it is empty.
+
+typedef struct ring ring_t;
+
+// Create a ring that holds up to size (a power of 2) items
+ring_t *ring_create(int size);
+
+void ring_push(ring_t *ring, void *item);
+
+void *ring_pop(ring_t *ring);
+
+typedef struct {
+   uint64_t pushes;
+   uint64_t occupancy;   // sum of the occupancy seen by each push
+   uint64_t push_waits;  // pushes that found the ring full
+   uint64_t pop_waits;   // pops that found the ring empty
+} ring_stats_t;
+
+// Read the statistics (only once both sides have finished with the ring)
+void ring_get_stats(ring_t *ring, ring_stats_t *stats);
+
+void ring_destroy(ring_t *ring);
+
+#endif
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "scan.h"
+#include "output.h"
+
+// Number of entries shown of the opcode and page histograms
+#define SCAN_TOP 16
+
+struct scan {
+   int       c816;
+   int       nmos;        // 0x7C and 0x80 aren't jumps
+   int       bit_branch;  // BBR/BBS, which aren't followed
+   int       lengths[256];
+   uint32_t  start;
+   uint32_t  end;
+   int       done;
+
+   // The instruction in progress (the first SCAN_MAX_CYCLES of its cycles)
+   int       in_instr;
+   int       counted;
+   int       num_cycles;
+   uint8_t   data[SCAN_MAX_CYCLES];
+   int8_t    rnw[SCAN_MAX_CYCLES];
+   // The operands (on the 65C816)
+   int       num_operands;
+   uint8_t   operands[4];
+
+   // The program counter (-1 if not known), and that of a block move (which
+   // fetches its opcode again for each byte moved)
+   int       pc;
+   int       move_pc;
+   // Set once rst has been asserted, until the reset sequence (which starts
+   // with an opcode fetch), and then during it
+   int       reset_seen;
+   int       resetting;
+
+   // Which signals have been seen to be connected
+   int       rst_known;
+   int       rnw_known;
+
+   // Exact
+   uint64_t  instructions;
+   uint64_t  cycles;
+   uint64_t  resets;
+   uint64_t  by_cycles[SCAN_MAX_CYCLES + 1];
+   uint64_t  by_opcode[256];
+   // Approximate
+   uint64_t  interrupts;
+   uint64_t  pc_unknown;
+   uint64_t  by_page[256];
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+// Returns 1 if the instruction looks like an interrupt: an opcode fetch
+// that's discarded, followed by the return address and flags being pushed
+static int is_interrupt(const scan_t *scan) {
+   int opcode = scan->data[0];
+   if (opcode == 0x00 || (scan->c816 && opcode == 0x02)) {
+      // BRK and COP are instructions
+      return 0;
+   }
+   return scan->num_cycles >= 7 && !scan->rnw[2] && !scan->rnw[3] && !scan->rnw[4];
+}
+
+static int relative(int pc, int length, int offset) {
+   return pc < 0 ? -1 : (pc + length + offset) & 0xffff;
+}
+
+// The address of the next instruction, from the opcode and what was read
+// from the data bus (or -1 if it can't be worked out)
+static int next_pc(const scan_t *scan) {
+   int n = scan->num_cycles;
+   if (n > SCAN_MAX_CYCLES) {
+      return -1;
+   }
+   const uint8_t *data = scan->data;
+   int opcode = data[0];
+   int pc = scan->pc;
+   // The last two bytes read, for an indirect jump
+   int last = n >= 3 ? data[n - 2] | (data[n - 1] << 8) : -1;
+   if (scan->c816) {
+      const uint8_t *op = scan->operands;
+      int target = op[0] | (op[1] << 8);
+      switch (opcode) {
+      case 0x4C: // JMP abs
+      case 0x20: // JSR abs
+      case 0x5C: // JML long
+      case 0x22: // JSL long
+         return scan->num_operands >= 2 ? target : -1;
+      case 0x60: // RTS
+      case 0x6B: // RTL
+         return n >= 5 ? ((data[3] | (data[4] << 8)) + 1) & 0xffff : -1;
+      case 0x40: // RTI
+         return n >= 6 ? data[4] | (data[5] << 8) : -1;
+      case 0xDC: // JML [abs]
+         return n >= 5 ? data[3] | (data[4] << 8) : -1;
+      case 0x00: // BRK
+      case 0x02: // COP
+      case 0x6C: // JMP (abs)
+      case 0x7C: // JMP (abs,X)
+      case 0xFC: // JSR (abs,X)
+         return last;
+      case 0x82: // BRL
+         return relative(pc, 3, (int16_t) target);
+      case 0x80: // BRA
+         return relative(pc, 2, (int8_t) op[0]);
+      }
+      if ((opcode & 0x1f) == 0x10) {
+         // Conditional branches take extra cycles if taken
+         return relative(pc, 2, n > 2 ? (int8_t) op[0] : 0);
+      }
+      return relative(pc, 1 + scan->num_operands, 0);
+   }
+   switch (opcode) {
+   case 0x4C: // JMP abs
+      return data[1] | (data[2] << 8);
+   case 0x20: // JSR abs (the high byte is read last)
+      return n >= 6 ? data[1] | (data[5] << 8) : -1;
+   case 0x60: // RTS
+      return n >= 5 ? ((data[3] | (data[4] << 8)) + 1) & 0xffff : -1;
+   case 0x40: // RTI
+      return n >= 6 ? data[4] | (data[5] << 8) : -1;
+   case 0x00: // BRK
+   case 0x6C: // JMP (abs)
+      return last;
+   case 0x7C: // JMP (abs,X)
+      if (!scan->nmos) {
+         return last;
+      }
+      break;
+   case 0x80: // BRA
+      if (!scan->nmos) {
+         return relative(pc, 2, (int8_t) data[1]);
+      }
+      break;
+   }
+   if ((opcode & 0x1f) == 0x10) {
+      return relative(pc, 2, n > 2 ? (int8_t) data[1] : 0);
+   }
+   if (scan->bit_branch && (opcode & 0x0f) == 0x0f) {
+      return -1;
+   }
+   return relative(pc, scan->lengths[opcode], 0);
+}
+
+static void end_instruction(scan_t *scan) {
+   int n = scan->num_cycles;
+   if (scan->counted) {
+      scan->instructions++;
+      scan->cycles += n;
+      scan->by_cycles[n < SCAN_MAX_CYCLES ? n : SCAN_MAX_CYCLES]++;
+      scan->by_opcode[scan->data[0]]++;
+   }
+   if (scan->resetting || (scan->rnw_known && is_interrupt(scan))) {
+      if (scan->counted) {
+         if (scan->resetting) {
+            scan->resets++;
+         } else {
+            scan->interrupts++;
+         }
+      }
+      // The vector is read last
+      scan->pc = n >= 3 && n <= SCAN_MAX_CYCLES ? scan->data[n - 2] | (scan->data[n - 1] << 8) : -1;
+      scan->move_pc = -1;
+   } else {
+      if (scan->counted) {
+         if (scan->pc < 0) {
+            scan->pc_unknown++;
+         } else {
+            scan->by_page[scan->pc >> 8]++;
+         }
+      }
+      int opcode = scan->data[0];
+      scan->move_pc = scan->c816 && (opcode == 0x44 || opcode == 0x54) ? scan->pc : -1;
+      scan->pc = next_pc(scan);
+   }
+   scan->in_instr = 0;
+}
+
+static int in_chunk(const scan_t *scan, uint32_t sample_count) {
+   return sample_count > scan->start && (!scan->end || sample_count <= scan->end);
+}
+
+// Write the biggest entries of a histogram, largest first
+static void report_top(const uint64_t *counts, int num, uint64_t total, int page) {
+   char shown[256] = { 0 };
+   for (int n = 0; n < SCAN_TOP; n++) {
+      int best = -1;
+      for (int i = 0; i < num; i++) {
+         if (!shown[i] && counts[i] && (best < 0 || counts[i] > counts[best])) {
+            best = i;
+         }
+      }
+      if (best < 0) {
+         break;
+      }
+      shown[best] = 1;
+      if (page) {
+         output_printf("   %02X00-%02XFF : %12" PRIu64 " (%5.1f%%)\n", best, best, counts[best], 100.0 * counts[best] / total);
+      } else {
+         output_printf("   %02X : %12" PRIu64 " (%5.1f%%)\n", best, counts[best], 100.0 * counts[best] / total);
+      }
+   }
+}
+
+// Count a bus cycle, returning 1 once the chunk is complete
+static int scan_sample(scan_t *scan, bus_cycle_t bus, uint32_t sample_count) {
+   if (scan->done) {
+      return 1;
+   }
+   if (bus_type(bus) == LAST) {
+      if (scan->in_instr) {
+         end_instruction(scan);
+      }
+      scan->done = 1;
+      return 1;
+   }
+   if (bus_rnw(bus) >= 0) {
+      scan->rnw_known = 1;
+   }
+   if (bus_rst(bus) == 0) {
+      if (scan->in_instr) {
+         end_instruction(scan);
+      }
+      if (scan->end && sample_count > scan->end) {
+         scan->done = 1;
+         return 1;
+      }
+      scan->rst_known = 1;
+      scan->reset_seen = 1;
+      return 0;
+   }
+   if (bus_rst(bus) > 0) {
+      scan->rst_known = 1;
+   }
+   if (bus_type(bus) == OPCODE) {
+      if (scan->in_instr) {
+         end_instruction(scan);
+      }
+      if (scan->end && sample_count > scan->end) {
+         scan->done = 1;
+         return 1;
+      }
+      if (scan->move_pc >= 0 && bus_data(bus) == scan->data[0]) {
+         // Most likely the block move again, for the next byte
+         scan->pc = scan->move_pc;
+      }
+      scan->resetting = scan->reset_seen;
+      scan->reset_seen = 0;
+      scan->in_instr = 1;
+      scan->counted = in_chunk(scan, sample_count);
+      scan->num_cycles = 0;
+      scan->num_operands = 0;
+   } else if (!scan->in_instr) {
+      return 0;
+   } else if (bus_type(bus) == PROGRAM && scan->num_operands < (int) sizeof(scan->operands)) {
+      scan->operands[scan->num_operands++] = bus_data(bus);
+   }
+   if (scan->num_cycles < SCAN_MAX_CYCLES) {
+      scan->data[scan->num_cycles] = bus_data(bus);
+      scan->rnw[scan->num_cycles] = bus_rnw(bus);
+   }
+   scan->num_cycles++;
+   return 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+scan_t *scan_create(int cpu_type, const int *lengths, uint32_t start, uint32_t end) {
+   scan_t *scan = (scan_t *)calloc(1, sizeof(scan_t));
+   scan->c816 = cpu_type == CPU_65C816;
+   scan->nmos = cpu_type == CPU_6502 || cpu_type == CPU_6502_ARLET;
+   scan->bit_branch = cpu_type == CPU_65C02_ROCKWELL || cpu_type == CPU_65C02_WDC;
+   memcpy(scan->lengths, lengths, sizeof(scan->lengths));
+   scan->start = start;
+   scan->end = end;
+   scan->pc = -1;
+   scan->move_pc = -1;
+   return scan;
+}
+
+int scan_samples(scan_t *scan, const bus_window_t *batch, int num) {
+   for (int i = 0; i < num; i++) {
+      if (scan_sample(scan, batch->bus[i], batch->sample_count[i])) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+void scan_merge(scan_t *scan, const scan_t *next) {
+   scan->instructions += next->instructions;
+   scan->cycles += next->cycles;
+   scan->resets += next->resets;
+   scan->interrupts += next->interrupts;
+   scan->pc_unknown += next->pc_unknown;
+   for (int i = 0; i <= SCAN_MAX_CYCLES; i++) {
+      scan->by_cycles[i] += next->by_cycles[i];
+   }
+   for (int i = 0; i < 256; i++) {
+      scan->by_opcode[i] += next->by_opcode[i];
+      scan->by_page[i] += next->by_page[i];
+   }
+   scan->rst_known |= next->rst_known;
+   scan->rnw_known |= next->rnw_known;
+}
+
+void scan_report(const scan_t *scan) {
+   uint64_t total = scan->instructions ? scan->instructions : 1;
+   uint64_t known = scan->instructions - scan->interrupts - scan->resets - scan->pc_unknown;
+   output_printf("Structural scan (from the bus cycles alone, without emulation)\n");
+   output_printf("\nExact:\n");
+   output_printf("   opcode fetches     : %12" PRIu64 " (instructions, interrupts and resets)\n", scan->instructions);
+   output_printf("   bus cycles         : %12" PRIu64 " (not counting those with rst asserted)\n", scan->cycles);
+   output_printf("   cycles/instruction : %12.3f\n", (double) scan->cycles / total);
+   if (scan->rst_known) {
+      output_printf("   resets             : %12" PRIu64 "\n", scan->resets);
+   } else {
+      output_printf("   resets             :      unknown (rst is not connected)\n");
+   }
+   output_printf("\nApproximate (from the data bus, with no registers or memory):\n");
+   if (scan->rnw_known) {
+      output_printf("   interrupts         : %12" PRIu64 " (opcode fetches followed by stack writes)\n", scan->interrupts);
+   } else {
+      output_printf("   interrupts         :      unknown (rnw is not connected)\n");
+   }
+   output_printf("   program counter    : %12" PRIu64 " (%.1f%% of the instructions, followed from jumps, branches and returns)\n",
+                 known, 100.0 * known / total);
+   output_printf("\nCycles per instruction (exact):\n");
+   for (int i = 1; i <= SCAN_MAX_CYCLES; i++) {
+      if (scan->by_cycles[i]) {
+         output_printf("   %2d%s : %12" PRIu64 " (%5.1f%%)\n", i, i == SCAN_MAX_CYCLES ? "+" : " ", scan->by_cycles[i], 100.0 * scan->by_cycles[i] / total);
+      }
+   }
+   output_printf("\nMost frequent opcodes (exact, including those discarded by interrupts):\n");
+   report_top(scan->by_opcode, 256, total, 0);
+   output_printf("\nMost frequent code pages (approximate%s):\n", scan->c816 ? ", ignoring the bank" : "");
+   report_top(scan->by_page, 256, total, 1);
+}
+
+void scan_destroy(scan_t *scan) {
+   free(scan);
+}
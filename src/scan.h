@@ -0,0 +1,44 @@
+#ifndef _INCLUDE_SCAN_H
+#define _INCLUDE_SCAN_H
+
+#include <stdint.h>
+
+#include "defs.h"
+
+// Structural scan (--scan): a summary of a capture worked out from the bus
+// cycles alone, without emulating anything. Instructions are delimited by
+// the opcode fetches (sync, or vpa/vda on the 65C816), so the instruction
+// and cycle counts are exact. The flow of control is followed from the
+// opcodes and the targets on the data bus (jumps, branches, returns and
+// vectors), and interrupts are spotted by their stack writes, so the
+// program counter and the interrupt count are only approximate.
+//
+// A capture can be scanned as several chunks in parallel: each chunk
+// counts the instructions whose opcode fetch falls in its range of sample
+// numbers (and runs on to the end of the last), and the chunks are then
+// merged in order. The program counter isn't known at the start of each
+// chunk until the first jump, so fewer instructions are placed.
+
+// Cycles per instruction are counted individually up to this (and longer
+// instructions together)
+#define SCAN_MAX_CYCLES 16
+
+typedef struct scan scan_t;
+
+// lengths is the length of each opcode (only used for the 6502 family, as
+// the 65C816 marks its operands with vpa). The chunk is start < sample
+// number <= end, with an end of 0 for the end of the capture.
+scan_t *scan_create(int cpu_type, const int *lengths, uint32_t start, uint32_t end);
+
+// Count a batch of bus cycles, returning 1 once the chunk is complete
+int scan_samples(scan_t *scan, const bus_window_t *batch, int num);
+
+// Add the counts of the next chunk
+void scan_merge(scan_t *scan, const scan_t *next);
+
+// Write the summary to the output
+void scan_report(const scan_t *scan);
+
+void scan_destroy(scan_t *scan);
+
+#endif
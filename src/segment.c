@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "segment.h"
+#include "output.h"
+
+// The output of a segment, spilled to a temporary file as it's decoded,
+// and read back from it in order by the caller (so only the chunks being
+// filled and written out are held in memory, however far ahead the later
+// segments get)
+typedef struct {
+   segment_t        *segment;
+   context_t        *caller;
+   segment_setup_t   setup;
+   segment_decode_t  decode;
+   int               last;
+   context_t        *context;     // of the last segment, once decoded
+   pthread_t         thread;
+   pthread_mutex_t   lock;
+   pthread_cond_t    ready;
+   FILE             *file;
+   fpos_t            read_pos;    // of the next chunk to be read back
+   uint64_t          written;     // chunks written to the file
+   uint64_t          read;        // chunks read back from it
+   int               failed;      // the file couldn't be written
+   int               done;
+} queue_t;
+
+// The queue of the segment being decoded by this thread
+static __thread queue_t *current;
+
+// ====================================================================
+// Segment decoding
+// ====================================================================
+
+static void push_chunk(queue_t *queue, const output_chunk_t *chunk) {
+   pthread_mutex_lock(&queue->lock);
+   if (fseek(queue->file, 0, SEEK_END) ||
+       fwrite(&chunk->len, sizeof(chunk->len), 1, queue->file) != 1 ||
+       fwrite(&chunk->num_profile, sizeof(chunk->num_profile), 1, queue->file) != 1 ||
+       fwrite(chunk->text, 1, chunk->len, queue->file) != chunk->len ||
+       fwrite(chunk->profile, sizeof(output_profile_t), chunk->num_profile, queue->file) != (size_t) chunk->num_profile ||
+       fflush(queue->file)) {
+      queue->failed = 1;
+   } else {
+      queue->written++;
+      pthread_cond_signal(&queue->ready);
+   }
+   pthread_mutex_unlock(&queue->lock);
+}
+
+static void finish_queue(queue_t *queue) {
+   pthread_mutex_lock(&queue->lock);
+   queue->done = 1;
+   pthread_cond_signal(&queue->ready);
+   pthread_mutex_unlock(&queue->lock);
+}
+
+// Write out the full chunk, then reuse it
+static output_chunk_t *segment_handoff(output_chunk_t *chunk) {
+   push_chunk(current, chunk);
+   return chunk;
+}
+
+static void run_segment(queue_t *queue) {
+   current = queue;
+   output_chunk_t *chunk = (output_chunk_t *)malloc(sizeof(output_chunk_t));
+   if (!chunk) {
+      queue->segment->status = 1;
+      return;
+   }
+   output_divert(segment_handoff, chunk);
+   queue->decode(queue->segment);
+   push_chunk(queue, output_restore());
+   free(chunk);
+}
+
+static void *segment_main(void *arg) {
+   queue_t *queue = (queue_t *)arg;
+   if (queue->setup(&queue->caller->arguments)) {
+      run_segment(queue);
+      // The state at the end of the capture is passed on to the caller
+      if (queue->last) {
+         queue->context = context;
+      } else {
+         context_destroy(context);
+      }
+   } else {
+      queue->segment->status = 1;
+   }
+   finish_queue(queue);
+   return NULL;
+}
+
+// ====================================================================
+// Output stitching
+// ====================================================================
+
+// Read back the next chunk of the output of a segment, waiting for it to
+// be written. Returns 0 at the end, or -1 if it can't be read.
+static int pop_chunk(queue_t *queue, output_chunk_t *chunk) {
+   int result = 1;
+   pthread_mutex_lock(&queue->lock);
+   while (queue->read == queue->written && !queue->done && !queue->failed) {
+      pthread_cond_wait(&queue->ready, &queue->lock);
+   }
+   if (queue->failed) {
+      result = -1;
+   } else if (queue->read == queue->written) {
+      result = 0;
+   } else if (fsetpos(queue->file, &queue->read_pos) ||
+              fread(&chunk->len, sizeof(chunk->len), 1, queue->file) != 1 ||
+              fread(&chunk->num_profile, sizeof(chunk->num_profile), 1, queue->file) != 1 ||
+              chunk->len > OUTPUT_CHUNK_SIZE || chunk->num_profile < 0 || chunk->num_profile > OUTPUT_CHUNK_PROFILE ||
+              fread(chunk->text, 1, chunk->len, queue->file) != chunk->len ||
+              fread(chunk->profile, sizeof(output_profile_t), chunk->num_profile, queue->file) != (size_t) chunk->num_profile ||
+              fgetpos(queue->file, &queue->read_pos)) {
+      result = -1;
+   } else {
+      queue->read++;
+   }
+   pthread_mutex_unlock(&queue->lock);
+   return result;
+}
+
+// Write out the output of a segment as it's decoded, returning non-zero
+// if it failed
+static int stitch_output(queue_t *queue, output_chunk_t *chunk) {
+   int result;
+   while ((result = pop_chunk(queue, chunk)) > 0) {
+      output_replay(chunk);
+   }
+   return result < 0 || queue->segment->status != 0;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+segment_t *segment_create(int num) {
+   return (segment_t *)calloc(num, sizeof(segment_t));
+}
+
+int segment_run(segment_t *segments, int num, segment_setup_t setup, segment_decode_t decode) {
+   if (num < 1) {
+      return 0;
+   }
+   queue_t *queues = (queue_t *)calloc(num, sizeof(queue_t));
+   output_chunk_t *chunk = (output_chunk_t *)malloc(sizeof(output_chunk_t));
+   if (!queues || !chunk) {
+      perror("failed to allocate segment output");
+      free(queues);
+      free(chunk);
+      return num;
+   }
+   for (int i = 0; i < num; i++) {
+      queue_t *queue = queues + i;
+      queue->file = tmpfile();
+      if (!queue->file || fgetpos(queue->file, &queue->read_pos)) {
+         perror("failed to create segment file");
+         for (int j = 0; j <= i; j++) {
+            if (queues[j].file) {
+               fclose(queues[j].file);
+            }
+         }
+         free(queues);
+         free(chunk);
+         return num;
+      }
+      queue->segment = segments + i;
+      queue->caller = context;
+      queue->setup = setup;
+      queue->decode = decode;
+      pthread_mutex_init(&queue->lock, NULL);
+      pthread_cond_init(&queue->ready, NULL);
+      queue->last = i == num - 1;
+      segments[i].status = 0;
+   }
+   for (int i = 0; i < num; i++) {
+      if (pthread_create(&queues[i].thread, NULL, segment_main, queues + i) != 0) {
+         perror("failed to create segment decoder thread");
+         exit(1);
+      }
+   }
+   // Write out the output in order, while the later segments are decoded
+   int failed = 0;
+   chunk->num_lines = 0;
+   chunk->formatted = 0;
+   for (int i = 0; i < num; i++) {
+      if (stitch_output(queues + i, chunk)) {
+         fprintf(stderr, "segment %d failed to decode\n", i);
+         failed++;
+      }
+      pthread_join(queues[i].thread, NULL);
+      // The output of a segment is discarded once it's written out
+      fclose(queues[i].file);
+   }
+   free(chunk);
+   // The caller ends up with the final emulator and memory state (as used
+   // by the profiler output)
+   if (queues[num - 1].context) {
+      context_take_state(queues[num - 1].context);
+      context_destroy(queues[num - 1].context);
+   }
+   for (int i = 0; i < num; i++) {
+      pthread_mutex_destroy(&queues[i].lock);
+      pthread_cond_destroy(&queues[i].ready);
+   }
+   free(queues);
+   return failed;
+}
+
+void segment_report(segment_t *segments, int num) {
+   for (int i = 0; i < num; i++) {
+      segment_t *segment = segments + i;
+      fprintf(stderr, "segment %2d: first instruction at %08x; %10" PRIu64 " instructions; %8" PRIu64 " prediction failures; ",
+              i, segment->first, segment->instructions, segment->fails);
+      if (segment->lock) {
+         fprintf(stderr, "state locked at %08x after %" PRIu64 " instructions\n", segment->lock, segment->lock_instructions);
+      } else {
+         fprintf(stderr, "state never locked\n");
+      }
+   }
+}
+
+void segment_destroy(segment_t *segments) {
+   free(segments);
+}
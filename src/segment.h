@@ -0,0 +1,58 @@
+#ifndef _INCLUDE_SEGMENT_H
+#define _INCLUDE_SEGMENT_H
+
+#include <inttypes.h>
+
+#include "context.h"
+
+// Segmented decode: the capture is split into segments, which are
+// decoded concurrently on threads of their own, each in its own context,
+// and each starting from an unknown state as it would after reset.
+//
+// A segment boundary is a clean point in the bus cycle stream: the first
+// opcode fetch (or cycle with RST asserted) after a nominal sample number.
+// Both segments either side of a boundary find the same bus cycle, so
+// the instructions are split exactly between them.
+//
+// The output of each segment (text and profiled instructions) is spilled
+// to a temporary file, and written out in order by the calling thread as
+// it's decoded, so the profiler sees one continuous stream. The caller then takes over the
+// emulator state of the last segment (though memory only written by the
+// earlier segments will be unknown).
+
+#define MAX_SEGMENTS 64
+
+typedef struct {
+   // Filled in by the caller
+   uint32_t start;              // nominal start sample number (0 = the beginning)
+   uint32_t end;                // nominal end sample number (0 = the end)
+   // Filled in by the decoder
+   int      status;             // 0 if the segment was decoded successfully
+   uint32_t first;              // sample number of the first instruction decoded
+   uint32_t lock;               // sample number at which the state was fully known (0 = never)
+   uint64_t lock_instructions;  // instructions decoded before the state was fully known
+   uint64_t instructions;
+   uint64_t fails;              // instructions where the prediction failed
+} segment_t;
+
+// Creates and sets the context for a segment, configured with the caller's
+// arguments, on the segment's thread (returns NULL on failure)
+typedef context_t *(*segment_setup_t)(const arguments_t *args);
+
+typedef void (*segment_decode_t)(segment_t *segment);
+
+// Allocate a table of num segments
+segment_t *segment_create(int num);
+
+// Decode the segments concurrently, writing out their output in order
+//
+// setup is called on the thread of each segment, and decode is then called
+// with output already diverted. Returns the number of segments that failed.
+int segment_run(segment_t *segments, int num, segment_setup_t setup, segment_decode_t decode);
+
+// Write a summary of the segments (boundaries and state lock) to stderr
+void segment_report(segment_t *segments, int num);
+
+void segment_destroy(segment_t *segments);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sink.h"
+#include "ring.h"
+
+// Number of buffers with a writer thread (a power of 2)
+#define SINK_BUFFERS 2
+
+typedef struct {
+   char   *data;
+   size_t  len;
+} buffer_t;
+
+struct sink {
+   FILE      *stream;    // NULL when writing directly to fd
+   int        fd;
+   int        failed;
+   buffer_t   buffers[SINK_BUFFERS];
+   // The buffer being filled
+   buffer_t  *current;
+
+   // With a writer thread, full buffers are passed to it, and returned
+   // once written
+   int        async;
+   pthread_t  thread;
+   ring_t    *full;
+   ring_t    *free;
+
+   // Updated by whichever thread writes
+   uint64_t   bytes;
+   uint64_t   writes;
+   uint64_t   write_ns;
+   uint64_t   max_write_ns;
+
+   // Time spent waiting for a buffer to be written
+   uint64_t   wait_ns;
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static uint64_t now_ns() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_buffer(sink_t *sink, buffer_t *buffer) {
+   if (buffer->len == 0) {
+      return;
+   }
+   uint64_t start = now_ns();
+   if (sink->stream) {
+      if (fwrite(buffer->data, 1, buffer->len, sink->stream) != buffer->len) {
+         sink->failed = 1;
+      }
+   } else {
+      const char *p = buffer->data;
+      size_t left = buffer->len;
+      while (left > 0) {
+         ssize_t n = write(sink->fd, p, left);
+         if (n < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+            sink->failed = 1;
+            break;
+         }
+         p += n;
+         left -= n;
+      }
+   }
+   uint64_t ns = now_ns() - start;
+   sink->bytes += buffer->len;
+   sink->writes++;
+   sink->write_ns += ns;
+   if (ns > sink->max_write_ns) {
+      sink->max_write_ns = ns;
+   }
+   buffer->len = 0;
+}
+
+static void *writer_main(void *arg) {
+   sink_t *sink = (sink_t *)arg;
+   buffer_t *buffer;
+   while ((buffer = (buffer_t *)ring_pop(sink->full)) != NULL) {
+      write_buffer(sink, buffer);
+      ring_push(sink->free, buffer);
+   }
+   return NULL;
+}
+
+// Pass on the full current buffer, and continue with an empty one
+static void next_buffer(sink_t *sink) {
+   if (!sink->async) {
+      write_buffer(sink, sink->current);
+      return;
+   }
+   ring_push(sink->full, sink->current);
+   uint64_t start = now_ns();
+   sink->current = (buffer_t *)ring_pop(sink->free);
+   sink->wait_ns += now_ns() - start;
+}
+
+static sink_t *create_sink(FILE *stream, int fd, int async) {
+   sink_t *sink = (sink_t *)calloc(1, sizeof(sink_t));
+   sink->stream = stream;
+   sink->fd = fd;
+   sink->async = async;
+   for (int i = 0; i < (async ? SINK_BUFFERS : 1); i++) {
+      sink->buffers[i].data = (char *)malloc(SINK_BUFFER);
+   }
+   sink->current = sink->buffers;
+   if (async) {
+      sink->full = ring_create(SINK_BUFFERS);
+      sink->free = ring_create(SINK_BUFFERS);
+      for (int i = 1; i < SINK_BUFFERS; i++) {
+         ring_push(sink->free, sink->buffers + i);
+      }
+      if (pthread_create(&sink->thread, NULL, writer_main, sink) != 0) {
+         perror("failed to create output thread");
+         exit(1);
+      }
+   }
+   return sink;
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+sink_t *sink_create_stream(FILE *stream, int async) {
+   return create_sink(stream, -1, async);
+}
+
+sink_t *sink_create_file(const char *filename, int async) {
+   int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0) {
+      return NULL;
+   }
+   return create_sink(NULL, fd, async);
+}
+
+void sink_write(sink_t *sink, const char *data, size_t len) {
+   while (len > 0) {
+      buffer_t *buffer = sink->current;
+      size_t space = SINK_BUFFER - buffer->len;
+      if (space == 0) {
+         next_buffer(sink);
+         continue;
+      }
+      size_t n = len < space ? len : space;
+      memcpy(buffer->data + buffer->len, data, n);
+      buffer->len += n;
+      data += n;
+      len -= n;
+   }
+}
+
+int sink_vprintf(sink_t *sink, const char *fmt, va_list ap) {
+   va_list copy;
+   va_copy(copy, ap);
+   buffer_t *buffer = sink->current;
+   size_t space = SINK_BUFFER - buffer->len;
+   int n = vsnprintf(buffer->data + buffer->len, space, fmt, ap);
+   if (n >= 0 && (size_t) n < space) {
+      // The normal case: formatted directly into the buffer
+      buffer->len += n;
+   } else if (n > 0) {
+      // Didn't fit, so format again into a temporary buffer
+      char *text = (char *)malloc(n + 1);
+      vsnprintf(text, n + 1, fmt, copy);
+      sink_write(sink, text, n);
+      free(text);
+   }
+   va_end(copy);
+   return n;
+}
+
+int sink_printf(sink_t *sink, const char *fmt, ...) {
+   va_list ap;
+   va_start(ap, fmt);
+   int n = sink_vprintf(sink, fmt, ap);
+   va_end(ap);
+   return n;
+}
+
+void sink_putc(sink_t *sink, int c) {
+   buffer_t *buffer = sink->current;
+   if (buffer->len == SINK_BUFFER) {
+      next_buffer(sink);
+      buffer = sink->current;
+   }
+   buffer->data[buffer->len++] = c;
+}
+
+int sink_flush(sink_t *sink) {
+   if (sink->async) {
+      // Pass on the current buffer, then wait for all of them to come back
+      buffer_t *buffers[SINK_BUFFERS];
+      ring_push(sink->full, sink->current);
+      uint64_t start = now_ns();
+      for (int i = 0; i < SINK_BUFFERS; i++) {
+         buffers[i] = (buffer_t *)ring_pop(sink->free);
+      }
+      sink->wait_ns += now_ns() - start;
+      for (int i = 1; i < SINK_BUFFERS; i++) {
+         ring_push(sink->free, buffers[i]);
+      }
+      sink->current = buffers[0];
+   } else {
+      write_buffer(sink, sink->current);
+   }
+   if (sink->stream && fflush(sink->stream)) {
+      sink->failed = 1;
+   }
+   return sink->failed;
+}
+
+void sink_print_stats(sink_t *sink) {
+   double ms = 1e-6;
+   fprintf(stderr, "output          : %10" PRIu64 " bytes; %6" PRIu64 " writes; write %9.3f ms (max %8.3f ms); waited %9.3f ms\n",
+           sink->bytes, sink->writes, sink->write_ns * ms, sink->max_write_ns * ms, sink->wait_ns * ms);
+}
+
+int sink_close(sink_t *sink) {
+   int failed = sink_flush(sink);
+   if (sink->async) {
+      ring_push(sink->full, NULL);
+      pthread_join(sink->thread, NULL);
+      ring_destroy(sink->full);
+      ring_destroy(sink->free);
+   }
+   if (!sink->stream && close(sink->fd)) {
+      failed = 1;
+   }
+   for (int i = 0; i < SINK_BUFFERS; i++) {
+      free(sink->buffers[i].data);
+   }
+   free(sink);
+   return failed;
+}
@@ -0,0 +1,47 @@
+#ifndef _INCLUDE_SINK_H
+#define _INCLUDE_SINK_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+// Where the text output finally goes: either a stdio stream, or a file
+// written directly (bypassing stdio).
+//
+// The text is collected in a large buffer, which is written out in one go
+// when full. With a writer thread, the sink is double buffered: one buffer
+// is filled while the other is written, so the decoder only waits for the
+// output when it gets a whole buffer ahead (e.g. of a slow pipe).
+
+// Size of each buffer
+#define SINK_BUFFER (4 << 20)
+
+typedef struct sink sink_t;
+
+// Create a sink writing to a stream (which is left open when it's closed)
+sink_t *sink_create_stream(FILE *stream, int async);
+
+// Create a sink writing directly to a file, returning NULL if it can't be
+// created
+sink_t *sink_create_file(const char *filename, int async);
+
+void sink_write(sink_t *sink, const char *data, size_t len);
+
+int sink_printf(sink_t *sink, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+int sink_vprintf(sink_t *sink, const char *fmt, va_list ap);
+
+void sink_putc(sink_t *sink, int c);
+
+// Write out everything buffered, waiting until it's been written; returns
+// non-zero if any write has failed
+int sink_flush(sink_t *sink);
+
+// Write the byte count, flush latency, and the time spent waiting for the
+// writer to stderr (with the pipeline statistics)
+void sink_print_stats(sink_t *sink);
+
+// Flush, and close the sink; returns non-zero if any write has failed
+int sink_close(sink_t *sink);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "defs.h"
 #include "symbols.h"
+#include "context.h"
 
 typedef enum {
    SWS_GROUND,
@@ -17,24 +18,42 @@ typedef enum {
    SWS_AWAIT_COMMA
 } swstate;
 
-// Being very lazy here using an array!
-static char **symbol_table = NULL;
-
-static int max_address = -1;
+struct symbols_state {
+   // Being very lazy here using an array!
+   char **symbol_table;
+   int max_address;
+};
 
 void symbol_init(int size) {
-   symbol_table = (char **)malloc(size * sizeof(char *));
+   symbol_destroy();
+   struct symbols_state *symbols = (struct symbols_state *)malloc(sizeof(struct symbols_state));
+   symbols->symbol_table = (char **)malloc(size * sizeof(char *));
    for (int i = 0; i < size;i++) {
-      symbol_table[i] = NULL;
+      symbols->symbol_table[i] = NULL;
+   }
+   symbols->max_address = size - 1;
+   context->symbols = symbols;
+}
+
+void symbol_destroy() {
+   struct symbols_state *symbols = context->symbols;
+   if (symbols) {
+      for (int i = 0; i <= symbols->max_address; i++) {
+         free(symbols->symbol_table[i]);
+      }
+      free(symbols->symbol_table);
+      free(symbols);
+      context->symbols = NULL;
    }
-   max_address = size - 1;
 }
 
 void symbol_add(char *name, int address) {
-   if (address >= 0 && address <= max_address) {
+   struct symbols_state *symbols = context->symbols;
+   if (address >= 0 && address <= symbols->max_address) {
       char *copy = (char *)malloc(strlen(name)+1);
       strcpy(copy, name);
-      symbol_table[address] = copy;
+      free(symbols->symbol_table[address]);
+      symbols->symbol_table[address] = copy;
    } else {
       // This case should never happen
       fprintf(stderr, "symbol %s:%04x out of range\r\n", name, address);
@@ -43,13 +62,26 @@ void symbol_add(char *name, int address) {
 }
 
 char *symbol_lookup(int address) {
-   if (address >= 0 && address <= max_address) {
-      return symbol_table[address];
+   struct symbols_state *symbols = context->symbols;
+   if (symbols && address >= 0 && address <= symbols->max_address) {
+      return symbols->symbol_table[address];
    } else {
       return NULL;
    }
 }
 
+int symbol_find(const char *name) {
+   struct symbols_state *symbols = context->symbols;
+   if (symbols) {
+      for (int i = 0; i <= symbols->max_address; i++) {
+         if (symbols->symbol_table[i] && !strcmp(symbols->symbol_table[i], name)) {
+            return i;
+         }
+      }
+   }
+   return -1;
+}
+
 void symbol_import_swift(char *filename)
 {
    FILE *fp = fopen(filename, "r");
@@ -4,10 +4,15 @@
 
 void symbol_init(int size);
 
+void symbol_destroy();
+
 void symbol_add(char *name, int address);
 
 char *symbol_lookup(int address);
 
+// Returns the (lowest) address of a symbol, or -1 if there's none of that name
+int symbol_find(const char *name);
+
 void symbol_import_swift(char *filename);
 
 #endif
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "defs.h"
+#include "memory.h"
+
+#define TRACE_MAGIC "D6502TRC"
+
+// Size of the read/write buffer
+#define TRACE_BUFFER 0x100000
+
+// Longest instruction record
+#define TRACE_MAX_RECORD (sizeof(trace_instr_t) + MAX_EM_STATE * sizeof(int32_t))
+
+typedef struct {
+   char     magic[8];
+   uint32_t version;
+   uint32_t flags;
+   uint32_t num_state;
+   uint32_t argc;
+   // Followed by each argument, as a uint32_t length then the characters
+} trace_header_t;
+
+struct trace {
+   FILE          *file;
+   int            reading;
+   int            failed;
+   trace_header_t header;
+   char         **argv;
+   // Buffered records
+   uint8_t       *buffer;
+   size_t         size;
+   uint8_t       *ptr;
+   uint8_t       *end;
+};
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+static void flush_buffer(trace_t *trace) {
+   size_t len = trace->ptr - trace->buffer;
+   if (fwrite(trace->buffer, 1, len, trace->file) != len) {
+      trace->failed = 1;
+   }
+   trace->ptr = trace->buffer;
+}
+
+// Make the next len bytes available in the buffer, returns NULL at the end of the file
+static const uint8_t *take(trace_t *trace, size_t len) {
+   size_t have = trace->end - trace->ptr;
+   if (have < len) {
+      // Only a long text record needs more than the normal buffer
+      if (len > trace->size) {
+         size_t offset = trace->ptr - trace->buffer;
+         trace->size = len;
+         trace->buffer = (uint8_t *)realloc(trace->buffer, trace->size);
+         trace->ptr = trace->buffer + offset;
+      }
+      memmove(trace->buffer, trace->ptr, have);
+      have += fread(trace->buffer + have, 1, trace->size - have, trace->file);
+      trace->ptr = trace->buffer;
+      trace->end = trace->buffer + have;
+      if (have < len) {
+         return NULL;
+      }
+   }
+   const uint8_t *p = trace->ptr;
+   trace->ptr += len;
+   return p;
+}
+
+static void free_trace(trace_t *trace) {
+   if (trace->argv) {
+      for (uint32_t i = 0; i < trace->header.argc; i++) {
+         free(trace->argv[i]);
+      }
+      free(trace->argv);
+   }
+   free(trace->buffer);
+   free(trace);
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+trace_t *trace_create(const char *filename, int argc, char *argv[], int num_state, int flags) {
+   FILE *fp = fopen(filename, "wb");
+   if (!fp) {
+      return NULL;
+   }
+   trace_t *trace = (trace_t *)calloc(1, sizeof(trace_t));
+   memcpy(trace->header.magic, TRACE_MAGIC, sizeof(trace->header.magic));
+   trace->header.version   = TRACE_VERSION;
+   trace->header.flags     = flags;
+   trace->header.num_state = num_state;
+   trace->header.argc      = argc;
+   trace->file = fp;
+   trace->size = TRACE_BUFFER;
+   trace->buffer = (uint8_t *)malloc(trace->size);
+   trace->ptr = trace->buffer;
+   trace->end = trace->buffer + trace->size;
+   if (fwrite(&trace->header, sizeof(trace->header), 1, fp) != 1) {
+      trace->failed = 1;
+   }
+   for (int i = 0; i < argc; i++) {
+      uint32_t len = strlen(argv[i]);
+      if (fwrite(&len, sizeof(len), 1, fp) != 1 || fwrite(argv[i], 1, len, fp) != len) {
+         trace->failed = 1;
+      }
+   }
+   return trace;
+}
+
+void trace_write_instr(trace_t *trace, const trace_instr_t *instr, const int *state) {
+   if ((size_t) (trace->end - trace->ptr) < TRACE_MAX_RECORD) {
+      flush_buffer(trace);
+   }
+   memcpy(trace->ptr, instr, sizeof(trace_instr_t));
+   trace->ptr += sizeof(trace_instr_t);
+   if (instr->flags & TRACE_STATE) {
+      // Records are not aligned (text records are any length)
+      int32_t regs[MAX_EM_STATE];
+      for (uint32_t i = 0; i < trace->header.num_state; i++) {
+         regs[i] = state[i];
+      }
+      memcpy(trace->ptr, regs, trace->header.num_state * sizeof(int32_t));
+      trace->ptr += trace->header.num_state * sizeof(int32_t);
+   }
+}
+
+void trace_write_text(trace_t *trace, const char *text, size_t len) {
+   trace_text_t rec = { .type = TRACE_TEXT, .len = len };
+   if ((size_t) (trace->end - trace->ptr) < sizeof(rec) + len) {
+      flush_buffer(trace);
+   }
+   memcpy(trace->ptr, &rec, sizeof(rec));
+   trace->ptr += sizeof(rec);
+   if (len > (size_t) (trace->end - trace->ptr)) {
+      // Too long to buffer
+      flush_buffer(trace);
+      if (fwrite(text, 1, len, trace->file) != len) {
+         trace->failed = 1;
+      }
+   } else {
+      memcpy(trace->ptr, text, len);
+      trace->ptr += len;
+   }
+}
+
+void trace_write_memory(trace_t *trace) {
+   trace_text_t rec = { .type = TRACE_MEMORY, .len = 0 };
+   if ((size_t) (trace->end - trace->ptr) < sizeof(rec)) {
+      flush_buffer(trace);
+   }
+   memcpy(trace->ptr, &rec, sizeof(rec));
+   trace->ptr += sizeof(rec);
+   flush_buffer(trace);
+   if (memory_save(trace->file, 1)) {
+      trace->failed = 1;
+   }
+}
+
+trace_t *trace_open(const char *filename) {
+   FILE *fp = fopen(filename, "rb");
+   if (!fp) {
+      perror(filename);
+      return NULL;
+   }
+   trace_t *trace = (trace_t *)calloc(1, sizeof(trace_t));
+   trace->file = fp;
+   trace->reading = 1;
+   trace_header_t *header = &trace->header;
+   if (fread(header, sizeof(*header), 1, fp) != 1 ||
+       memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) ||
+       header->version != TRACE_VERSION ||
+       header->num_state > MAX_EM_STATE ||
+       header->argc > TRACE_MAX_ARGS) {
+      fprintf(stderr, "%s: not a trace file (or an incompatible version)\n", filename);
+      fclose(fp);
+      header->argc = 0;
+      free_trace(trace);
+      return NULL;
+   }
+   trace->argv = (char **)calloc(header->argc + 1, sizeof(char *));
+   for (uint32_t i = 0; i < header->argc; i++) {
+      uint32_t len;
+      if (fread(&len, sizeof(len), 1, fp) != 1 || len > 0x10000) {
+         trace->failed = 1;
+         break;
+      }
+      trace->argv[i] = (char *)calloc(len + 1, 1);
+      if (fread(trace->argv[i], 1, len, fp) != len) {
+         trace->failed = 1;
+         break;
+      }
+   }
+   if (trace->failed) {
+      fprintf(stderr, "%s: truncated trace file\n", filename);
+      fclose(fp);
+      free_trace(trace);
+      return NULL;
+   }
+   trace->size = TRACE_BUFFER;
+   trace->buffer = (uint8_t *)malloc(trace->size);
+   trace->ptr = trace->buffer;
+   trace->end = trace->buffer;
+   return trace;
+}
+
+int trace_get_args(trace_t *trace, char ***argv) {
+   *argv = trace->argv;
+   return trace->header.argc;
+}
+
+int trace_get_num_state(trace_t *trace) {
+   return trace->header.num_state;
+}
+
+int trace_get_flags(trace_t *trace) {
+   return trace->header.flags;
+}
+
+int trace_read(trace_t *trace, trace_instr_t *instr, int *state, const char **text, size_t *len) {
+   const uint8_t *p = take(trace, 1);
+   if (!p) {
+      return 0;
+   }
+   // Back up, to take the whole record
+   trace->ptr--;
+   if (*p == TRACE_INSTRUCTION) {
+      if (!(p = take(trace, sizeof(trace_instr_t)))) {
+         trace->failed = 1;
+         return 0;
+      }
+      memcpy(instr, p, sizeof(trace_instr_t));
+      if (instr->flags & TRACE_STATE) {
+         if (!(p = take(trace, trace->header.num_state * sizeof(int32_t)))) {
+            trace->failed = 1;
+            return 0;
+         }
+         int32_t regs[MAX_EM_STATE];
+         memcpy(regs, p, trace->header.num_state * sizeof(int32_t));
+         for (uint32_t i = 0; i < trace->header.num_state; i++) {
+            state[i] = regs[i];
+         }
+      }
+      return TRACE_INSTRUCTION;
+   } else if (*p == TRACE_TEXT) {
+      trace_text_t rec;
+      if (!(p = take(trace, sizeof(rec)))) {
+         trace->failed = 1;
+         return 0;
+      }
+      memcpy(&rec, p, sizeof(rec));
+      if (!(p = take(trace, rec.len))) {
+         trace->failed = 1;
+         return 0;
+      }
+      *text = (const char *)p;
+      *len = rec.len;
+      return TRACE_TEXT;
+   } else if (*p == TRACE_MEMORY) {
+      if (!take(trace, sizeof(trace_text_t))) {
+         trace->failed = 1;
+         return 0;
+      }
+      // The memory follows, and is read directly from the file
+      fseek(trace->file, -(long) (trace->end - trace->ptr), SEEK_CUR);
+      trace->ptr = trace->end;
+      if (memory_restore(trace->file)) {
+         trace->failed = 1;
+         return 0;
+      }
+      return TRACE_MEMORY;
+   }
+   trace->failed = 1;
+   return 0;
+}
+
+int trace_close(trace_t *trace) {
+   if (!trace->reading) {
+      flush_buffer(trace);
+   }
+   int failed = trace->failed;
+   if (fclose(trace->file)) {
+      failed = 1;
+   }
+   free_trace(trace);
+   return failed;
+}
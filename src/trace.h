@@ -0,0 +1,112 @@
+#ifndef _INCLUDE_TRACE_H
+#define _INCLUDE_TRACE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Binary instruction trace: written by --trace_out in place of the text
+// output, and rendered back to exactly the same text by render6502.
+//
+// The header holds the command line of the decode, so the renderer can
+// configure its decoder the same way. It's followed by a stream of:
+//   - an instruction record (trace_instr_t), one per instruction, which
+//     when TRACE_STATE is set is followed by the registers afterwards
+//     (num_state int32s, as the emulator's save_state)
+//   - a text record (trace_text_t) followed by len bytes of text, for
+//     any other output (memory logging, prediction failures, etc), in
+//     its place in the output
+//   - finally, a memory record (a trace_text_t with a len of 0) followed
+//     by the memory model at the end (as memory_save), which the
+//     profilers read when writing their results
+//
+// The registers are recorded when the output shows them (for every
+// instruction with --state, otherwise just those that failed).
+//
+// When the instruction lines need the memory model (--showromno and
+// --bbcfwa), the lines are written as text records instead, and the
+// renderer then only uses the instruction records for profiling.
+
+#define TRACE_VERSION 3
+
+// Record types
+#define TRACE_INSTRUCTION 1
+#define TRACE_TEXT        2
+#define TRACE_MEMORY      3
+
+// Instruction record flags
+#define TRACE_FAIL      1   // prediction failed
+#define TRACE_TRIGGERED 2   // between the start and stop triggers
+#define TRACE_SKIPPING  4   // within an interrupt (with the trigger skipint option)
+#define TRACE_STATE     8   // the registers follow
+
+// Header flags
+#define TRACE_TEXT_LINES 1  // instruction lines are written as text records
+#define TRACE_ALL_STATE  2  // every instruction has the registers (--state)
+
+// Most arguments in the header
+#define TRACE_MAX_ARGS 256
+
+typedef struct {
+   uint8_t  type;
+   uint8_t  flags;
+   uint8_t  kind;          // STEP_INTERRUPT and/or STEP_RESET
+   uint8_t  opcode;
+   uint8_t  op1;
+   uint8_t  op2;
+   uint8_t  op3;
+   uint8_t  opcount;
+   uint8_t  num_cycles;
+   int8_t   user;          // value of the user signal at the last bus cycle (-1 indicates unknown)
+   int16_t  pb;            // -1 indicates unknown
+   int32_t  pc;            // -1 indicates unknown
+   int32_t  ea;            // -1 indicates none (or unknown)
+   uint32_t sample_count;  // of the first bus cycle
+   uint32_t cycle_count;
+   uint32_t real_cycles;   // including any where RDY was low
+} trace_instr_t;
+
+typedef struct {
+   uint8_t  type;
+   uint8_t  reserved[3];
+   uint32_t len;
+} trace_text_t;
+
+typedef struct trace trace_t;
+
+// Create a trace, recording the command line of the decode
+//
+// Returns NULL if the file can't be created
+trace_t *trace_create(const char *filename, int argc, char *argv[], int num_state, int flags);
+
+void trace_write_instr(trace_t *trace, const trace_instr_t *instr, const int *state);
+
+void trace_write_text(trace_t *trace, const char *text, size_t len);
+
+// Write the memory model of the current context (at the end of the trace)
+void trace_write_memory(trace_t *trace);
+
+// Open a trace for reading, returning NULL (with a message on stderr) if
+// it's not a trace
+trace_t *trace_open(const char *filename);
+
+// The command line of the decode, and the header fields
+int trace_get_args(trace_t *trace, char ***argv);
+
+int trace_get_num_state(trace_t *trace);
+
+int trace_get_flags(trace_t *trace);
+
+// Read the next record, returning its type (or 0 at the end)
+//
+// For an instruction, fills in instr and state (which must hold at least
+// MAX_EM_STATE ints), and for text, text and len (valid until the next
+// call). The memory record is restored into the memory model of the
+// current context.
+int trace_read(trace_t *trace, trace_instr_t *instr, int *state, const char **text, size_t *len);
+
+// Close the trace
+//
+// Returns non-zero if the trace could not be read or written
+int trace_close(trace_t *trace);
+
+#endif
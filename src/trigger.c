@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "trigger.h"
+#include "memory.h"
+#include "symbols.h"
+
+#define MAX_RULES  (MAX_TRIGGER_RULES + 1)   // the --on rules, plus the filter
+#define MAX_CODE   512
+#define MAX_STACK  16
+#define MAX_NTH    32
+#define MAX_FIELDS 32
+
+typedef enum {
+   OP_CONST,        // push a
+   OP_PC,
+   OP_PB,
+   OP_OPCODE,
+   OP_USER,
+   OP_CYCLE,
+   OP_INSTR,
+   OP_REG,          // push the register shown in field a
+   OP_READ,         // push 1 if a read of a..b (with data c, if not -1)
+   OP_WRITE,        // push 1 if a write of a..b (likewise)
+   OP_EQ,           // replace the top two with the comparison
+   OP_NE,
+   OP_LT,
+   OP_LE,
+   OP_GT,
+   OP_GE,
+   OP_IN,           // replace the top with 1 if it's in a..b
+   OP_OUT,          // replace the top with 1 if it's not in a..b
+   OP_NOT,
+   OP_JUMP_FALSE,   // jump to a if the top is false (keeping it), else pop it
+   OP_JUMP_TRUE,    // jump to a if the top is true (keeping it), else pop it
+   OP_NTH,          // replace the top with 1 the a'th time it's true (counter b)
+   OP_END
+} op_type_t;
+
+typedef struct {
+   uint8_t op;
+   int32_t a;
+   int32_t b;
+   int32_t c;
+} op_t;
+
+typedef struct {
+   trigger_action_t action;
+   int              start;   // of the code
+} rule_t;
+
+// A field of the state, and the registers shown in it (e.g. the 65C816
+// accumulator is shown as one field, from the B and A registers)
+typedef struct {
+   char name[8];
+   int  offset;
+   int  len;
+   int  num_parts;
+   int  index[2];    // in the state
+   int  shift[2];
+} field_t;
+
+struct trigger {
+   cpu_emulator_t *em;
+   int             uses_memory;
+
+   int             num_rules;
+   rule_t          rules[MAX_RULES];
+   int             filter;    // the rule of the filter (or -1)
+
+   int             num_code;
+   op_t            code[MAX_CODE];
+
+   int             num_nth;
+   uint64_t        nth[MAX_NTH];
+
+   int             num_fields;
+   field_t         fields[MAX_FIELDS];
+};
+
+typedef struct {
+   trigger_t  *trigger;
+   const char *p;
+   const char *error;
+   int         depth;
+   int         max_depth;
+} parser_t;
+
+static const char *action_names[] = { "start", "stop", "profile", "snapshot", "end" };
+
+// ====================================================================
+// Private Methods
+// ====================================================================
+
+// Find which registers of the state are shown in each field, by writing
+// the state with each one known in turn
+static void find_fields(trigger_t *trigger) {
+   char blank[256];
+   char probe[256];
+   int state[MAX_EM_STATE];
+   for (int i = 0; i < MAX_EM_STATE; i++) {
+      state[i] = -1;
+   }
+   trigger->em->write_state(blank, state);
+   const char *p = blank;
+   while (*p && trigger->num_fields < MAX_FIELDS) {
+      const char *eq = strchr(p, '=');
+      if (!eq) {
+         break;
+      }
+      const char *end = strchr(eq, ' ');
+      if (!end) {
+         end = eq + strlen(eq);
+      }
+      field_t *field = trigger->fields + trigger->num_fields++;
+      int len = eq - p < (int) sizeof(field->name) - 1 ? eq - p : (int) sizeof(field->name) - 1;
+      memcpy(field->name, p, len);
+      field->name[len] = 0;
+      field->offset = eq + 1 - blank;
+      field->len = end - eq - 1;
+      p = *end ? end + 1 : end;
+   }
+   for (int i = 0; i < MAX_EM_STATE; i++) {
+      state[i] = 0;
+      trigger->em->write_state(probe, state);
+      state[i] = -1;
+      int first = 0;
+      while (blank[first] && probe[first] == blank[first]) {
+         first++;
+      }
+      if (!blank[first]) {
+         continue;
+      }
+      int last = first;
+      while (blank[last + 1] && probe[last + 1] != blank[last + 1]) {
+         last++;
+      }
+      for (int j = 0; j < trigger->num_fields; j++) {
+         field_t *field = trigger->fields + j;
+         if (first >= field->offset && last < field->offset + field->len && field->num_parts < 2) {
+            // Each hex digit to the right is 4 bits
+            field->index[field->num_parts] = i;
+            field->shift[field->num_parts] = (field->offset + field->len - 1 - last) * 4;
+            field->num_parts++;
+            break;
+         }
+      }
+   }
+}
+
+// The first field of the name (e.g. the 65C816 X register, not flag)
+static int find_field(trigger_t *trigger, const char *name) {
+   for (int i = 0; i < trigger->num_fields; i++) {
+      if (trigger->fields[i].num_parts && !strcmp(trigger->fields[i].name, name)) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+static void skip_space(parser_t *ps) {
+   while (isspace((unsigned char) *ps->p)) {
+      ps->p++;
+   }
+}
+
+static int accept(parser_t *ps, const char *token) {
+   skip_space(ps);
+   size_t len = strlen(token);
+   if (strncmp(ps->p, token, len)) {
+      return 0;
+   }
+   ps->p += len;
+   return 1;
+}
+
+static void expect(parser_t *ps, const char *token) {
+   if (!ps->error && !accept(ps, token)) {
+      ps->error = token[0] == ')' ? "missing )" : token[0] == '(' ? "missing (" : "missing ,";
+   }
+}
+
+static int emit(parser_t *ps, op_type_t op, int a, int b, int c) {
+   trigger_t *trigger = ps->trigger;
+   if (trigger->num_code == MAX_CODE) {
+      ps->error = "too long";
+      return 0;
+   }
+   switch (op) {
+   case OP_CONST: case OP_PC: case OP_PB: case OP_OPCODE: case OP_USER:
+   case OP_CYCLE: case OP_INSTR: case OP_REG: case OP_READ: case OP_WRITE:
+      ps->depth++;
+      break;
+   case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+   case OP_JUMP_FALSE: case OP_JUMP_TRUE:
+      ps->depth--;
+      break;
+   default:
+      break;
+   }
+   if (ps->depth > ps->max_depth) {
+      ps->max_depth = ps->depth;
+   }
+   if (op == OP_READ || op == OP_WRITE) {
+      trigger->uses_memory = 1;
+   }
+   trigger->code[trigger->num_code] = (op_t) { .op = op, .a = a, .b = b, .c = c };
+   return trigger->num_code++;
+}
+
+static int parse_name(parser_t *ps, char *name, size_t size) {
+   skip_space(ps);
+   const char *p = ps->p;
+   if (!isalpha((unsigned char) *p) && *p != '_') {
+      return 0;
+   }
+   while (isalnum((unsigned char) *p) || *p == '_') {
+      p++;
+   }
+   if ((size_t) (p - ps->p) >= size) {
+      return 0;
+   }
+   memcpy(name, ps->p, p - ps->p);
+   name[p - ps->p] = 0;
+   ps->p = p;
+   return 1;
+}
+
+static int parse_number(parser_t *ps, int *value) {
+   skip_space(ps);
+   const char *p = ps->p;
+   int base = 10;
+   if ((*p == '$' || *p == '&') && isxdigit((unsigned char) p[1])) {
+      p++;
+      base = 16;
+   } else if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && isxdigit((unsigned char) p[2])) {
+      p += 2;
+      base = 16;
+   } else if (!isdigit((unsigned char) *p)) {
+      return 0;
+   }
+   char *end;
+   long long n = strtoll(p, &end, base);
+   if (n > INT32_MAX) {
+      ps->error = "number too large";
+      return 0;
+   }
+   *value = (int) n;
+   ps->p = end;
+   return 1;
+}
+
+// A number or the name of a symbol, returning 0 (leaving the position
+// unchanged) if it's neither
+static int parse_constant(parser_t *ps, int *value) {
+   if (parse_number(ps, value)) {
+      return 1;
+   }
+   const char *p = ps->p;
+   char name[64];
+   if (parse_name(ps, name, sizeof(name)) && find_field(ps->trigger, name) < 0) {
+      int address = symbol_find(name);
+      if (address >= 0) {
+         *value = address;
+         return 1;
+      }
+   }
+   ps->p = p;
+   return 0;
+}
+
+// ADDR or LO..HI
+static void parse_range(parser_t *ps, int *lo, int *hi) {
+   if (!parse_constant(ps, lo)) {
+      if (!ps->error) {
+         ps->error = "expected an address";
+      }
+      return;
+   }
+   *hi = *lo;
+   if (accept(ps, "..") && !parse_constant(ps, hi) && !ps->error) {
+      ps->error = "expected an address";
+   }
+}
+
+static void parse_or(parser_t *ps);
+
+// read(RANGE) or read(RANGE, DATA), and likewise write
+static void parse_access(parser_t *ps, op_type_t op) {
+   int lo = 0;
+   int hi = 0;
+   int data = -1;
+   expect(ps, "(");
+   if (!ps->error) {
+      parse_range(ps, &lo, &hi);
+   }
+   if (!ps->error && accept(ps, ",") && !parse_constant(ps, &data) && !ps->error) {
+      ps->error = "expected data";
+   }
+   expect(ps, ")");
+   emit(ps, op, lo, hi, data);
+}
+
+static void parse_term(parser_t *ps) {
+   int value;
+   char name[64];
+   skip_space(ps);
+   const char *p = ps->p;
+   if (accept(ps, "(")) {
+      parse_or(ps);
+      expect(ps, ")");
+   } else if (parse_number(ps, &value)) {
+      emit(ps, OP_CONST, value, 0, 0);
+   } else if (ps->error) {
+      return;
+   } else if (!parse_name(ps, name, sizeof(name))) {
+      ps->error = "expected a value";
+   } else if (!strcmp(name, "pc")) {
+      emit(ps, OP_PC, 0, 0, 0);
+   } else if (!strcmp(name, "pb")) {
+      emit(ps, OP_PB, 0, 0, 0);
+   } else if (!strcmp(name, "opcode")) {
+      emit(ps, OP_OPCODE, 0, 0, 0);
+   } else if (!strcmp(name, "user")) {
+      emit(ps, OP_USER, 0, 0, 0);
+   } else if (!strcmp(name, "cycle")) {
+      emit(ps, OP_CYCLE, 0, 0, 0);
+   } else if (!strcmp(name, "instr")) {
+      emit(ps, OP_INSTR, 0, 0, 0);
+   } else if (!strcmp(name, "read")) {
+      parse_access(ps, OP_READ);
+   } else if (!strcmp(name, "write")) {
+      parse_access(ps, OP_WRITE);
+   } else if (!strcmp(name, "nth")) {
+      int n = 0;
+      expect(ps, "(");
+      if (!ps->error && !parse_constant(ps, &n) && !ps->error) {
+         ps->error = "expected a count";
+      }
+      expect(ps, ",");
+      if (!ps->error) {
+         parse_or(ps);
+      }
+      expect(ps, ")");
+      if (ps->trigger->num_nth == MAX_NTH) {
+         ps->error = "too many nth()";
+      } else {
+         emit(ps, OP_NTH, n, ps->trigger->num_nth++, 0);
+      }
+   } else if ((value = find_field(ps->trigger, name)) >= 0) {
+      emit(ps, OP_REG, value, 0, 0);
+   } else if ((value = symbol_find(name)) >= 0) {
+      emit(ps, OP_CONST, value, 0, 0);
+   } else {
+      ps->p = p;
+      ps->error = "unknown name";
+   }
+}
+
+static void parse_compare(parser_t *ps) {
+   static const struct {
+      const char *token;
+      op_type_t   op;
+   } ops[] = {
+      // Longest first
+      { "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE }, { "<", OP_LT }, { ">", OP_GT }
+   };
+   parse_term(ps);
+   for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]) && !ps->error; i++) {
+      if (accept(ps, ops[i].token)) {
+         if (ops[i].op == OP_EQ || ops[i].op == OP_NE) {
+            // A range?
+            const char *p = ps->p;
+            int lo;
+            int hi;
+            if (parse_constant(ps, &lo) && accept(ps, "..")) {
+               if (!parse_constant(ps, &hi)) {
+                  ps->error = "expected an address";
+               }
+               emit(ps, ops[i].op == OP_EQ ? OP_IN : OP_OUT, lo, hi, 0);
+               return;
+            }
+            ps->p = p;
+         }
+         parse_term(ps);
+         emit(ps, ops[i].op, 0, 0, 0);
+         return;
+      }
+   }
+}
+
+static void parse_unary(parser_t *ps) {
+   skip_space(ps);
+   if (ps->p[0] == '!' && ps->p[1] != '=') {
+      ps->p++;
+      parse_unary(ps);
+      emit(ps, OP_NOT, 0, 0, 0);
+   } else {
+      parse_compare(ps);
+   }
+}
+
+static void parse_and(parser_t *ps) {
+   parse_unary(ps);
+   while (!ps->error && accept(ps, "&&")) {
+      int jump = emit(ps, OP_JUMP_FALSE, 0, 0, 0);
+      parse_unary(ps);
+      ps->trigger->code[jump].a = ps->trigger->num_code;
+   }
+}
+
+static void parse_or(parser_t *ps) {
+   parse_and(ps);
+   while (!ps->error && accept(ps, "||")) {
+      int jump = emit(ps, OP_JUMP_TRUE, 0, 0, 0);
+      parse_and(ps);
+      ps->trigger->code[jump].a = ps->trigger->num_code;
+   }
+}
+
+static int compile(trigger_t *trigger, const char *option, trigger_action_t action, const char *expr) {
+   if (trigger->num_rules == MAX_RULES) {
+      fprintf(stderr, "--%s: too many rules\n", option);
+      return 1;
+   }
+   int start = trigger->num_code;
+   parser_t ps = { .trigger = trigger, .p = expr };
+   parse_or(&ps);
+   skip_space(&ps);
+   if (!ps.error && *ps.p) {
+      ps.error = "unexpected text";
+   }
+   if (!ps.error && ps.max_depth > MAX_STACK) {
+      ps.error = "too complex";
+   }
+   if (!ps.error) {
+      emit(&ps, OP_END, 0, 0, 0);
+   }
+   if (ps.error) {
+      fprintf(stderr, "--%s: %s at \"%s\"\n", option, ps.error, ps.p);
+      trigger->num_code = start;
+      return 1;
+   }
+   trigger->rules[trigger->num_rules++] = (rule_t) { .action = action, .start = start };
+   return 0;
+}
+
+static int64_t read_field(const trigger_t *trigger, int n, const int *state) {
+   const field_t *field = trigger->fields + n;
+   int64_t value = 0;
+   for (int i = 0; i < field->num_parts; i++) {
+      int part = state[field->index[i]];
+      if (part < 0) {
+         return -1;
+      }
+      value |= (int64_t) part << field->shift[i];
+   }
+   return value;
+}
+
+static int accessed(int write, int lo, int hi, int data) {
+   const mem_record_t *records;
+   int n = memory_records(&records);
+   for (int i = 0; i < n; i++) {
+      const mem_record_t *r = records + i;
+      if (r->write == write && r->ea >= lo && r->ea <= hi && (data < 0 || r->data == data)) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+// Run the code of a rule; unknown values are -1, and only positive ones are true
+static int run(trigger_t *trigger, const rule_t *rule, const trigger_instr_t *instr) {
+   int64_t stack[MAX_STACK];
+   int sp = 0;
+   const op_t *code = trigger->code;
+   for (int pc = rule->start; ; pc++) {
+      const op_t *op = code + pc;
+      int64_t a;
+      int64_t b;
+      switch (op->op) {
+      case OP_CONST:  stack[sp++] = op->a;                                    break;
+      case OP_PC:     stack[sp++] = instr->pc;                                break;
+      case OP_PB:     stack[sp++] = instr->pb;                                break;
+      case OP_OPCODE: stack[sp++] = instr->opcode;                            break;
+      case OP_USER:   stack[sp++] = instr->user;                              break;
+      case OP_CYCLE:  stack[sp++] = (int64_t) instr->cycle;                   break;
+      case OP_INSTR:  stack[sp++] = (int64_t) instr->instr;                   break;
+      case OP_REG:    stack[sp++] = read_field(trigger, op->a, instr->state); break;
+      case OP_READ:   stack[sp++] = accessed(0, op->a, op->b, op->c);         break;
+      case OP_WRITE:  stack[sp++] = accessed(1, op->a, op->b, op->c);         break;
+      case OP_EQ: case OP_NE: case OP_LT: case OP_LE: case OP_GT: case OP_GE:
+         b = stack[--sp];
+         a = stack[sp - 1];
+         if (a < 0 || b < 0) {
+            stack[sp - 1] = 0;
+         } else {
+            switch (op->op) {
+            case OP_EQ: stack[sp - 1] = a == b; break;
+            case OP_NE: stack[sp - 1] = a != b; break;
+            case OP_LT: stack[sp - 1] = a <  b; break;
+            case OP_LE: stack[sp - 1] = a <= b; break;
+            case OP_GT: stack[sp - 1] = a >  b; break;
+            default:    stack[sp - 1] = a >= b; break;
+            }
+         }
+         break;
+      case OP_IN:
+         a = stack[sp - 1];
+         stack[sp - 1] = a >= 0 && a >= op->a && a <= op->b;
+         break;
+      case OP_OUT:
+         a = stack[sp - 1];
+         stack[sp - 1] = a >= 0 && (a < op->a || a > op->b);
+         break;
+      case OP_NOT:
+         stack[sp - 1] = stack[sp - 1] <= 0;
+         break;
+      case OP_JUMP_FALSE:
+         if (stack[sp - 1] <= 0) {
+            pc = op->a - 1;
+         } else {
+            sp--;
+         }
+         break;
+      case OP_JUMP_TRUE:
+         if (stack[sp - 1] > 0) {
+            pc = op->a - 1;
+         } else {
+            sp--;
+         }
+         break;
+      case OP_NTH:
+         stack[sp - 1] = stack[sp - 1] > 0 && ++trigger->nth[op->b] == (uint64_t) op->a;
+         break;
+      default:
+         return stack[0] > 0;
+      }
+   }
+}
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+trigger_t *trigger_create(cpu_emulator_t *em) {
+   trigger_t *trigger = (trigger_t *)calloc(1, sizeof(trigger_t));
+   trigger->em = em;
+   trigger->filter = -1;
+   find_fields(trigger);
+   return trigger;
+}
+
+int trigger_add(trigger_t *trigger, const char *rule) {
+   const char *colon = strchr(rule, ':');
+   int len = colon ? colon - rule : 0;
+   for (int i = 0; i < (int) (sizeof(action_names) / sizeof(action_names[0])); i++) {
+      if ((int) strlen(action_names[i]) == len && !strncmp(rule, action_names[i], len)) {
+         return compile(trigger, "on", (trigger_action_t) i, colon + 1);
+      }
+   }
+   fprintf(stderr, "--on: expected start, stop, profile, snapshot or end, then :condition, at \"%s\"\n", rule);
+   return 1;
+}
+
+int trigger_set_filter(trigger_t *trigger, const char *expr) {
+   if (compile(trigger, "filter", TRIGGER_FILTER, expr)) {
+      return 1;
+   }
+   trigger->filter = trigger->num_rules - 1;
+   return 0;
+}
+
+int trigger_has(const trigger_t *trigger, trigger_action_t action) {
+   for (int i = 0; i < trigger->num_rules; i++) {
+      if (trigger->rules[i].action == action) {
+         return 1;
+      }
+   }
+   return 0;
+}
+
+int trigger_uses_memory(const trigger_t *trigger) {
+   return trigger->uses_memory;
+}
+
+unsigned trigger_evaluate(trigger_t *trigger, const trigger_instr_t *instr) {
+   unsigned hit = trigger->filter < 0 ? 1 << TRIGGER_FILTER : 0;
+   for (int i = 0; i < trigger->num_rules; i++) {
+      const rule_t *rule = trigger->rules + i;
+      if (run(trigger, rule, instr)) {
+         hit |= 1 << rule->action;
+      }
+   }
+   return hit;
+}
+
+void trigger_destroy(trigger_t *trigger) {
+   free(trigger);
+}
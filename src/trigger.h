@@ -0,0 +1,71 @@
+#ifndef _INCLUDE_TRIGGER_H
+#define _INCLUDE_TRIGGER_H
+
+#include <stdint.h>
+
+#include "defs.h"
+
+// Triggers (--on) and the filter (--filter): conditions on each instruction,
+// compiled once into a compact bytecode for a small stack machine, which is
+// run after each instruction has been emulated.
+//
+// A condition is an expression of:
+//   pc, pb, opcode, user   of the instruction (pb on the 65C816 only)
+//   cycle, instr           bus cycles and instructions decoded before it
+//   A, X, SP, C, ...       a register or flag afterwards, named as in the
+//                          state (as for --format)
+//   NAME                   the address of a symbol (see --labels)
+//   read(ADDR)             set if the instruction read ADDR (or LO..HI),
+//   read(LO..HI, DATA)     optionally only with the data DATA
+//   write(...)             likewise, for writes
+//   nth(N, EXPR)           set on the Nth instruction for which EXPR is
+// compared with ==, !=, <, <=, > or >= (== and != can also take a range,
+// e.g. pc == $8000..$BFFF), and combined with !, && and || (and brackets).
+// Numbers are decimal, or hex with a leading $, & or 0x. Anything unknown
+// (e.g. a register before it's been seen) matches no comparison.
+
+typedef enum {
+   TRIGGER_START,     // start the output
+   TRIGGER_STOP,      // stop the output
+   TRIGGER_PROFILE,   // start profiling
+   TRIGGER_SNAPSHOT,  // write the registers
+   TRIGGER_END,       // end the decode
+   TRIGGER_FILTER     // the instruction passes the filter (not an action)
+} trigger_action_t;
+
+// What the conditions see of an instruction
+typedef struct {
+   int        pc;
+   int        pb;
+   int        opcode;
+   int        user;
+   uint64_t   cycle;
+   uint64_t   instr;
+   const int *state;   // registers afterwards (as save_state)
+} trigger_instr_t;
+
+typedef struct trigger trigger_t;
+
+trigger_t *trigger_create(cpu_emulator_t *em);
+
+// Compile an --on rule (ACTION:EXPR), returning non-zero (with a message on
+// stderr) if it's not valid
+int trigger_add(trigger_t *trigger, const char *rule);
+
+// Compile the --filter expression, likewise
+int trigger_set_filter(trigger_t *trigger, const char *expr);
+
+// Returns 1 if any rule has the action (or for TRIGGER_FILTER, if there's
+// a filter)
+int trigger_has(const trigger_t *trigger, trigger_action_t action);
+
+// Returns 1 if any condition needs the memory accesses to be recorded
+int trigger_uses_memory(const trigger_t *trigger);
+
+// Run the rules for an instruction, returning the actions hit as a bitmask
+// (1 << action), including TRIGGER_FILTER if it should be shown
+unsigned trigger_evaluate(trigger_t *trigger, const trigger_instr_t *instr);
+
+void trigger_destroy(trigger_t *trigger);
+
+#endif
@@ -3,6 +3,10 @@
 
 #include <inttypes.h>
 
+// Allocate (and free) the tube decoder state of the current context
+void tube_create();
+void tube_destroy();
+
 void tube_read(int reg, uint8_t data);
 void tube_write(int reg, uint8_t data);
 
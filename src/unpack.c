@@ -0,0 +1,282 @@
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "defs.h"
+#include "unpack.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define UNPACK_X86
+#include <immintrin.h>
+#endif
+
+// ====================================================================
+// Scalar implementation (also used for the tail of a block)
+// ====================================================================
+
+static inline int8_t tri_state(uint16_t sample, int idx) {
+   return idx < 0 ? -1 : (sample >> idx) & 1;
+}
+
+static void unpack_scalar(const unpack_pins_t *pins, const uint16_t *words, int from, int to, unpack_planes_t *planes) {
+   for (int i = from; i < to; i++) {
+      uint16_t sample = words[i];
+      planes->data[i] = (sample >> pins->idx_data) & 255;
+      planes->rnw[i]  = tri_state(sample, pins->idx_rnw);
+      planes->rst[i]  = tri_state(sample, pins->idx_rst);
+      planes->e[i]    = tri_state(sample, pins->idx_e);
+      planes->user[i] = tri_state(sample, pins->idx_user);
+      if (pins->c816) {
+         if (pins->idx_vpa < 0 || pins->idx_vda < 0) {
+            planes->type[i] = UNKNOWN;
+         } else {
+            // INTERNAL, PROGRAM, DATA, OPCODE are consecutive
+            planes->type[i] = INTERNAL + ((sample >> pins->idx_vpa) & 1) + 2 * ((sample >> pins->idx_vda) & 1);
+         }
+      } else {
+         if (pins->idx_sync < 0) {
+            planes->type[i] = UNKNOWN;
+         } else {
+            planes->type[i] = DATA + ((sample >> pins->idx_sync) & 1);
+         }
+      }
+      if (pins->idx_rdy < 0) {
+         planes->rdy[i] = 1;
+      } else {
+         planes->rdy[i] = ((sample >> pins->idx_rdy) & 1) == pins->rdy_pol;
+      }
+   }
+}
+
+static int edges_scalar(const uint16_t *words, int from, int to, int idx, uint16_t *edges, int num) {
+   for (int i = from; i < to; i++) {
+      if (((words[i] ^ words[i - 1]) >> idx) & 1) {
+         edges[num++] = i;
+      }
+   }
+   return num;
+}
+
+// ====================================================================
+// SSE2 implementation (16 samples per iteration)
+// ====================================================================
+
+#ifdef UNPACK_X86
+
+// Extract bit idx of 16 samples as 16 bytes of 0/1 (or fill if idx < 0)
+static inline __m128i bit_plane_sse2(__m128i lo, __m128i hi, int idx, int fill) {
+   if (idx < 0) {
+      return _mm_set1_epi8(fill);
+   }
+   __m128i shift = _mm_cvtsi32_si128(idx);
+   __m128i one   = _mm_set1_epi16(1);
+   return _mm_packus_epi16(_mm_and_si128(_mm_srl_epi16(lo, shift), one),
+                           _mm_and_si128(_mm_srl_epi16(hi, shift), one));
+}
+
+static int unpack_sse2(const unpack_pins_t *pins, const uint16_t *words, int n, unpack_planes_t *planes) {
+   __m128i data_shift = _mm_cvtsi32_si128(pins->idx_data);
+   __m128i data_mask  = _mm_set1_epi16(0xff);
+   __m128i rdy_flip   = _mm_set1_epi8(pins->rdy_pol ^ 1);
+   int i;
+   for (i = 0; i + 16 <= n; i += 16) {
+      __m128i lo = _mm_loadu_si128((const __m128i *)(words + i));
+      __m128i hi = _mm_loadu_si128((const __m128i *)(words + i + 8));
+      __m128i data = _mm_packus_epi16(_mm_and_si128(_mm_srl_epi16(lo, data_shift), data_mask),
+                                      _mm_and_si128(_mm_srl_epi16(hi, data_shift), data_mask));
+      __m128i type;
+      if (pins->c816) {
+         if (pins->idx_vpa < 0 || pins->idx_vda < 0) {
+            type = _mm_set1_epi8(UNKNOWN);
+         } else {
+            __m128i vpa = bit_plane_sse2(lo, hi, pins->idx_vpa, 0);
+            __m128i vda = bit_plane_sse2(lo, hi, pins->idx_vda, 0);
+            type = _mm_add_epi8(_mm_set1_epi8(INTERNAL), _mm_add_epi8(vpa, _mm_add_epi8(vda, vda)));
+         }
+      } else {
+         if (pins->idx_sync < 0) {
+            type = _mm_set1_epi8(UNKNOWN);
+         } else {
+            type = _mm_add_epi8(_mm_set1_epi8(DATA), bit_plane_sse2(lo, hi, pins->idx_sync, 0));
+         }
+      }
+      __m128i rdy;
+      if (pins->idx_rdy < 0) {
+         rdy = _mm_set1_epi8(1);
+      } else {
+         rdy = _mm_xor_si128(bit_plane_sse2(lo, hi, pins->idx_rdy, 0), rdy_flip);
+      }
+      _mm_storeu_si128((__m128i *)(planes->data + i), data);
+      _mm_storeu_si128((__m128i *)(planes->rnw  + i), bit_plane_sse2(lo, hi, pins->idx_rnw,  -1));
+      _mm_storeu_si128((__m128i *)(planes->rst  + i), bit_plane_sse2(lo, hi, pins->idx_rst,  -1));
+      _mm_storeu_si128((__m128i *)(planes->e    + i), bit_plane_sse2(lo, hi, pins->idx_e,    -1));
+      _mm_storeu_si128((__m128i *)(planes->user + i), bit_plane_sse2(lo, hi, pins->idx_user, -1));
+      _mm_storeu_si128((__m128i *)(planes->type + i), type);
+      _mm_storeu_si128((__m128i *)(planes->rdy  + i), rdy);
+   }
+   return i;
+}
+
+static int edges_sse2(const uint16_t *words, int *n, int idx, uint16_t *edges) {
+   __m128i shift = _mm_cvtsi32_si128(idx);
+   __m128i one   = _mm_set1_epi16(1);
+   __m128i zero  = _mm_setzero_si128();
+   int num = 0;
+   int i;
+   for (i = 0; i + 16 <= *n; i += 16) {
+      // Compare each sample with its predecessor
+      __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(words + i)),
+                                 _mm_loadu_si128((const __m128i *)(words + i - 1)));
+      __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(words + i + 8)),
+                                 _mm_loadu_si128((const __m128i *)(words + i + 7)));
+      __m128i changed = _mm_packus_epi16(_mm_and_si128(_mm_srl_epi16(lo, shift), one),
+                                         _mm_and_si128(_mm_srl_epi16(hi, shift), one));
+      unsigned int mask = _mm_movemask_epi8(_mm_sub_epi8(zero, changed));
+      while (mask) {
+         edges[num++] = i + __builtin_ctz(mask);
+         mask &= mask - 1;
+      }
+   }
+   *n = i;
+   return num;
+}
+
+// ====================================================================
+// AVX2 implementation (32 samples per iteration)
+// ====================================================================
+
+// packus works within 128-bit lanes, so the result needs re-ordering
+#define PACK256(a, b) _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8)
+
+__attribute__((target("avx2")))
+static inline __m256i bit_plane_avx2(__m256i lo, __m256i hi, int idx, int fill) {
+   if (idx < 0) {
+      return _mm256_set1_epi8(fill);
+   }
+   __m128i shift = _mm_cvtsi32_si128(idx);
+   __m256i one   = _mm256_set1_epi16(1);
+   return PACK256(_mm256_and_si256(_mm256_srl_epi16(lo, shift), one),
+                  _mm256_and_si256(_mm256_srl_epi16(hi, shift), one));
+}
+
+__attribute__((target("avx2")))
+static int unpack_avx2(const unpack_pins_t *pins, const uint16_t *words, int n, unpack_planes_t *planes) {
+   __m128i data_shift = _mm_cvtsi32_si128(pins->idx_data);
+   __m256i data_mask  = _mm256_set1_epi16(0xff);
+   __m256i rdy_flip   = _mm256_set1_epi8(pins->rdy_pol ^ 1);
+   int i;
+   for (i = 0; i + 32 <= n; i += 32) {
+      __m256i lo = _mm256_loadu_si256((const __m256i *)(words + i));
+      __m256i hi = _mm256_loadu_si256((const __m256i *)(words + i + 16));
+      __m256i data = PACK256(_mm256_and_si256(_mm256_srl_epi16(lo, data_shift), data_mask),
+                             _mm256_and_si256(_mm256_srl_epi16(hi, data_shift), data_mask));
+      __m256i type;
+      if (pins->c816) {
+         if (pins->idx_vpa < 0 || pins->idx_vda < 0) {
+            type = _mm256_set1_epi8(UNKNOWN);
+         } else {
+            __m256i vpa = bit_plane_avx2(lo, hi, pins->idx_vpa, 0);
+            __m256i vda = bit_plane_avx2(lo, hi, pins->idx_vda, 0);
+            type = _mm256_add_epi8(_mm256_set1_epi8(INTERNAL), _mm256_add_epi8(vpa, _mm256_add_epi8(vda, vda)));
+         }
+      } else {
+         if (pins->idx_sync < 0) {
+            type = _mm256_set1_epi8(UNKNOWN);
+         } else {
+            type = _mm256_add_epi8(_mm256_set1_epi8(DATA), bit_plane_avx2(lo, hi, pins->idx_sync, 0));
+         }
+      }
+      __m256i rdy;
+      if (pins->idx_rdy < 0) {
+         rdy = _mm256_set1_epi8(1);
+      } else {
+         rdy = _mm256_xor_si256(bit_plane_avx2(lo, hi, pins->idx_rdy, 0), rdy_flip);
+      }
+      _mm256_storeu_si256((__m256i *)(planes->data + i), data);
+      _mm256_storeu_si256((__m256i *)(planes->rnw  + i), bit_plane_avx2(lo, hi, pins->idx_rnw,  -1));
+      _mm256_storeu_si256((__m256i *)(planes->rst  + i), bit_plane_avx2(lo, hi, pins->idx_rst,  -1));
+      _mm256_storeu_si256((__m256i *)(planes->e    + i), bit_plane_avx2(lo, hi, pins->idx_e,    -1));
+      _mm256_storeu_si256((__m256i *)(planes->user + i), bit_plane_avx2(lo, hi, pins->idx_user, -1));
+      _mm256_storeu_si256((__m256i *)(planes->type + i), type);
+      _mm256_storeu_si256((__m256i *)(planes->rdy  + i), rdy);
+   }
+   return i;
+}
+
+__attribute__((target("avx2")))
+static int edges_avx2(const uint16_t *words, int *n, int idx, uint16_t *edges) {
+   __m128i shift = _mm_cvtsi32_si128(idx);
+   __m256i one   = _mm256_set1_epi16(1);
+   __m256i zero  = _mm256_setzero_si256();
+   int num = 0;
+   int i;
+   for (i = 0; i + 32 <= *n; i += 32) {
+      // Compare each sample with its predecessor
+      __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(words + i)),
+                                    _mm256_loadu_si256((const __m256i *)(words + i - 1)));
+      __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(words + i + 16)),
+                                    _mm256_loadu_si256((const __m256i *)(words + i + 15)));
+      __m256i changed = PACK256(_mm256_and_si256(_mm256_srl_epi16(lo, shift), one),
+                                _mm256_and_si256(_mm256_srl_epi16(hi, shift), one));
+      unsigned int mask = _mm256_movemask_epi8(_mm256_sub_epi8(zero, changed));
+      while (mask) {
+         edges[num++] = i + __builtin_ctz(mask);
+         mask &= mask - 1;
+      }
+   }
+   *n = i;
+   return num;
+}
+
+// Whether the CPU has AVX2 is found once, by whichever thread unpacks first
+static pthread_once_t avx2_once = PTHREAD_ONCE_INIT;
+static int avx2;
+
+static void detect_avx2() {
+   avx2 = __builtin_cpu_supports("avx2");
+}
+
+static int use_avx2() {
+   pthread_once(&avx2_once, detect_avx2);
+   return avx2;
+}
+
+#endif
+
+// ====================================================================
+// Public Methods
+// ====================================================================
+
+void unpack_words(const unpack_pins_t *pins, const uint16_t *words, int n, unpack_planes_t *planes) {
+   int done = 0;
+#ifdef UNPACK_X86
+   if (use_avx2()) {
+      done = unpack_avx2(pins, words, n, planes);
+   } else {
+      done = unpack_sse2(pins, words, n, planes);
+   }
+#endif
+   unpack_scalar(pins, words, done, n, planes);
+
+   // Compact out the rdy-low cycles (branch free, as rdy is usually high)
+   int num = 0;
+   for (int i = 0; i < n; i++) {
+      planes->index[num] = i;
+      num += planes->rdy[i];
+   }
+   planes->num = num;
+}
+
+int unpack_edges(const uint16_t *words, int n, int idx, uint16_t *edges) {
+   int num = 0;
+   int done = 0;
+#ifdef UNPACK_X86
+   done = n;
+   if (use_avx2()) {
+      num = edges_avx2(words, &done, idx, edges);
+   } else {
+      num = edges_sse2(words, &done, idx, edges);
+   }
+#endif
+   return edges_scalar(words, done, n, idx, edges, num);
+}
@@ -0,0 +1,52 @@
+#ifndef _INCLUDE_UNPACK_H
+#define _INCLUDE_UNPACK_H
+
+#include <inttypes.h>
+
+// Number of 16-bit samples unpacked in one pass
+#define UNPACK_BLOCK 4096
+
+// Pin assignments, as bit numbers into the 16-bit sample (-1 if unconnected)
+typedef struct {
+   int idx_data;
+   int idx_rnw;
+   int idx_rst;
+   int idx_e;
+   int idx_user;
+   int idx_rdy;
+   int idx_sync;
+   int idx_vpa;
+   int idx_vda;
+   int rdy_pol;    // the value of rdy that indicates a valid bus cycle
+   int c816;       // type is derived from vpa/vda rather than sync
+} unpack_pins_t;
+
+// A block of samples unpacked into structure-of-arrays form
+//
+// The tri-state planes (rnw, rst, e, user) hold -1 where the pin is
+// unconnected, matching the corresponding fields of sample_t. The type
+// plane holds sample_type_t values.
+//
+// index[0..num-1] lists the offsets of the samples with rdy asserted.
+typedef struct {
+   uint8_t  data[UNPACK_BLOCK];
+   int8_t   rnw[UNPACK_BLOCK];
+   int8_t   rst[UNPACK_BLOCK];
+   int8_t   e[UNPACK_BLOCK];
+   int8_t   user[UNPACK_BLOCK];
+   uint8_t  type[UNPACK_BLOCK];
+   uint8_t  rdy[UNPACK_BLOCK];
+   uint16_t index[UNPACK_BLOCK];
+   int      num;
+} unpack_planes_t;
+
+// Unpack n (<= UNPACK_BLOCK) samples, then compact out the rdy-low cycles
+void unpack_words(const unpack_pins_t *pins, const uint16_t *words, int n, unpack_planes_t *planes);
+
+// Find the edges of bit idx in n (<= UNPACK_BLOCK) samples, i.e. the
+// offsets i where it differs from the previous sample (words[-1] must
+// be readable). Returns the number of offsets written to edges, which
+// are in ascending order.
+int unpack_edges(const uint16_t *words, int n, int idx, uint16_t *edges);
+
+#endif
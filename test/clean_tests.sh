@@ -13,4 +13,7 @@ for machine in "${machine_names[@]}"
 do
    rm -f ${machine}/*.tmp
    rm -f ${machine}/*.log
+   rm -f ${machine}/*.cycles ${machine}/*.index ${machine}/*.trace ${machine}/*.fanout ${machine}/*.segments
 done
+
+rm -f 816_blitter/*.cycles 816_blitter/*.trace
@@ -27,6 +27,7 @@ do
 done
 
 DECODE=../decode6502
+RENDER=../render6502
 
 common_options="--machine=beeb --debug=0 --mem=FFF --cpu=65816 -a -h -i -y -s --sp=01E0 --phi2= --rdy= --rst= --e="
 
@@ -89,6 +90,36 @@ do
 
     echo "  Trace MD5: ${md5}; Prediction fail count: ${fail_count}; Reference diff count: ${diff_count}"
 
+    # The other options should all give the same trace
+    for option in threads cache_write cache_read trace_out
+    do
+        optlog=${data%.data}_${option}.log
+        case ${option} in
+            threads)
+                runcmd="${DECODE} ${common_options} ${test_options[${name}]} --threads=4 ${data} > ${optlog}"
+                ;;
+            cache_write|cache_read)
+                # The first writes the cache, and the second reads it back
+                runcmd="${DECODE} ${common_options} ${test_options[${name}]} --cache=${data%.data}.cycles ${data} > ${optlog}"
+                ;;
+            trace_out)
+                runcmd="${DECODE} ${common_options} ${test_options[${name}]} --trace_out=${data%.data}.trace ${data} && ${RENDER} ${data%.data}.trace > ${optlog}"
+                ;;
+        esac
+        if [ "${option}" == "cache_write" ]; then
+            rm -f ${data%.data}.cycles
+        fi
+        eval ${runcmd}
+        optmd5=`md5sum ${optlog} | cut -c1-8`
+        if [ "${optmd5}" == "${md5}" ]; then
+            echo -e "  ${option}: \e[32mPASS\e[97m: trace matches"
+        else
+            echo -e "  ${option}: \e[31mFAIL\e[97m: trace doesn't match; Trace MD5: ${optmd5}"
+            echo "  % ${runcmd}"
+        fi
+        rm -f ${optlog}
+    done
+
 
     echo
 
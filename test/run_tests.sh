@@ -1,6 +1,7 @@
 #!/bin/bash
 
 DECODE=../decode6502
+RENDER=../render6502
 
 EXTENDED_TEST_FILE_BASE="https://github.com/hoglet67/6502Decoder/releases/download/test_data"
 EXTENDED_TEST_FILE_NAME="extended_tests.zip"
@@ -87,6 +88,51 @@ test_options[nosync_nornw_norst_nordy]="--sync= --rnw= --rst= --rdy="
 # Use the sync based decoder as the deference
 ref=${test_names[0]}
 
+# Tests of the other options, run with the options of the reference (on the
+# basic tests only). Each should give the reference trace, other than those
+# with a trace of their own, whose MD5 is given in option_md5
+option_names=(
+    threads
+    segments
+    cache_write
+    cache_read
+    index
+    index_window
+    fanout
+    trace_out
+    format
+    fold
+    on
+    filter
+    machine_file
+)
+
+declare -A option_md5
+
+option_md5[beeb_segments]=56237ec0
+option_md5[beeb_index_window]=aa6b0275
+option_md5[beeb_fold]=19e73280
+option_md5[beeb_on]=a42c1687
+option_md5[beeb_filter]=84b60506
+
+option_md5[master_segments]=237598f4
+option_md5[master_index_window]=b91bc35f
+option_md5[master_fold]=79ba2a4d
+option_md5[master_on]=9c96d791
+option_md5[master_filter]=13953909
+
+option_md5[elk_segments]=a69d8d4f
+option_md5[elk_index_window]=7ced894f
+option_md5[elk_fold]=621f2e5a
+option_md5[elk_on]=f8171d26
+option_md5[elk_filter]=f7dbaba1
+
+option_md5[beebr65c02_segments]=ae24ae63
+option_md5[beebr65c02_index_window]=153d6d27
+option_md5[beebr65c02_fold]=14c2191a
+option_md5[beebr65c02_on]=aa9d64a4
+option_md5[beebr65c02_filter]=e81003c8
+
 # Parse the command line options
 POSITIONAL=()
 EXTENDED=0
@@ -121,6 +167,84 @@ else
   STATARGS=-c%s
 fi
 
+# Check the trace of ${test} in ${log}, against the reference trace, or
+# against the MD5 given (for a trace of its own)
+check_trace() {
+    expmd5=$1
+    # If the file contains a RESET marker, prune any lines before this
+    if grep -q RESET ${log}; then
+        sed -n '/RESET/,$p' < ${log} > tmp.log
+        mv tmp.log ${log}
+    fi
+    fail_count=`grep fail ${log} | wc -l`
+    md5=`md5sum ${log} | cut -c1-8`
+    size=$(stat ${STATARGS} "${log}")
+    echo "  Trace MD5: ${md5}; Prediction fail count: ${fail_count}"
+    # Log some context around each failure (limit to 100 failures)
+    # Compare md5 of results with ref, rather than using diff, as diff can blow up
+    if [ "${test}" == "${ref}" ]; then
+        refmd5=${md5}
+        reflog=${machine}/trace_${data}_${ref}.log
+        echo "  this is the reference trace"
+        if [ "${fail_count}" != "0" ]; then
+            echo
+            grep -10 -m 100 fail ${log}
+            echo
+        fi
+    elif [ -n "${expmd5}" ]; then
+        if [ "${md5}" == "${expmd5}" ]; then
+            echo -e "  \e[32mPASS\e[97m: test trace matches expected MD5"
+        else
+            echo -e "  \e[31mFAIL\e[97m: test trace doesn't match expected MD5 ${expmd5}"
+        fi
+    elif [ "${md5}" == "${refmd5}" ]; then
+        echo -e "  \e[32mPASS\e[97m: test trace matches reference trace"
+    else
+        if [ "${fail_count}" != "0" ]; then
+            echo
+            grep -10 -m 100 fail ${log}
+            echo
+        fi
+        difcmd="diff ${reflog} ${log}"
+        if (( size < MAXDIFFSIZE )); then
+            diff_count=`${difcmd} | wc -l`
+            echo -e "  \e[31mFAIL\e[97m: test trace doesn't match reference trace; Diff Count: " ${diff_count}
+        else
+            echo -e "  \e[31mFAIL\e[97m: test trace doesn't match reference trace; file too large too diff"
+        fi
+        echo "  % ${difcmd}"
+    fi
+}
+
+# Check the segmented decode of ${test} in ${log}, against the reference
+# trace: the same instructions, at the same addresses wherever they are
+# known (each segment after the first starts with the PC unknown), and a
+# report in ${report} of each of the ${num} segments that accounts for
+# every instruction
+check_segments() {
+    num=$1
+    sed -n 's/^\([0-9A-F?]\{4\}\) : .*/\1/p' ${reflog} > ref.addr
+    sed -n 's/^\([0-9A-F?]\{4\}\) : .*/\1/p' ${log} > test.addr
+    instr_count=`wc -l < ref.addr`
+    addr_diff_count=`paste -d ' ' ref.addr test.addr | awk '$1 != $2 && $2 != "????"' | wc -l`
+    rm -f ref.addr test.addr
+    report_count=`wc -l < ${report}`
+    segment_count=`grep -c "^segment *[0-9]*: first instruction at [0-9a-f]*; *[0-9]* instructions;" ${report}`
+    segment_instr_count=`sed -n 's/^segment .*; *\([0-9]*\) instructions;.*/\1/p' ${report} | awk '{ n += $1 } END { print n + 0 }'`
+    echo "  Instructions: ${instr_count}; Address differences: ${addr_diff_count}; Segments reported: ${segment_count}, with ${segment_instr_count} instructions"
+    if [ "${addr_diff_count}" == "0" ]; then
+        echo -e "  \e[32mPASS\e[97m: test instruction addresses match reference trace"
+    else
+        echo -e "  \e[31mFAIL\e[97m: test instruction addresses don't match reference trace"
+    fi
+    if [ "${report_count}" == "${num}" ] && [ "${segment_count}" == "${num}" ] && [ "${segment_instr_count}" == "${instr_count}" ]; then
+        echo -e "  \e[32mPASS\e[97m: segment report accounts for every instruction"
+    else
+        echo -e "  \e[31mFAIL\e[97m: segment report doesn't account for every instruction"
+        echo "  % cat ${report}"
+    fi
+}
+
 for data in "${data_names[@]}"
 do
     for machine in "${machine_names[@]}"
@@ -141,45 +265,79 @@ do
                 echo "Test: ${test}"
                 echo "  % ${runcmd}"
                 eval $runcmd
-                # If the file contains a RESET marker, prune any lines before this
-                if grep -q RESET ${log}; then
-                    sed -n '/RESET/,$p' < ${log} > tmp.log
-                    mv tmp.log ${log}
-                fi
-                fail_count=`grep fail ${log} | wc -l`
-                md5=`md5sum ${log} | cut -c1-8`
-                size=$(stat ${STATARGS} "${log}")
-                echo "  Trace MD5: ${md5}; Prediction fail count: ${fail_count}"
-                # Log some context around each failure (limit to 100 failures)
-                # Compare md5 of results with ref, rather than using diff, as diff can blow up
-                if [ "${test}" == "${ref}" ]; then
-                    refmd5=${md5}
-                    reflog=${machine}/trace_${data}_${ref}.log
-                    echo "  this is the reference trace"
-                    if [ "${fail_count}" != "0" ]; then
-                        echo
-                        grep -10 -m 100 fail ${log}
-                        echo
-                    fi
-                elif [ "${md5}" == "${refmd5}" ]; then
-                    echo -e "  \e[32mPASS\e[97m: test trace matches reference trace"
-                else
-                    if [ "${fail_count}" != "0" ]; then
-                        echo
-                        grep -10 -m 100 fail ${log}
-                        echo
-                    fi
-                    difcmd="diff ${reflog} ${log}"
-                    if (( size < MAXDIFFSIZE )); then
-                        diff_count=`${difcmd} | wc -l`
-                        echo -e "  \e[31mFAIL\e[97m: test trace doesn't match reference trace; Diff Count: " ${diff_count}
-                    else
-                        echo -e "  \e[31mFAIL\e[97m: test trace doesn't match reference trace; file too large too diff"
-                    fi
-                    echo "  % ${difcmd}"
-                fi
+                check_trace
                 echo
             done
+            if [ "${data}" == "${data_names[0]}" ]; then
+                # Then the other options, with the options of the reference
+                options="${common_options} ${data_options[${data}]} ${machine_options[${machine}]} ${test_options[${ref}]}"
+                capture=${machine}/${data}.tmp
+                rm -f ${capture}.cycles ${capture}.index
+                for test in "${option_names[@]}"
+                do
+                    log=${machine}/trace_${data}_${test}.log
+                    logs=${log}
+                    case ${test} in
+                        threads)
+                            runcmd="${DECODE} ${options} --threads=4 ${capture} > ${log}"
+                            ;;
+                        segments)
+                            # The report of the segments is written to stderr
+                            report=${machine}/${data}.segments
+                            runcmd="${DECODE} ${options} --segments=4 ${capture} > ${log} 2> ${report}"
+                            ;;
+                        cache_write|cache_read)
+                            # The first writes the cache, and the second reads it back
+                            runcmd="${DECODE} ${options} --cache ${capture} > ${log}"
+                            ;;
+                        index)
+                            runcmd="${DECODE} ${options} --index ${capture} > ${log}"
+                            ;;
+                        index_window)
+                            # From the nearest checkpoint of the index, which
+                            # gives the same trace as decoding from the start
+                            runcmd="${DECODE} ${options} --index --from_instr=100000 --to_instr=200000 ${capture} > ${log}"
+                            ;;
+                        trace_out)
+                            runcmd="${DECODE} ${options} --trace_out=${machine}/${data}.trace ${capture} && ${RENDER} ${machine}/${data}.trace > ${log}"
+                            ;;
+                        fanout)
+                            # Each decoder writes its own trace
+                            logs="${log} ${machine}/trace_${data}_${test}_nornw.log"
+                            echo "${log}" > ${machine}/${data}.fanout
+                            echo "${machine}/trace_${data}_${test}_nornw.log --rnw=" >> ${machine}/${data}.fanout
+                            runcmd="${DECODE} ${options} --fanout=${machine}/${data}.fanout ${capture}"
+                            ;;
+                        format)
+                            # The same as the default output
+                            runcmd="${DECODE} ${options} --format='%a : %8h : %14i : %s' ${capture} > ${log}"
+                            ;;
+                        fold)
+                            runcmd="${DECODE} ${options} --mem=00F --fold ${capture} > ${log}"
+                            ;;
+                        on)
+                            runcmd="${DECODE} ${options} --mem=00F --on='start:instr==100000' --on='stop:instr==200000' ${capture} > ${log}"
+                            ;;
+                        filter)
+                            runcmd="${DECODE} ${options} --mem=00F --filter='opcode==0x20' ${capture} > ${log}"
+                            ;;
+                        machine_file)
+                            runcmd="${DECODE} ${options} --machine_file=${machine}/memory.map ${capture} > ${log}"
+                            ;;
+                    esac
+                    echo "Test: ${test}"
+                    echo "  % ${runcmd}"
+                    eval $runcmd
+                    for log in ${logs}
+                    do
+                        check_trace ${option_md5[${machine}_${test}]}
+                    done
+                    if [ "${test}" == "segments" ]; then
+                        check_segments 4
+                    fi
+                    echo
+                done
+            fi
         fi
     done
 done